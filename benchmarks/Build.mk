@@ -0,0 +1,22 @@
+# Assemble all benchmark programs, then time each one with `runpeg --bench`
+BENCH_DIR := $(DIR)
+BENCH_BUILD := $(BUILD_DIR)
+BENCH_EAR_SRCS := $(wildcard $(BENCH_DIR)/*.ear)
+BENCH_PEG_FILES := $(patsubst $(BENCH_DIR)/%.ear,$(BENCH_BUILD)/%.peg,$(BENCH_EAR_SRCS))
+BENCH_TARGETS := $(patsubst $(BENCH_DIR)/%.ear,bench[%],$(BENCH_EAR_SRCS))
+PRODUCTS := $(BENCH_PEG_FILES)
+
+# Every benchmark gets the same stdin, which only io.ear reads
+BENCH_INPUT := $(BENCH_BUILD)/input.txt
+
+
+.PHONY: bench
+
+bench: $(BENCH_TARGETS)
+
+$(BENCH_INPUT): | $(BENCH_BUILD)/.dir
+	$(_v)yes 'The quick brown fox jumps over the lazy dog' | head -n 4000 > $@
+
+bench[%]: $(BENCH_BUILD)/%.peg $(BENCH_INPUT) | $(PEG_BIN)/runpeg
+	$(_V)echo 'Benchmark $*'
+	$(_v)$(PEG_BIN)/runpeg --bench $< < $(BENCH_INPUT) >/dev/null
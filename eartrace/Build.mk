@@ -0,0 +1,13 @@
+TARGET := eartrace
+PRODUCT := $(PEG_BIN)/$(TARGET)
+
+EARTRACE_DIR := $(DIR)
+
+LIBS := \
+	$(PEG_BIN)/libear.so \
+	$(PEG_BIN)/libeardbg.so \
+	$(PEG_BIN)/libkjc_argparse.a
+
+$(EARTRACE_DIR)/eartrace.c: $(PEG_DIR)/kjc_argparse/kjc_argparse.h
+
+PUBLISH_TOP := $(PRODUCT)
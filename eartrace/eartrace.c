@@ -0,0 +1,201 @@
+//
+//  eartrace.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libear/ear.h"
+#include "libeardbg/debugger.h"
+#include "libeardbg/trace.h"
+#include "kjc_argparse/kjc_argparse.h"
+
+
+// Parse a PEGASUS file whose symbols should be used when decoding the trace
+static Pegasus* load_image(const char* path) {
+	Pegasus* peg = Pegasus_new();
+	if(!peg) {
+		perror("alloc");
+		return NULL;
+	}
+	
+	PegStatus s = Pegasus_parseFromFile(peg, path);
+	if(s != PEG_SUCCESS) {
+		if(s == PEG_IO_ERROR) {
+			perror(path);
+		}
+		else {
+			fprintf(stderr, "Error: Failed to parse %s as a PEGASUS file: %s\n", path, PegStatus_toString(s));
+		}
+		Pegasus_destroy(&peg);
+	}
+	
+	return peg;
+}
+
+
+int main(int argc, char** argv) {
+	static EAR ear;
+	int ret = EXIT_FAILURE;
+	int fd = -1;
+	void* trace_map = MAP_FAILED;
+	size_t trace_size = 0;
+	const char* traceFile = NULL;
+	const char* bootromFile = NULL;
+	const char* pegFile = NULL;
+	bool showRegs = false;
+	Pegasus* bootpeg = NULL;
+	Pegasus* userpeg = NULL;
+	Debugger* dbg = NULL;
+	
+	ARGPARSE(argc, argv) {
+		ARG('h', "help", NULL) {
+			ARGPARSE_HELP();
+			return 0;
+		}
+		
+		ARG_STRING(0, "bootrom", "PEGASUS file of the bootrom, used to show kernel symbols", filepath) {
+			bootromFile = filepath;
+		}
+		
+		ARG_STRING(0, "peg", "PEGASUS file of the traced program, used to show user symbols", filepath) {
+			pegFile = filepath;
+		}
+		
+		ARG('r', "regs", "Show the registers changed by each instruction") {
+			showRegs = true;
+		}
+		
+		ARG_POSITIONAL("trace.bin", arg) {
+			if(traceFile != NULL) {
+				fprintf(stderr, "Error: Only one trace file may be decoded at a time\n");
+				goto usage;
+			}
+			traceFile = arg;
+		}
+		
+		ARG_END {
+			if(traceFile == NULL) {
+				fprintf(stderr, "Error: No trace file given\n");
+				goto usage;
+			}
+			
+			// All good!
+			break;
+		
+		usage:
+			ARGPARSE_HELP();
+			exit(EXIT_FAILURE);
+		}
+	}
+	
+	// The CPU is never run, it only holds the register state used to show instructions
+	EAR_init(&ear);
+	dbg = Debugger_init(&ear, DEBUG_DETACHED);
+	
+	if(bootromFile) {
+		bootpeg = load_image(bootromFile);
+		if(!bootpeg) {
+			goto cleanup;
+		}
+		Debugger_addPegasusImage(dbg, bootpeg, false);
+	}
+	
+	if(pegFile) {
+		userpeg = load_image(pegFile);
+		if(!userpeg) {
+			goto cleanup;
+		}
+		Debugger_addPegasusImage(dbg, userpeg, true);
+	}
+	
+	fd = open(traceFile, O_RDONLY);
+	if(fd < 0) {
+		perror(traceFile);
+		goto cleanup;
+	}
+	
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		perror(traceFile);
+		goto cleanup;
+	}
+	trace_size = st.st_size;
+	
+	if(trace_size != 0) {
+		trace_map = mmap(NULL, trace_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(trace_map == MAP_FAILED) {
+			perror(traceFile);
+			goto cleanup;
+		}
+	}
+	
+	TraceReader reader;
+	if(!TraceReader_init(&reader, trace_map, trace_size)) {
+		fprintf(stderr, "Error: %s is not an EAR trace file\n", traceFile);
+		goto cleanup;
+	}
+	
+	TraceEntry entry;
+	while(TraceReader_next(&reader, &entry)) {
+		// Show the instruction the same way that `runpeg --trace` does
+		ear.ctx.active = entry.bank;
+		EAR_ThreadState* ctx = CTX(ear);
+		ctx->cr[CR_INSN_ADDR] = entry.insn_addr;
+		ctx->r[DPC] = entry.dpc;
+		
+		Pegasus* peg = dbg->pegs[entry.bank];
+		if(peg) {
+			Pegasus_Symbol* sym = Pegasus_findSymbolByAddress(peg, entry.insn_addr);
+			if(sym && sym->value == entry.insn_addr) {
+				printf("  %s:\n", sym->name);
+			}
+		}
+		
+		printf("\t%04X.%04X: %c ", entry.insn_addr, entry.dpc, entry.cond ? ' ' : '#');
+		Debugger_showInstruction(dbg, &entry.insn, entry.pc, stdout);
+		
+		if(showRegs && entry.changed) {
+			const char* sep = "\t\t";
+			EAR_Register i;
+			for(i = 0; i < 16; i++) {
+				if(entry.changed & (1 << i)) {
+					printf("%s%s=%04X", sep, EAR_getRegisterName(i), entry.values[i]);
+					sep = " ";
+				}
+			}
+			printf("\n");
+		}
+	}
+	
+	if(reader.pos != reader.size) {
+		fprintf(stderr, "Warning: %s ends with a truncated record\n", traceFile);
+	}
+	
+	ret = EXIT_SUCCESS;
+	
+cleanup:
+	if(trace_map != MAP_FAILED) {
+		munmap(trace_map, trace_size);
+	}
+	
+	if(fd >= 0) {
+		close(fd);
+	}
+	
+	if(dbg) {
+		Debugger_destroy(dbg);
+	}
+	
+	Pegasus_destroy(&userpeg);
+	Pegasus_destroy(&bootpeg);
+	
+	return ret;
+}
@@ -1,4 +1,30 @@
-TARGET := libear.so
-PRODUCT := $(PEG_BIN)/$(TARGET)
+TARGETS := libear.so libear-stats.so ear-microbench
+PRODUCTS := $(addprefix $(PEG_BIN)/,$(TARGETS))
 
-PUBLISH_TOP := $(PRODUCT)
+EAR_DIR := $(DIR)
+EAR_BUILD := $(BUILD_DIR)
+EAR_SRCS := bus.c ear.c mmu.c
+
+target := libear.so
+$(target)_SRCS := $(EAR_SRCS)
+
+# Same library with the runtime statistics counters compiled in, for `runpeg --stats`
+target := libear-stats.so
+$(target)_CFLAGS := $(DEFAULT_CFLAGS) -DEAR_STATS=1
+$(target)_SRCS := $(EAR_SRCS)
+
+# Host-side microbenchmarks of libear's hot functions, run by hand. These measure
+# the same build of libear that runpeg uses.
+target := ear-microbench
+$(target)_SRCS := $(EAR_DIR)/microbench/microbench.c
+$(target)_OBJS := $(patsubst $(EAR_DIR)/%,$(EAR_BUILD)/$(target)_objs/%.o,$($(target)_SRCS))
+$(target)_CFLAGS := $(DEFAULT_CFLAGS) -DEAR_STATS=1
+$(target)_LIBS := \
+	$(PEG_BIN)/libear-stats.so \
+	$(PEG_BIN)/libeardbg-stats.so
+$(target)_LDLIBS := -lm
+
+# Ensure each of the targets are built into the PEG_BIN directory
+$(foreach target,$(TARGETS),$(eval $(target)_PRODUCT := $(PEG_BIN)/$(target)))
+
+PUBLISH_TOP := $(PEG_BIN)/libear.so
@@ -78,6 +78,8 @@ static Bus_Device* Bus_addChildDevice(
 	new_dev->prefix_pattern = prefix_pattern;
 	new_dev->prefix_bitcount = prefix_bitcount;
 	new_dev->allowed_modes = BUS_MODE_RDWR;
+	new_dev->reads = 0;
+	new_dev->writes = 0;
 	return new_dev;
 }
 
@@ -241,6 +243,15 @@ static bool Bus_deviceAccessSelf(
 		return false;
 	}
 	
+#if EAR_STATS
+	if(mode == BUS_MODE_READ) {
+		++dev->reads;
+	}
+	else {
+		++dev->writes;
+	}
+#endif
+	
 	// Call the handler function for this device
 	return dev->handler_fn(dev->handler_cookie, mode, addr, is_byte, data, out_r);
 }
@@ -367,6 +378,35 @@ bool Bus_access(
 	return Bus_zoneAccess(&bus->devices, mode, addr, is_byte, data, out_r);
 }
 
+/*!
+ * @brief Find the most specific device that handles a physical address.
+ * 
+ * @param addr Full 24-bit physical address
+ * 
+ * @return The device, or NULL if no device is mapped at that address
+ */
+Bus_Device* Bus_findDevice(Bus* bus, Bus_Addr addr) {
+	Bus_DeviceArray* devices = &bus->devices;
+	Bus_Device* found = NULL;
+	
+	// Descend into the children of each matching device
+	bool descended;
+	do {
+		descended = false;
+		foreach(devices, dev) {
+			Bus_Addr prefix_mask = ~((1 << (BUS_ADDRESS_BITS - dev->prefix_bitcount)) - 1);
+			if((dev->prefix_pattern & prefix_mask) == (addr & prefix_mask)) {
+				found = dev;
+				devices = &dev->children;
+				descended = true;
+				break;
+			}
+		}
+	} while(descended);
+	
+	return found;
+}
+
 /*!
  * @brief Handle a bus access.
  * 
@@ -432,3 +472,24 @@ void Bus_dump(void* cookie, FILE* fp) {
 	Bus* bus = cookie;
 	return Bus_dumpZone(&bus->devices, fp, 0);
 }
+
+
+static void Bus_destroyZone(Bus_DeviceArray* devices) {
+	foreach(devices, dev) {
+		if(dev->handler_fn == Bus_memoryHandler) {
+			free(dev->handler_cookie);
+		}
+		Bus_destroyZone(&dev->children);
+	}
+	array_clear(devices);
+}
+
+/*!
+ * @brief Detach every device from the bus and free the bus's own allocations. Memory
+ * attached with `Bus_addMemory` still belongs to the caller.
+ */
+void Bus_destroy(Bus* bus) {
+	Bus_destroyZone(&bus->devices);
+	bus->hook_fn = NULL;
+	bus->hook_cookie = NULL;
+}
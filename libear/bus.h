@@ -37,6 +37,10 @@ struct Bus_Device {
 	
 	//! Allowed access modes
 	uint8_t allowed_modes : 2;
+	
+	//! Number of reads and writes sent to this device
+	uint64_t reads;
+	uint64_t writes;
 };
 
 typedef struct Bus Bus;
@@ -57,6 +61,12 @@ struct Bus {
  */
 void Bus_init(Bus* bus);
 
+/*!
+ * @brief Detach every device from the bus and free the bus's own allocations. Memory
+ * attached with `Bus_addMemory` still belongs to the caller.
+ */
+void Bus_destroy(Bus* bus);
+
 /*!
  * @brief Attach a device to the physical memory bus.
  * 
@@ -116,6 +126,15 @@ bool Bus_access(
 	EAR_HaltReason* out_r
 );
 
+/*!
+ * @brief Find the most specific device that handles a physical address.
+ * 
+ * @param addr Full 24-bit physical address
+ * 
+ * @return The device, or NULL if no device is mapped at that address
+ */
+Bus_Device* Bus_findDevice(Bus* bus, Bus_Addr addr);
+
 /*!
  * @brief Handle a bus access.
  * 
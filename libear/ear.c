@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <time.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include "common/macros.h"
@@ -38,6 +39,7 @@
  */
 void EAR_init(EAR* ear) {
 	memset(ear, 0, sizeof(*ear));
+	ear->ins_limit = UINT64_MAX;
 	
 	// Init registers
 	EAR_resetRegisters(ear);
@@ -88,6 +90,16 @@ void EAR_setExecHook(EAR* ear, EAR_ExecHook* exec_fn, void* exec_cookie) {
 	ear->exec_cookie = exec_cookie;
 }
 
+/*!
+ * @brief Limit how many instructions the CPU may run. Once `ins_count` reaches the
+ * limit, stepping the CPU returns HALT_INSN_LIMIT without doing anything.
+ * 
+ * @param limit Total instruction count to stop at, or UINT64_MAX for no limit
+ */
+void EAR_setInstructionLimit(EAR* ear, uint64_t limit) {
+	ear->ins_limit = limit;
+}
+
 static EAR_HaltReason EAR_raiseException(EAR* ear, EAR_ExceptionInfo exc_info, EAR_UWord exc_addr) {
 	CTX(*ear)->cr[CR_EXC_ADDR] = exc_addr;
 	CTX(*ear)->cr[CR_EXC_INFO] = exc_info;
@@ -100,6 +112,16 @@ static EAR_HaltReason EAR_raiseException(EAR* ear, EAR_ExceptionInfo exc_info, E
 	// Swap thread contexts
 	ear->ctx.active ^= 1;
 	
+#if EAR_STATS
+	++ear->stats.bank_swaps;
+	if(exc_info & 1) {
+		++ear->stats.exceptions[EXC_CODE_GET(exc_info)];
+	}
+#endif
+	
+	// Not an instruction, so a faulting instruction that's run again is only counted once
+	++ear->exc_count;
+	
 	// Debugger wants to break on HLT?
 	if(!exc_info && ear->exc_catch & EXC_MASK_HLT) {
 		return HALT_DEBUGGER;
@@ -670,6 +692,48 @@ static bool EAR_evaluateCondition(EAR* ear, EAR_Cond cond) {
 	}
 }
 
+#if EAR_STATS && EAR_STATS_TIMING
+static inline uint64_t EAR_monotonicNanos(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif /* EAR_STATS && EAR_STATS_TIMING */
+
+// Call the port read callback, counting the byte and (with EAR_STATS_TIMING) the time spent blocked in it
+static inline EAR_HaltReason EAR_portRead(EAR* ear, uint8_t port_number, EAR_Byte* out_byte) {
+#if EAR_STATS && EAR_STATS_TIMING
+	uint64_t start = EAR_monotonicNanos();
+#endif
+	EAR_HaltReason ret = ear->read_fn(ear->port_cookie, port_number, out_byte);
+#if EAR_STATS && EAR_STATS_TIMING
+	ear->stats.port_ns += EAR_monotonicNanos() - start;
+#endif
+#if EAR_STATS
+	if(ret == HALT_NONE) {
+		++ear->stats.port_reads[port_number & (EAR_PORT_COUNT - 1)];
+	}
+#endif
+	return ret;
+}
+
+// Likewise for the port write callback
+static inline EAR_HaltReason EAR_portWrite(EAR* ear, uint8_t port_number, EAR_Byte byte) {
+#if EAR_STATS && EAR_STATS_TIMING
+	uint64_t start = EAR_monotonicNanos();
+#endif
+	EAR_HaltReason ret = ear->write_fn(ear->port_cookie, port_number, byte);
+#if EAR_STATS && EAR_STATS_TIMING
+	ear->stats.port_ns += EAR_monotonicNanos() - start;
+#endif
+#if EAR_STATS
+	if(ret == HALT_NONE) {
+		++ear->stats.port_writes[port_number & (EAR_PORT_COUNT - 1)];
+	}
+#endif
+	return ret;
+}
+
 static EAR_HaltReason EAR_executeInstruction(EAR* ear, EAR_Instruction* insn) {
 	EAR_HaltReason ret = HALT_NONE;
 	EAR_ThreadState* ctx = CTX(*ear);
@@ -1125,7 +1189,7 @@ static EAR_HaltReason EAR_executeInstruction(EAR* ear, EAR_Instruction* insn) {
 				break;
 			}
 			
-			ret = ear->read_fn(ear->port_cookie, insn->port_number, &btmp);
+			ret = EAR_portRead(ear, insn->port_number, &btmp);
 			if(ret != HALT_NONE) {
 				if(!EAR_FAILED(ret)) {
 					// Don't change flags or set `EXC_INFO`, just return the halt reason
@@ -1158,7 +1222,7 @@ static EAR_HaltReason EAR_executeInstruction(EAR* ear, EAR_Instruction* insn) {
 				break;
 			}
 			
-			ret = ear->write_fn(ear->port_cookie, insn->port_number, (EAR_Byte)vyu);
+			ret = EAR_portWrite(ear, insn->port_number, (EAR_Byte)vyu);
 			if(ret != HALT_NONE) {
 				if(!EAR_FAILED(ret)) {
 					// Don't change flags or set `EXC_INFO`, just return the halt reason
@@ -1374,6 +1438,12 @@ EAR_HaltReason EAR_stepInstruction(EAR* ear) {
 	EAR_ThreadState* ctx = CTX(*ear);
 	bool cond = false;
 	
+	// Out of instruction budget? This is the only check, so running without a limit
+	// (UINT64_MAX) costs one well-predicted compare per instruction
+	if(ear->ins_count >= ear->ins_limit) {
+		return HALT_INSN_LIMIT;
+	}
+	
 	// Are both threads in an exception state?
 	if(ctx->cr[CR_EXC_INFO] & 1) {
 		return HALT_DOUBLE_FAULT;
@@ -1423,6 +1493,10 @@ EAR_HaltReason EAR_stepInstruction(EAR* ear) {
 		
 		cond = EAR_evaluateCondition(ear, ctx->insn.cond);
 		
+#if EAR_STATS
+		++ear->stats.insns[ctx->insn.op & (EAR_OPCODE_COUNT - 1)][cond];
+#endif
+		
 		// Execute the pre-exec hook, if installed
 		if(ear->exec_fn) {
 			ret = ear->exec_fn(ear->exec_cookie, &ctx->insn, pc, /*before=*/true, cond);
@@ -1505,6 +1579,31 @@ EAR_HaltReason EAR_continue(EAR* ear) {
 	return reason;
 }
 
+/*! Runs kernel code until the CPU is about to execute an instruction in user mode.
+ * @return Reason returned by the instruction that switched to user mode (HALT_NONE or
+ *         HALT_EXCEPTION), or the reason for halting before that
+ */
+EAR_HaltReason EAR_continueToUserMode(EAR* ear) {
+	EAR_HaltReason reason;
+	
+	while(true) {
+		reason = EAR_stepInstruction(ear);
+		if(CTX(*ear)->cr[CR_FLAGS] & FLAG_DENY_XREGS) {
+			break;
+		}
+		
+		// Allow exceptions to be handled normally
+		if(reason == HALT_EXCEPTION) {
+			reason = HALT_NONE;
+		}
+		if(reason != HALT_NONE) {
+			break;
+		}
+	}
+	
+	return reason;
+}
+
 /*! Invokes a function at a given virtual address and passing up to 6 arguments.
  * @note This will overwrite the values of registers A0-A5, PC, DPC, RA, and RD.
  *       All other registers are left untouched, so the existing values of SP and
@@ -1585,6 +1684,8 @@ const char* EAR_haltReasonToString(EAR_HaltReason status) {
 			return "Program tried to return from the topmost stack frame";
 		case HALT_COMPLETE:
 			return "For internal use only, used to support fault handlers and callbacks";
+		case HALT_INSN_LIMIT:
+			return "Reached the instruction limit";
 		default:
 			return "Unknown halt reason";
 	}
@@ -21,6 +21,20 @@
 #endif
 
 
+#define EAR_OPCODE_COUNT 32
+#define EAR_EXC_CODE_COUNT 8
+#define EAR_PORT_COUNT 16
+
+//! Runtime statistics counters
+typedef struct EAR_Stats {
+	uint64_t insns[EAR_OPCODE_COUNT][2];       //!< Instructions by opcode and whether their condition passed
+	uint64_t exceptions[EAR_EXC_CODE_COUNT];   //!< Exceptions raised, by EXC_CODE
+	uint64_t bank_swaps;                       //!< Thread context switches, from exceptions or HLT
+	uint64_t port_reads[EAR_PORT_COUNT];       //!< Bytes successfully read from each port
+	uint64_t port_writes[EAR_PORT_COUNT];      //!< Bytes successfully written to each port
+	uint64_t port_ns;                          //!< Host time spent in the port read and write callbacks
+} EAR_Stats;
+
 struct EAR {
 	EAR_Context ctx;             //!< CPU thread context
 	EAR_MemoryHandler* mem_fn;   //!< Function pointer called to handle memory accesses
@@ -31,8 +45,11 @@ struct EAR {
 	EAR_ExecHook* exec_fn;       //!< Function pointer called before executing each instruction
 	void* exec_cookie;           //!< Opaque cookie value passed to exec_fn
 	uint64_t ins_count;          //!< Total number of instructions executed
+	uint64_t exc_count;          //!< Total number of exceptions raised
+	uint64_t ins_limit;          //!< Stop with HALT_INSN_LIMIT once ins_count reaches this
 	EAR_ExceptionMask exc_catch; //!< Mask of exceptions to catch
 	bool verbose;                //!< True if verbose output should be printed
+	EAR_Stats stats;             //!< Runtime statistics counters
 };
 
 #define CTX_X(ear, cross) (&(ear).ctx.banks[(ear).ctx.active ^ (cross)])
@@ -79,6 +96,14 @@ void EAR_setPorts(EAR* ear, EAR_PortRead* read_fn, EAR_PortWrite* write_fn, void
  */
 void EAR_setExecHook(EAR* ear, EAR_ExecHook* exec_fn, void* exec_cookie);
 
+/*!
+ * @brief Limit how many instructions the CPU may run. Once `ins_count` reaches the
+ * limit, stepping the CPU returns HALT_INSN_LIMIT without doing anything.
+ * 
+ * @param limit Total instruction count to stop at, or UINT64_MAX for no limit
+ */
+void EAR_setInstructionLimit(EAR* ear, uint64_t limit);
+
 /*!
  * @brief Fetch the next code instruction starting at *pc.
  * 
@@ -116,6 +141,15 @@ EAR_HaltReason EAR_stepInstruction(EAR* ear);
  */
 EAR_HaltReason EAR_continue(EAR* ear);
 
+/*!
+ * @brief Runs kernel code until the CPU is about to execute an instruction in user
+ * mode. Exceptions are handled normally.
+ * 
+ * @return Reason returned by the instruction that switched to user mode (HALT_NONE or
+ *         HALT_EXCEPTION), or the reason for halting before that
+ */
+EAR_HaltReason EAR_continueToUserMode(EAR* ear);
+
 /*!
  * @brief Invokes a function at a given virtual address and passing up to 6 arguments.
  * 
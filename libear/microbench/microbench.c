@@ -0,0 +1,417 @@
+//
+//  microbench.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+//  Times the emulator's hot functions in isolation, separately from any guest
+//  program. Each benchmark is warmed up, then run for a number of repetitions,
+//  and the cost of one operation is reported as min/median/mean/max over them.
+//
+//  Usage: ear-microbench [name-filter...]
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "common/macros.h"
+#include "libear/ear.h"
+#include "libear/mmu.h"
+#include "libear/bus.h"
+#include "libeardbg/debugger.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MB_UNIT "cycles"
+static inline uint64_t mb_now(void) {
+	return __rdtsc();
+}
+#else
+#define MB_UNIT "ns"
+static inline uint64_t mb_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+// Repetitions thrown away before measuring, then measured
+#define MB_WARMUP_REPS 5
+#define MB_REPS 31
+
+//! Operations timed together in one repetition
+#define MB_OPS_PER_REP 100000
+
+// Results are added here so the compiler can't skip the work
+static volatile uint64_t g_sink;
+
+
+typedef void MB_Func(void* cookie, uint32_t ops);
+
+typedef struct MB_Stats {
+	double min;
+	double median;
+	double mean;
+	double stddev;
+	double max;
+} MB_Stats;
+
+static int compare_doubles(const void* a, const void* b) {
+	double da = *(const double*)a;
+	double db = *(const double*)b;
+	return da < db ? -1 : da > db;
+}
+
+static MB_Stats mb_measure(MB_Func* func, void* cookie) {
+	double per_op[MB_REPS];
+	
+	for(unsigned i = 0; i < MB_WARMUP_REPS; i++) {
+		func(cookie, MB_OPS_PER_REP);
+	}
+	
+	for(unsigned i = 0; i < MB_REPS; i++) {
+		uint64_t start = mb_now();
+		func(cookie, MB_OPS_PER_REP);
+		uint64_t end = mb_now();
+		per_op[i] = (double)(end - start) / MB_OPS_PER_REP;
+	}
+	
+	MB_Stats stats = {0};
+	for(unsigned i = 0; i < MB_REPS; i++) {
+		stats.mean += per_op[i];
+	}
+	stats.mean /= MB_REPS;
+	for(unsigned i = 0; i < MB_REPS; i++) {
+		stats.stddev += (per_op[i] - stats.mean) * (per_op[i] - stats.mean);
+	}
+	stats.stddev = sqrt(stats.stddev / MB_REPS);
+	
+	qsort(per_op, MB_REPS, sizeof(*per_op), compare_doubles);
+	stats.min = per_op[0];
+	stats.median = per_op[MB_REPS / 2];
+	stats.max = per_op[MB_REPS - 1];
+	return stats;
+}
+
+
+static bool mb_selected(const char* name, int argc, char** argv) {
+	if(argc <= 1) {
+		return true;
+	}
+	
+	for(int i = 1; i < argc; i++) {
+		if(strstr(name, argv[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void mb_run(const char* name, MB_Func* func, void* cookie, int argc, char** argv) {
+	if(!mb_selected(name, argc, argv)) {
+		return;
+	}
+	
+	MB_Stats stats = mb_measure(func, cookie);
+	printf(
+		"%-36s %9.1f %9.1f %9.1f %8.1f %9.1f\n",
+		name, stats.min, stats.median, stats.mean, stats.stddev, stats.max
+	);
+	fflush(stdout);
+}
+
+
+// Flat 64KiB memory used as the virtual address space when decoding
+typedef struct FlatMemory {
+	EAR_Byte bytes[EAR_VIRTUAL_ADDRESS_SPACE_SIZE];
+} FlatMemory;
+
+static bool flat_memoryHandler(
+	void* cookie, EAR_Protection prot, Bus_AccessMode mode,
+	EAR_FullAddr vmaddr, bool is_byte, void* data, EAR_HaltReason* out_r
+) {
+	FlatMemory* mem = cookie;
+	(void)prot;
+	(void)out_r;
+	
+	vmaddr &= EAR_VIRTUAL_ADDRESS_SPACE_SIZE - 1;
+	if(mode == BUS_MODE_READ) {
+		if(is_byte) {
+			*(EAR_Byte*)data = mem->bytes[vmaddr];
+		}
+		else {
+			*(EAR_UWord*)data = mem->bytes[vmaddr] | mem->bytes[(vmaddr + 1) & 0xFFFF] << 8;
+		}
+	}
+	else {
+		mem->bytes[vmaddr] = *(EAR_Byte*)data;
+		if(!is_byte) {
+			mem->bytes[(vmaddr + 1) & 0xFFFF] = *(EAR_UWord*)data >> 8;
+		}
+	}
+	return true;
+}
+
+static bool null_memoryHandler(
+	void* cookie, EAR_Protection prot, Bus_AccessMode mode,
+	EAR_FullAddr vmaddr, bool is_byte, void* data, EAR_HaltReason* out_r
+) {
+	(void)cookie;
+	(void)prot;
+	(void)mode;
+	(void)vmaddr;
+	(void)is_byte;
+	(void)data;
+	(void)out_r;
+	return true;
+}
+
+static bool null_busHandler(
+	void* cookie, Bus_AccessMode mode,
+	EAR_PhysAddr paddr, bool is_byte, void* data,
+	EAR_HaltReason* out_r
+) {
+	(void)cookie;
+	(void)mode;
+	(void)paddr;
+	(void)is_byte;
+	(void)data;
+	(void)out_r;
+	return true;
+}
+
+
+/*
+ * Instruction streams, assembled with `earasm -s @TEXT`. The first mixes
+ * instructions with immediates, memory operands, and register lists. The
+ * second is only short register-to-register forms.
+ */
+static const EAR_Byte g_stream_mixed[] = {
+	0xfa, 0x80, 0x35, 0xda, 0xfc, 0xb3, 0xec, 0x71, 0xe0, 0x18, 0xd2, 0xe1,
+	0x1f, 0x34, 0x12, 0xf0, 0x32, 0xf3, 0x54, 0xd7, 0xf2, 0x6f, 0x20, 0x00,
+	0xed, 0x12, 0x95, 0xe3, 0xff, 0xd0, 0xe7, 0x1f, 0x01, 0x00, 0x28, 0x9f,
+	0x08, 0x00, 0xd7, 0xea, 0x9f, 0x08, 0xec, 0x4f, 0x7f, 0x00, 0xf7, 0xcf,
+	0xff, 0xf8, 0x40, 0xf9, 0x03, 0xdb, 0xfc, 0xac, 0xfb, 0x80, 0xc5,
+};
+
+static const EAR_Byte g_stream_simple[] = {
+	0xe0, 0x12, 0xe1, 0x34, 0xec, 0x71, 0xe7, 0x23, 0xe8, 0x45, 0xe6, 0x67,
+	0xfc, 0x10, 0xfc, 0x2f, 0xed, 0x12, 0xf0, 0x32, 0xf1, 0x34, 0xec, 0x56,
+	0xe0, 0x81, 0xec, 0x98, 0xfc, 0x90, 0xff,
+};
+
+typedef struct FetchBench {
+	FlatMemory* mem;
+	EAR_FullAddr start;
+	EAR_FullAddr end;
+} FetchBench;
+
+static void bench_fetch(void* cookie, uint32_t ops) {
+	FetchBench* fb = cookie;
+	EAR_FullAddr pc = fb->start;
+	uint64_t sum = 0;
+	
+	for(uint32_t i = 0; i < ops; i++) {
+		EAR_Instruction insn;
+		EAR_ExceptionInfo exc_info = 0;
+		EAR_UWord exc_addr = 0;
+		EAR_HaltReason r = EAR_fetchInstruction(
+			&flat_memoryHandler, fb->mem,
+			&pc, EAR_VIRTUAL_ADDRESS_SPACE_SIZE - 1, 0, false,
+			&insn, &exc_info, &exc_addr
+		);
+		ASSERT(r == HALT_NONE);
+		sum += insn.op;
+		if(pc >= fb->end) {
+			pc = fb->start;
+		}
+	}
+	
+	g_sink += sum;
+}
+
+
+typedef struct TranslateBench {
+	MMU* mmu;
+	EAR_Protection prot;
+} TranslateBench;
+
+static void bench_translate(void* cookie, uint32_t ops) {
+	TranslateBench* tb = cookie;
+	uint64_t sum = 0;
+	
+	for(uint32_t i = 0; i < ops; i++) {
+		EAR_PhysAddr paddr = 0;
+		EAR_HaltReason r = MMU_translate(tb->mmu, (EAR_VirtAddr)(i * 0x101), tb->prot, &paddr);
+		ASSERT(r == HALT_NONE);
+		sum += paddr;
+	}
+	
+	g_sink += sum;
+}
+
+
+typedef struct BusBench {
+	Bus* bus;
+	Bus_Addr addr;
+} BusBench;
+
+static void bench_bus_access(void* cookie, uint32_t ops) {
+	BusBench* bb = cookie;
+	EAR_UWord value = 0;
+	uint64_t sum = 0;
+	
+	for(uint32_t i = 0; i < ops; i++) {
+		EAR_HaltReason r = HALT_NONE;
+		Bus_access(bb->bus, BUS_MODE_READ, bb->addr, /*is_byte=*/false, &value, &r);
+		sum += value;
+	}
+	
+	g_sink += sum;
+}
+
+
+typedef struct MemoryDeviceBench {
+	Bus_Device* dev;
+	bool is_byte;
+} MemoryDeviceBench;
+
+static void bench_memory_device(void* cookie, uint32_t ops) {
+	MemoryDeviceBench* mb = cookie;
+	Bus_AccessHandler* handler_fn = mb->dev->handler_fn;
+	void* handler_cookie = mb->dev->handler_cookie;
+	Bus_Addr base = mb->dev->prefix_pattern;
+	uint64_t sum = 0;
+	
+	for(uint32_t i = 0; i < ops; i++) {
+		EAR_UWord value = 0;
+		EAR_HaltReason r = HALT_NONE;
+		Bus_Addr addr = base + ((i * 2) & 0xFFFE);
+		handler_fn(handler_cookie, BUS_MODE_READ, addr, mb->is_byte, &value, &r);
+		sum += value;
+	}
+	
+	g_sink += sum;
+}
+
+
+static void bench_debugger(void* cookie, uint32_t ops) {
+	Debugger* dbg = cookie;
+	EAR_Byte value = 0;
+	uint64_t sum = 0;
+	
+	for(uint32_t i = 0; i < ops; i++) {
+		EAR_HaltReason r = HALT_NONE;
+		bool ok = Debugger_memoryHandler(dbg, EAR_PROT_READ, BUS_MODE_READ, 0x4000, /*is_byte=*/true, &value, &r);
+		ASSERT(ok);
+		sum += ok;
+	}
+	
+	g_sink += sum;
+}
+
+
+int main(int argc, char** argv) {
+	printf("Cost of one operation in %s, over %u repetitions of %u operations after %u warmup repetitions\n\n",
+		MB_UNIT, MB_REPS, MB_OPS_PER_REP, MB_WARMUP_REPS);
+	printf("%-36s %9s %9s %9s %8s %9s\n", "benchmark", "min", "median", "mean", "stddev", "max");
+	
+	// EAR_fetchInstruction
+	FlatMemory* flat = calloc(1, sizeof(*flat));
+	if(!flat) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	memcpy(&flat->bytes[0x100], g_stream_mixed, sizeof(g_stream_mixed));
+	memcpy(&flat->bytes[0x200], g_stream_simple, sizeof(g_stream_simple));
+	
+	FetchBench fetch_mixed = {flat, 0x100, 0x100 + sizeof(g_stream_mixed)};
+	FetchBench fetch_simple = {flat, 0x200, 0x200 + sizeof(g_stream_simple)};
+	mb_run("EAR_fetchInstruction mixed", &bench_fetch, &fetch_mixed, argc, argv);
+	mb_run("EAR_fetchInstruction simple", &bench_fetch, &fetch_simple, argc, argv);
+	
+	// Physical memory: RAM in region 1, with a page table in its first page
+	// that maps each virtual page to the RAM page with the same number
+	EAR_UWord* ram = calloc(1, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+	if(!ram) {
+		perror("calloc");
+		return EXIT_FAILURE;
+	}
+	
+	Bus ram_bus;
+	Bus_init(&ram_bus);
+	Bus_addMemory(&ram_bus, "RAM", BUS_MODE_RDWR, 0x010000, EAR_VIRTUAL_ADDRESS_SPACE_SIZE, ram);
+	for(EAR_UWord vpage = 0; vpage < EAR_PAGE_COUNT; vpage++) {
+		EAR_UWord pte = 0x0100 | vpage;
+		Bus_access(&ram_bus, BUS_MODE_WRITE, 0x010000 + vpage * sizeof(MMU_PTE), false, &pte, NULL);
+	}
+	
+	// MMU_translate
+	EAR ear;
+	EAR_init(&ear);
+	MMU mmu;
+	MMU_init(&mmu);
+	MMU_setContext(&mmu, &ear.ctx);
+	MMU_setBusHandler(&mmu, &Bus_accessHandler, &ram_bus);
+	
+	EAR_ThreadState* ctx = CTX(ear);
+	ctx->cr[CR_MEMBASE_R] = 0x01 << MEMBASE_REGION_SHIFT;
+	ctx->cr[CR_MEMBASE_W] = 0x0100 | MMU_ENABLED;
+	TranslateBench translate_off = {&mmu, EAR_PROT_READ};
+	TranslateBench translate_on = {&mmu, EAR_PROT_WRITE};
+	mb_run("MMU_translate off", &bench_translate, &translate_off, argc, argv);
+	mb_run("MMU_translate on", &bench_translate, &translate_on, argc, argv);
+	
+	// Bus_access over a device tree four levels deep with 16 devices at each level
+	Bus tree_bus;
+	Bus_init(&tree_bus);
+	for(Bus_Addr i = 0; i < 16; i++) {
+		Bus_addDevice(&tree_bus, "L1", &null_busHandler, NULL, i << 20, 4);
+	}
+	for(Bus_Addr i = 0; i < 16; i++) {
+		Bus_addDevice(&tree_bus, "L2", &null_busHandler, NULL, 0xF00000 | i << 16, 8);
+	}
+	for(Bus_Addr i = 0; i < 16; i++) {
+		Bus_addDevice(&tree_bus, "L3", &null_busHandler, NULL, 0xFF0000 | i << 12, 12);
+	}
+	for(Bus_Addr i = 0; i < 16; i++) {
+		Bus_addDevice(&tree_bus, "L4", &null_busHandler, NULL, 0xFFF000 | i << 8, 16);
+	}
+	
+	BusBench bus_first = {&tree_bus, 0x000000};
+	BusBench bus_shallow = {&tree_bus, 0xE00000};
+	BusBench bus_deep = {&tree_bus, 0xFFFF00};
+	mb_run("Bus_access depth 1 first", &bench_bus_access, &bus_first, argc, argv);
+	mb_run("Bus_access depth 1 last", &bench_bus_access, &bus_shallow, argc, argv);
+	mb_run("Bus_access depth 4 last", &bench_bus_access, &bus_deep, argc, argv);
+	
+	// Bus_memoryHandler, called directly through the RAM device
+	MemoryDeviceBench memory_byte = {&ram_bus.devices.elems[0], true};
+	MemoryDeviceBench memory_word = {&ram_bus.devices.elems[0], false};
+	mb_run("Bus_memoryHandler byte", &bench_memory_device, &memory_byte, argc, argv);
+	mb_run("Bus_memoryHandler word", &bench_memory_device, &memory_word, argc, argv);
+	
+	// Debugger_hookMemAccess, through the debugger's memory handler. The breakpoints
+	// are all on the page being accessed, but none of them are hit.
+	static const unsigned bp_counts[] = {0, 10, 255};
+	for(size_t i = 0; i < ARRAY_COUNT(bp_counts); i++) {
+		Debugger* dbg = Debugger_init(&ear, DEBUG_KERNEL);
+		Debugger_setMemoryHandler(dbg, &null_memoryHandler, NULL);
+		for(unsigned bp = 0; bp < bp_counts[i]; bp++) {
+			Debugger_addBreakpoint(dbg, 0x4001 + bp, BP_READ);
+		}
+		
+		char name[64];
+		snprintf(name, sizeof(name), "Debugger_hookMemAccess %u bps", bp_counts[i]);
+		mb_run(name, &bench_debugger, dbg, argc, argv);
+		Debugger_destroy(dbg);
+	}
+	
+	free(ram);
+	free(flat);
+	return EXIT_SUCCESS;
+}
@@ -39,22 +39,21 @@ static inline uint16_t get_membase(EAR_ThreadState* ctx, EAR_Protection prot) {
 	return ctx->cr[cr];
 }
 
-/*! Translate an attempt to access a virtual address with the given type of access into
- * the physical address backing that address and the virtual address of a function to be
- * called to handle page faults.
- *
- * @param vmaddr Virtual address to translate
- * @param prot Attempted access permissions, exactly one of read, write, or execute
- * @param out_paddr Output variable that will hold the physical address of the memory
- *        page that backs this virtual address.
- * @return HALT_NONE if translation succeeds, halt reason otherwise.
- */
-EAR_HaltReason MMU_translate(
-	MMU* mmu, EAR_VirtAddr vmaddr, EAR_Protection prot, EAR_PhysAddr* out_paddr
+// Shared by MMU_translate() and MMU_memoryHandler(), which counts the translations it does for the CPU
+static inline EAR_HaltReason MMU_walk(
+	MMU* mmu, EAR_VirtAddr vmaddr, EAR_Protection prot, EAR_PhysAddr* out_paddr, bool count
 ) {
 	EAR_HaltReason r = HALT_NONE;
 	uint16_t membase = get_membase(&mmu->ctx->banks[mmu->ctx->active], prot);
 	bool mmu_enabled = !!(membase & MMU_ENABLED);
+#if EAR_STATS
+	if(count) {
+		++mmu->translations;
+		mmu->walks += mmu_enabled;
+	}
+#else
+	(void)count;
+#endif
 	if(!mmu_enabled) {
 		*out_paddr = ((EAR_PhysAddr)(membase >> MEMBASE_REGION_SHIFT) << EAR_REGION_SHIFT) | vmaddr;
 		return HALT_NONE;
@@ -73,6 +72,10 @@ EAR_HaltReason MMU_translate(
 	// Compute output physical address
 	*out_paddr = ((EAR_PhysAddr)pte << EAR_PAGE_SHIFT) | EAR_PAGE_OFFSET(vmaddr);
 	if(MMU_PTE_INVALID(pte)) {
+#if EAR_STATS
+		mmu->faults += count;
+#endif
+		
 		// The 0xFF region is used to indicate an invalid PTE
 		return HALT_MMU_FAULT;
 	}
@@ -80,6 +83,22 @@ EAR_HaltReason MMU_translate(
 	return HALT_NONE;
 }
 
+/*! Translate an attempt to access a virtual address with the given type of access into
+ * the physical address backing that address and the virtual address of a function to be
+ * called to handle page faults. This doesn't update the statistics counters.
+ *
+ * @param vmaddr Virtual address to translate
+ * @param prot Attempted access permissions, exactly one of read, write, or execute
+ * @param out_paddr Output variable that will hold the physical address of the memory
+ *        page that backs this virtual address.
+ * @return HALT_NONE if translation succeeds, halt reason otherwise.
+ */
+EAR_HaltReason MMU_translate(
+	MMU* mmu, EAR_VirtAddr vmaddr, EAR_Protection prot, EAR_PhysAddr* out_paddr
+) {
+	return MMU_walk(mmu, vmaddr, prot, out_paddr, /*count=*/false);
+}
+
 /*!
  * @brief Function called to handle virtual memory accesses.
  * 
@@ -102,9 +121,10 @@ bool MMU_memoryHandler(
 	ASSERT(vmaddr < EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
 	MMU* mmu = cookie;
 	
-	// Perform MMU lookup to convert from virtual to physical address
-	EAR_PhysAddr paddr;
-	EAR_HaltReason r = MMU_translate(mmu, vmaddr, prot, &paddr);
+	// Perform MMU lookup to convert from virtual to physical address. Accesses without
+	// an out_r pointer come from the debugger, so they aren't counted.
+	EAR_PhysAddr paddr = 0;
+	EAR_HaltReason r = MMU_walk(mmu, vmaddr, prot, &paddr, /*count=*/out_r != NULL);
 	if(r != HALT_NONE) {
 		if(out_r) {
 			*out_r = r;
@@ -7,6 +7,9 @@ struct MMU {
 	EAR_Context* ctx;            //!< CPU context for accessing MEMBASE_* control registers
 	Bus_AccessHandler* bus_fn;   //!< Function pointer called for physical memory accesses
 	void* bus_cookie;            //!< Opaque cookie value passed to bus_fn
+	uint64_t translations;       //!< Number of virtual addresses translated for the CPU
+	uint64_t walks;              //!< Translations that read a page table entry
+	uint64_t faults;             //!< Translations that found an invalid page table entry
 };
 
 
@@ -22,7 +25,7 @@ void MMU_setBusHandler(MMU* mmu, Bus_AccessHandler* bus_fn, void* bus_cookie);
 
 /*! Translate an attempt to access a virtual address with the given type of access into
  * the physical address backing that address and the virtual address of a function to be
- * called to handle page faults.
+ * called to handle page faults. This doesn't update the statistics counters.
  *
  * @param vmaddr Virtual address to translate
  * @param prot Attempted access permissions, exactly one of read, write, or execute
@@ -6,6 +6,17 @@
 #include <stdio.h>
 #include <assert.h>
 
+// Set to 1 to update the runtime statistics counters in the CPU, MMU, and bus. Only the
+// libear-stats.so build used by runpeg turns this on.
+#ifndef EAR_STATS
+#define EAR_STATS 0
+#endif
+
+// Set to 1 to also time the port callbacks, which costs two clock reads per port access
+#ifndef EAR_STATS_TIMING
+#define EAR_STATS_TIMING 0
+#endif
+
 // Machine data types
 typedef uint8_t EAR_Byte;
 #define EAR_REGISTER_BITS 16U
@@ -315,6 +326,7 @@ typedef enum EAR_HaltReason {
 	HALT_DEBUGGER,                //!< Halted by the debugger
 	HALT_RETURN,                  //!< Program tried to return from the topmost stack frame
 	HALT_COMPLETE,                //!< For internal use only, used by callbacks to mark completion
+	HALT_INSN_LIMIT,              //!< Reached the instruction limit set with EAR_setInstructionLimit
 } EAR_HaltReason;
 #define EAR_FAILED(haltReason) ((haltReason) < 0)
 
@@ -1,13 +1,27 @@
-TARGET := libeardbg.so
-PRODUCT := $(PEG_BIN)/$(TARGET)
+TARGETS := libeardbg.so libeardbg-stats.so
+PRODUCTS := $(addprefix $(PEG_BIN)/,$(TARGETS))
 
 DBG_DIR := $(DIR)
 DBG_BUILD := $(BUILD_DIR)
+DBG_SRCS := $(notdir $(wildcard $(DBG_DIR)/*.c))
 
-$(DBG_BUILD)/$(TARGET)_objs/debugger.c.o: $(LIB_DIR)/linenoise/linenoise.h
+$(foreach target,$(TARGETS),$(DBG_BUILD)/$(target)_objs/debugger.c.o): $(LIB_DIR)/linenoise/linenoise.h
 
-LIBS := \
+target := libeardbg.so
+$(target)_SRCS := $(DBG_SRCS)
+$(target)_LIBS := \
 	$(PEG_BIN)/libear.so \
 	$(PEG_BIN)/liblinenoise.a
 
-PUBLISH_TOP := $(PRODUCT)
+# Same library built against libear-stats.so, so it can print the statistics
+target := libeardbg-stats.so
+$(target)_CFLAGS := $(DEFAULT_CFLAGS) -DEAR_STATS=1
+$(target)_SRCS := $(DBG_SRCS)
+$(target)_LIBS := \
+	$(PEG_BIN)/libear-stats.so \
+	$(PEG_BIN)/liblinenoise.a
+
+# Ensure each of the targets are built into the PEG_BIN directory
+$(foreach target,$(TARGETS),$(eval $(target)_PRODUCT := $(PEG_BIN)/$(target)))
+
+PUBLISH_TOP := $(PEG_BIN)/libeardbg.so
@@ -0,0 +1,183 @@
+//
+//  bench.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "bench.h"
+#include <stdlib.h>
+#include <inttypes.h>
+
+
+/*!
+ * @brief Create a benchmark timer and insert it between the CPU and the MMU, and
+ * between the CPU and its ports. This should happen after the port handlers are
+ * set, and before the debugger interposes so that the debugger's own memory
+ * accesses aren't counted.
+ * 
+ * @param cpu EAR processor to measure
+ * 
+ * @return Newly created benchmark timer, or NULL on error
+ */
+Bench* Bench_create(EAR* cpu) {
+	Bench* bench = calloc(1, sizeof(*bench));
+	if(!bench) {
+		return NULL;
+	}
+	
+	bench->cpu = cpu;
+	bench->mem_fn = cpu->mem_fn;
+	bench->mem_cookie = cpu->mem_cookie;
+	EAR_setMemoryHandler(cpu, &Bench_memoryHandler, bench);
+	
+	bench->read_fn = cpu->read_fn;
+	bench->write_fn = cpu->write_fn;
+	bench->port_cookie = cpu->port_cookie;
+	EAR_setPorts(cpu, &Bench_portRead, &Bench_portWrite, bench);
+	return bench;
+}
+
+
+static uint64_t Bench_elapsedNanos(const struct timespec* start, const struct timespec* end) {
+	return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000 + end->tv_nsec - start->tv_nsec;
+}
+
+
+static void Bench_startPhase(Bench* bench, uint8_t phase) {
+	bench->phase = phase;
+	bench->start_insns[phase] = bench->cpu->ins_count;
+	clock_gettime(CLOCK_MONOTONIC, &bench->start_time[phase]);
+}
+
+
+/*! Start timing the boot phase, right before the CPU starts running. */
+void Bench_start(Bench* bench) {
+	bench->started = true;
+	Bench_startPhase(bench, BENCH_BOOT);
+}
+
+
+/*!
+ * @brief Counts a memory access by the CPU and notices when it starts running user
+ * code, then performs the access.
+ */
+bool Bench_memoryHandler(
+	void* cookie, EAR_Protection prot, Bus_AccessMode mode,
+	EAR_FullAddr vmaddr, bool is_byte, void* data, EAR_HaltReason* out_r
+) { //Bench_memoryHandler
+	Bench* bench = cookie;
+	
+	// Accesses without an out_r pointer come from the debugger
+	if(out_r) {
+		if(bench->phase == BENCH_BOOT
+			&& prot == EAR_PROT_EXECUTE
+			&& (CTX(*bench->cpu)->cr[CR_FLAGS] & FLAG_DENY_XREGS)
+		) {
+			Bench_startPhase(bench, BENCH_USER);
+		}
+		++bench->accesses[bench->phase];
+	}
+	
+	return bench->mem_fn(bench->mem_cookie, prot, mode, vmaddr, is_byte, data, out_r);
+}
+
+
+/*! Times a port read by the CPU, which may block waiting for input. */
+EAR_HaltReason Bench_portRead(void* cookie, uint8_t port, EAR_Byte* out_byte) {
+	Bench* bench = cookie;
+	struct timespec start, end;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	EAR_HaltReason r = bench->read_fn(bench->port_cookie, port, out_byte);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	bench->port_ns[bench->phase] += Bench_elapsedNanos(&start, &end);
+	return r;
+}
+
+
+/*! Times a port write by the CPU, which may block waiting for output to drain. */
+EAR_HaltReason Bench_portWrite(void* cookie, uint8_t port, EAR_Byte byte) {
+	Bench* bench = cookie;
+	struct timespec start, end;
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	EAR_HaltReason r = bench->write_fn(bench->port_cookie, port, byte);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	bench->port_ns[bench->phase] += Bench_elapsedNanos(&start, &end);
+	return r;
+}
+
+
+// MIPS and ns/insn only count the time spent running, not the time blocked on ports
+static void Bench_printPhase(
+	FILE* fp, const char* name, uint64_t insns, uint64_t accesses, double seconds, double port_seconds
+) { //Bench_printPhase
+	double run_seconds = seconds > port_seconds ? seconds - port_seconds : 0;
+	double mips = run_seconds > 0 ? insns / run_seconds / 1e6 : 0;
+	double ns_per_insn = insns ? run_seconds * 1e9 / insns : 0;
+	double accesses_per_insn = insns ? (double)accesses / insns : 0;
+	fprintf(
+		fp, "  %-5s %14" PRIu64 " %10.3f %10.3f %10.2f %10.2f %10.2f\n",
+		name, insns, seconds * 1e3, port_seconds * 1e3, mips, ns_per_insn, accesses_per_insn
+	);
+}
+
+
+/*!
+ * @brief Stop timing, print the results, and destroy the benchmark timer.
+ * 
+ * @param fp File to print the results to
+ */
+void Bench_finish(Bench** pbench, FILE* fp) {
+	Bench* bench = *pbench;
+	if(!bench) {
+		return;
+	}
+	*pbench = NULL;
+	
+	if(bench->started) {
+		struct timespec end_time;
+		clock_gettime(CLOCK_MONOTONIC, &end_time);
+		uint64_t end_insns = bench->cpu->ins_count;
+		
+		double seconds[BENCH_PHASES] = {0};
+		uint64_t insns[BENCH_PHASES] = {0};
+		for(uint8_t phase = 0; phase <= bench->phase; phase++) {
+			struct timespec* phase_end = phase < bench->phase ? &bench->start_time[phase + 1] : &end_time;
+			seconds[phase] = (phase_end->tv_sec - bench->start_time[phase].tv_sec)
+				+ (phase_end->tv_nsec - bench->start_time[phase].tv_nsec) / 1e9;
+			insns[phase] = (phase < bench->phase ? bench->start_insns[phase + 1] : end_insns)
+				- bench->start_insns[phase];
+		}
+		
+		double port_seconds[BENCH_PHASES];
+		for(uint8_t phase = 0; phase < BENCH_PHASES; phase++) {
+			port_seconds[phase] = bench->port_ns[phase] / 1e9;
+		}
+		
+		// "ms" is the wall time of each phase, and "port ms" is the part of it spent
+		// blocked on port I/O, which MIPS and ns/insn leave out
+		fprintf(
+			fp, "Benchmark:\n  %-5s %14s %10s %10s %10s %10s %10s\n",
+			"phase", "instructions", "ms", "port ms", "MIPS", "ns/insn", "mem/insn"
+		);
+		Bench_printPhase(
+			fp, "boot", insns[BENCH_BOOT], bench->accesses[BENCH_BOOT],
+			seconds[BENCH_BOOT], port_seconds[BENCH_BOOT]
+		);
+		Bench_printPhase(
+			fp, "user", insns[BENCH_USER], bench->accesses[BENCH_USER],
+			seconds[BENCH_USER], port_seconds[BENCH_USER]
+		);
+		Bench_printPhase(
+			fp, "total",
+			insns[BENCH_BOOT] + insns[BENCH_USER],
+			bench->accesses[BENCH_BOOT] + bench->accesses[BENCH_USER],
+			seconds[BENCH_BOOT] + seconds[BENCH_USER],
+			port_seconds[BENCH_BOOT] + port_seconds[BENCH_USER]
+		);
+	}
+	
+	free(bench);
+}
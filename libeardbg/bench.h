@@ -0,0 +1,98 @@
+//
+//  bench.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_BENCH_H
+#define EARDBG_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+#include "libear/ear.h"
+
+
+/*
+ * Emulator benchmark timer. It measures how fast the emulator runs a guest
+ * program, reporting the bootrom's run separately from the user program. The
+ * user program is considered to start at the first instruction fetched in
+ * user mode.
+ * 
+ * For each phase it reports the guest MIPS, host nanoseconds per instruction,
+ * and the number of memory accesses the CPU made per instruction. Time spent
+ * blocked in port reads and writes, like waiting for input, is reported on its
+ * own and left out of the MIPS and ns/insn numbers.
+ */
+
+#define BENCH_BOOT 0
+#define BENCH_USER 1
+#define BENCH_PHASES 2
+
+typedef struct Bench {
+	EAR* cpu;
+	
+	// Real memory handler that accesses are passed through to
+	EAR_MemoryHandler* mem_fn;
+	void* mem_cookie;
+	
+	// Real port handlers that accesses are passed through to
+	EAR_PortRead* read_fn;
+	EAR_PortWrite* write_fn;
+	void* port_cookie;
+	
+	bool started;
+	uint8_t phase;
+	
+	// Time and instruction count at the start of each phase
+	struct timespec start_time[BENCH_PHASES];
+	uint64_t start_insns[BENCH_PHASES];
+	
+	// CPU memory accesses made during each phase
+	uint64_t accesses[BENCH_PHASES];
+	
+	// Host time spent in the port handlers during each phase
+	uint64_t port_ns[BENCH_PHASES];
+} Bench;
+
+
+/*!
+ * @brief Create a benchmark timer and insert it between the CPU and the MMU, and
+ * between the CPU and its ports. This should happen after the port handlers are
+ * set, and before the debugger interposes so that the debugger's own memory
+ * accesses aren't counted.
+ * 
+ * @param cpu EAR processor to measure
+ * 
+ * @return Newly created benchmark timer, or NULL on error
+ */
+Bench* Bench_create(EAR* cpu);
+
+/*! Start timing the boot phase, right before the CPU starts running. */
+void Bench_start(Bench* bench);
+
+/*!
+ * @brief Counts a memory access by the CPU and notices when it starts running user
+ * code, then performs the access.
+ */
+bool Bench_memoryHandler(
+	void* cookie, EAR_Protection prot, Bus_AccessMode mode,
+	EAR_FullAddr vmaddr, bool is_byte, void* data, EAR_HaltReason* out_r
+);
+
+/*! Times a port read by the CPU, which may block waiting for input. */
+EAR_HaltReason Bench_portRead(void* cookie, uint8_t port, EAR_Byte* out_byte);
+
+/*! Times a port write by the CPU, which may block waiting for output to drain. */
+EAR_HaltReason Bench_portWrite(void* cookie, uint8_t port, EAR_Byte byte);
+
+/*!
+ * @brief Stop timing, print the results, and destroy the benchmark timer.
+ * 
+ * @param fp File to print the results to
+ */
+void Bench_finish(Bench** pbench, FILE* fp);
+
+#endif /* EARDBG_BENCH_H */
@@ -7,10 +7,12 @@
 
 #include "debugger.h"
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 #include "common/dynamic_array.h"
 #include "common/dynamic_string.h"
 #include "libear/mmu.h"
+#include "gdbstub.h"
 
 
 volatile sig_atomic_t g_interrupted = 0;
@@ -65,6 +67,8 @@ Debugger* Debugger_init(EAR* cpu, DebugFlags debug_flags) {
 	dbg->debug_flags = debug_flags;
 	dbg->cpu = cpu;
 	dbg->r = HALT_NONE;
+	dbg->log_sink.fp = stderr;
+	dbg->last_hit_bpid = BREAKPOINT_NONE;
 	
 	return dbg;
 }
@@ -93,6 +97,12 @@ void Debugger_setBusDumper(Debugger* dbg, Bus_DumpFunc* bus_dump_fn) {
 }
 
 
+/*! Give the debugger the physical memory bus, for `pmap` and `stats` */
+void Debugger_setBus(Debugger* dbg, Bus* bus) {
+	dbg->bus = bus;
+}
+
+
 /*!
  * @brief Check whether the specified thread state is in kernel mode.
  *        We do this by checking if the thread may access the opposite thread's registers.
@@ -106,13 +116,55 @@ bool Debugger_isKernelMode(EAR_ThreadState* ctx) {
 void Debugger_stepInstruction(Debugger* dbg) {
 	bool enabledInterruptHandler = enable_interrupt_handler();
 	
+	Debugger_updateInterposers(dbg);
 	dbg->debug_flags |= DEBUG_RESUMING;
-	do {
-		dbg->r = EAR_stepInstruction(dbg->cpu);
-		if(dbg->r != HALT_NONE && dbg->r != HALT_EXCEPTION) {
+	dbg->r = EAR_stepInstruction(dbg->cpu);
+	
+	// When not kernel debugging, run the kernel until it returns to user mode. The
+	// debugger can't stop in kernel mode, so it doesn't need to watch memory accesses.
+	if((dbg->r == HALT_NONE || dbg->r == HALT_EXCEPTION)
+		&& !(dbg->debug_flags & DEBUG_KERNEL)
+		&& Debugger_isKernelMode(CTX(*dbg->cpu))
+	) {
+		dbg->debug_flags |= DEBUG_SKIPPING_KERNEL;
+		Debugger_updateInterposers(dbg);
+		
+		dbg->r = EAR_continueToUserMode(dbg->cpu);
+		
+		dbg->debug_flags &= ~DEBUG_SKIPPING_KERNEL;
+		Debugger_updateInterposers(dbg);
+	}
+	
+	if(enabledInterruptHandler) {
+		disable_interrupt_handler();
+	}
+}
+
+
+// Continue until the temporary breakpoint at `addr` is hit with SP at or above `min_sp`
+static void Debugger_runToTemporary(Debugger* dbg, EAR_VirtAddr addr, EAR_VirtAddr min_sp) {
+	bool enabledInterruptHandler = enable_interrupt_handler();
+	
+	BreakpointID bpid = Debugger_addBreakpoint(dbg, addr, BP_EXECUTE | BP_TEMPORARY);
+	Debugger_updateInterposers(dbg);
+	
+	while(true) {
+		dbg->temp_bp_hit = false;
+		dbg->debug_flags |= DEBUG_RESUMING;
+		dbg->r = EAR_continue(dbg->cpu);
+		if(dbg->r != HALT_BREAKPOINT || !dbg->temp_bp_hit) {
 			break;
 		}
-	} while(!(dbg->debug_flags & DEBUG_KERNEL) && Debugger_isKernelMode(CTX(*dbg->cpu)));
+		
+		// Keep going when a recursive call reaches the same address in a deeper frame
+		if(CTX(*dbg->cpu)->r[SP] >= min_sp) {
+			dbg->r = HALT_NONE;
+			break;
+		}
+	}
+	
+	Debugger_removeBreakpoint(dbg, bpid);
+	Debugger_updateInterposers(dbg);
 	
 	if(enabledInterruptHandler) {
 		disable_interrupt_handler();
@@ -120,6 +172,73 @@ void Debugger_stepInstruction(Debugger* dbg) {
 }
 
 
+/*!
+ * @brief Step a single instruction, but run function calls until they return.
+ */
+void Debugger_stepOver(Debugger* dbg) {
+	EAR_ThreadState* ctx = CTX(*dbg->cpu);
+	
+	// Decode the next instruction to see if it's a function call
+	EAR_Instruction insn;
+	EAR_FullAddr pc = ctx->r[PC];
+	EAR_ExceptionInfo exc_info = 0;
+	EAR_UWord exc_addr = 0;
+	EAR_HaltReason r = EAR_fetchInstruction(
+		dbg->mem_fn, dbg->mem_cookie,
+		&pc, EAR_VIRTUAL_ADDRESS_SPACE_SIZE - 1, ctx->r[DPC],
+		/*verbose=*/false, &insn, &exc_info, &exc_addr
+	);
+	if(r != HALT_NONE || (ctx->cr[CR_FLAGS] & FLAG_RESUME) || (insn.op != OP_FCA && insn.op != OP_FCR)) {
+		Debugger_stepInstruction(dbg);
+		return;
+	}
+	
+	// Whether or not the call's condition passes, the instruction after it is reached
+	// when the call returns with the stack pointer back where it is now
+	Debugger_runToTemporary(dbg, (EAR_VirtAddr)pc, ctx->r[SP]);
+}
+
+
+/*!
+ * @brief Run until the current function returns to its caller.
+ */
+void Debugger_finish(Debugger* dbg) {
+	EAR_ThreadState* ctx = CTX(*dbg->cpu);
+	EAR_VirtAddr ret_addr;
+	EAR_VirtAddr min_sp;
+	
+	// At the first instruction of a function, the frame hasn't been set up yet
+	Pegasus* peg = dbg->pegs[dbg->cpu->ctx.active];
+	Pegasus_Symbol* sym = peg ? Pegasus_findSymbolByAddress(peg, ctx->r[PC]) : NULL;
+	if(sym && sym->value == ctx->r[PC]) {
+		ret_addr = ctx->r[RA];
+		min_sp = ctx->r[SP];
+	}
+	else {
+		// The saved return address is stored just above the saved frame pointer
+		if(Debugger_readVirt(dbg, &ret_addr, EAR_PROT_READ, ctx->r[FP] + sizeof(EAR_UWord), sizeof(ret_addr))) {
+			fprintf(stderr, "Unable to read the return address from the current stack frame\n");
+			return;
+		}
+		
+		// Once the frame is popped, SP is above the frame pointer
+		min_sp = ctx->r[FP] + 1;
+	}
+	
+	Debugger_runToTemporary(dbg, ret_addr, min_sp);
+}
+
+
+/*!
+ * @brief Run until execution reaches a code address.
+ * 
+ * @param addr Virtual address of the code to stop at
+ */
+void Debugger_runUntil(Debugger* dbg, EAR_VirtAddr addr) {
+	Debugger_runToTemporary(dbg, addr, 0);
+}
+
+
 /*!
  * @brief Hook function called before executing each instruction.
  * 
@@ -138,6 +257,10 @@ EAR_HaltReason Debugger_execHook(void* cookie, EAR_Instruction* insn, EAR_FullAd
 		return HALT_NONE;
 	}
 	
+	if(before && dbg->history.enabled && !(dbg->debug_flags & DEBUG_REPLAYING)) {
+		Debugger_recordHistory(dbg);
+	}
+	
 	if(!before) {
 		dbg->debug_flags &= ~DEBUG_RESUMING;
 		return HALT_NONE;
@@ -161,6 +284,14 @@ EAR_HaltReason Debugger_execHook(void* cookie, EAR_Instruction* insn, EAR_FullAd
 				break;
 			}
 			
+			if(dbg->debug_flags & DEBUG_REPLAYING) {
+				// Searching the history for breakpoint hits, so just take note of it
+				if(dbg->history.scan == SCAN_BREAKPOINT) {
+					Debugger_noteScanHit(dbg);
+				}
+				break;
+			}
+			
 			EAR_UWord curpc = ctx->cr[CR_INSN_ADDR];
 			EAR_UWord dpc = ctx->r[DPC];
 			fprintf(stderr, "Hit `BPT` at %04X.%04X\n", curpc, dpc);
@@ -171,6 +302,211 @@ EAR_HaltReason Debugger_execHook(void* cookie, EAR_Instruction* insn, EAR_FullAd
 }
 
 
+static int BreakpointIndexEntry_compare(const void* a, const void* b) {
+	const BreakpointIndexEntry* x = a;
+	const BreakpointIndexEntry* y = b;
+	if(x->start != y->start) {
+		return x->start < y->start ? -1 : 1;
+	}
+	return x->bpid < y->bpid ? -1 : x->bpid > y->bpid;
+}
+
+
+static void BreakpointIndex_setPages(BreakpointIndex* index, EAR_FullAddr start, EAR_FullAddr end) {
+	uint32_t page;
+	for(page = start >> EAR_PAGE_SHIFT; page <= (end - 1) >> EAR_PAGE_SHIFT; page++) {
+		index->pages[page / 8] |= 1 << (page % 8);
+	}
+}
+
+
+static inline bool BreakpointIndex_hasPage(const BreakpointIndex* index, uint32_t page) {
+	return page < BP_INDEX_PAGE_COUNT && (index->pages[page / 8] & (1 << (page % 8)));
+}
+
+
+// Rebuild the page bitmaps and interval lists from the enabled breakpoints
+static void Debugger_rebuildBreakpointIndex(Debugger* dbg) {
+	BreakpointIndex* indexes[2] = {&dbg->bp_virt, &dbg->bp_phys};
+	size_t i;
+	
+	for(i = 0; i < ARRAY_COUNT(indexes); i++) {
+		memset(indexes[i]->pages, 0, sizeof(indexes[i]->pages));
+		array_clear(&indexes[i]->entries);
+	}
+	
+	enumerate(&dbg->breakpoints, bpid, bp) {
+		if((bp->flags & (BP_IN_USE | BP_ENABLED)) != (BP_IN_USE | BP_ENABLED)) {
+			continue;
+		}
+		
+		BreakpointIndex* index = (bp->flags & BP_PHYSICAL) ? &dbg->bp_phys : &dbg->bp_virt;
+		BreakpointIndexEntry entry = {
+			.start = bp->addr,
+			.end = bp->addr + bp->size,
+			.bpid = (BreakpointID)bpid,
+		};
+		array_append(&index->entries, entry);
+		BreakpointIndex_setPages(index, entry.start, entry.end);
+	}
+	
+	// Sort each list by start address and compute the running maximum end address,
+	// which lets lookups stop as soon as no earlier range can reach the address
+	for(i = 0; i < ARRAY_COUNT(indexes); i++) {
+		BreakpointIndex* index = indexes[i];
+		if(array_empty(&index->entries)) {
+			continue;
+		}
+		
+		qsort(
+			index->entries.elems, index->entries.count,
+			sizeof(*index->entries.elems), &BreakpointIndexEntry_compare
+		);
+		
+		EAR_FullAddr max_end = 0;
+		foreach(&index->entries, entry) {
+			if(entry->end > max_end) {
+				max_end = entry->end;
+			}
+			entry->max_end = max_end;
+		}
+	}
+	
+	dbg->bp_index_dirty = false;
+}
+
+
+// Read memory for a breakpoint condition or logpoint without hitting any breakpoints
+static bool Debugger_exprRead(void* cookie, EAR_VirtAddr addr, bool is_byte, EAR_UWord* out_value) {
+	Debugger* dbg = cookie;
+	
+	if(is_byte) {
+		EAR_Byte byte;
+		if(!dbg->mem_fn(dbg->mem_cookie, EAR_PROT_READ, BUS_MODE_READ, addr, /*is_byte=*/true, &byte, NULL)) {
+			return false;
+		}
+		
+		*out_value = byte;
+		return true;
+	}
+	
+	if(addr & 1) {
+		return false;
+	}
+	
+	return dbg->mem_fn(dbg->mem_cookie, EAR_PROT_READ, BUS_MODE_READ, addr, /*is_byte=*/false, out_value, NULL);
+}
+
+
+// Count a hit on a breakpoint and decide whether it should stop execution
+static bool Debugger_checkBreakpoint(Debugger* dbg, BreakpointID bpid) {
+	Breakpoint* bp = &dbg->breakpoints.elems[bpid];
+	const EAR_ThreadState* ctx = CTX(*dbg->cpu);
+	
+	// An instruction can reach the same breakpoint more than once, such as with each word
+	// pushed by PSH, or when it's fetched again after its exception handler returns. The
+	// thread state's count of retired instructions only advances once it completes, so
+	// together with the instruction address it identifies the instruction.
+	uint32_t insn_count = ctx->cr[CR_INSN_COUNT_LO] | ((uint32_t)ctx->cr[CR_INSN_COUNT_HI] << 16);
+	bool again = bp->hits != 0
+		&& bp->hit_bank == dbg->cpu->ctx.active
+		&& bp->hit_insn_count == insn_count
+		&& bp->hit_insn_addr == ctx->cr[CR_INSN_ADDR];
+	
+	// Hits that are replayed from a snapshot were already counted and logged
+	bool replaying = !!(dbg->debug_flags & DEBUG_REPLAYING);
+	bool counted = !replaying && !again;
+	if(counted) {
+		++bp->hits;
+		bp->hit_insn_count = insn_count;
+		bp->hit_insn_addr = ctx->cr[CR_INSN_ADDR];
+		bp->hit_bank = dbg->cpu->ctx.active;
+	}
+	
+	if(!bp->cond && !bp->log) {
+		return true;
+	}
+	
+	DebugExprEnv env = {
+		.ctx = ctx,
+		.hits = bp->hits,
+		.read_fn = &Debugger_exprRead,
+		.read_cookie = dbg,
+	};
+	
+	if(bp->log) {
+		if(counted) {
+			DebugLogFormat_print(bp->log, &env, &dbg->log_sink);
+		}
+		return false;
+	}
+	
+	EAR_UWord value;
+	const char* error;
+	if(!DebugExpr_eval(bp->cond, &env, &value, &error)) {
+		// Stop so that the user can see what went wrong
+		if(!replaying) {
+			Debugger_flushLog(dbg);
+			fprintf(stderr, "Unable to evaluate the condition of breakpoint #%u: %s\n", bpid + 1, error);
+		}
+		return true;
+	}
+	
+	return value != 0;
+}
+
+
+// Find the lowest numbered breakpoint that watches any of the accessed bytes with a matching mode
+// and should stop, preferring the user's breakpoints over temporary ones. Every matching breakpoint
+// is counted as being hit, and logpoints print their messages, once per instruction.
+static bool Debugger_findBreakpoint(
+	Debugger* dbg, const BreakpointIndex* index,
+	BreakpointFlags prot, EAR_FullAddr addr, EAR_UWord size, BreakpointID* out_bpid
+) { //Debugger_findBreakpoint
+	const Breakpoint* breakpoints = dbg->breakpoints.elems;
+	EAR_FullAddr end = addr + size;
+	
+	// Number of ranges that start before the end of the access
+	size_t lo = 0, hi = index->entries.count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(index->entries.elems[mid].start < end) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	
+	bool found = false;
+	while(lo-- > 0) {
+		const BreakpointIndexEntry* entry = &index->entries.elems[lo];
+		if(entry->max_end <= addr) {
+			break;
+		}
+		
+		if(entry->end > addr && (breakpoints[entry->bpid].flags & prot & BP_PROT_MASK)) {
+			if(!Debugger_checkBreakpoint(dbg, entry->bpid)) {
+				continue;
+			}
+			
+			bool temporary = !!(breakpoints[entry->bpid].flags & BP_TEMPORARY);
+			if(found) {
+				bool found_temporary = !!(breakpoints[*out_bpid].flags & BP_TEMPORARY);
+				if(temporary != found_temporary ? temporary : entry->bpid > *out_bpid) {
+					continue;
+				}
+			}
+			
+			*out_bpid = entry->bpid;
+			found = true;
+		}
+	}
+	
+	return found;
+}
+
+
 static EAR_HaltReason Debugger_hookMemAccess(
 	Debugger* dbg, BreakpointFlags prot, EAR_FullAddr addr, EAR_UWord size
 ) { //Debugger_hookMemAccess
@@ -181,6 +517,18 @@ static EAR_HaltReason Debugger_hookMemAccess(
 		return HALT_NONE;
 	}
 	
+	if(dbg->bp_index_dirty) {
+		Debugger_rebuildBreakpointIndex(dbg);
+	}
+	
+	// Most accesses are to pages without any breakpoints
+	const BreakpointIndex* index = (prot & BP_PHYSICAL) ? &dbg->bp_phys : &dbg->bp_virt;
+	if(!BreakpointIndex_hasPage(index, addr >> EAR_PAGE_SHIFT)
+		&& !BreakpointIndex_hasPage(index, (addr + size - 1) >> EAR_PAGE_SHIFT)
+	) {
+		return HALT_NONE;
+	}
+	
 	// When resuming from a breakpoint or trying to disassemble code, don't halt
 	if(dbg->debug_flags & (DEBUG_RESUMING | DEBUG_NOBREAK)) {
 		return HALT_NONE;
@@ -191,53 +539,63 @@ static EAR_HaltReason Debugger_hookMemAccess(
 		return HALT_NONE;
 	}
 	
-	enumerate(&dbg->breakpoints, i, bp) {
-		if(!(bp->flags & BP_ENABLED)) {
-			continue;
-		}
-		
-		if(!(bp->flags & prot)) {
-			continue;
-		}
-		
-		if(!(addr <= bp->addr && bp->addr < addr + size)) {
-			continue;
+	BreakpointID bpid = 0;
+	if(!Debugger_findBreakpoint(dbg, index, prot, addr, size, &bpid)) {
+		return HALT_NONE;
+	}
+	
+	// Temporary breakpoints aren't part of the history the user can search
+	bool temporary = !!(dbg->breakpoints.elems[bpid].flags & BP_TEMPORARY);
+	if(dbg->debug_flags & DEBUG_REPLAYING) {
+		if(dbg->history.scan == SCAN_BREAKPOINT && !temporary) {
+			Debugger_noteScanHit(dbg);
 		}
+		return HALT_NONE;
+	}
+	
+	// Stopping at a temporary breakpoint is reported by whatever set it
+	if(temporary) {
+		dbg->temp_bp_hit = true;
+		return HALT_BREAKPOINT;
+	}
+	
+	// Messages from logpoints that were hit first should be printed before this one
+	Debugger_flushLog(dbg);
+	
+	dbg->last_hit_bpid = bpid;
+	dbg->last_hit_addr = addr;
+	
+	const char* accessMode;
+	switch(prot & BP_PROT_MASK) {
+		case BP_READ:
+			accessMode = "read";
+			break;
 		
-		const char* accessMode;
-		switch(prot) {
-			case BP_READ:
-				accessMode = "read";
-				break;
-			
-			case BP_WRITE:
-				accessMode = "write";
-				break;
-			
-			case BP_EXECUTE:
-				accessMode = "execute";
-				break;
-			
-			default:
-				accessMode = "access";
-				break;
-		}
-		fprintf(
-			stderr, "HW breakpoint #%u hit trying to %s %u byte%s at ",
-			(BreakpointID)(i + 1), accessMode, size, size == 1 ? "" : "s"
-		);
+		case BP_WRITE:
+			accessMode = "write";
+			break;
 		
-		if(prot & BP_PHYSICAL) {
-			fprintf(stderr, "%02X:%04X\n", EAR_FULL_REGION(addr), EAR_FULL_NOTREGION(addr));
-		}
-		else {
-			fprintf(stderr, "%04X\n", addr);
-		}
+		case BP_EXECUTE:
+			accessMode = "execute";
+			break;
 		
-		return HALT_BREAKPOINT;
+		default:
+			accessMode = "access";
+			break;
 	}
+	fprintf(
+		stderr, "HW breakpoint #%u hit trying to %s %u byte%s at ",
+		bpid + 1, accessMode, size, size == 1 ? "" : "s"
+	);
 	
-	return HALT_NONE;
+	if(prot & BP_PHYSICAL) {
+		fprintf(stderr, "%02X:%04X\n", EAR_FULL_REGION(addr), EAR_FULL_NOTREGION(addr));
+	}
+	else {
+		fprintf(stderr, "%04X\n", addr);
+	}
+	
+	return HALT_BREAKPOINT;
 }
 
 
@@ -279,8 +637,8 @@ bool Debugger_busHandler(
 	
 	ASSERT(dbg->bus_fn != NULL);
 	if(!dbg->bus_fn(dbg->bus_cookie, mode, paddr, is_byte, data, &r)) {
-		// Only print an error if the debugger is attached
-		if(dbg->debug_flags & DEBUG_DETACHED) {
+		// Only print an error if the debugger is attached and not replaying history
+		if(dbg->debug_flags & (DEBUG_DETACHED | DEBUG_REPLAYING)) {
 			return false;
 		}
 		
@@ -311,6 +669,17 @@ bool Debugger_busHandler(
 		return false;
 	}
 	
+	// Searching the history for the last write to an address?
+	DebugHistory* h = &dbg->history;
+	if((dbg->debug_flags & DEBUG_REPLAYING) && h->scan == SCAN_WRITE && h->scan_physical
+		&& mode == BUS_MODE_WRITE
+	) {
+		EAR_PhysAddr offset = h->scan_paddr - paddr;
+		if(offset < (is_byte ? 1u : 2u)) {
+			Debugger_noteScanHit(dbg);
+		}
+	}
+	
 	return true;
 }
 
@@ -365,10 +734,24 @@ bool Debugger_memoryHandler(
 		return false;
 	}
 	
-	return dbg->mem_fn(
-		dbg->mem_cookie, prot, mode,
-		vmaddr, is_byte, data, out_r
-	);
+	if(!dbg->mem_fn(dbg->mem_cookie, prot, mode, vmaddr, is_byte, data, out_r)) {
+		return false;
+	}
+	
+	// Searching the history for the last write to an address that isn't mapped? Writes
+	// to mapped addresses are matched by physical address in the bus handler instead.
+	DebugHistory* h = &dbg->history;
+	if((dbg->debug_flags & DEBUG_REPLAYING) && h->scan == SCAN_WRITE && !h->scan_physical
+		&& prot == EAR_PROT_WRITE
+		&& ((dbg->debug_flags & DEBUG_KERNEL) || !Debugger_isKernelMode(CTX(*dbg->cpu)))
+	) {
+		EAR_VirtAddr offset = h->scan_addr - (EAR_VirtAddr)vmaddr;
+		if(offset < (is_byte ? 1 : 2)) {
+			Debugger_noteScanHit(dbg);
+		}
+	}
+	
+	return true;
 }
 
 
@@ -399,9 +782,96 @@ bool Debugger_memoryHandler_physical(
 }
 
 
+/*!
+ * @brief Let the debugger insert itself as a man-in-the-middle between the CPU and the MMU,
+ * between the MMU and the bus, and between the CPU and its ports. The handlers that are
+ * currently installed in the CPU and MMU are used as the real handlers.
+ * 
+ * The debugger only stays in the path of memory and port accesses while it needs to
+ * see them, so a detached debugger adds no overhead to them.
+ * 
+ * @param mmu MMU used by the CPU
+ */
+void Debugger_interpose(Debugger* dbg, MMU* mmu) {
+	EAR* cpu = dbg->cpu;
+	
+	Debugger_setMemoryHandler(dbg, cpu->mem_fn, cpu->mem_cookie);
+	Debugger_setBusHandler(dbg, mmu->bus_fn, mmu->bus_cookie);
+	dbg->port_read_fn = cpu->read_fn;
+	dbg->port_write_fn = cpu->write_fn;
+	dbg->port_cookie = cpu->port_cookie;
+	dbg->mmu = mmu;
+	
+	Debugger_updateInterposers(dbg);
+}
+
+
+/*!
+ * @brief Install or remove the debugger's memory, bus, and port handlers depending on
+ * whether it is attached, has breakpoints, or is recording history. This should be
+ * called before running the CPU after any of those change.
+ */
+void Debugger_updateInterposers(Debugger* dbg) {
+	if(!dbg->mmu) {
+		return;
+	}
+	
+	if(dbg->bp_index_dirty) {
+		Debugger_rebuildBreakpointIndex(dbg);
+	}
+	
+	// Virtual memory accesses are only checked for breakpoints, and when searching
+	// the history for writes
+	bool attached = !(dbg->debug_flags & DEBUG_DETACHED);
+	bool skipping_kernel = !!(dbg->debug_flags & DEBUG_SKIPPING_KERNEL);
+	bool want_mem = attached && !skipping_kernel && (
+		!array_empty(&dbg->bp_virt.entries) || (dbg->debug_flags & DEBUG_REPLAYING)
+	);
+	if(want_mem != dbg->mem_interposed) {
+		if(want_mem) {
+			EAR_setMemoryHandler(dbg->cpu, &Debugger_memoryHandler, dbg);
+		}
+		else {
+			EAR_setMemoryHandler(dbg->cpu, dbg->mem_fn, dbg->mem_cookie);
+		}
+		dbg->mem_interposed = want_mem;
+	}
+	
+	// The bus handler also reports bus errors, so keep it whenever attached
+	bool want_bus = attached && !skipping_kernel;
+	if(want_bus != dbg->bus_interposed) {
+		if(want_bus) {
+			MMU_setBusHandler(dbg->mmu, &Debugger_busHandler, dbg);
+		}
+		else {
+			MMU_setBusHandler(dbg->mmu, dbg->bus_fn, dbg->bus_cookie);
+		}
+		dbg->bus_interposed = want_bus;
+	}
+	
+	// Port accesses are only needed to replay history
+	bool want_ports = dbg->history.enabled;
+	if(want_ports != dbg->ports_interposed) {
+		if(want_ports) {
+			EAR_setPorts(dbg->cpu, &Debugger_portRead, &Debugger_portWrite, dbg);
+		}
+		else {
+			EAR_setPorts(dbg->cpu, dbg->port_read_fn, dbg->port_write_fn, dbg->port_cookie);
+		}
+		dbg->ports_interposed = want_ports;
+	}
+}
+
+
 /*! Destroys a debugger object that was previously created using `Debugger_init`. */
 void Debugger_destroy(Debugger* dbg) {
+	Debugger_flushLog(dbg);
+	Debugger_clearBreakpoints(dbg);
+	Debugger_clearHistory(dbg);
+	array_clear(&dbg->history.memory);
 	array_clear(&dbg->breakpoints);
+	array_clear(&dbg->bp_virt.entries);
+	array_clear(&dbg->bp_phys.entries);
 	free(dbg);
 }
 
@@ -414,13 +884,31 @@ void Debugger_destroy(Debugger* dbg) {
  * @return Registered breakpoint ID
  */
 BreakpointID Debugger_addBreakpoint(Debugger* dbg, EAR_FullAddr addr, BreakpointFlags flags) {
+	return Debugger_addBreakpointRange(dbg, addr, 1, flags);
+}
+
+
+/*!
+ * @brief Registers a HW memory access breakpoint that watches a range of addresses.
+ * 
+ * @param addr First address to watch
+ * @param size Number of bytes to watch (at least 1)
+ * @param flags Breakpoint flags
+ * @return Registered breakpoint ID
+ */
+BreakpointID Debugger_addBreakpointRange(
+	Debugger* dbg, EAR_FullAddr addr, EAR_FullAddr size, BreakpointFlags flags
+) {
 	// Can't have an execute breakpoint on a physical address
 	ASSERT(!((flags & BP_PHYSICAL) && (flags & BP_EXECUTE)));
+	ASSERT(size != 0);
 	
 	Breakpoint new_bp = {
 		.addr = addr,
+		.size = size,
 		.flags = BP_IN_USE | BP_ENABLED | flags,
 	};
+	dbg->bp_index_dirty = true;
 	
 	enumerate(&dbg->breakpoints, i, bp) {
 		if(!(bp->flags & BP_IN_USE)) {
@@ -434,13 +922,28 @@ BreakpointID Debugger_addBreakpoint(Debugger* dbg, EAR_FullAddr addr, Breakpoint
 }
 
 
+/*!
+ * @brief Registers a logpoint, which prints a message each time the code address is
+ * executed instead of stopping.
+ * 
+ * @param addr Code address to place the logpoint
+ * @param log Compiled message format, which the debugger takes ownership of
+ * @return Registered breakpoint ID
+ */
+BreakpointID Debugger_addLogpoint(Debugger* dbg, EAR_VirtAddr addr, DebugLogFormat* log) {
+	BreakpointID bpid = Debugger_addBreakpoint(dbg, addr, BP_EXECUTE);
+	dbg->breakpoints.elems[bpid].log = log;
+	return bpid;
+}
+
+
 /*!
  * @brief Checks whether a breakpoint with the provided ID exists.
  * 
  * @param bpid Breakpoint ID to check for existence
  * @return True if a breakpoint with that ID exists, false otherwise
  */
-static bool Debugger_breakpointExists(Debugger* dbg, BreakpointID bpid) {
+bool Debugger_breakpointExists(Debugger* dbg, BreakpointID bpid) {
 	if(bpid >= dbg->breakpoints.count) {
 		return false;
 	}
@@ -449,6 +952,25 @@ static bool Debugger_breakpointExists(Debugger* dbg, BreakpointID bpid) {
 }
 
 
+/*!
+ * @brief Only stop at a breakpoint when a condition is true.
+ * 
+ * @param bpid Breakpoint ID to change
+ * @param cond Compiled condition, which the debugger takes ownership of, or NULL to
+ *        make the breakpoint unconditional
+ */
+void Debugger_setBreakpointCondition(Debugger* dbg, BreakpointID bpid, DebugExpr* cond) {
+	if(!Debugger_breakpointExists(dbg, bpid)) {
+		DebugExpr_destroy(cond);
+		return;
+	}
+	
+	Breakpoint* bp = &dbg->breakpoints.elems[bpid];
+	DebugExpr_destroy(bp->cond);
+	bp->cond = cond;
+}
+
+
 /*!
  * @brief Temporarily disables a registered breakpoint.
  * 
@@ -460,6 +982,7 @@ void Debugger_disableBreakpoint(Debugger* dbg, BreakpointID bpid) {
 	}
 	
 	dbg->breakpoints.elems[bpid].flags &= ~BP_ENABLED;
+	dbg->bp_index_dirty = true;
 }
 
 
@@ -474,6 +997,7 @@ void Debugger_enableBreakpoint(Debugger* dbg, BreakpointID bpid) {
 	}
 	
 	dbg->breakpoints.elems[bpid].flags |= BP_ENABLED;
+	dbg->bp_index_dirty = true;
 }
 
 
@@ -488,6 +1012,7 @@ bool Debugger_toggleBreakpoint(Debugger* dbg, BreakpointID bpid) {
 		return false;
 	}
 	
+	dbg->bp_index_dirty = true;
 	Breakpoint* bp = &dbg->breakpoints.elems[bpid];
 	if(bp->flags & BP_ENABLED) {
 		bp->flags &= ~BP_ENABLED;
@@ -509,13 +1034,46 @@ void Debugger_removeBreakpoint(Debugger* dbg, BreakpointID bpid) {
 		return;
 	}
 	
-	dbg->breakpoints.elems[bpid].flags = 0;
+	Breakpoint* bp = &dbg->breakpoints.elems[bpid];
+	DebugExpr_destroy(bp->cond);
+	DebugLogFormat_destroy(bp->log);
+	memset(bp, 0, sizeof(*bp));
+	dbg->bp_index_dirty = true;
 }
 
 
 /*! Clear all registered breakpoints. */
 void Debugger_clearBreakpoints(Debugger* dbg) {
+	foreach(&dbg->breakpoints, bp) {
+		DebugExpr_destroy(bp->cond);
+		DebugLogFormat_destroy(bp->log);
+	}
 	array_clear(&dbg->breakpoints);
+	dbg->bp_index_dirty = true;
+}
+
+
+/*! Write out any logpoint messages that are still buffered. */
+void Debugger_flushLog(Debugger* dbg) {
+	DebugLogSink_flush(&dbg->log_sink);
+}
+
+
+/*!
+ * @brief Called just before the program exits so that buffered logpoint messages are
+ * written and a connected GDB client or running script is told about the exit.
+ * 
+ * @param status Exit status of the program
+ */
+void Debugger_notifyExit(Debugger* dbg, int status) {
+	Debugger_flushLog(dbg);
+	
+	if(dbg->gdb) {
+		GdbStub_notifyExit(dbg->gdb, status);
+	}
+	if(dbg->script) {
+		Debugger_scriptNotifyExit(dbg, status);
+	}
 }
 
 
@@ -1137,46 +1695,52 @@ static bool deref(Debugger* dbg, EAR_VirtAddr addr, EAR_UWord* out) {
 }
 
 
+// Read a word of virtual memory for unwinding, optionally without printing errors
+static bool Debugger_unwindRead(Debugger* dbg, EAR_VirtAddr addr, bool quiet, EAR_UWord* out) {
+	if(!quiet) {
+		return deref(dbg, addr, out);
+	}
+	
+	return Debugger_exprRead(dbg, addr, /*is_byte=*/false, out);
+}
+
+
 /*!
- * @brief Display the backtrace of the selected thread state.
+ * @brief Walk the frame pointer chain of the selected thread state, starting with its PC.
  * 
  * @param alt True to use the inactive thread state
- * @param stream File stream used for output
+ * @param quiet True to not print errors when reading the stack fails
+ * @param frame_fn Function called for each frame that is found
+ * @param cookie Opaque value passed to `frame_fn`
+ * 
+ * @return True if the frame pointer chain has a cycle
  */
-void Debugger_showBacktrace(Debugger* dbg, bool alt, FILE* stream) {
+bool Debugger_unwind(
+	Debugger* dbg, bool alt, bool quiet,
+	Debugger_FrameFunc* frame_fn, void* cookie
+) { //Debugger_unwind
 	EAR_ThreadState* ctx = CTX_X(*dbg->cpu, alt);
 	if(alt) {
 		// HACK: Need to swap active thread state for Debugger_readVirt()
 		// to access the inactive thread state.
 		dbg->cpu->ctx.active ^= 1;
 	}
-	Pegasus* peg = dbg->pegs[dbg->cpu->ctx.active];
-	Pegasus_Symbol* sym = NULL;
 	
+	bool cycle = false;
 	EAR_VirtAddr pc = ctx->r[PC];
 	EAR_UWord dpc = ctx->r[DPC];
 	EAR_VirtAddr fp = ctx->r[FP];
-	fprintf(stream, "frame #0: %04X.%04X", pc, dpc);
-	if(peg) {
-		sym = Pegasus_findSymbolByAddress(peg, pc);
-		if(sym) {
-			unsigned sym_offset = pc - sym->value;
-			fprintf(stream, " %s+%#x", sym->name, sym_offset);
-		}
+	if(!frame_fn(cookie, 0, pc, dpc)) {
+		goto out;
 	}
-	fprintf(stream, "\n");
 	
 	// Cycle detection using trick with a slow and fast pointer
 	EAR_VirtAddr fpSlow = fp;
 	
-	int frameIndex;
+	unsigned frameIndex;
 	for(frameIndex = 1; ; frameIndex++) {
 		EAR_VirtAddr fpNext;
-		if(!deref(dbg, fp, &fpNext)) {
-			// fprintf(
-			// 	stream, "Failed to dereference frame pointer at %04X\n",
-			// 	fp, fp + 3 * 2
-			// );
+		if(!Debugger_unwindRead(dbg, fp, quiet, &fpNext)) {
 			break;
 		}
 		
@@ -1188,44 +1752,76 @@ void Debugger_showBacktrace(Debugger* dbg, bool alt, FILE* stream) {
 		
 		// Fast pointer can only hit slow pointer if there is a cycle
 		if(fpNext == fpSlow) {
-			fprintf(stream, "Backtrace: cycle detected!\n");
+			cycle = true;
 			break;
 		}
 		
 		if(
-			!deref(dbg, fp + sizeof(EAR_UWord), &pc)
-			|| !deref(dbg, fp + 2 * sizeof(EAR_UWord), &dpc)
+			!Debugger_unwindRead(dbg, fp + sizeof(EAR_UWord), quiet, &pc)
+			|| !Debugger_unwindRead(dbg, fp + 2 * sizeof(EAR_UWord), quiet, &dpc)
 		) {
 			break;
 		}
 		
 		fp = fpNext;
-		fprintf(
-			stream, "frame #%d: %04X.%04X",
-			frameIndex, pc, dpc
-		);
-		if(peg) {
-			sym = Pegasus_findSymbolByAddress(peg, pc);
-			if(sym) {
-				unsigned sym_offset = pc - sym->value;
-				fprintf(stream, " %s+%#x", sym->name, sym_offset);
-			}
+		if(!frame_fn(cookie, frameIndex, pc, dpc)) {
+			break;
 		}
-		fprintf(stream, "\n");
 		
 		// Advance slow pointer every other iteration
 		if(frameIndex % 2 == 0) {
-			if(!deref(dbg, fpSlow, &fpSlow)) {
+			if(!Debugger_unwindRead(dbg, fpSlow, quiet, &fpSlow)) {
 				// Shouldn't be possible, as the fast pointer already got here
 				ASSERT(!"Failed to dereference slow pointer in backtrace");
 			}
 		}
 	}
 	
+out:
 	// Restore active thread state index (if swapped before)
 	if(alt) {
 		dbg->cpu->ctx.active ^= 1;
 	}
+	return cycle;
+}
+
+
+typedef struct BacktraceCookie {
+	Pegasus* peg;
+	FILE* stream;
+} BacktraceCookie;
+
+static bool Debugger_showFrame(void* cookie, unsigned index, EAR_VirtAddr pc, EAR_UWord dpc) {
+	BacktraceCookie* bt = cookie;
+	
+	fprintf(bt->stream, "frame #%u: %04X.%04X", index, pc, dpc);
+	if(bt->peg) {
+		Pegasus_Symbol* sym = Pegasus_findSymbolByAddress(bt->peg, pc);
+		if(sym) {
+			unsigned sym_offset = pc - sym->value;
+			fprintf(bt->stream, " %s+%#x", sym->name, sym_offset);
+		}
+	}
+	fprintf(bt->stream, "\n");
+	return true;
+}
+
+
+/*!
+ * @brief Display the backtrace of the selected thread state.
+ * 
+ * @param alt True to use the inactive thread state
+ * @param stream File stream used for output
+ */
+void Debugger_showBacktrace(Debugger* dbg, bool alt, FILE* stream) {
+	BacktraceCookie bt = {
+		.peg = dbg->pegs[dbg->cpu->ctx.active ^ alt],
+		.stream = stream,
+	};
+	
+	if(Debugger_unwind(dbg, alt, /*quiet=*/false, &Debugger_showFrame, &bt)) {
+		fprintf(stream, "Backtrace: cycle detected!\n");
+	}
 }
 
 /*! Prints the thread's register state to the output stream. */
@@ -13,11 +13,19 @@
 #include <signal.h>
 #include "common/dynamic_array.h"
 #include "libear/ear.h"
+#include "libear/bus.h"
 #include "repl.h"
 #include "pegasus.h"
+#include "history.h"
+#include "expr.h"
 
 
-typedef EAR_Byte BreakpointID;
+typedef uint32_t BreakpointID;
+
+//! Placeholder BreakpointID for when there is no breakpoint
+#define BREAKPOINT_NONE ((BreakpointID)-1)
+
+typedef struct GdbStub GdbStub;
 
 // Debugger state
 typedef uint8_t DebugFlags;
@@ -37,6 +45,12 @@ typedef uint8_t DebugFlags;
 //! Allow debugging of kernel memory and registers
 #define DEBUG_KERNEL ((DebugFlags)(1 << 4))
 
+//! Execution is being replayed from a snapshot, so breakpoints and bus errors are silent
+#define DEBUG_REPLAYING ((DebugFlags)(1 << 5))
+
+//! Kernel code is running at full speed until it returns to user mode
+#define DEBUG_SKIPPING_KERNEL ((DebugFlags)(1 << 6))
+
 typedef uint8_t BreakpointFlags;
 #define BP_IN_USE ((BreakpointFlags)(1 << 0))
 #define BP_ENABLED ((BreakpointFlags)(1 << 1))
@@ -44,14 +58,42 @@ typedef uint8_t BreakpointFlags;
 #define BP_READ ((BreakpointFlags)(1 << 3))
 #define BP_WRITE ((BreakpointFlags)(1 << 4))
 #define BP_EXECUTE ((BreakpointFlags)(1 << 5))
+#define BP_TEMPORARY ((BreakpointFlags)(1 << 6)) //!< Used internally by `next`, `finish`, and `until`
 
 #define BP_PROT_MASK (BP_READ | BP_WRITE | BP_EXECUTE)
 
 typedef struct Breakpoint {
 	EAR_FullAddr addr;
+	EAR_FullAddr size; //!< Number of bytes watched, starting at addr
 	BreakpointFlags flags;
+	uint64_t hits;           //!< Number of instructions that have reached the breakpoint
+	uint32_t hit_insn_count; //!< CR_INSN_COUNT of the thread state that last reached it
+	EAR_UWord hit_insn_addr; //!< Address of the instruction that last reached it
+	uint8_t hit_bank;        //!< Index of the thread state that last reached it
+	DebugExpr* cond;         //!< Only stop when this evaluates to nonzero (optional)
+	DebugLogFormat* log;     //!< Print this message instead of stopping (optional)
 } Breakpoint;
 
+//! One enabled breakpoint in a BreakpointIndex
+typedef struct BreakpointIndexEntry {
+	EAR_FullAddr start;
+	EAR_FullAddr end;     //!< One past the last watched address
+	EAR_FullAddr max_end; //!< Largest `end` of this entry and all entries before it
+	BreakpointID bpid;
+} BreakpointIndexEntry;
+
+//! Number of pages tracked by a BreakpointIndex (enough for the physical address space)
+#define BP_INDEX_PAGE_COUNT (EAR_PHYSICAL_ADDRESS_SPACE_SIZE >> EAR_PAGE_SHIFT)
+
+//! Lookup structure for the enabled breakpoints in one address space
+typedef struct BreakpointIndex {
+	// One bit per page that has at least one breakpoint on it
+	uint8_t pages[BP_INDEX_PAGE_COUNT / 8];
+	
+	// Sorted by start address
+	dynamic_array(BreakpointIndexEntry) entries;
+} BreakpointIndex;
+
 typedef struct Debugger {
 	EAR* cpu;
 	bool* trace;
@@ -60,10 +102,28 @@ typedef struct Debugger {
 	Bus_AccessHandler* bus_fn;
 	Bus_DumpFunc* bus_dump_fn;
 	void* bus_cookie;
+	Bus* bus;
+	EAR_PortRead* port_read_fn;
+	EAR_PortWrite* port_write_fn;
+	void* port_cookie;
+	MMU* mmu;
+	bool mem_interposed;
+	bool bus_interposed;
+	bool ports_interposed;
 	dynamic_array(Breakpoint) breakpoints;
+	BreakpointIndex bp_virt;
+	BreakpointIndex bp_phys;
+	bool bp_index_dirty;
+	bool temp_bp_hit;
 	Pegasus* pegs[2];
 	EAR_HaltReason r;
 	DebugFlags debug_flags;
+	DebugHistory history;
+	DebugLogSink log_sink;
+	BreakpointID last_hit_bpid;  //!< Most recent breakpoint that stopped execution
+	EAR_FullAddr last_hit_addr;  //!< Address of the access that hit it
+	GdbStub* gdb;                //!< Connected GDB client, if any
+	DebugScript* script;         //!< Script being run by `Debugger_runScript`, if any
 } Debugger;
 
 
@@ -96,6 +156,9 @@ void Debugger_setBusHandler(Debugger* dbg, Bus_AccessHandler* bus_fn, void* bus_
 /*! Set function used to dump physical memory layout */
 void Debugger_setBusDumper(Debugger* dbg, Bus_DumpFunc* bus_dump_fn);
 
+/*! Give the debugger the physical memory bus, for `pmap` and `stats` */
+void Debugger_setBus(Debugger* dbg, Bus* bus);
+
 /*!
  * @brief Check whether the specified thread state is in kernel mode.
  *        We do this by seeing if any control registers are denied.
@@ -171,6 +234,25 @@ bool Debugger_memoryHandler_physical(
 	EAR_FullAddr paddr, bool is_byte, void* data, EAR_HaltReason* out_r
 );
 
+/*!
+ * @brief Let the debugger insert itself as a man-in-the-middle between the CPU and the MMU,
+ * between the MMU and the bus, and between the CPU and its ports. The handlers that are
+ * currently installed in the CPU and MMU are used as the real handlers.
+ * 
+ * The debugger only stays in the path of memory and port accesses while it needs to
+ * see them, so a detached debugger adds no overhead to them.
+ * 
+ * @param mmu MMU used by the CPU
+ */
+void Debugger_interpose(Debugger* dbg, MMU* mmu);
+
+/*!
+ * @brief Install or remove the debugger's memory, bus, and port handlers depending on
+ * whether it is attached, has breakpoints, or is recording history. This should be
+ * called before running the CPU after any of those change.
+ */
+void Debugger_updateInterposers(Debugger* dbg);
+
 /*! Destroys a debugger object that was previously created using `Debugger_init`. */
 void Debugger_destroy(Debugger* dbg);
 
@@ -183,6 +265,45 @@ void Debugger_destroy(Debugger* dbg);
  */
 BreakpointID Debugger_addBreakpoint(Debugger* dbg, EAR_FullAddr addr, BreakpointFlags flags);
 
+/*!
+ * @brief Registers a HW memory access breakpoint that watches a range of addresses.
+ * 
+ * @param addr First address to watch
+ * @param size Number of bytes to watch (at least 1)
+ * @param flags Breakpoint flags
+ * @return Registered breakpoint ID
+ */
+BreakpointID Debugger_addBreakpointRange(
+	Debugger* dbg, EAR_FullAddr addr, EAR_FullAddr size, BreakpointFlags flags
+);
+
+/*!
+ * @brief Registers a logpoint, which prints a message each time the code address is
+ * executed instead of stopping.
+ * 
+ * @param addr Code address to place the logpoint
+ * @param log Compiled message format, which the debugger takes ownership of
+ * @return Registered breakpoint ID
+ */
+BreakpointID Debugger_addLogpoint(Debugger* dbg, EAR_VirtAddr addr, DebugLogFormat* log);
+
+/*!
+ * @brief Checks whether a breakpoint with the provided ID exists.
+ * 
+ * @param bpid Breakpoint ID to check for existence
+ * @return True if a breakpoint with that ID exists, false otherwise
+ */
+bool Debugger_breakpointExists(Debugger* dbg, BreakpointID bpid);
+
+/*!
+ * @brief Only stop at a breakpoint when a condition is true.
+ * 
+ * @param bpid Breakpoint ID to change
+ * @param cond Compiled condition, which the debugger takes ownership of, or NULL to
+ *        make the breakpoint unconditional
+ */
+void Debugger_setBreakpointCondition(Debugger* dbg, BreakpointID bpid, DebugExpr* cond);
+
 /*!
  * @brief Temporarily disables a registered breakpoint.
  * 
@@ -215,6 +336,17 @@ void Debugger_removeBreakpoint(Debugger* dbg, BreakpointID bpid);
 /*! Clear all registered breakpoints. */
 void Debugger_clearBreakpoints(Debugger* dbg);
 
+/*! Write out any logpoint messages that are still buffered. */
+void Debugger_flushLog(Debugger* dbg);
+
+/*!
+ * @brief Called just before the program exits so that buffered logpoint messages are
+ * written and a connected GDB client or running script is told about the exit.
+ * 
+ * @param status Exit status of the program
+ */
+void Debugger_notifyExit(Debugger* dbg, int status);
+
 /*!
  * @brief Read a span of physical memory into a buffer.
  * 
@@ -282,6 +414,33 @@ void Debugger_showVMMap(Debugger* dbg, FILE* stream);
  */
 void Debugger_showContext(Debugger* dbg, bool alt, FILE* stream);
 
+/*!
+ * @brief Called for each frame found while walking the stack.
+ * 
+ * @param cookie Opaque value passed to `Debugger_unwind`
+ * @param index Frame number, where frame 0 is the thread's current PC
+ * @param pc Code address of the frame
+ * @param dpc DPC value of the frame
+ * 
+ * @return True to keep walking the stack
+ */
+typedef bool Debugger_FrameFunc(void* cookie, unsigned index, EAR_VirtAddr pc, EAR_UWord dpc);
+
+/*!
+ * @brief Walk the frame pointer chain of the selected thread state, starting with its PC.
+ * 
+ * @param alt True to use the inactive thread state
+ * @param quiet True to not print errors when reading the stack fails
+ * @param frame_fn Function called for each frame that is found
+ * @param cookie Opaque value passed to `frame_fn`
+ * 
+ * @return True if the frame pointer chain has a cycle
+ */
+bool Debugger_unwind(
+	Debugger* dbg, bool alt, bool quiet,
+	Debugger_FrameFunc* frame_fn, void* cookie
+);
+
 /*!
  * @brief Display the backtrace of the selected thread state.
  * 
@@ -318,6 +477,102 @@ void Debugger_showControlRegs(Debugger* dbg, bool alt, FILE* stream);
 /*! Step a single instruction in the debugger, semantically */
 void Debugger_stepInstruction(Debugger* dbg);
 
+/*!
+ * @brief Step a single instruction, but run function calls until they return.
+ */
+void Debugger_stepOver(Debugger* dbg);
+
+/*!
+ * @brief Run until the current function returns to its caller.
+ */
+void Debugger_finish(Debugger* dbg);
+
+/*!
+ * @brief Run until execution reaches a code address.
+ * 
+ * @param addr Virtual address of the code to stop at
+ */
+void Debugger_runUntil(Debugger* dbg, EAR_VirtAddr addr);
+
+/*!
+ * @brief Set this function as the CPU's port read handler so that the values read can
+ * be replayed later.
+ * 
+ * @param cookie Opaque value passed to the callback (the debugger)
+ * @param port Port number being read
+ * @param out_byte Output pointer where the byte that was read will be written
+ * 
+ * @return Halt reason from the real port read function or the history
+ */
+EAR_HaltReason Debugger_portRead(void* cookie, uint8_t port, EAR_Byte* out_byte);
+
+/*!
+ * @brief Set this function as the CPU's port write handler so that writes aren't
+ * performed a second time when replaying.
+ * 
+ * @param cookie Opaque value passed to the callback (the debugger)
+ * @param port Port number being written
+ * @param byte Byte being written
+ * 
+ * @return Halt reason from the real port write function or the history
+ */
+EAR_HaltReason Debugger_portWrite(void* cookie, uint8_t port, EAR_Byte byte);
+
+/*!
+ * @brief Register writable memory that should be saved in each snapshot. All writable
+ * memory must be registered for reverse execution to be possible.
+ * 
+ * @param data Pointer to the memory
+ * @param size Size of the memory in bytes
+ */
+void Debugger_addHistoryMemory(Debugger* dbg, void* data, size_t size);
+
+/*!
+ * @brief Called before each instruction executes to periodically take snapshots.
+ * 
+ * @note As more snapshots are taken, the spacing between them doubles to keep the
+ *       total number of snapshots below DEBUG_HISTORY_MAX_SNAPSHOTS.
+ */
+void Debugger_recordHistory(Debugger* dbg);
+
+/*!
+ * @brief Start recording history from the current state, discarding anything that
+ * was recorded before.
+ */
+void Debugger_startHistory(Debugger* dbg);
+
+/*! Discard all recorded snapshots and port accesses and stop recording history. */
+void Debugger_clearHistory(Debugger* dbg);
+
+/*!
+ * @brief Called while replaying when something that is being searched for happens.
+ */
+void Debugger_noteScanHit(Debugger* dbg);
+
+/*!
+ * @brief Go back to the previous instruction boundary where stepping would have stopped.
+ * 
+ * @return True if there was an earlier instruction in the recorded history
+ */
+bool Debugger_reverseStep(Debugger* dbg);
+
+/*!
+ * @brief Go back to the most recent breakpoint hit.
+ * 
+ * @return True if a breakpoint was hit, or false if execution went back to the beginning
+ *         of the recorded history
+ */
+bool Debugger_reverseContinue(Debugger* dbg);
+
+/*!
+ * @brief Go back to just before the most recent instruction that wrote to a virtual address.
+ * 
+ * @param addr Virtual address that was written
+ * 
+ * @return True if a write was found, or false if the current state is unchanged
+ */
+bool Debugger_reverseToLastWrite(Debugger* dbg, EAR_VirtAddr addr);
+
 /*! Global flag that is set when a keyboard interrupt is caught. */
 extern volatile sig_atomic_t g_interrupted;
 
@@ -0,0 +1,759 @@
+//
+//  expr.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "expr.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include "common/macros.h"
+#include "common/dynamic_string.h"
+
+
+// Bytecode operations. Operands follow the opcode byte and are little-endian.
+typedef uint8_t ExprOp;
+#define EXPR_END       ((ExprOp)0)  //!< Finish with the result on top of the stack
+#define EXPR_PUSH      ((ExprOp)1)  //!< Push a 16-bit constant
+#define EXPR_REG       ((ExprOp)2)  //!< Push the register whose number is in the next byte
+#define EXPR_HITS      ((ExprOp)3)  //!< Push the hit count
+#define EXPR_LOAD      ((ExprOp)4)  //!< Replace an address with the word stored there
+#define EXPR_LOAD_BYTE ((ExprOp)5)  //!< Replace an address with the byte stored there
+#define EXPR_NEG       ((ExprOp)6)
+#define EXPR_INV       ((ExprOp)7)
+#define EXPR_NOT       ((ExprOp)8)
+#define EXPR_MUL       ((ExprOp)9)
+#define EXPR_DIV       ((ExprOp)10)
+#define EXPR_MOD       ((ExprOp)11)
+#define EXPR_ADD       ((ExprOp)12)
+#define EXPR_SUB       ((ExprOp)13)
+#define EXPR_SHL       ((ExprOp)14)
+#define EXPR_SHR       ((ExprOp)15)
+#define EXPR_LT        ((ExprOp)16)
+#define EXPR_LE        ((ExprOp)17)
+#define EXPR_GT        ((ExprOp)18)
+#define EXPR_GE        ((ExprOp)19)
+#define EXPR_EQ        ((ExprOp)20)
+#define EXPR_NE        ((ExprOp)21)
+#define EXPR_AND       ((ExprOp)22)
+#define EXPR_XOR       ((ExprOp)23)
+#define EXPR_OR        ((ExprOp)24)
+#define EXPR_AND_THEN  ((ExprOp)25) //!< If the top is zero, jump forward by the 16-bit offset, otherwise pop it
+#define EXPR_OR_ELSE   ((ExprOp)26) //!< If the top is nonzero, set it to 1 and jump forward, otherwise pop it
+#define EXPR_BOOL      ((ExprOp)27) //!< Replace the top with 1 if it's nonzero
+
+typedef struct ExprBinaryOp {
+	const char* token;
+	ExprOp op;
+	unsigned prec;
+} ExprBinaryOp;
+
+// Two character operators come first so that "<=" isn't read as "<"
+static const ExprBinaryOp s_binops[] = {
+	{"||", EXPR_OR_ELSE, 1},
+	{"&&", EXPR_AND_THEN, 2},
+	{"==", EXPR_EQ, 6},
+	{"!=", EXPR_NE, 6},
+	{"<=", EXPR_LE, 7},
+	{">=", EXPR_GE, 7},
+	{"<<", EXPR_SHL, 8},
+	{">>", EXPR_SHR, 8},
+	{"|", EXPR_OR, 3},
+	{"^", EXPR_XOR, 4},
+	{"&", EXPR_AND, 5},
+	{"<", EXPR_LT, 7},
+	{">", EXPR_GT, 7},
+	{"+", EXPR_ADD, 9},
+	{"-", EXPR_SUB, 9},
+	{"*", EXPR_MUL, 10},
+	{"/", EXPR_DIV, 10},
+	{"%", EXPR_MOD, 10},
+};
+
+typedef struct ExprParser {
+	const char* source;
+	const char* p;
+	Pegasus* peg;
+	dynamic_array(uint8_t) code;
+	unsigned depth;
+	bool failed;
+} ExprParser;
+
+
+static void ExprParser_fail(ExprParser* ps, const char* message) {
+	if(ps->failed) {
+		return;
+	}
+	
+	fprintf(stderr, "Invalid expression `%s`: %s", ps->source, message);
+	if(*ps->p != '\0') {
+		fprintf(stderr, " at `%s`", ps->p);
+	}
+	fprintf(stderr, "\n");
+	ps->failed = true;
+}
+
+
+static void ExprParser_skipSpaces(ExprParser* ps) {
+	while(isspace(*ps->p)) {
+		++ps->p;
+	}
+}
+
+
+// Emit an operation and track how many values it leaves on the stack
+static void ExprParser_emit(ExprParser* ps, ExprOp op, int stack_change) {
+	array_append(&ps->code, op);
+	
+	ps->depth += stack_change;
+	if(ps->depth > DEBUG_EXPR_MAX_DEPTH) {
+		ExprParser_fail(ps, "expression is too deeply nested");
+	}
+}
+
+
+static void ExprParser_emit16(ExprParser* ps, EAR_UWord value) {
+	array_append(&ps->code, value & 0xFF);
+	array_append(&ps->code, value >> 8);
+}
+
+
+static bool ExprParser_isNameChar(char c) {
+	return isalnum(c) || c == '_' || c == '@' || c == '.' || c == '$';
+}
+
+
+static bool ExprParser_parseRegisterName(const char* name, EAR_Register* out_reg) {
+	EAR_Register reg;
+	for(reg = 0; reg < 16; reg++) {
+		char numbered[4];
+		snprintf(numbered, sizeof(numbered), "R%u", reg);
+		if(!strcasecmp(name, EAR_getRegisterName(reg)) || !strcasecmp(name, numbered)) {
+			*out_reg = reg;
+			return true;
+		}
+	}
+	
+	return false;
+}
+
+
+static bool ExprParser_parseHex(const char* str, EAR_UWord* out_value) {
+	if(!strncasecmp(str, "0x", 2)) {
+		str += 2;
+	}
+	
+	if(*str == '\0' || strlen(str) > 4) {
+		return false;
+	}
+	
+	char* end;
+	unsigned long value = strtoul(str, &end, 16);
+	if(*end != '\0') {
+		return false;
+	}
+	
+	*out_value = (EAR_UWord)value;
+	return true;
+}
+
+
+static void ExprParser_parseBinary(ExprParser* ps, unsigned min_prec);
+
+static void ExprParser_parseName(ExprParser* ps) {
+	const char* start = ps->p;
+	while(ExprParser_isNameChar(*ps->p)) {
+		++ps->p;
+	}
+	
+	char* name = strndup(start, ps->p - start);
+	EAR_Register reg;
+	EAR_UWord value;
+	Pegasus_Symbol* sym;
+	
+	ExprParser_skipSpaces(ps);
+	if(!strcasecmp(name, "byte") && *ps->p == '[') {
+		++ps->p;
+		ExprParser_parseBinary(ps, 1);
+		ExprParser_skipSpaces(ps);
+		if(*ps->p != ']') {
+			ExprParser_fail(ps, "expected `]`");
+		}
+		else {
+			++ps->p;
+		}
+		ExprParser_emit(ps, EXPR_LOAD_BYTE, 0);
+	}
+	else if(ExprParser_parseRegisterName(name, &reg)) {
+		ExprParser_emit(ps, EXPR_REG, 1);
+		array_append(&ps->code, reg);
+	}
+	else if(!strcasecmp(name, "hits")) {
+		ExprParser_emit(ps, EXPR_HITS, 1);
+	}
+	else if(ps->peg && (sym = Pegasus_findSymbolByName(ps->peg, name))) {
+		ExprParser_emit(ps, EXPR_PUSH, 1);
+		ExprParser_emit16(ps, sym->value);
+	}
+	else if(ExprParser_parseHex(name, &value)) {
+		ExprParser_emit(ps, EXPR_PUSH, 1);
+		ExprParser_emit16(ps, value);
+	}
+	else {
+		ps->p = start;
+		ExprParser_fail(ps, "unknown register, symbol, or number");
+	}
+	
+	free(name);
+}
+
+
+static void ExprParser_parseUnary(ExprParser* ps) {
+	ExprParser_skipSpaces(ps);
+	
+	switch(*ps->p) {
+		case '-':
+			++ps->p;
+			ExprParser_parseUnary(ps);
+			ExprParser_emit(ps, EXPR_NEG, 0);
+			break;
+		
+		case '~':
+			++ps->p;
+			ExprParser_parseUnary(ps);
+			ExprParser_emit(ps, EXPR_INV, 0);
+			break;
+		
+		case '!':
+			++ps->p;
+			ExprParser_parseUnary(ps);
+			ExprParser_emit(ps, EXPR_NOT, 0);
+			break;
+		
+		case '(':
+			++ps->p;
+			ExprParser_parseBinary(ps, 1);
+			ExprParser_skipSpaces(ps);
+			if(*ps->p != ')') {
+				ExprParser_fail(ps, "expected `)`");
+				break;
+			}
+			++ps->p;
+			break;
+		
+		case '[':
+			++ps->p;
+			ExprParser_parseBinary(ps, 1);
+			ExprParser_skipSpaces(ps);
+			if(*ps->p != ']') {
+				ExprParser_fail(ps, "expected `]`");
+				break;
+			}
+			++ps->p;
+			ExprParser_emit(ps, EXPR_LOAD, 0);
+			break;
+		
+		default:
+			if(!ExprParser_isNameChar(*ps->p)) {
+				ExprParser_fail(ps, "expected a value");
+				break;
+			}
+			
+			ExprParser_parseName(ps);
+			break;
+	}
+}
+
+
+static const ExprBinaryOp* ExprParser_peekBinaryOp(ExprParser* ps) {
+	ExprParser_skipSpaces(ps);
+	
+	size_t i;
+	for(i = 0; i < ARRAY_COUNT(s_binops); i++) {
+		if(!strncmp(ps->p, s_binops[i].token, strlen(s_binops[i].token))) {
+			return &s_binops[i];
+		}
+	}
+	
+	return NULL;
+}
+
+
+// Precedence climbing: parse operators that bind at least as tightly as min_prec
+static void ExprParser_parseBinary(ExprParser* ps, unsigned min_prec) {
+	ExprParser_parseUnary(ps);
+	
+	while(!ps->failed) {
+		const ExprBinaryOp* binop = ExprParser_peekBinaryOp(ps);
+		if(!binop || binop->prec < min_prec) {
+			break;
+		}
+		ps->p += strlen(binop->token);
+		
+		if(binop->op == EXPR_AND_THEN || binop->op == EXPR_OR_ELSE) {
+			// When the jump isn't taken, the left value is popped
+			ExprParser_emit(ps, binop->op, -1);
+			size_t patch = ps->code.count;
+			ExprParser_emit16(ps, 0);
+			
+			ExprParser_parseBinary(ps, binop->prec + 1);
+			ExprParser_emit(ps, EXPR_BOOL, 0);
+			
+			size_t offset = ps->code.count - (patch + 2);
+			ps->code.elems[patch] = offset & 0xFF;
+			ps->code.elems[patch + 1] = offset >> 8;
+		}
+		else {
+			ExprParser_parseBinary(ps, binop->prec + 1);
+			ExprParser_emit(ps, binop->op, -1);
+		}
+	}
+}
+
+
+/*!
+ * @brief Compile an expression into bytecode. Errors are printed to stderr.
+ * 
+ * @param source Text of the expression
+ * @param peg Pegasus image used to look up symbol names, or NULL
+ * 
+ * @return Compiled expression, or NULL if it couldn't be parsed
+ */
+DebugExpr* DebugExpr_compile(const char* source, Pegasus* peg) {
+	ExprParser ps = {
+		.source = source,
+		.p = source,
+		.peg = peg,
+	};
+	
+	ExprParser_parseBinary(&ps, 1);
+	ExprParser_skipSpaces(&ps);
+	if(*ps.p != '\0') {
+		ExprParser_fail(&ps, "unexpected text");
+	}
+	ExprParser_emit(&ps, EXPR_END, 0);
+	
+	if(ps.failed) {
+		array_clear(&ps.code);
+		return NULL;
+	}
+	
+	DebugExpr* expr = calloc(1, sizeof(*expr));
+	if(!expr) {
+		array_clear(&ps.code);
+		return NULL;
+	}
+	
+	expr->code = ps.code.elems;
+	expr->source = strdup(source);
+	return expr;
+}
+
+
+/*!
+ * @brief Evaluate a compiled expression.
+ * 
+ * @param env Registers, hit count, and memory access function to use
+ * @param out_value Output pointer where the result will be written
+ * @param out_error Output pointer where a description of the problem will be
+ *        written if the expression can't be evaluated
+ * 
+ * @return True if the expression was evaluated successfully
+ */
+bool DebugExpr_eval(
+	const DebugExpr* expr, const DebugExprEnv* env,
+	EAR_UWord* out_value, const char** out_error
+) {
+	// The compiler makes sure that the stack can't overflow
+	EAR_UWord stack[DEBUG_EXPR_MAX_DEPTH];
+	EAR_UWord* sp = stack;
+	const uint8_t* ip = expr->code;
+	EAR_UWord a, b;
+	
+#define POP2() (b = *--sp, a = *--sp)
+	while(true) {
+		switch(*ip++) {
+			case EXPR_END:
+				*out_value = sp[-1];
+				return true;
+			
+			case EXPR_PUSH:
+				*sp++ = ip[0] | ip[1] << 8;
+				ip += 2;
+				break;
+			
+			case EXPR_REG:
+				*sp++ = env->ctx->r[*ip++];
+				break;
+			
+			case EXPR_HITS:
+				*sp++ = (EAR_UWord)MIN(env->hits, (uint64_t)EAR_UWORD_MAX);
+				break;
+			
+			case EXPR_LOAD:
+			case EXPR_LOAD_BYTE:
+				if(!env->read_fn(env->read_cookie, sp[-1], ip[-1] == EXPR_LOAD_BYTE, &sp[-1])) {
+					*out_error = "memory could not be read";
+					return false;
+				}
+				break;
+			
+			case EXPR_NEG: sp[-1] = -sp[-1]; break;
+			case EXPR_INV: sp[-1] = ~sp[-1]; break;
+			case EXPR_NOT: sp[-1] = !sp[-1]; break;
+			case EXPR_BOOL: sp[-1] = !!sp[-1]; break;
+			
+			case EXPR_DIV:
+			case EXPR_MOD:
+				POP2();
+				if(b == 0) {
+					*out_error = "division by zero";
+					return false;
+				}
+				*sp++ = ip[-1] == EXPR_DIV ? a / b : a % b;
+				break;
+			
+			case EXPR_MUL: POP2(); *sp++ = a * b; break;
+			case EXPR_ADD: POP2(); *sp++ = a + b; break;
+			case EXPR_SUB: POP2(); *sp++ = a - b; break;
+			case EXPR_SHL: POP2(); *sp++ = b < EAR_REGISTER_BITS ? a << b : 0; break;
+			case EXPR_SHR: POP2(); *sp++ = b < EAR_REGISTER_BITS ? a >> b : 0; break;
+			case EXPR_LT: POP2(); *sp++ = a < b; break;
+			case EXPR_LE: POP2(); *sp++ = a <= b; break;
+			case EXPR_GT: POP2(); *sp++ = a > b; break;
+			case EXPR_GE: POP2(); *sp++ = a >= b; break;
+			case EXPR_EQ: POP2(); *sp++ = a == b; break;
+			case EXPR_NE: POP2(); *sp++ = a != b; break;
+			case EXPR_AND: POP2(); *sp++ = a & b; break;
+			case EXPR_XOR: POP2(); *sp++ = a ^ b; break;
+			case EXPR_OR: POP2(); *sp++ = a | b; break;
+			
+			case EXPR_AND_THEN:
+			case EXPR_OR_ELSE:
+				// Short circuit when the left side decides the result
+				if(!sp[-1] == (ip[-1] == EXPR_AND_THEN)) {
+					sp[-1] = !!sp[-1];
+					ip += 2 + (ip[0] | ip[1] << 8);
+				}
+				else {
+					--sp;
+					ip += 2;
+				}
+				break;
+			
+			default:
+				ASSERT(false);
+				*out_error = "invalid bytecode";
+				return false;
+		}
+	}
+#undef POP2
+}
+
+
+/*! Destroy an expression that was previously compiled using `DebugExpr_compile`. */
+void DebugExpr_destroy(DebugExpr* expr) {
+	if(!expr) {
+		return;
+	}
+	
+	free(expr->code);
+	free(expr->source);
+	free(expr);
+}
+
+
+// Find the expression written just before the '=' at the end of `text`, as in "A0=%x"
+static char* DebugLogFormat_implicitArg(const dynamic_string* text) {
+	size_t end = string_length(text);
+	if(end == 0 || text->elems[end - 1] != '=') {
+		return NULL;
+	}
+	--end;
+	
+	size_t start = end;
+	while(start > 0 && !isspace(text->elems[start - 1]) && text->elems[start - 1] != ',') {
+		--start;
+	}
+	
+	if(start == end) {
+		return NULL;
+	}
+	
+	return strndup(&text->elems[start], end - start);
+}
+
+
+/*!
+ * @brief Compile a logpoint's format string and arguments. Errors are printed to stderr.
+ * 
+ * The format string supports printf-style `%x`, `%X`, `%u`, `%d`, `%c`, and `%s`
+ * conversions with an optional width and `0` or `-` flag, as well as `%%`. Each
+ * conversion uses the next argument expression. When no arguments are given, each
+ * conversion instead uses the text just before its `=`, so "A0=%x" prints A0.
+ * 
+ * @param format Format string
+ * @param args Argument expressions
+ * @param arg_count Number of argument expressions
+ * @param peg Pegasus image used to look up symbol names, or NULL
+ * 
+ * @return Compiled format, or NULL if it couldn't be parsed
+ */
+DebugLogFormat* DebugLogFormat_compile(
+	const char* format, char* const* args, size_t arg_count, Pegasus* peg
+) {
+	DebugLogFormat* fmt = calloc(1, sizeof(*fmt));
+	if(!fmt) {
+		return NULL;
+	}
+	fmt->source = strdup(format);
+	
+	dynamic_string text = {0};
+	size_t arg_index = 0;
+	const char* p = format;
+	
+	while(true) {
+		if(*p != '%' && *p != '\0') {
+			string_appendChar(&text, *p++);
+			continue;
+		}
+		
+		if(p[0] == '%' && p[1] == '%') {
+			string_appendChar(&text, '%');
+			p += 2;
+			continue;
+		}
+		
+		DebugLogPiece piece = {0};
+		if(*p == '%') {
+			++p;
+			
+			bool left = false;
+			while(*p == '-' || *p == '0') {
+				if(*p == '-') {
+					left = true;
+				}
+				else {
+					piece.zero_pad = true;
+				}
+				++p;
+			}
+			
+			while(isdigit(*p) && piece.width < 100) {
+				piece.width = piece.width * 10 + (*p++ - '0');
+			}
+			if(left) {
+				piece.width = -piece.width;
+				piece.zero_pad = false;
+			}
+			
+			if(*p == '\0' || !strchr("xXudcs", *p)) {
+				fprintf(stderr, "Invalid conversion in format string `%s`\n", format);
+				goto fail;
+			}
+			piece.conv = *p++;
+			
+			if(arg_count != 0) {
+				if(arg_index >= arg_count) {
+					fprintf(stderr, "Not enough arguments for format string `%s`\n", format);
+					goto fail;
+				}
+				piece.arg = DebugExpr_compile(args[arg_index++], peg);
+			}
+			else {
+				char* name = DebugLogFormat_implicitArg(&text);
+				if(!name) {
+					fprintf(
+						stderr, "No argument for a conversion in format string `%s` (write it like \"A0=%%x\" "
+						"or pass the expressions after the format string)\n", format
+					);
+					goto fail;
+				}
+				piece.arg = DebugExpr_compile(name, peg);
+				free(name);
+			}
+			
+			if(!piece.arg) {
+				goto fail;
+			}
+		}
+		
+		piece.text = strdup(string_cstr(&text));
+		string_clear(&text);
+		array_append(&fmt->pieces, piece);
+		
+		if(*p == '\0') {
+			break;
+		}
+	}
+	
+	if(arg_index != arg_count) {
+		fprintf(stderr, "Too many arguments for format string `%s`\n", format);
+		goto fail;
+	}
+	
+	array_clear(&text);
+	return fmt;
+	
+fail:
+	array_clear(&text);
+	DebugLogFormat_destroy(fmt);
+	return NULL;
+}
+
+
+static void DebugLogFormat_printString(
+	const DebugLogPiece* piece, const DebugExprEnv* env, EAR_VirtAddr addr, DebugLogSink* sink
+) { //DebugLogFormat_printString
+	char str[DEBUG_LOG_MAX_STRING + 1];
+	size_t len = 0;
+	
+	while(len < DEBUG_LOG_MAX_STRING) {
+		EAR_UWord c;
+		if(!env->read_fn(env->read_cookie, (EAR_VirtAddr)(addr + len), /*is_byte=*/true, &c)) {
+			break;
+		}
+		
+		if(c == 0) {
+			break;
+		}
+		str[len++] = (char)c;
+	}
+	str[len] = '\0';
+	
+	DebugLogSink_printf(sink, "%*s", piece->width, str);
+}
+
+
+/*!
+ * @brief Format a logpoint message and write it to the sink as one line.
+ * 
+ * @param env Registers, hit count, and memory access function to use
+ * @param sink Buffered output for the message
+ */
+void DebugLogFormat_print(const DebugLogFormat* fmt, const DebugExprEnv* env, DebugLogSink* sink) {
+	foreach(&fmt->pieces, piece) {
+		DebugLogSink_printf(sink, "%s", piece->text);
+		if(!piece->arg) {
+			continue;
+		}
+		
+		EAR_UWord value;
+		const char* error;
+		if(!DebugExpr_eval(piece->arg, env, &value, &error)) {
+			DebugLogSink_printf(sink, "<%s>", error);
+			continue;
+		}
+		
+		switch(piece->conv) {
+			case 'x':
+				if(piece->zero_pad) {
+					DebugLogSink_printf(sink, "%0*x", piece->width, value);
+				}
+				else {
+					DebugLogSink_printf(sink, "%*x", piece->width, value);
+				}
+				break;
+			
+			case 'X':
+				if(piece->zero_pad) {
+					DebugLogSink_printf(sink, "%0*X", piece->width, value);
+				}
+				else {
+					DebugLogSink_printf(sink, "%*X", piece->width, value);
+				}
+				break;
+			
+			case 'u':
+				if(piece->zero_pad) {
+					DebugLogSink_printf(sink, "%0*u", piece->width, value);
+				}
+				else {
+					DebugLogSink_printf(sink, "%*u", piece->width, value);
+				}
+				break;
+			
+			case 'd':
+				if(piece->zero_pad) {
+					DebugLogSink_printf(sink, "%0*d", piece->width, (EAR_SWord)value);
+				}
+				else {
+					DebugLogSink_printf(sink, "%*d", piece->width, (EAR_SWord)value);
+				}
+				break;
+			
+			case 'c':
+				DebugLogSink_printf(sink, "%*c", piece->width, (char)value);
+				break;
+			
+			case 's':
+				DebugLogFormat_printString(piece, env, value, sink);
+				break;
+		}
+	}
+	
+	DebugLogSink_printf(sink, "\n");
+}
+
+
+/*! Destroy a format that was previously compiled using `DebugLogFormat_compile`. */
+void DebugLogFormat_destroy(DebugLogFormat* fmt) {
+	if(!fmt) {
+		return;
+	}
+	
+	foreach(&fmt->pieces, piece) {
+		free(piece->text);
+		DebugExpr_destroy(piece->arg);
+	}
+	array_clear(&fmt->pieces);
+	free(fmt->source);
+	free(fmt);
+}
+
+
+/*! Append formatted text to the sink, writing it out if the buffer fills up. */
+void DebugLogSink_printf(DebugLogSink* sink, const char* format, ...) {
+	va_list ap;
+	
+	va_start(ap, format);
+	int len = vsnprintf(&sink->buf[sink->len], sizeof(sink->buf) - sink->len, format, ap);
+	va_end(ap);
+	if(len < 0) {
+		return;
+	}
+	
+	// Didn't fit, so make room and try again
+	if((size_t)len >= sizeof(sink->buf) - sink->len) {
+		DebugLogSink_flush(sink);
+		
+		va_start(ap, format);
+		if((size_t)len < sizeof(sink->buf)) {
+			vsnprintf(sink->buf, sizeof(sink->buf), format, ap);
+		}
+		else {
+			// Too big to ever be buffered
+			vfprintf(sink->fp, format, ap);
+			len = 0;
+		}
+		va_end(ap);
+	}
+	
+	sink->len += len;
+}
+
+
+/*! Write out everything that is buffered in the sink. */
+void DebugLogSink_flush(DebugLogSink* sink) {
+	if(sink->len == 0) {
+		return;
+	}
+	
+	fwrite(sink->buf, 1, sink->len, sink->fp);
+	fflush(sink->fp);
+	sink->len = 0;
+}
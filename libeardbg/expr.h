@@ -0,0 +1,156 @@
+//
+//  expr.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_EXPR_H
+#define EARDBG_EXPR_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/dynamic_array.h"
+#include "libear/ear.h"
+#include "pegasus.h"
+
+
+/*
+ * Breakpoint conditions and logpoint arguments are compiled once into a small
+ * stack bytecode, which is evaluated each time the breakpoint is reached.
+ * 
+ * Operands are register names (A0, SP, R7, ...), `hits` (the number of times
+ * the breakpoint has been reached, up to FFFF), symbol names, and hex numbers
+ * (with or without a "0x" prefix, like addresses elsewhere in the debugger).
+ * `[expr]` reads a word of virtual memory and `byte[expr]` reads a byte.
+ * 
+ * Operators, from lowest to highest precedence:
+ * 
+ *   ||   &&   |   ^   &   == !=   < <= > >=   << >>   + -   * / %   unary - ~ !
+ * 
+ * All values are 16-bit and unsigned, and `&&` and `||` short-circuit.
+ */
+
+//! Largest number of values an expression may need on its stack at once
+#define DEBUG_EXPR_MAX_DEPTH 16
+
+//! Longest string printed by a `%s` conversion in a logpoint
+#define DEBUG_LOG_MAX_STRING 64
+
+//! Logpoint output is buffered until this much is waiting or the debugger stops
+#define DEBUG_LOG_SINK_SIZE 0x1000
+
+typedef struct DebugExpr {
+	uint8_t* code;
+	char* source;
+} DebugExpr;
+
+/*!
+ * @brief Reads virtual memory while evaluating an expression.
+ * 
+ * @param cookie Opaque value from the DebugExprEnv
+ * @param addr Virtual address to read
+ * @param is_byte True to read a byte, false to read a word
+ * @param out_value Output pointer where the value read will be written
+ * 
+ * @return True if the memory could be read
+ */
+typedef bool DebugExpr_ReadFunc(void* cookie, EAR_VirtAddr addr, bool is_byte, EAR_UWord* out_value);
+
+//! Everything an expression can refer to when it's evaluated
+typedef struct DebugExprEnv {
+	const EAR_ThreadState* ctx;
+	uint64_t hits;
+	DebugExpr_ReadFunc* read_fn;
+	void* read_cookie;
+} DebugExprEnv;
+
+//! Buffered output for logpoints
+typedef struct DebugLogSink {
+	FILE* fp;
+	size_t len;
+	char buf[DEBUG_LOG_SINK_SIZE];
+} DebugLogSink;
+
+//! One conversion of a logpoint format string, along with the literal text before it
+typedef struct DebugLogPiece {
+	char* text;
+	char conv;       //!< One of "xXudcs", or '\0' for the text at the end
+	int width;       //!< Negative to left-justify
+	bool zero_pad;
+	DebugExpr* arg;
+} DebugLogPiece;
+
+typedef struct DebugLogFormat {
+	dynamic_array(DebugLogPiece) pieces;
+	char* source;
+} DebugLogFormat;
+
+
+/*!
+ * @brief Compile an expression into bytecode. Errors are printed to stderr.
+ * 
+ * @param source Text of the expression
+ * @param peg Pegasus image used to look up symbol names, or NULL
+ * 
+ * @return Compiled expression, or NULL if it couldn't be parsed
+ */
+DebugExpr* DebugExpr_compile(const char* source, Pegasus* peg);
+
+/*!
+ * @brief Evaluate a compiled expression.
+ * 
+ * @param env Registers, hit count, and memory access function to use
+ * @param out_value Output pointer where the result will be written
+ * @param out_error Output pointer where a description of the problem will be
+ *        written if the expression can't be evaluated
+ * 
+ * @return True if the expression was evaluated successfully
+ */
+bool DebugExpr_eval(
+	const DebugExpr* expr, const DebugExprEnv* env,
+	EAR_UWord* out_value, const char** out_error
+);
+
+/*! Destroy an expression that was previously compiled using `DebugExpr_compile`. */
+void DebugExpr_destroy(DebugExpr* expr);
+
+/*!
+ * @brief Compile a logpoint's format string and arguments. Errors are printed to stderr.
+ * 
+ * The format string supports printf-style `%x`, `%X`, `%u`, `%d`, `%c`, and `%s`
+ * conversions with an optional width and `0` or `-` flag, as well as `%%`. Each
+ * conversion uses the next argument expression. When no arguments are given, each
+ * conversion instead uses the text just before its `=`, so "A0=%x" prints A0.
+ * 
+ * @param format Format string
+ * @param args Argument expressions
+ * @param arg_count Number of argument expressions
+ * @param peg Pegasus image used to look up symbol names, or NULL
+ * 
+ * @return Compiled format, or NULL if it couldn't be parsed
+ */
+DebugLogFormat* DebugLogFormat_compile(
+	const char* format, char* const* args, size_t arg_count, Pegasus* peg
+);
+
+/*!
+ * @brief Format a logpoint message and write it to the sink as one line.
+ * 
+ * @param env Registers, hit count, and memory access function to use
+ * @param sink Buffered output for the message
+ */
+void DebugLogFormat_print(const DebugLogFormat* fmt, const DebugExprEnv* env, DebugLogSink* sink);
+
+/*! Destroy a format that was previously compiled using `DebugLogFormat_compile`. */
+void DebugLogFormat_destroy(DebugLogFormat* fmt);
+
+/*! Append formatted text to the sink, writing it out if the buffer fills up. */
+void DebugLogSink_printf(DebugLogSink* sink, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+/*! Write out everything that is buffered in the sink. */
+void DebugLogSink_flush(DebugLogSink* sink);
+
+#endif /* EARDBG_EXPR_H */
@@ -0,0 +1,1040 @@
+//
+//  gdbstub.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "gdbstub.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <ctype.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "common/macros.h"
+
+
+// Signal numbers used in stop replies, as GDB numbers them
+#define GDB_SIGINT  2
+#define GDB_SIGILL  4
+#define GDB_SIGTRAP 5
+#define GDB_SIGABRT 6
+#define GDB_SIGBUS  10
+#define GDB_SIGSEGV 11
+#define GDB_SIGXCPU 24
+
+
+static bool GdbStub_fill(GdbStub* stub) {
+	ssize_t n;
+	do {
+		n = read(stub->fd, stub->in_buf, sizeof(stub->in_buf));
+	} while(n < 0 && errno == EINTR);
+	
+	if(n <= 0) {
+		return false;
+	}
+	
+	stub->in_pos = 0;
+	stub->in_len = n;
+	return true;
+}
+
+
+// Returns the next byte from the connection, or -1 once it's closed
+static int GdbStub_getc(GdbStub* stub) {
+	if(stub->in_pos == stub->in_len && !GdbStub_fill(stub)) {
+		return -1;
+	}
+	return stub->in_buf[stub->in_pos++];
+}
+
+
+static bool GdbStub_write(GdbStub* stub, const void* data, size_t size) {
+	const uint8_t* p = data;
+	while(size > 0) {
+		ssize_t n = send(stub->fd, p, size, MSG_NOSIGNAL);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+
+static int hexval(int c) {
+	if(c >= '0' && c <= '9') {
+		return c - '0';
+	}
+	c = tolower(c);
+	if(c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+
+// Parses at least one hex digit, advancing the pointer past them
+static bool parseHex(const char** pp, uint32_t* out_value) {
+	const char* p = *pp;
+	uint32_t value = 0;
+	int digit;
+	
+	if(hexval(*p) < 0) {
+		return false;
+	}
+	while((digit = hexval(*p)) >= 0) {
+		value = (value << 4) | digit;
+		++p;
+	}
+	
+	*pp = p;
+	*out_value = value;
+	return true;
+}
+
+
+// Parses two hex digits as a byte
+static bool parseHexByte(const char** pp, uint8_t* out_byte) {
+	int hi = hexval((*pp)[0]);
+	int lo = hi < 0 ? -1 : hexval((*pp)[1]);
+	if(lo < 0) {
+		return false;
+	}
+	
+	*out_byte = (uint8_t)(hi << 4 | lo);
+	*pp += 2;
+	return true;
+}
+
+
+/*!
+ * @brief Wait for the next packet from the client and acknowledge it.
+ * 
+ * @return False once the connection is closed
+ */
+static bool GdbStub_readPacket(GdbStub* stub) {
+	while(true) {
+		// Skip acknowledgements and interrupts that arrive while already stopped
+		int c;
+		do {
+			c = GdbStub_getc(stub);
+			if(c < 0) {
+				return false;
+			}
+		} while(c != '$');
+		
+		string_clear(&stub->packet);
+		uint8_t sum = 0;
+		while((c = GdbStub_getc(stub)) != '#') {
+			if(c < 0) {
+				return false;
+			}
+			sum += (uint8_t)c;
+			
+			// Binary data escapes '#', '$', '}', and '*' as '}' followed by the byte XOR 0x20
+			if(c == '}') {
+				c = GdbStub_getc(stub);
+				if(c < 0) {
+					return false;
+				}
+				sum += (uint8_t)c;
+				c ^= 0x20;
+			}
+			string_appendChar(&stub->packet, (char)c);
+		}
+		
+		int hi = GdbStub_getc(stub);
+		int lo = GdbStub_getc(stub);
+		if(hi < 0 || lo < 0) {
+			return false;
+		}
+		string_cstr(&stub->packet);
+		
+		if(stub->no_ack) {
+			return true;
+		}
+		
+		if(hexval(hi) >= 0 && hexval(lo) >= 0 && (hexval(hi) << 4 | hexval(lo)) == sum) {
+			return GdbStub_write(stub, "+", 1);
+		}
+		
+		// Ask for the corrupted packet to be sent again
+		if(!GdbStub_write(stub, "-", 1)) {
+			return false;
+		}
+	}
+}
+
+
+/*!
+ * @brief Send the reply that has been built up, waiting for it to be acknowledged.
+ * 
+ * @return False once the connection is closed
+ */
+static bool GdbStub_sendReply(GdbStub* stub) {
+	dynamic_string framed = {0};
+	uint8_t sum = 0;
+	
+	string_appendChar(&framed, '$');
+	for(size_t i = 0; i < string_length(&stub->reply); i++) {
+		char c = stub->reply.elems[i];
+		if(c == '#' || c == '$' || c == '}' || c == '*') {
+			string_appendChar(&framed, '}');
+			sum += '}';
+			c ^= 0x20;
+		}
+		string_appendChar(&framed, c);
+		sum += (uint8_t)c;
+	}
+	
+	char trailer[4];
+	snprintf(trailer, sizeof(trailer), "#%02x", sum);
+	string_append(&framed, trailer);
+	
+	bool ok;
+	while(true) {
+		ok = GdbStub_write(stub, framed.elems, string_length(&framed));
+		if(!ok || stub->no_ack) {
+			break;
+		}
+		
+		int c;
+		do {
+			c = GdbStub_getc(stub);
+		} while(c >= 0 && c != '+' && c != '-');
+		
+		if(c != '-') {
+			ok = c == '+';
+			break;
+		}
+	}
+	
+	array_clear(&framed);
+	string_clear(&stub->reply);
+	return ok;
+}
+
+
+static void GdbStub_replyf(GdbStub* stub, const char* format, ...) __attribute__((format(printf, 2, 3)));
+static void GdbStub_replyf(GdbStub* stub, const char* format, ...) {
+	char buf[64];
+	va_list ap;
+	va_start(ap, format);
+	vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+	string_append(&stub->reply, buf);
+}
+
+
+static void GdbStub_replyHex(GdbStub* stub, const uint8_t* data, size_t size) {
+	for(size_t i = 0; i < size; i++) {
+		GdbStub_replyf(stub, "%02x", data[i]);
+	}
+}
+
+
+// Returns true when the client has sent an interrupt (or hung up) while running
+static bool GdbStub_pollInterrupt(GdbStub* stub) {
+	while(true) {
+		if(stub->in_pos == stub->in_len) {
+			struct pollfd pfd = {.fd = stub->fd, .events = POLLIN};
+			if(poll(&pfd, 1, 0) <= 0) {
+				return false;
+			}
+			if(!GdbStub_fill(stub)) {
+				return true;
+			}
+		}
+		
+		uint8_t c = stub->in_buf[stub->in_pos];
+		if(c == 0x03) {
+			++stub->in_pos;
+			return true;
+		}
+		
+		// Leave anything else for GdbStub_readPacket once stopped
+		if(c == '$') {
+			return false;
+		}
+		++stub->in_pos;
+	}
+}
+
+
+/*!
+ * @brief Find the register with the given GDB register number.
+ * 
+ * @param out_reg Output pointer where a pointer to the register will be written, or
+ *        NULL if the register isn't available
+ * 
+ * @return False if there is no such register
+ */
+static bool GdbStub_getRegister(GdbStub* stub, uint32_t regnum, EAR_UWord** out_reg) {
+	Debugger* dbg = stub->dbg;
+	if(regnum >= GDB_REG_COUNT) {
+		return false;
+	}
+	
+	if(regnum >= 16 && !(dbg->debug_flags & DEBUG_KERNEL)) {
+		*out_reg = NULL;
+		return true;
+	}
+	
+	EAR_ThreadState* ctx = CTX_X(*dbg->cpu, regnum >= 32);
+	regnum %= 32;
+	*out_reg = regnum < 16 ? &ctx->r[regnum] : &ctx->cr[regnum - 16];
+	return true;
+}
+
+
+static void GdbStub_replyRegister(GdbStub* stub, const EAR_UWord* reg) {
+	if(reg) {
+		GdbStub_replyf(stub, "%02x%02x", *reg & 0xFF, *reg >> 8);
+	}
+	else {
+		GdbStub_replyf(stub, "xxxx");
+	}
+}
+
+
+// Parses a little-endian register value, returning false if it's malformed
+static bool GdbStub_parseRegister(const char** pp, EAR_UWord* out_value, bool* out_unavailable) {
+	if(strncmp(*pp, "xxxx", 4) == 0) {
+		*pp += 4;
+		*out_unavailable = true;
+		return true;
+	}
+	
+	uint8_t lo, hi;
+	if(!parseHexByte(pp, &lo) || !parseHexByte(pp, &hi)) {
+		return false;
+	}
+	
+	*out_value = lo | (hi << 8);
+	*out_unavailable = false;
+	return true;
+}
+
+
+static bool GdbStub_setRegister(GdbStub* stub, EAR_UWord* reg, EAR_UWord value) {
+	// The ZERO register always reads as zero
+	if(reg == &CTX(*stub->dbg->cpu)->r[ZERO] || reg == &CTX_X(*stub->dbg->cpu, 1)->r[ZERO]) {
+		return value == 0;
+	}
+	
+	*reg = value;
+	return true;
+}
+
+
+/*!
+ * @brief Read or write memory one byte at a time, like the CPU would but without
+ * triggering breakpoints.
+ * 
+ * @param addr Virtual address, or GDB_PHYS_BASE plus a physical address
+ * @param buf Data buffer to read into or write from
+ * @param size Number of bytes to access
+ * @param write True to write memory, false to read it
+ * 
+ * @return Number of bytes accessed before the first failure
+ */
+static size_t GdbStub_accessMemory(
+	GdbStub* stub, uint32_t addr, uint8_t* buf, size_t size, bool write
+) { //GdbStub_accessMemory
+	Debugger* dbg = stub->dbg;
+	Bus_AccessMode mode = write ? BUS_MODE_WRITE : BUS_MODE_READ;
+	
+	size_t i;
+	for(i = 0; i < size; i++) {
+		uint32_t cur = addr + i;
+		bool ok;
+		
+		if(cur >= GDB_PHYS_BASE) {
+			cur -= GDB_PHYS_BASE;
+			if(cur >= EAR_PHYSICAL_ADDRESS_SPACE_SIZE || !dbg->bus_fn) {
+				break;
+			}
+			ok = dbg->bus_fn(dbg->bus_cookie, mode, cur, true, &buf[i], NULL);
+		}
+		else {
+			if(cur >= EAR_VIRTUAL_ADDRESS_SPACE_SIZE) {
+				break;
+			}
+			ok = dbg->mem_fn(
+				dbg->mem_cookie, write ? EAR_PROT_WRITE : EAR_PROT_READ,
+				mode, cur, true, &buf[i], NULL
+			);
+		}
+		
+		if(!ok) {
+			break;
+		}
+	}
+	
+	return i;
+}
+
+
+static void GdbStub_buildTargetXML(GdbStub* stub) {
+	dynamic_string* xml = &stub->target_xml;
+	
+	string_append(xml,
+		"<?xml version=\"1.0\"?>\n"
+		"<!DOCTYPE target SYSTEM \"gdb-target.dtd\">\n"
+		"<target version=\"1.0\">\n"
+		"<feature name=\"org.pegasus.ear.core\">\n"
+	);
+	
+	char line[128];
+	for(uint32_t regnum = 0; regnum < GDB_REG_COUNT; regnum++) {
+		bool alt = regnum >= 32;
+		uint32_t idx = regnum % 32;
+		const char* name = idx < 16 ? EAR_getRegisterName(idx) : EAR_getControlRegisterName(idx - 16);
+		const char* type = "uint16";
+		if(idx == PC) {
+			type = "code_ptr";
+		}
+		else if(idx == SP || idx == FP) {
+			type = "data_ptr";
+		}
+		
+		char lower[32];
+		size_t i;
+		for(i = 0; name[i] != '\0' && i < sizeof(lower) - 1; i++) {
+			lower[i] = tolower((unsigned char)name[i]);
+		}
+		lower[i] = '\0';
+		
+		snprintf(
+			line, sizeof(line), "<reg name=\"%s%s\" bitsize=\"16\" type=\"%s\" regnum=\"%u\"/>\n",
+			alt ? "alt_" : "", lower, type, regnum
+		);
+		string_append(xml, line);
+	}
+	
+	string_append(xml, "</feature>\n</target>\n");
+}
+
+
+static void GdbStub_replyStop(GdbStub* stub) {
+	Debugger* dbg = stub->dbg;
+	int sig;
+	
+	switch(dbg->r) {
+		case HALT_RETURN:
+		case HALT_COMPLETE:
+			stub->exited = true;
+			GdbStub_replyf(stub, "W00");
+			return;
+		
+		case HALT_DEBUGGER:
+			sig = GDB_SIGINT;
+			break;
+		
+		case HALT_UNALIGNED:
+		case HALT_BUS_FAULT:
+		case HALT_BUS_PROTECTED:
+		case HALT_BUS_ERROR:
+			sig = GDB_SIGBUS;
+			break;
+		
+		case HALT_MMU_FAULT:
+			sig = GDB_SIGSEGV;
+			break;
+		
+		case HALT_DENIED:
+		case HALT_DECODE:
+			sig = GDB_SIGILL;
+			break;
+		
+		case HALT_DOUBLE_FAULT:
+		case HALT_IO_ERROR:
+			sig = GDB_SIGABRT;
+			break;
+		
+		case HALT_INSN_LIMIT:
+			sig = GDB_SIGXCPU;
+			break;
+		
+		default:
+			sig = GDB_SIGTRAP;
+			break;
+	}
+	
+	GdbStub_replyf(stub, "T%02x", sig);
+	
+	// Tell the client which watchpoint was hit and the address that was accessed
+	BreakpointID bpid = dbg->last_hit_bpid;
+	if(dbg->r == HALT_BREAKPOINT && bpid < dbg->breakpoints.count) {
+		Breakpoint* bp = &dbg->breakpoints.elems[bpid];
+		const char* kind = NULL;
+		switch(bp->flags & BP_PROT_MASK) {
+			case BP_WRITE:
+				kind = "watch";
+				break;
+			
+			case BP_READ:
+				kind = "rwatch";
+				break;
+			
+			case BP_READ | BP_WRITE:
+				kind = "awatch";
+				break;
+		}
+		
+		if(kind) {
+			EAR_FullAddr addr = dbg->last_hit_addr;
+			if(bp->flags & BP_PHYSICAL) {
+				addr += GDB_PHYS_BASE;
+			}
+			GdbStub_replyf(stub, "%s:%x;", kind, addr);
+		}
+	}
+	
+	GdbStub_replyf(stub, "thread:1;");
+}
+
+
+static void GdbStub_continue(GdbStub* stub) {
+	Debugger* dbg = stub->dbg;
+	bool enabledInterruptHandler = enable_interrupt_handler();
+	
+	Debugger_updateInterposers(dbg);
+	dbg->last_hit_bpid = BREAKPOINT_NONE;
+	dbg->debug_flags |= DEBUG_RESUMING;
+	dbg->r = HALT_NONE;
+	
+	// Run in slices so that an interrupt from the client can be noticed
+	while(dbg->r == HALT_NONE) {
+		for(uint32_t i = 0; i < GDB_POLL_INTERVAL && dbg->r == HALT_NONE; i++) {
+			dbg->r = EAR_stepInstruction(dbg->cpu);
+			
+			// Allow exceptions to be handled normally
+			if(dbg->r == HALT_EXCEPTION) {
+				dbg->r = HALT_NONE;
+			}
+		}
+		
+		if(dbg->r == HALT_NONE && (g_interrupted || GdbStub_pollInterrupt(stub))) {
+			dbg->r = HALT_DEBUGGER;
+		}
+	}
+	
+	// The client can only see the kernel when kernel debugging
+	if(dbg->r == HALT_DEBUGGER
+		&& !(dbg->debug_flags & DEBUG_KERNEL)
+		&& Debugger_isKernelMode(CTX(*dbg->cpu))
+	) {
+		dbg->debug_flags |= DEBUG_SKIPPING_KERNEL;
+		Debugger_updateInterposers(dbg);
+		
+		EAR_HaltReason r = EAR_continueToUserMode(dbg->cpu);
+		if(r != HALT_NONE && r != HALT_EXCEPTION) {
+			dbg->r = r;
+		}
+		
+		dbg->debug_flags &= ~DEBUG_SKIPPING_KERNEL;
+		Debugger_updateInterposers(dbg);
+	}
+	
+	if(enabledInterruptHandler) {
+		disable_interrupt_handler();
+	}
+	
+	Debugger_flushLog(dbg);
+	GdbStub_replyStop(stub);
+}
+
+
+static void GdbStub_step(GdbStub* stub) {
+	Debugger* dbg = stub->dbg;
+	
+	dbg->last_hit_bpid = BREAKPOINT_NONE;
+	Debugger_stepInstruction(dbg);
+	if(dbg->r == HALT_EXCEPTION) {
+		dbg->r = HALT_NONE;
+	}
+	
+	Debugger_flushLog(dbg);
+	GdbStub_replyStop(stub);
+}
+
+
+static void GdbStub_reverse(GdbStub* stub, bool step) {
+	Debugger* dbg = stub->dbg;
+	
+	dbg->last_hit_bpid = BREAKPOINT_NONE;
+	bool found = step ? Debugger_reverseStep(dbg) : Debugger_reverseContinue(dbg);
+	if(!found && !g_interrupted) {
+		GdbStub_replyf(stub, "T%02xreplaylog:begin;", GDB_SIGTRAP);
+		return;
+	}
+	
+	if(dbg->r == HALT_EXCEPTION) {
+		dbg->r = HALT_NONE;
+	}
+	GdbStub_replyStop(stub);
+}
+
+
+static void GdbStub_readRegisters(GdbStub* stub) {
+	for(uint32_t regnum = 0; regnum < GDB_REG_COUNT; regnum++) {
+		EAR_UWord* reg = NULL;
+		GdbStub_getRegister(stub, regnum, &reg);
+		GdbStub_replyRegister(stub, reg);
+	}
+}
+
+
+static void GdbStub_writeRegisters(GdbStub* stub, const char* p) {
+	for(uint32_t regnum = 0; regnum < GDB_REG_COUNT && *p != '\0'; regnum++) {
+		EAR_UWord value = 0;
+		bool unavailable = false;
+		if(!GdbStub_parseRegister(&p, &value, &unavailable)) {
+			GdbStub_replyf(stub, "E01");
+			return;
+		}
+		
+		EAR_UWord* reg = NULL;
+		GdbStub_getRegister(stub, regnum, &reg);
+		if(reg && !unavailable) {
+			GdbStub_setRegister(stub, reg, value);
+		}
+	}
+	
+	Debugger_startHistory(stub->dbg);
+	GdbStub_replyf(stub, "OK");
+}
+
+
+static void GdbStub_readRegister(GdbStub* stub, const char* p) {
+	uint32_t regnum;
+	EAR_UWord* reg = NULL;
+	if(!parseHex(&p, &regnum) || !GdbStub_getRegister(stub, regnum, &reg)) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	GdbStub_replyRegister(stub, reg);
+}
+
+
+static void GdbStub_writeRegister(GdbStub* stub, const char* p) {
+	uint32_t regnum;
+	EAR_UWord* reg = NULL;
+	EAR_UWord value = 0;
+	bool unavailable = false;
+	if(!parseHex(&p, &regnum) || *p++ != '='
+		|| !GdbStub_parseRegister(&p, &value, &unavailable)
+		|| !GdbStub_getRegister(stub, regnum, &reg)
+		|| !reg || unavailable
+		|| !GdbStub_setRegister(stub, reg, value)
+	) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	Debugger_startHistory(stub->dbg);
+	GdbStub_replyf(stub, "OK");
+}
+
+
+static void GdbStub_readMemory(GdbStub* stub, const char* p) {
+	uint32_t addr, size;
+	if(!parseHex(&p, &addr) || *p++ != ',' || !parseHex(&p, &size)) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	uint8_t buf[GDB_PACKET_SIZE / 2];
+	size = MIN(size, sizeof(buf));
+	size_t done = GdbStub_accessMemory(stub, addr, buf, size, false);
+	if(done == 0 && size != 0) {
+		GdbStub_replyf(stub, "E14");
+		return;
+	}
+	
+	GdbStub_replyHex(stub, buf, done);
+}
+
+
+static void GdbStub_writeMemory(GdbStub* stub, const char* p) {
+	uint32_t addr, size;
+	if(!parseHex(&p, &addr) || *p++ != ',' || !parseHex(&p, &size) || *p++ != ':'
+		|| size > strlen(p) / 2
+	) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	uint8_t buf[GDB_PACKET_SIZE / 2];
+	if(size > sizeof(buf)) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	for(uint32_t i = 0; i < size; i++) {
+		if(!parseHexByte(&p, &buf[i])) {
+			GdbStub_replyf(stub, "E01");
+			return;
+		}
+	}
+	
+	size_t done = GdbStub_accessMemory(stub, addr, buf, size, true);
+	
+	// Writes change what happened in the recorded history
+	if(done != 0) {
+		Debugger_startHistory(stub->dbg);
+	}
+	
+	if(done != size) {
+		GdbStub_replyf(stub, "E14");
+		return;
+	}
+	GdbStub_replyf(stub, "OK");
+}
+
+
+static void GdbStub_breakpoint(GdbStub* stub, const char* p, bool insert) {
+	Debugger* dbg = stub->dbg;
+	uint32_t type, addr, kind;
+	if(!parseHex(&p, &type) || *p++ != ',' || !parseHex(&p, &addr) || *p++ != ','
+		|| !parseHex(&p, &kind)
+	) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	// Software and hardware breakpoints are both HW breakpoints in the debugger
+	BreakpointFlags flags;
+	EAR_FullAddr size = 1;
+	switch(type) {
+		case 0:
+		case 1:
+			flags = BP_EXECUTE;
+			break;
+		
+		case 2:
+			flags = BP_WRITE;
+			break;
+		
+		case 3:
+			flags = BP_READ;
+			break;
+		
+		case 4:
+			flags = BP_READ | BP_WRITE;
+			break;
+		
+		default:
+			// Unsupported breakpoint type
+			return;
+	}
+	if(!(flags & BP_EXECUTE) && kind != 0) {
+		size = kind;
+	}
+	
+	EAR_FullAddr limit = EAR_VIRTUAL_ADDRESS_SPACE_SIZE;
+	if(addr >= GDB_PHYS_BASE) {
+		if(flags & BP_EXECUTE) {
+			GdbStub_replyf(stub, "E01");
+			return;
+		}
+		addr -= GDB_PHYS_BASE;
+		flags |= BP_PHYSICAL;
+		limit = EAR_PHYSICAL_ADDRESS_SPACE_SIZE;
+	}
+	if(addr >= limit || size > limit - addr) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	if(insert) {
+		Debugger_addBreakpointRange(dbg, addr, size, flags);
+		GdbStub_replyf(stub, "OK");
+		return;
+	}
+	
+	enumerate(&dbg->breakpoints, i, bp) {
+		if((bp->flags & BP_IN_USE)
+			&& !(bp->flags & BP_TEMPORARY)
+			&& (bp->flags & (BP_PROT_MASK | BP_PHYSICAL)) == flags
+			&& bp->addr == addr && bp->size == size
+		) {
+			Debugger_removeBreakpoint(dbg, (BreakpointID)i);
+			break;
+		}
+	}
+	GdbStub_replyf(stub, "OK");
+}
+
+
+static void GdbStub_readTargetXML(GdbStub* stub, const char* p) {
+	uint32_t offset, length;
+	if(!parseHex(&p, &offset) || *p++ != ',' || !parseHex(&p, &length)) {
+		GdbStub_replyf(stub, "E01");
+		return;
+	}
+	
+	if(string_empty(&stub->target_xml)) {
+		GdbStub_buildTargetXML(stub);
+	}
+	
+	size_t total = string_length(&stub->target_xml);
+	if(offset >= total) {
+		GdbStub_replyf(stub, "l");
+		return;
+	}
+	
+	size_t count = MIN(length, total - offset);
+	string_appendChar(&stub->reply, offset + count < total ? 'm' : 'l');
+	string_appendLength(&stub->reply, &stub->target_xml.elems[offset], count);
+}
+
+
+// Commands whose names are longer than one character
+static void GdbStub_query(GdbStub* stub, const char* p) {
+	if(strncmp(p, "qSupported", strlen("qSupported")) == 0) {
+		GdbStub_replyf(
+			stub,
+			"PacketSize=%x;QStartNoAckMode+;qXfer:features:read+;ReverseStep+;ReverseContinue+",
+			GDB_PACKET_SIZE
+		);
+	}
+	else if(strncmp(p, "qXfer:features:read:target.xml:", strlen("qXfer:features:read:target.xml:")) == 0) {
+		GdbStub_readTargetXML(stub, p + strlen("qXfer:features:read:target.xml:"));
+	}
+	else if(strcmp(p, "qAttached") == 0) {
+		GdbStub_replyf(stub, "1");
+	}
+	else if(strcmp(p, "qC") == 0) {
+		GdbStub_replyf(stub, "QC1");
+	}
+	else if(strcmp(p, "qfThreadInfo") == 0) {
+		GdbStub_replyf(stub, "m1");
+	}
+	else if(strcmp(p, "qsThreadInfo") == 0) {
+		GdbStub_replyf(stub, "l");
+	}
+	else if(strncmp(p, "qSymbol", strlen("qSymbol")) == 0) {
+		GdbStub_replyf(stub, "OK");
+	}
+	else if(strcmp(p, "vCont?") == 0) {
+		GdbStub_replyf(stub, "vCont;c;C;s;S");
+	}
+	else if(strncmp(p, "vCont;", strlen("vCont;")) == 0) {
+		// There is only one thread, so the first action is the only one that matters
+		switch(p[strlen("vCont;")]) {
+			case 'c':
+			case 'C':
+				GdbStub_continue(stub);
+				break;
+			
+			case 's':
+			case 'S':
+				GdbStub_step(stub);
+				break;
+			
+			default:
+				GdbStub_replyf(stub, "E01");
+				break;
+		}
+	}
+	
+	// Anything else gets the empty reply, meaning it isn't supported
+}
+
+
+/*!
+ * @brief Handle one packet from the client, building the reply to send.
+ * 
+ * @return False when the session is over
+ */
+static bool GdbStub_handlePacket(GdbStub* stub) {
+	Debugger* dbg = stub->dbg;
+	const char* p = stub->packet.elems;
+	bool invasive = !!(dbg->debug_flags & DEBUG_INVASIVE);
+	
+	// The OK is still acknowledged, but nothing after it
+	if(strcmp(p, "QStartNoAckMode") == 0) {
+		GdbStub_replyf(stub, "OK");
+		bool ok = GdbStub_sendReply(stub);
+		stub->no_ack = true;
+		return ok;
+	}
+	
+	switch(*p) {
+		case '?':
+			GdbStub_replyStop(stub);
+			break;
+		
+		case 'g':
+			GdbStub_readRegisters(stub);
+			break;
+		
+		case 'G':
+			if(!invasive) {
+				GdbStub_replyf(stub, "E01");
+				break;
+			}
+			GdbStub_writeRegisters(stub, p + 1);
+			break;
+		
+		case 'p':
+			GdbStub_readRegister(stub, p + 1);
+			break;
+		
+		case 'P':
+			if(!invasive) {
+				GdbStub_replyf(stub, "E01");
+				break;
+			}
+			GdbStub_writeRegister(stub, p + 1);
+			break;
+		
+		case 'm':
+			GdbStub_readMemory(stub, p + 1);
+			break;
+		
+		case 'M':
+			if(!invasive) {
+				GdbStub_replyf(stub, "E01");
+				break;
+			}
+			GdbStub_writeMemory(stub, p + 1);
+			break;
+		
+		case 'c':
+			GdbStub_continue(stub);
+			break;
+		
+		case 's':
+			GdbStub_step(stub);
+			break;
+		
+		case 'b':
+			if(p[1] == 'c' || p[1] == 's') {
+				GdbStub_reverse(stub, p[1] == 's');
+			}
+			break;
+		
+		case 'Z':
+		case 'z':
+			GdbStub_breakpoint(stub, p + 1, *p == 'Z');
+			break;
+		
+		case 'H':
+		case 'T':
+			// There is only one thread, and it's always alive
+			GdbStub_replyf(stub, "OK");
+			break;
+		
+		case 'D':
+			// Let the program run on its own from here
+			Debugger_clearBreakpoints(dbg);
+			dbg->debug_flags |= DEBUG_DETACHED;
+			GdbStub_replyf(stub, "OK");
+			GdbStub_sendReply(stub);
+			return false;
+		
+		case 'k':
+			// No reply is expected
+			dbg->r = HALT_DEBUGGER;
+			return false;
+		
+		case 'q':
+		case 'Q':
+		case 'v':
+			GdbStub_query(stub, p);
+			break;
+	}
+	
+	return GdbStub_sendReply(stub);
+}
+
+
+/*!
+ * @brief Let a GDB client control execution over a connected socket until it
+ * disconnects, kills the program, or the program exits.
+ * 
+ * @param fd Connected socket to the GDB client
+ * 
+ * @return Halt reason that ended the session
+ */
+EAR_HaltReason Debugger_serveGdb(Debugger* dbg, int fd) {
+	GdbStub stub = {0};
+	stub.dbg = dbg;
+	stub.fd = fd;
+	
+	// Every packet is a round trip, so don't let small writes be delayed
+	int one = 1;
+	(void)setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	
+	// Record history from here on so that execution can be reversed
+	Debugger_startHistory(dbg);
+	
+	// When not kernel debugging, skip to the first instruction in user mode
+	if(!(dbg->debug_flags & DEBUG_KERNEL)) {
+		Debugger_stepInstruction(dbg);
+		if(dbg->r == HALT_EXCEPTION) {
+			dbg->r = HALT_NONE;
+		}
+	}
+	
+	dbg->gdb = &stub;
+	
+	bool connected = true;
+	while(!stub.exited && (connected = GdbStub_readPacket(&stub))) {
+		if(!GdbStub_handlePacket(&stub)) {
+			break;
+		}
+	}
+	
+	// When the client goes away without detaching, stop the program
+	if(!connected) {
+		dbg->r = HALT_DEBUGGER;
+	}
+	
+	dbg->gdb = NULL;
+	
+	// After detaching, run the rest of the program without the debugger
+	if(dbg->debug_flags & DEBUG_DETACHED) {
+		Debugger_updateInterposers(dbg);
+		dbg->r = EAR_continue(dbg->cpu);
+	}
+	
+	Debugger_flushLog(dbg);
+	array_clear(&stub.packet);
+	array_clear(&stub.reply);
+	array_clear(&stub.target_xml);
+	return dbg->r;
+}
+
+
+/*!
+ * @brief Tell the GDB client that the program is exiting.
+ * 
+ * @param status Exit status of the program
+ */
+void GdbStub_notifyExit(GdbStub* stub, int status) {
+	if(stub->exited) {
+		return;
+	}
+	
+	// The client is waiting for a stop reply to its continue or step
+	string_clear(&stub->reply);
+	GdbStub_replyf(stub, "W%02x", status & 0xFF);
+	GdbStub_sendReply(stub);
+	stub->exited = true;
+}
@@ -0,0 +1,76 @@
+//
+//  gdbstub.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_GDBSTUB_H
+#define EARDBG_GDBSTUB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/dynamic_string.h"
+#include "debugger.h"
+
+
+/*
+ * GDB remote serial protocol stub, so that GDB (or anything else that speaks the
+ * protocol) can control the debugger over a socket.
+ * 
+ * Registers are numbered with the active bank's 16 registers first, followed by its
+ * 16 control registers, and then the same again for the inactive bank. Only the
+ * active bank's registers are available unless kernel debugging.
+ * 
+ * Addresses below GDB_PHYS_BASE are virtual. Physical address `paddr` is accessed
+ * as `GDB_PHYS_BASE + paddr`.
+ */
+
+//! Number of registers in the 'g' packet
+#define GDB_REG_COUNT 64
+
+//! Physical memory is accessed at this offset
+#define GDB_PHYS_BASE 0x1000000
+
+//! Largest packet GDB is told it may send
+#define GDB_PACKET_SIZE 0x4000
+
+//! While running, the connection is checked for an interrupt this many instructions apart
+#define GDB_POLL_INTERVAL 0x4000
+
+struct GdbStub {
+	Debugger* dbg;
+	int fd;
+	bool no_ack;
+	bool exited;
+	
+	// Bytes received but not yet consumed
+	uint8_t in_buf[GDB_PACKET_SIZE];
+	size_t in_pos;
+	size_t in_len;
+	
+	dynamic_string packet;
+	dynamic_string reply;
+	dynamic_string target_xml;
+};
+
+
+/*!
+ * @brief Let a GDB client control execution over a connected socket until it
+ * disconnects, kills the program, or the program exits.
+ * 
+ * @param fd Connected socket to the GDB client
+ * 
+ * @return Halt reason that ended the session
+ */
+EAR_HaltReason Debugger_serveGdb(Debugger* dbg, int fd);
+
+/*!
+ * @brief Tell the GDB client that the program is exiting.
+ * 
+ * @param status Exit status of the program
+ */
+void GdbStub_notifyExit(GdbStub* stub, int status);
+
+#endif /* EARDBG_GDBSTUB_H */
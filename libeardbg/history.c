@@ -0,0 +1,529 @@
+//
+//  history.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "debugger.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "libear/mmu.h"
+
+
+// Position in the history of the current instruction boundary
+static inline uint64_t Debugger_historyPos(Debugger* dbg) {
+	return dbg->cpu->ins_count + dbg->cpu->exc_count;
+}
+
+
+// Find the recorded result of a port access that is being replayed, or NULL if it happens for the first time
+static DebugPortEvent* Debugger_findPortEvent(
+	Debugger* dbg, bool is_read, uint8_t port, EAR_HaltReason* out_r
+) { //Debugger_findPortEvent
+	DebugHistory* h = &dbg->history;
+	uint64_t pos = Debugger_historyPos(dbg);
+	
+	if(array_empty(&h->port_events) || pos > h->port_events.elems[h->port_events.count - 1].pos) {
+		return NULL;
+	}
+	
+	// Binary search for the access made by this instruction
+	size_t lo = 0, hi = h->port_events.count;
+	while(lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if(h->port_events.elems[mid].pos < pos) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	
+	DebugPortEvent* event = &h->port_events.elems[lo];
+	if(event->pos != pos || event->is_read != is_read || event->port_number != port) {
+		fprintf(
+			stderr, "Replay diverged at instruction %" PRIu64 ": unexpected %s port %u\n",
+			dbg->cpu->ins_count, is_read ? "read from" : "write to", port
+		);
+		*out_r = HALT_BUS_ERROR;
+		return NULL;
+	}
+	
+	*out_r = event->r;
+	return event;
+}
+
+
+static void Debugger_addPortEvent(
+	Debugger* dbg, bool is_read, uint8_t port, EAR_Byte byte, EAR_HaltReason r
+) { //Debugger_addPortEvent
+	// Accesses that were interrupted will be performed again later
+	if(!dbg->history.enabled || r == HALT_DEBUGGER) {
+		return;
+	}
+	
+	DebugPortEvent event = {
+		.pos = Debugger_historyPos(dbg),
+		.r = r,
+		.port_number = port,
+		.is_read = is_read,
+		.byte = byte,
+	};
+	array_append(&dbg->history.port_events, event);
+}
+
+
+/*!
+ * @brief Set this function as the CPU's port read handler so that the values read can
+ * be replayed later.
+ * 
+ * @param cookie Opaque value passed to the callback (the debugger)
+ * @param port Port number being read
+ * @param out_byte Output pointer where the byte that was read will be written
+ * 
+ * @return Halt reason from the real port read function or the history
+ */
+EAR_HaltReason Debugger_portRead(void* cookie, uint8_t port, EAR_Byte* out_byte) {
+	Debugger* dbg = cookie;
+	EAR_HaltReason r = HALT_NONE;
+	
+	DebugPortEvent* event = Debugger_findPortEvent(dbg, /*is_read=*/true, port, &r);
+	if(event) {
+		*out_byte = event->byte;
+		return r;
+	}
+	else if(r != HALT_NONE) {
+		return r;
+	}
+	
+	EAR_Byte byte = 0;
+	r = dbg->port_read_fn(dbg->port_cookie, port, &byte);
+	Debugger_addPortEvent(dbg, /*is_read=*/true, port, byte, r);
+	*out_byte = byte;
+	return r;
+}
+
+
+/*!
+ * @brief Set this function as the CPU's port write handler so that writes aren't
+ * performed a second time when replaying.
+ * 
+ * @param cookie Opaque value passed to the callback (the debugger)
+ * @param port Port number being written
+ * @param byte Byte being written
+ * 
+ * @return Halt reason from the real port write function or the history
+ */
+EAR_HaltReason Debugger_portWrite(void* cookie, uint8_t port, EAR_Byte byte) {
+	Debugger* dbg = cookie;
+	EAR_HaltReason r = HALT_NONE;
+	
+	if(Debugger_findPortEvent(dbg, /*is_read=*/false, port, &r) || r != HALT_NONE) {
+		return r;
+	}
+	
+	r = dbg->port_write_fn(dbg->port_cookie, port, byte);
+	Debugger_addPortEvent(dbg, /*is_read=*/false, port, byte, r);
+	return r;
+}
+
+
+/*!
+ * @brief Register writable memory that should be saved in each snapshot. All writable
+ * memory must be registered for reverse execution to be possible.
+ * 
+ * @param data Pointer to the memory
+ * @param size Size of the memory in bytes
+ */
+void Debugger_addHistoryMemory(Debugger* dbg, void* data, size_t size) {
+	DebugMemory mem = {
+		.data = data,
+		.size = size,
+	};
+	array_append(&dbg->history.memory, mem);
+	dbg->history.memory_size += size;
+}
+
+
+static void Debugger_saveSnapshot(Debugger* dbg, DebugSnapshot* snap) {
+	DebugHistory* h = &dbg->history;
+	
+	snap->pos = Debugger_historyPos(dbg);
+	snap->ins_count = dbg->cpu->ins_count;
+	snap->exc_count = dbg->cpu->exc_count;
+	snap->ctx = dbg->cpu->ctx;
+	snap->mem = malloc(h->memory_size);
+	if(!snap->mem) {
+		abort();
+	}
+	
+	uint8_t* p = snap->mem;
+	foreach(&h->memory, mem) {
+		memcpy(p, mem->data, mem->size);
+		p += mem->size;
+	}
+}
+
+
+static void Debugger_restoreSnapshot(Debugger* dbg, const DebugSnapshot* snap) {
+	DebugHistory* h = &dbg->history;
+	
+	dbg->cpu->ins_count = snap->ins_count;
+	dbg->cpu->exc_count = snap->exc_count;
+	dbg->cpu->ctx = snap->ctx;
+	
+	const uint8_t* p = snap->mem;
+	foreach(&h->memory, mem) {
+		memcpy(mem->data, p, mem->size);
+		p += mem->size;
+	}
+	
+	dbg->debug_flags &= ~DEBUG_RESUMING;
+}
+
+
+/*!
+ * @brief Called before each instruction executes to periodically take snapshots.
+ * 
+ * @note As more snapshots are taken, the spacing between them doubles to keep the
+ *       total number of snapshots below DEBUG_HISTORY_MAX_SNAPSHOTS.
+ */
+void Debugger_recordHistory(Debugger* dbg) {
+	DebugHistory* h = &dbg->history;
+	if(Debugger_historyPos(dbg) < h->next_snapshot) {
+		return;
+	}
+	
+	// The exec hook runs after the instruction has been fetched, so rewind PC to make
+	// the snapshot look like it was taken just before this instruction
+	DebugSnapshot snap;
+	Debugger_saveSnapshot(dbg, &snap);
+	EAR_ThreadState* ctx = &snap.ctx.banks[snap.ctx.active];
+	ctx->r[PC] = ctx->cr[CR_INSN_ADDR];
+	array_append(&h->snapshots, snap);
+	
+	// Thin out the snapshots to keep memory usage bounded, always keeping the first one
+	if(h->snapshots.count >= DEBUG_HISTORY_MAX_SNAPSHOTS) {
+		size_t i, kept = 0;
+		for(i = 0; i < h->snapshots.count; i++) {
+			if(i % 2 == 0) {
+				h->snapshots.elems[kept++] = h->snapshots.elems[i];
+			}
+			else {
+				free(h->snapshots.elems[i].mem);
+			}
+		}
+		h->snapshots.count = kept;
+		h->interval *= 2;
+	}
+	
+	h->next_snapshot = h->snapshots.elems[h->snapshots.count - 1].pos + h->interval;
+}
+
+
+/*!
+ * @brief Start recording history from the current state, discarding anything that
+ * was recorded before.
+ */
+void Debugger_startHistory(Debugger* dbg) {
+	DebugHistory* h = &dbg->history;
+	
+	Debugger_clearHistory(dbg);
+	h->enabled = !array_empty(&h->memory);
+	h->interval = DEBUG_HISTORY_INITIAL_INTERVAL;
+	h->next_snapshot = Debugger_historyPos(dbg);
+}
+
+
+/*! Discard all recorded snapshots and port accesses and stop recording history. */
+void Debugger_clearHistory(Debugger* dbg) {
+	DebugHistory* h = &dbg->history;
+	
+	foreach(&h->snapshots, snap) {
+		free(snap->mem);
+	}
+	array_clear(&h->snapshots);
+	array_clear(&h->port_events);
+	h->enabled = false;
+}
+
+
+// Value of scan_last_stop before replaying reaches an instruction where stepping would stop
+#define SCAN_NO_STOP UINT64_MAX
+
+
+// True if stepping would stop at the current instruction boundary
+static bool Debugger_canStop(Debugger* dbg) {
+	return (dbg->debug_flags & DEBUG_KERNEL) || !Debugger_isKernelMode(CTX(*dbg->cpu));
+}
+
+
+/*!
+ * @brief Called while replaying when something that is being searched for happens.
+ */
+void Debugger_noteScanHit(Debugger* dbg) {
+	DebugHistory* h = &dbg->history;
+	h->scan_found = true;
+	
+	// When the kernel writes to memory on behalf of user code, stop at the instruction
+	// that entered the kernel instead. That may be SCAN_NO_STOP if it was before this
+	// part of the history.
+	h->scan_pos = Debugger_canStop(dbg) ? Debugger_historyPos(dbg) : h->scan_last_stop;
+}
+
+
+// Replay from the current state until the position reaches `end`. Breakpoints are ignored.
+static EAR_HaltReason Debugger_replayUntil(Debugger* dbg, uint64_t end, DebugScanKind scan) {
+	DebugHistory* h = &dbg->history;
+	EAR_HaltReason r = HALT_NONE;
+	
+	h->scan = scan;
+	dbg->debug_flags |= DEBUG_REPLAYING;
+	Debugger_updateInterposers(dbg);
+	
+	h->scan_last_stop = SCAN_NO_STOP;
+	while(Debugger_historyPos(dbg) < end) {
+		if(Debugger_canStop(dbg)) {
+			h->scan_last_stop = Debugger_historyPos(dbg);
+			if(scan == SCAN_STOP) {
+				Debugger_noteScanHit(dbg);
+			}
+			else if(scan == SCAN_FIRST_STOP) {
+				Debugger_noteScanHit(dbg);
+				break;
+			}
+		}
+		
+		r = EAR_stepInstruction(dbg->cpu);
+		if(r == HALT_EXCEPTION) {
+			r = HALT_NONE;
+		}
+		if(r != HALT_NONE || g_interrupted) {
+			break;
+		}
+	}
+	
+	dbg->debug_flags &= ~DEBUG_REPLAYING;
+	h->scan = SCAN_NONE;
+	Debugger_updateInterposers(dbg);
+	return r;
+}
+
+
+// Index of the last snapshot taken at or before the given position
+static size_t Debugger_findSnapshot(Debugger* dbg, uint64_t pos) {
+	DebugHistory* h = &dbg->history;
+	size_t i = h->snapshots.count;
+	while(i > 1 && h->snapshots.elems[i - 1].pos > pos) {
+		--i;
+	}
+	return i - 1;
+}
+
+
+// Replay from the nearest snapshot up to the instruction boundary at the given position
+static EAR_HaltReason Debugger_goTo(Debugger* dbg, uint64_t pos) {
+	size_t i = Debugger_findSnapshot(dbg, pos);
+	Debugger_restoreSnapshot(dbg, &dbg->history.snapshots.elems[i]);
+	return Debugger_replayUntil(dbg, pos, SCAN_NONE);
+}
+
+
+// Search backwards from the current position for the latest time `scan` found something
+static bool Debugger_searchBackward(Debugger* dbg, DebugScanKind scan, uint64_t* out_pos) {
+	DebugHistory* h = &dbg->history;
+	uint64_t end = Debugger_historyPos(dbg);
+	
+	// Search one snapshot interval at a time, starting with the most recent
+	size_t i = h->snapshots.count;
+	while(i-- > 0) {
+		DebugSnapshot* snap = &h->snapshots.elems[i];
+		if(snap->pos >= end) {
+			continue;
+		}
+		
+		uint64_t window_end = end;
+		if(i + 1 < h->snapshots.count && h->snapshots.elems[i + 1].pos < end) {
+			window_end = h->snapshots.elems[i + 1].pos;
+		}
+		
+		h->scan_found = false;
+		Debugger_restoreSnapshot(dbg, snap);
+		EAR_HaltReason r = Debugger_replayUntil(dbg, window_end, scan);
+		if(r != HALT_NONE || g_interrupted) {
+			return false;
+		}
+		
+		if(h->scan_found) {
+			if(h->scan_pos != SCAN_NO_STOP) {
+				*out_pos = h->scan_pos;
+				return true;
+			}
+			
+			// Found in kernel code that was entered before this snapshot, so look for the
+			// instruction that entered it. When that's before the recorded history (like the
+			// kernel writing to memory while loading the program), there's nothing to report.
+			scan = SCAN_STOP;
+		}
+	}
+	
+	return false;
+}
+
+
+// Common setup for the reverse execution commands
+static bool Debugger_beginReverse(Debugger* dbg, DebugSnapshot* saved) {
+	if(!dbg->history.enabled || array_empty(&dbg->history.snapshots)) {
+		fprintf(stderr, "No execution history has been recorded\n");
+		return false;
+	}
+	
+	// Save the current state to restore if the search fails
+	Debugger_saveSnapshot(dbg, saved);
+	return true;
+}
+
+
+static void Debugger_endReverse(Debugger* dbg, DebugSnapshot* saved, bool restore) {
+	if(restore) {
+		Debugger_restoreSnapshot(dbg, saved);
+	}
+	free(saved->mem);
+}
+
+
+/*!
+ * @brief Go back to the previous instruction boundary where stepping would have stopped.
+ * 
+ * @return True if there was an earlier instruction in the recorded history
+ */
+bool Debugger_reverseStep(Debugger* dbg) {
+	DebugSnapshot saved;
+	if(!Debugger_beginReverse(dbg, &saved)) {
+		return false;
+	}
+	
+	bool enabledInterruptHandler = enable_interrupt_handler();
+	
+	uint64_t target;
+	bool found = Debugger_searchBackward(dbg, SCAN_STOP, &target);
+	if(found) {
+		dbg->r = Debugger_goTo(dbg, target);
+	}
+	else if(!g_interrupted) {
+		fprintf(stderr, "Already at the beginning of the recorded history\n");
+	}
+	
+	Debugger_endReverse(dbg, &saved, !found);
+	
+	if(enabledInterruptHandler) {
+		disable_interrupt_handler();
+	}
+	return found;
+}
+
+
+// Go to the earliest instruction boundary before `end` where stepping would stop
+static bool Debugger_goToFirstStop(Debugger* dbg, uint64_t end) {
+	DebugHistory* h = &dbg->history;
+	
+	h->scan_found = false;
+	Debugger_restoreSnapshot(dbg, &h->snapshots.elems[0]);
+	EAR_HaltReason r = Debugger_replayUntil(dbg, end, SCAN_FIRST_STOP);
+	return r == HALT_NONE && !g_interrupted && h->scan_found;
+}
+
+
+/*!
+ * @brief Go back to the most recent breakpoint hit.
+ * 
+ * @return True if a breakpoint was hit, or false if execution went back to the beginning
+ *         of the recorded history
+ */
+bool Debugger_reverseContinue(Debugger* dbg) {
+	DebugSnapshot saved;
+	if(!Debugger_beginReverse(dbg, &saved)) {
+		return false;
+	}
+	
+	bool enabledInterruptHandler = enable_interrupt_handler();
+	
+	uint64_t target;
+	bool found = Debugger_searchBackward(dbg, SCAN_BREAKPOINT, &target);
+	bool moved = found;
+	if(found) {
+		// Replay up to the instruction that hits the breakpoint, then let it hit the
+		// breakpoint for real so the state is exactly what it was the first time
+		dbg->r = Debugger_goTo(dbg, target);
+		if(dbg->r == HALT_NONE) {
+			dbg->r = EAR_stepInstruction(dbg->cpu);
+		}
+	}
+	else if(!g_interrupted) {
+		// Like reverse-step, only stop where stepping could have stopped, which skips
+		// the kernel code at the start of the history unless kernel debugging
+		moved = Debugger_goToFirstStop(dbg, saved.pos);
+		if(moved) {
+			fprintf(stderr, "No breakpoint was hit, stopped at the beginning of the recorded history\n");
+			dbg->r = HALT_NONE;
+		}
+		else if(!g_interrupted) {
+			fprintf(stderr, "No breakpoint was hit, already at the beginning of the recorded history\n");
+		}
+	}
+	
+	Debugger_endReverse(dbg, &saved, !moved);
+	
+	if(enabledInterruptHandler) {
+		disable_interrupt_handler();
+	}
+	return found;
+}
+
+
+/*!
+ * @brief Go back to just before the most recent instruction that wrote to a virtual address.
+ * 
+ * @param addr Virtual address that was written
+ * 
+ * @return True if a write was found, or false if the current state is unchanged
+ */
+bool Debugger_reverseToLastWrite(Debugger* dbg, EAR_VirtAddr addr) {
+	DebugSnapshot saved;
+	if(!Debugger_beginReverse(dbg, &saved)) {
+		return false;
+	}
+	
+	bool enabledInterruptHandler = enable_interrupt_handler();
+	
+	// Match writes by the physical address currently backing `addr`, so writes through other
+	// mappings of that memory count, but the kernel writing to its own `addr` doesn't
+	DebugHistory* h = &dbg->history;
+	h->scan_addr = addr;
+	dbg->debug_flags |= DEBUG_NOBREAK;
+	h->scan_physical = dbg->mmu && MMU_translate(dbg->mmu, addr, EAR_PROT_WRITE, &h->scan_paddr) == HALT_NONE;
+	dbg->debug_flags &= ~DEBUG_NOBREAK;
+	
+	uint64_t target;
+	bool found = Debugger_searchBackward(dbg, SCAN_WRITE, &target);
+	if(found) {
+		dbg->r = Debugger_goTo(dbg, target);
+		
+		// The write may come from resuming an instruction that was interrupted
+		EAR_ThreadState* ctx = CTX(*dbg->cpu);
+		EAR_UWord pc = (ctx->cr[CR_FLAGS] & FLAG_RESUME) ? ctx->cr[CR_INSN_ADDR] : ctx->r[PC];
+		fprintf(stderr, "Last write to %04X was by instruction #%" PRIu64 " at %04X\n", addr, dbg->cpu->ins_count, pc);
+	}
+	else if(!g_interrupted) {
+		fprintf(stderr, "No write to %04X in the recorded history\n", addr);
+	}
+	
+	Debugger_endReverse(dbg, &saved, !found);
+	
+	if(enabledInterruptHandler) {
+		disable_interrupt_handler();
+	}
+	return found;
+}
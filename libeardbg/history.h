@@ -0,0 +1,86 @@
+//
+//  history.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_HISTORY_H
+#define EARDBG_HISTORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/dynamic_array.h"
+#include "libear/ear.h"
+
+
+//! Snapshots start out being taken this many instructions apart
+#define DEBUG_HISTORY_INITIAL_INTERVAL 0x1000
+
+//! Once this many snapshots exist, every other one is dropped and the interval doubles
+#define DEBUG_HISTORY_MAX_SNAPSHOTS 64
+
+//! Saved machine state at an instruction boundary
+typedef struct DebugSnapshot {
+	uint64_t pos;
+	uint64_t ins_count;
+	uint64_t exc_count;
+	EAR_Context ctx;
+	uint8_t* mem;
+} DebugSnapshot;
+
+//! Result of a port access, saved so that it can be replayed
+typedef struct DebugPortEvent {
+	uint64_t pos;
+	EAR_HaltReason r;
+	uint8_t port_number;
+	bool is_read;
+	EAR_Byte byte;
+} DebugPortEvent;
+
+//! Writable memory that is saved in each snapshot
+typedef struct DebugMemory {
+	void* data;
+	size_t size;
+} DebugMemory;
+
+// What to look for while replaying from a snapshot
+typedef uint8_t DebugScanKind;
+#define SCAN_NONE       ((DebugScanKind)0) //!< Just replay
+#define SCAN_STOP       ((DebugScanKind)1) //!< Instruction boundaries where stepping would stop
+#define SCAN_BREAKPOINT ((DebugScanKind)2) //!< Breakpoint hits
+#define SCAN_WRITE      ((DebugScanKind)3) //!< Writes to scan_addr
+#define SCAN_FIRST_STOP ((DebugScanKind)4) //!< Stop replaying at the first boundary where stepping would stop
+
+typedef struct DebugHistory {
+	// True once the debugger has started recording history
+	bool enabled;
+	
+	dynamic_array(DebugMemory) memory;
+	size_t memory_size;
+	
+	// Positions in the history count both instructions and exceptions (see
+	// Debugger_historyPos), so the first instruction of an exception handler
+	// isn't at the same position as the instruction that raised the exception.
+	
+	// Sorted by position
+	dynamic_array(DebugSnapshot) snapshots;
+	uint64_t interval;
+	uint64_t next_snapshot;
+	
+	// Every port access that has happened, sorted by position. Accesses
+	// at or before the last one are replayed instead of being performed again.
+	dynamic_array(DebugPortEvent) port_events;
+	
+	// State of a search through the history
+	DebugScanKind scan;
+	EAR_VirtAddr scan_addr;
+	EAR_PhysAddr scan_paddr;
+	bool scan_physical;
+	uint64_t scan_last_stop;
+	bool scan_found;
+	uint64_t scan_pos;
+} DebugHistory;
+
+#endif /* EARDBG_HISTORY_H */
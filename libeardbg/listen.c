@@ -0,0 +1,339 @@
+//
+//  listen.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "listen.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "common/macros.h"
+
+
+// When listening for a connection to a UNIX domain socket, be careful to ensure that
+// the socket is always deleted even when this program is killed by alarm().
+static const char* g_unix_bind = NULL;
+static const int signals_to_catch[] = {
+	SIGALRM,
+	SIGINT,
+	SIGSEGV,
+	SIGABRT,
+	SIGPIPE,
+	SIGTERM,
+	SIGHUP,
+};
+
+static void unlink_unix_socket(int signum) {
+	if(g_unix_bind != NULL) {
+		unlink(g_unix_bind);
+		_exit(signum);
+	}
+}
+
+
+/*!
+ * @brief Bind to a TCP address or UNIX domain socket and start listening for connections.
+ * 
+ * @param listen_address Either "<hostname>:<port>" (the hostname is optional) or the
+ *        path of a UNIX domain socket to create
+ * @param backlog Maximum number of pending connections, passed to listen()
+ * 
+ * @return Listening socket, or -1 on error (after printing an error message). It should
+ *         be closed with `close_listener` so that a UNIX domain socket is deleted.
+ */
+int listen_on_address(const char* listen_address, int backlog) {
+	int err = -1;
+	int sock = -1;
+	bool did_unix_bind = false;
+	unsigned i;
+	
+	// There are two forms of socket listen addresses handled here.
+	//
+	// 1. <hostname>:<port>
+	// 2. <path to UNIX domain socket>
+	const char* port_str = strchr(listen_address, ':');
+	if(port_str != NULL) {
+		// This is form 1, meaning we will listen for incoming TCP connections on the given host and port.
+		char* hostname;
+		if(port_str == listen_address) {
+			hostname = NULL;
+		}
+		else {
+			hostname = strndup(listen_address, port_str - listen_address);
+		}
+		port_str++;
+		
+		struct addrinfo hints = {0};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_PASSIVE;
+		
+		// Do a domain name lookup on the provided hostname
+		struct addrinfo* ais = NULL;
+		int gai_err = getaddrinfo(hostname, port_str, &hints, &ais);
+		destroy(&hostname);
+		if(gai_err != 0) {
+			fprintf(stderr, "Error: Couldn't resolve hostname \"%s\": %s\n", listen_address, gai_strerror(gai_err));
+			goto out;
+		}
+		
+		// Try listening to each returned address
+		struct addrinfo* ai;
+		int first_errno = 0;
+		for(ai = ais; ai != NULL; ai = ai->ai_next) {
+			errno = 0;
+			sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if(sock == -1) {
+				if(first_errno == 0) {
+					first_errno = errno;
+				}
+				continue;
+			}
+			
+			// Allow restarting right away while old connections are in TIME_WAIT
+			int one = 1;
+			setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			
+			errno = 0;
+			int err = bind(sock, ai->ai_addr, ai->ai_addrlen);
+			if(err == 0) {
+				break;
+			}
+			
+			if(first_errno == 0) {
+				first_errno = errno;
+			}
+			
+			close(sock);
+			sock = -1;
+		}
+		
+		// Done with name lookup
+		freeaddrinfo(ais);
+		
+		if(ai == NULL) {
+			fprintf(stderr, "Error: Unable to bind to an address for %s:%s", listen_address, port_str);
+			if(first_errno != 0) {
+				fprintf(stderr, ": %s\n", strerror(first_errno));
+			}
+			else {
+				fprintf(stderr, "\n");
+			}
+			goto out;
+		}
+	}
+	else {
+		// This is form 2, meaning we will listen for incoming UNIX domain socket connections at the given path.
+		errno = 0;
+		sock = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(sock < 0) {
+			fprintf(stderr, "Error: Couldn't create UNIX socket: %s\n", strerror(errno));
+			goto out;
+		}
+		
+		struct sockaddr_un sau = {0};
+		sau.sun_family = AF_UNIX;
+		
+		// Make sure there's no truncation.
+		if(strlen(listen_address) >= sizeof(sau.sun_path)) {
+			fprintf(stderr, "Error: Listen address is too long (%s)\n", listen_address);
+			goto out;
+		}
+		strncpy(sau.sun_path, listen_address, sizeof(sau.sun_path) - 1);
+		
+		// Enable signal handler to delete the UNIX domain socket in case of a fatal signal.
+		g_unix_bind = listen_address;
+		for(i = 0; i < ARRAY_COUNT(signals_to_catch); i++) {
+			signal(signals_to_catch[i], &unlink_unix_socket);
+		}
+		
+		// Binding to a UNIX socket will create the filesystem entry.
+		errno = 0;
+		err = bind(sock, (struct sockaddr*)&sau, sizeof(sau));
+		if(err != 0) {
+			fprintf(stderr, "Error: Couldn't bind to UNIX socket at %s: %s\n", listen_address, strerror(errno));
+			goto out;
+		}
+		
+		did_unix_bind = true;
+		
+		// Set permissions of UNIX socket (tried doing fchmod() before bind(), didn't work)
+		errno = 0;
+		err = chmod(listen_address, 0777);
+		if(err < 0) {
+			fprintf(stderr, "Error: Failed to change UNIX socket permissions: %s\n", strerror(errno));
+			goto out;
+		}
+	}
+	
+	// We now have some bound socket (either TCP or UNIX domain) and need to listen to it.
+	errno = 0;
+	if(listen(sock, backlog) != 0) {
+		fprintf(stderr, "Error: Unable to listen on I/O socket: %s\n", strerror(errno));
+		goto out;
+	}
+	
+	return sock;
+	
+out:
+	close_listener(sock, did_unix_bind ? listen_address : NULL);
+	return -1;
+}
+
+
+/*!
+ * @brief Close a socket returned by `listen_on_address`.
+ * 
+ * @param sock Listening socket to close, or -1
+ * @param listen_address Address the socket was listening on, used to delete a UNIX
+ *        domain socket from the filesystem
+ */
+void close_listener(int sock, const char* listen_address) {
+	unsigned i;
+	
+	if(sock != -1) {
+		close(sock);
+	}
+	
+	// When we listened on a UNIX socket, we can also now delete the socket from the filesystem safely.
+	if(listen_address != NULL && strchr(listen_address, ':') == NULL) {
+		unlink(listen_address);
+	}
+	
+	// Uninstall the signal handlers now that the UNIX socket has been deleted.
+	if(g_unix_bind != NULL) {
+		g_unix_bind = NULL;
+		for(i = 0; i < ARRAY_COUNT(signals_to_catch); i++) {
+			signal(signals_to_catch[i], SIG_DFL);
+		}
+	}
+}
+
+
+/*!
+ * @brief Accept connections on a listening socket until an error occurs, handling each
+ * one in a forked child process. At most `max_children` children run at once, and any
+ * further connections wait in the backlog until one of them exits.
+ * 
+ * @param sock Listening socket returned by `listen_on_address`
+ * @param listen_address Address the socket is listening on
+ * @param max_children Maximum number of child processes running at once
+ * @param io_quiet True to skip printing a message while waiting for connections
+ * 
+ * @return In each child process, the connected socket (with the listening socket
+ *         closed). The parent process only returns on error, with -1 after printing
+ *         an error message and closing the listening socket.
+ */
+int fork_for_each_connection(int sock, const char* listen_address, unsigned max_children, bool io_quiet) {
+	unsigned running = 0;
+	
+	if(!io_quiet) {
+		fprintf(stderr, "Listening for incoming connections on %s (up to %u at once)...\n", listen_address, max_children);
+	}
+	
+	while(true) {
+		// Reap children that have finished, waiting for one when at the limit
+		while(running > 0) {
+			pid_t pid = waitpid(-1, NULL, running >= max_children ? 0 : WNOHANG);
+			if(pid > 0) {
+				running--;
+			}
+			else if(pid < 0 && errno == EINTR) {
+				continue;
+			}
+			else {
+				// No child has finished yet (or there are no children left at all)
+				if(pid < 0) {
+					running = 0;
+				}
+				break;
+			}
+		}
+		
+		// While children are running, wake up every second to reap the ones that exit even
+		// when no connections come in, so they don't linger as zombies
+		struct pollfd pfd = {.fd = sock, .events = POLLIN};
+		int ready = poll(&pfd, 1, running > 0 ? 1000 : -1);
+		if(ready < 0 && errno != EINTR) {
+			fprintf(stderr, "Error: Failed to wait for incoming connections: %s\n", strerror(errno));
+			break;
+		}
+		if(ready <= 0) {
+			continue;
+		}
+		
+		errno = 0;
+		int conn = accept(sock, NULL, NULL);
+		if(conn < 0) {
+			if(errno == EINTR || errno == ECONNABORTED) {
+				continue;
+			}
+			fprintf(stderr, "Error: Failed to accept incoming connection: %s\n", strerror(errno));
+			break;
+		}
+		
+		pid_t pid = fork();
+		if(pid == 0) {
+			// The child only handles this connection. Closing the listener here also
+			// uninstalls the signal handlers, so a crashing child won't delete the socket.
+			close_listener(sock, NULL);
+			return conn;
+		}
+		
+		if(pid < 0) {
+			fprintf(stderr, "Error: Failed to fork for incoming connection: %s\n", strerror(errno));
+		}
+		else {
+			running++;
+		}
+		close(conn);
+	}
+	
+	close_listener(sock, listen_address);
+	return -1;
+}
+
+
+/*!
+ * @brief Listen on a TCP address or UNIX domain socket and accept a single connection.
+ * 
+ * @param listen_address Either "<hostname>:<port>" (the hostname is optional) or the
+ *        path of a UNIX domain socket to create
+ * @param io_quiet True to skip printing a message while waiting for the connection
+ * 
+ * @return Connected socket, or -1 on error (after printing an error message)
+ */
+int listen_for_connection(const char* listen_address, bool io_quiet) {
+	int sock = listen_on_address(listen_address, 1);
+	if(sock < 0) {
+		return -1;
+	}
+	
+	if(!io_quiet) {
+		fprintf(stderr, "Listening for incoming connection on %s...\n", listen_address);
+	}
+	
+	// Accept the incoming connection, giving us the connection socket
+	errno = 0;
+	int conn = accept(sock, NULL, NULL);
+	if(conn < 0) {
+		fprintf(stderr, "Error: Failed to accept incoming connection: %s\n", strerror(errno));
+	}
+	
+	// We've received the only connection we care about, and can now close the listening socket.
+	close_listener(sock, listen_address);
+	return conn;
+}
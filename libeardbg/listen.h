@@ -0,0 +1,62 @@
+//
+//  listen.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_LISTEN_H
+#define EARDBG_LISTEN_H
+
+#include <stdbool.h>
+
+
+/*!
+ * @brief Bind to a TCP address or UNIX domain socket and start listening for connections.
+ * 
+ * @param listen_address Either "<hostname>:<port>" (the hostname is optional) or the
+ *        path of a UNIX domain socket to create
+ * @param backlog Maximum number of pending connections, passed to listen()
+ * 
+ * @return Listening socket, or -1 on error (after printing an error message). It should
+ *         be closed with `close_listener` so that a UNIX domain socket is deleted.
+ */
+int listen_on_address(const char* listen_address, int backlog);
+
+/*!
+ * @brief Close a socket returned by `listen_on_address`.
+ * 
+ * @param sock Listening socket to close, or -1
+ * @param listen_address Address the socket was listening on, used to delete a UNIX
+ *        domain socket from the filesystem
+ */
+void close_listener(int sock, const char* listen_address);
+
+/*!
+ * @brief Accept connections on a listening socket until an error occurs, handling each
+ * one in a forked child process. At most `max_children` children run at once, and any
+ * further connections wait in the backlog until one of them exits.
+ * 
+ * @param sock Listening socket returned by `listen_on_address`
+ * @param listen_address Address the socket is listening on
+ * @param max_children Maximum number of child processes running at once
+ * @param io_quiet True to skip printing a message while waiting for connections
+ * 
+ * @return In each child process, the connected socket (with the listening socket
+ *         closed). The parent process only returns on error, with -1 after printing
+ *         an error message and closing the listening socket.
+ */
+int fork_for_each_connection(int sock, const char* listen_address, unsigned max_children, bool io_quiet);
+
+/*!
+ * @brief Listen on a TCP address or UNIX domain socket and accept a single connection.
+ * 
+ * @param listen_address Either "<hostname>:<port>" (the hostname is optional) or the
+ *        path of a UNIX domain socket to create
+ * @param io_quiet True to skip printing a message while waiting for the connection
+ * 
+ * @return Connected socket, or -1 on error (after printing an error message)
+ */
+int listen_for_connection(const char* listen_address, bool io_quiet);
+
+#endif /* EARDBG_LISTEN_H */
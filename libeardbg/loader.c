@@ -0,0 +1,286 @@
+//
+//  loader.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "loader.h"
+#include <string.h>
+#include "common/macros.h"
+#include "libear/types.h"
+
+
+// Special PTE values understood by the bootrom's MMU fault handler (kernel_constants.ear)
+#define PTE_COW ((MMU_PTE)0xFFFE)
+#define PTE_ZERO ((MMU_PTE)0xFFF0)
+
+// Only this much of the PEGASUS file is visible to `@Pegasus_load` (ram.ear)
+#define REMOTE_VIEW_SIZE 0x1000
+
+// Size of the PEGASUS header plus the load command count
+#define PEG_HEADER_SIZE (sizeof(Pegasus_Header) + sizeof(uint16_t))
+
+
+/*!
+ * @brief Check whether the bootrom's `@Pegasus_load` routine would accept this PEGASUS
+ * image. Images that would make the bootrom panic should be left for the bootrom to load
+ * so that the failure looks exactly the same as it always has.
+ * 
+ * @param peg Parsed PEGASUS image
+ * @return True if the host-side loader can load this image
+ */
+bool PegasusLoader_canLoad(Pegasus* peg) {
+	bool success = false;
+	size_t orig_pos = peg->peg_pos;
+	
+	// The bootrom checks the architecture, but the parser doesn't
+	if(memcmp(peg->header.arch, PEGASUS_ARCH_EAR3, sizeof(peg->header.arch)) != 0) {
+		return false;
+	}
+	
+	// The bootrom panics if the load commands run past the end of its view of the file
+	if(!Pegasus_seek(peg, sizeof(Pegasus_Header), SEEK_SET)) {
+		goto out;
+	}
+	
+	uint16_t numcmds;
+	if(!Pegasus_read(peg, &numcmds, sizeof(numcmds))) {
+		goto out;
+	}
+	
+	size_t cmds_end = PEG_HEADER_SIZE;
+	uint16_t i;
+	for(i = 0; i < numcmds; i++) {
+		uint16_t cmdsize;
+		if(!Pegasus_seek(peg, cmds_end, SEEK_SET) || !Pegasus_read(peg, &cmdsize, sizeof(cmdsize))) {
+			goto out;
+		}
+		
+		cmds_end += cmdsize;
+		if(cmds_end > REMOTE_VIEW_SIZE) {
+			goto out;
+		}
+	}
+	
+	success = true;
+	
+out:
+	peg->peg_pos = orig_pos;
+	return success;
+}
+
+
+static EAR_HaltReason PegasusLoader_writePTE(
+	EAR_UWord membase, unsigned pte_index, MMU_PTE pte,
+	Bus_AccessHandler* bus_fn, void* bus_cookie
+) { //PegasusLoader_writePTE
+	EAR_HaltReason r = HALT_NONE;
+	
+	// Same PTE address computation as MMU_translate()
+	EAR_PhysAddr pte_addr;
+	pte_addr = (EAR_PhysAddr)(membase & ~MMU_ENABLED) << EAR_PAGE_SHIFT;
+	pte_addr += pte_index * sizeof(MMU_PTE);
+	pte_addr &= EAR_PHYSICAL_ADDRESS_SPACE_SIZE - 1;
+	
+	if(!bus_fn(bus_cookie, BUS_MODE_WRITE, pte_addr, /*is_byte=*/false, &pte, &r)) {
+		return r != HALT_NONE ? r : HALT_BUS_FAULT;
+	}
+	
+	return HALT_NONE;
+}
+
+
+/*!
+ * @brief Map a parsed PEGASUS image into the inactive (usermode) thread state on the host,
+ * producing the same page tables and entry registers as the bootrom's `@Pegasus_load`.
+ * 
+ * @note The user TTBs are located through the inactive thread state's MEMBASE_* control
+ *       registers, so the bootrom must already have configured the user MMU.
+ * @param cpu EAR processor whose inactive thread state will be loaded
+ * @param peg Parsed PEGASUS image to load
+ * @param region Physical memory region where the PEGASUS file is attached to the bus
+ * @param bus_fn Physical memory bus access function used to write PTEs
+ * @param bus_cookie Opaque value passed to `bus_fn`
+ * 
+ * @return HALT_NONE on success, or the halt reason from a failed PTE write
+ */
+EAR_HaltReason PegasusLoader_load(
+	EAR* cpu, Pegasus* peg, EAR_Byte region,
+	Bus_AccessHandler* bus_fn, void* bus_cookie
+) {
+	EAR_HaltReason r = HALT_NONE;
+	EAR_ThreadState* user = CTX_X(*cpu, 1);
+	
+	static const struct {
+		EAR_Protection prot;
+		EAR_ControlRegister cr;
+	} ttbs[] = {
+		{EAR_PROT_READ, CR_MEMBASE_R},
+		{EAR_PROT_WRITE, CR_MEMBASE_W},
+		{EAR_PROT_EXECUTE, CR_MEMBASE_X},
+	};
+	
+	foreach(&peg->segments, seg) {
+		unsigned i, j;
+		
+		for(i = 0; i < ARRAY_COUNT(ttbs); i++) {
+			if(!(seg->prot & ttbs[i].prot)) {
+				continue;
+			}
+			
+			EAR_UWord membase = user->cr[ttbs[i].cr];
+			unsigned pte_index = seg->virtual_page;
+			
+			// Present pages are backed directly by the PEGASUS file, except that
+			// writable pages are copy-on-write
+			EAR_UWord ppage = ((EAR_UWord)region << 8) | seg->file_page;
+			for(j = 0; j < seg->present_page_count; j++) {
+				MMU_PTE pte = ttbs[i].prot == EAR_PROT_WRITE ? PTE_COW : (MMU_PTE)(ppage + j);
+				r = PegasusLoader_writePTE(membase, pte_index++, pte, bus_fn, bus_cookie);
+				if(r != HALT_NONE) {
+					return r;
+				}
+			}
+			
+			// Absent pages are zero-filled on first access
+			for(j = 0; j < seg->absent_page_count; j++) {
+				r = PegasusLoader_writePTE(membase, pte_index++, PTE_ZERO, bus_fn, bus_cookie);
+				if(r != HALT_NONE) {
+					return r;
+				}
+			}
+		}
+	}
+	
+	// Each entrypoint command overwrites the registers of the user's thread state.
+	// This is what the bootrom's `POP A0, !{R1-R15}` does.
+	foreach(&peg->entrypoints, pentry) {
+		Pegasus_Entrypoint entry;
+		memcpy(&entry, *pentry, sizeof(entry));
+		
+		user->r[A0] = entry.a0;
+		user->r[A1] = entry.a1;
+		user->r[A2] = entry.a2;
+		user->r[A3] = entry.a3;
+		user->r[A4] = entry.a4;
+		user->r[A5] = entry.a5;
+		user->r[S0] = entry.s0;
+		user->r[S1] = entry.s1;
+		user->r[S2] = entry.s2;
+		user->r[FP] = entry.fp;
+		user->r[SP] = entry.sp;
+		user->r[RA] = entry.ra;
+		user->r[RD] = entry.rd;
+		user->r[PC] = entry.pc;
+		user->r[DPC] = entry.dpc;
+	}
+	
+	// Symbol tables and relocations are ignored, just like the bootrom does
+	return HALT_NONE;
+}
+
+
+/*!
+ * @brief Run the bootrom until it is about to execute the first instruction of
+ * `@Pegasus_load`. Nothing the bootrom does before that point depends on the user
+ * program, so the machine state can be saved here and reused for any PEGASUS image.
+ * 
+ * @param cpu EAR processor currently executing the bootrom
+ * @param bootpeg Parsed PEGASUS image of the bootrom, used to find `@Pegasus_load`
+ * @param out_at_loader Set to true when execution stopped at `@Pegasus_load`, or false
+ *        when the bootrom has no such symbol or switched to usermode without calling it
+ * 
+ * @return HALT_NONE when the bootrom should continue running, or the reason it halted
+ */
+EAR_HaltReason PegasusLoader_bootToLoader(EAR* cpu, Pegasus* bootpeg, bool* out_at_loader) {
+	EAR_HaltReason r = HALT_NONE;
+	*out_at_loader = false;
+	
+	Pegasus_Symbol* sym = Pegasus_findSymbolByName(bootpeg, PEGASUS_LOADER_SYMBOL);
+	if(!sym) {
+		return HALT_NONE;
+	}
+	
+	// Run the bootrom up to the first instruction of `@Pegasus_load`
+	while(CTX(*cpu)->r[PC] != sym->value) {
+		// Stop if the bootrom switched to usermode without loading anything
+		if(CTX(*cpu)->cr[CR_FLAGS] & FLAG_DENY_XREGS) {
+			return HALT_NONE;
+		}
+		
+		r = EAR_stepInstruction(cpu);
+		if(r != HALT_NONE) {
+			return r;
+		}
+	}
+	
+	*out_at_loader = true;
+	return HALT_NONE;
+}
+
+
+/*!
+ * @brief Perform the bootrom's call to `@Pegasus_load` on the host using
+ * `PegasusLoader_load` and return to the bootrom, which continues on to
+ * `@context_switch`. When the image can't be loaded on the host, execution is left at
+ * the call so that the bootrom loads it instead.
+ * 
+ * @note The CPU must be stopped at the first instruction of `@Pegasus_load`, as left by
+ *       `PegasusLoader_bootToLoader`.
+ * @param cpu EAR processor executing the bootrom
+ * @param peg Parsed PEGASUS image of the user program
+ * @param region Physical memory region where the user program is attached to the bus
+ * @param bus_fn Physical memory bus access function used to write PTEs
+ * @param bus_cookie Opaque value passed to `bus_fn`
+ * 
+ * @return HALT_NONE when the bootrom should continue running, or the reason it halted
+ */
+EAR_HaltReason PegasusLoader_loadFromCall(
+	EAR* cpu, Pegasus* peg, EAR_Byte region,
+	Bus_AccessHandler* bus_fn, void* bus_cookie
+) { //PegasusLoader_loadFromCall
+	if(!PegasusLoader_canLoad(peg)) {
+		return HALT_NONE;
+	}
+	
+	EAR_HaltReason r = PegasusLoader_load(cpu, peg, region, bus_fn, bus_cookie);
+	if(r != HALT_NONE) {
+		return r;
+	}
+	
+	// Return from `@Pegasus_load` as if it had run
+	EAR_ThreadState* ctx = CTX(*cpu);
+	ctx->r[PC] = ctx->r[RA];
+	ctx->r[DPC] = ctx->r[RD];
+	return HALT_NONE;
+}
+
+
+/*!
+ * @brief Run the bootrom until it calls `@Pegasus_load`, then perform that call on the
+ * host using `PegasusLoader_load` and return to the bootrom, which continues on to
+ * `@context_switch`. When the bootrom has no `@Pegasus_load` symbol or the image can't
+ * be loaded on the host, execution stops at the call and the bootrom loads it instead.
+ * 
+ * @param cpu EAR processor currently executing the bootrom
+ * @param bootpeg Parsed PEGASUS image of the bootrom, used to find `@Pegasus_load`
+ * @param peg Parsed PEGASUS image of the user program
+ * @param region Physical memory region where the user program is attached to the bus
+ * @param bus_fn Physical memory bus access function used to write PTEs
+ * @param bus_cookie Opaque value passed to `bus_fn`
+ * 
+ * @return HALT_NONE when the bootrom should continue running, or the reason it halted
+ */
+EAR_HaltReason PegasusLoader_fastBoot(
+	EAR* cpu, Pegasus* bootpeg, Pegasus* peg, EAR_Byte region,
+	Bus_AccessHandler* bus_fn, void* bus_cookie
+) {
+	bool at_loader;
+	EAR_HaltReason r = PegasusLoader_bootToLoader(cpu, bootpeg, &at_loader);
+	if(r != HALT_NONE || !at_loader) {
+		return r;
+	}
+	
+	return PegasusLoader_loadFromCall(cpu, peg, region, bus_fn, bus_cookie);
+}
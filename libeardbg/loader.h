@@ -0,0 +1,105 @@
+//
+//  loader.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_LOADER_H
+#define EARDBG_LOADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "libear/ear.h"
+#include "pegasus.h"
+
+
+//! Name of the bootrom routine that the host-side loader replaces
+#define PEGASUS_LOADER_SYMBOL "@Pegasus_load"
+
+
+/*!
+ * @brief Check whether the bootrom's `@Pegasus_load` routine would accept this PEGASUS
+ * image. Images that would make the bootrom panic should be left for the bootrom to load
+ * so that the failure looks exactly the same as it always has.
+ * 
+ * @param peg Parsed PEGASUS image
+ * @return True if the host-side loader can load this image
+ */
+bool PegasusLoader_canLoad(Pegasus* peg);
+
+/*!
+ * @brief Map a parsed PEGASUS image into the inactive (usermode) thread state on the host,
+ * producing the same page tables and entry registers as the bootrom's `@Pegasus_load`.
+ * 
+ * @note The user TTBs are located through the inactive thread state's MEMBASE_* control
+ *       registers, so the bootrom must already have configured the user MMU.
+ * @param cpu EAR processor whose inactive thread state will be loaded
+ * @param peg Parsed PEGASUS image to load
+ * @param region Physical memory region where the PEGASUS file is attached to the bus
+ * @param bus_fn Physical memory bus access function used to write PTEs
+ * @param bus_cookie Opaque value passed to `bus_fn`
+ * 
+ * @return HALT_NONE on success, or the halt reason from a failed PTE write
+ */
+EAR_HaltReason PegasusLoader_load(
+	EAR* cpu, Pegasus* peg, EAR_Byte region,
+	Bus_AccessHandler* bus_fn, void* bus_cookie
+);
+
+/*!
+ * @brief Run the bootrom until it is about to execute the first instruction of
+ * `@Pegasus_load`. Nothing the bootrom does before that point depends on the user
+ * program, so the machine state can be saved here and reused for any PEGASUS image.
+ * 
+ * @param cpu EAR processor currently executing the bootrom
+ * @param bootpeg Parsed PEGASUS image of the bootrom, used to find `@Pegasus_load`
+ * @param out_at_loader Set to true when execution stopped at `@Pegasus_load`, or false
+ *        when the bootrom has no such symbol or switched to usermode without calling it
+ * 
+ * @return HALT_NONE when the bootrom should continue running, or the reason it halted
+ */
+EAR_HaltReason PegasusLoader_bootToLoader(EAR* cpu, Pegasus* bootpeg, bool* out_at_loader);
+
+/*!
+ * @brief Perform the bootrom's call to `@Pegasus_load` on the host using
+ * `PegasusLoader_load` and return to the bootrom, which continues on to
+ * `@context_switch`. When the image can't be loaded on the host, execution is left at
+ * the call so that the bootrom loads it instead.
+ * 
+ * @note The CPU must be stopped at the first instruction of `@Pegasus_load`, as left by
+ *       `PegasusLoader_bootToLoader`.
+ * @param cpu EAR processor executing the bootrom
+ * @param peg Parsed PEGASUS image of the user program
+ * @param region Physical memory region where the user program is attached to the bus
+ * @param bus_fn Physical memory bus access function used to write PTEs
+ * @param bus_cookie Opaque value passed to `bus_fn`
+ * 
+ * @return HALT_NONE when the bootrom should continue running, or the reason it halted
+ */
+EAR_HaltReason PegasusLoader_loadFromCall(
+	EAR* cpu, Pegasus* peg, EAR_Byte region,
+	Bus_AccessHandler* bus_fn, void* bus_cookie
+);
+
+/*!
+ * @brief Run the bootrom until it calls `@Pegasus_load`, then perform that call on the
+ * host using `PegasusLoader_load` and return to the bootrom, which continues on to
+ * `@context_switch`. When the bootrom has no `@Pegasus_load` symbol or the image can't
+ * be loaded on the host, execution stops at the call and the bootrom loads it instead.
+ * 
+ * @param cpu EAR processor currently executing the bootrom
+ * @param bootpeg Parsed PEGASUS image of the bootrom, used to find `@Pegasus_load`
+ * @param peg Parsed PEGASUS image of the user program
+ * @param region Physical memory region where the user program is attached to the bus
+ * @param bus_fn Physical memory bus access function used to write PTEs
+ * @param bus_cookie Opaque value passed to `bus_fn`
+ * 
+ * @return HALT_NONE when the bootrom should continue running, or the reason it halted
+ */
+EAR_HaltReason PegasusLoader_fastBoot(
+	EAR* cpu, Pegasus* bootpeg, Pegasus* peg, EAR_Byte region,
+	Bus_AccessHandler* bus_fn, void* bus_cookie
+);
+
+#endif /* EARDBG_LOADER_H */
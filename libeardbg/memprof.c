@@ -0,0 +1,290 @@
+//
+//  memprof.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "memprof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include "common/dynamic_array.h"
+#include "common/macros.h"
+
+
+/*!
+ * @brief Create a memory access profiler and insert it between the CPU and the MMU
+ * and between the MMU and the bus. This should happen before the debugger interposes
+ * so that the debugger's own memory accesses aren't counted.
+ * 
+ * @param path Path of the CSV file to write when the profiler is closed
+ * @param cpu EAR processor whose memory accesses are counted
+ * @param mmu MMU used by the processor
+ * @param bus Physical memory bus, used to name the devices that were accessed
+ * 
+ * @return Newly created profiler, or NULL on error
+ */
+MemProfiler* MemProfiler_open(const char* path, EAR* cpu, MMU* mmu, Bus* bus) {
+	// Make sure the output file can be written before running anything
+	FILE* fp = fopen(path, "w");
+	if(!fp) {
+		return NULL;
+	}
+	fclose(fp);
+	
+	MemProfiler* mp = calloc(1, sizeof(*mp));
+	if(!mp) {
+		return NULL;
+	}
+	
+	mp->path = strdup(path);
+	mp->phys = calloc(2, sizeof(*mp->phys));
+	if(!mp->path || !mp->phys) {
+		free(mp->path);
+		free(mp->phys);
+		free(mp);
+		return NULL;
+	}
+	
+	mp->cpu = cpu;
+	mp->bus = bus;
+	mp->mem_fn = cpu->mem_fn;
+	mp->mem_cookie = cpu->mem_cookie;
+	mp->bus_fn = mmu->bus_fn;
+	mp->bus_cookie = mmu->bus_cookie;
+	
+	EAR_setMemoryHandler(cpu, &MemProfiler_memoryHandler, mp);
+	MMU_setBusHandler(mmu, &MemProfiler_busHandler, mp);
+	return mp;
+}
+
+
+/*!
+ * @brief Counts a virtual memory access by the CPU, then performs it.
+ * 
+ * Accesses without an `out_r` pointer come from the debugger rather than the
+ * CPU, and aren't counted.
+ */
+bool MemProfiler_memoryHandler(
+	void* cookie, EAR_Protection prot, Bus_AccessMode mode,
+	EAR_FullAddr vmaddr, bool is_byte, void* data, EAR_HaltReason* out_r
+) { //MemProfiler_memoryHandler
+	MemProfiler* mp = cookie;
+	if(!out_r) {
+		return mp->mem_fn(mp->mem_cookie, prot, mode, vmaddr, is_byte, data, out_r);
+	}
+	
+	EAR_ThreadState* ctx = CTX(*mp->cpu);
+	uint8_t kernel = !(ctx->cr[CR_FLAGS] & FLAG_DENY_XREGS);
+	uint8_t kind;
+	EAR_ControlRegister membase_cr;
+	switch(prot) {
+		case EAR_PROT_WRITE:
+			kind = MEMPROF_WRITE;
+			membase_cr = CR_MEMBASE_W;
+			break;
+		
+		case EAR_PROT_EXECUTE:
+			kind = MEMPROF_EXECUTE;
+			membase_cr = CR_MEMBASE_X;
+			break;
+		
+		default:
+			kind = MEMPROF_READ;
+			membase_cr = CR_MEMBASE_R;
+			break;
+	}
+	
+	EAR_UWord page = EAR_PAGE_NUMBER(vmaddr);
+	++mp->virt[kernel][kind][page];
+	
+	// With the MMU enabled, the first bus access is the page table entry read
+	mp->walk_pending = !!(ctx->cr[membase_cr] & MMU_ENABLED);
+	if(mp->walk_pending) {
+		++mp->virt[kernel][MEMPROF_WALK][page];
+	}
+	
+	mp->in_access = true;
+	mp->cur_kernel = kernel;
+	mp->cur_kind = kind;
+	bool ret = mp->mem_fn(mp->mem_cookie, prot, mode, vmaddr, is_byte, data, out_r);
+	mp->in_access = false;
+	mp->walk_pending = false;
+	return ret;
+}
+
+
+/*! Counts a physical memory access caused by the CPU, then performs it. */
+bool MemProfiler_busHandler(
+	void* cookie, Bus_AccessMode mode,
+	EAR_PhysAddr paddr, bool is_byte, void* data,
+	EAR_HaltReason* out_r
+) { //MemProfiler_busHandler
+	MemProfiler* mp = cookie;
+	
+	if(mp->in_access && out_r) {
+		uint8_t kind = mp->walk_pending ? MEMPROF_WALK : mp->cur_kind;
+		mp->walk_pending = false;
+		++mp->phys[mp->cur_kernel][kind][(paddr & (EAR_PHYSICAL_ADDRESS_SPACE_SIZE - 1)) >> EAR_PAGE_SHIFT];
+	}
+	
+	return mp->bus_fn(mp->bus_cookie, mode, paddr, is_byte, data, out_r);
+}
+
+
+static const char* MemProfiler_deviceName(Bus_Device* dev) {
+	if(!dev) {
+		return "(unmapped)";
+	}
+	return dev->name ? dev->name : "(unnamed)";
+}
+
+
+typedef struct MemProfRow {
+	const char* type;
+	uint8_t kernel;
+	uint32_t page;
+	const char* device;
+	uint64_t counts[MEMPROF_KINDS];
+	uint64_t total;
+} MemProfRow;
+
+static int compare_rows(const void* a, const void* b) {
+	const MemProfRow* ra = a;
+	const MemProfRow* rb = b;
+	if(ra->total != rb->total) {
+		return ra->total > rb->total ? -1 : 1;
+	}
+	if(ra->kernel != rb->kernel) {
+		return ra->kernel < rb->kernel ? -1 : 1;
+	}
+	return ra->page < rb->page ? -1 : ra->page > rb->page;
+}
+
+
+static void MemProfiler_writeRows(FILE* fp, MemProfRow* rows, size_t count, bool physical) {
+	if(count != 0) {
+		qsort(rows, count, sizeof(*rows), compare_rows);
+	}
+	
+	for(size_t i = 0; i < count; i++) {
+		MemProfRow* row = &rows[i];
+		fprintf(fp, "%s,%s,", row->type, row->kernel ? "kernel" : "user");
+		if(physical) {
+			EAR_PhysAddr addr = row->page << EAR_PAGE_SHIFT;
+			fprintf(fp, "%02X:%04X", EAR_FULL_REGION(addr), EAR_FULL_NOTREGION(addr));
+		}
+		else {
+			fprintf(fp, "%04X", row->page << EAR_PAGE_SHIFT);
+		}
+		fprintf(
+			fp, ",%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+			row->device ? row->device : "",
+			row->counts[MEMPROF_READ], row->counts[MEMPROF_WRITE],
+			row->counts[MEMPROF_EXECUTE], row->counts[MEMPROF_WALK]
+		);
+	}
+}
+
+
+/*!
+ * @brief Write the CSV summary and destroy the profiler. The profiler's handlers
+ * must not be called after this.
+ * 
+ * @return True if the summary was written successfully
+ */
+bool MemProfiler_close(MemProfiler** pmp) {
+	MemProfiler* mp = *pmp;
+	if(!mp) {
+		return true;
+	}
+	*pmp = NULL;
+	
+	FILE* fp = fopen(mp->path, "w");
+	if(!fp) {
+		free(mp->phys);
+		free(mp->path);
+		free(mp);
+		return false;
+	}
+	
+	fprintf(fp, "type,mode,page,device,reads,writes,executes,walks\n");
+	
+	dynamic_array(MemProfRow) rows = {0};
+	for(uint8_t kernel = 0; kernel < 2; kernel++) {
+		for(uint32_t page = 0; page < EAR_PAGE_COUNT; page++) {
+			MemProfRow row = {.type = "virt", .kernel = kernel, .page = page};
+			for(unsigned kind = 0; kind < MEMPROF_KINDS; kind++) {
+				row.counts[kind] = mp->virt[kernel][kind][page];
+				row.total += row.counts[kind];
+			}
+			if(row.total != 0) {
+				array_append(&rows, row);
+			}
+		}
+	}
+	MemProfiler_writeRows(fp, rows.elems, rows.count, false);
+	array_clear(&rows);
+	
+	// Bus accesses are totalled per device as the physical pages are listed
+	typedef struct DeviceTotal {
+		Bus_Device* dev;
+		uint64_t counts[MEMPROF_KINDS];
+	} DeviceTotal;
+	dynamic_array(DeviceTotal) devices = {0};
+	
+	for(uint8_t kernel = 0; kernel < 2; kernel++) {
+		for(uint32_t page = 0; page < MEMPROF_PHYS_PAGES; page++) {
+			MemProfRow row = {.type = "phys", .kernel = kernel, .page = page};
+			for(unsigned kind = 0; kind < MEMPROF_KINDS; kind++) {
+				row.counts[kind] = mp->phys[kernel][kind][page];
+				row.total += row.counts[kind];
+			}
+			if(row.total == 0) {
+				continue;
+			}
+			
+			Bus_Device* dev = Bus_findDevice(mp->bus, page << EAR_PAGE_SHIFT);
+			row.device = MemProfiler_deviceName(dev);
+			array_append(&rows, row);
+			
+			DeviceTotal* total = NULL;
+			foreach(&devices, cur) {
+				if(cur->dev == dev) {
+					total = cur;
+					break;
+				}
+			}
+			if(!total) {
+				DeviceTotal empty = {.dev = dev};
+				array_append(&devices, empty);
+				total = &devices.elems[devices.count - 1];
+			}
+			for(unsigned kind = 0; kind < MEMPROF_KINDS; kind++) {
+				total->counts[kind] += row.counts[kind];
+			}
+		}
+	}
+	MemProfiler_writeRows(fp, rows.elems, rows.count, true);
+	array_clear(&rows);
+	
+	foreach(&devices, total) {
+		fprintf(
+			fp, "device,all,,%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n",
+			MemProfiler_deviceName(total->dev),
+			total->counts[MEMPROF_READ], total->counts[MEMPROF_WRITE],
+			total->counts[MEMPROF_EXECUTE], total->counts[MEMPROF_WALK]
+		);
+	}
+	array_clear(&devices);
+	
+	bool ok = !ferror(fp);
+	ok = fclose(fp) == 0 && ok;
+	
+	free(mp->phys);
+	free(mp->path);
+	free(mp);
+	return ok;
+}
@@ -0,0 +1,109 @@
+//
+//  memprof.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_MEMPROF_H
+#define EARDBG_MEMPROF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "libear/ear.h"
+#include "libear/mmu.h"
+#include "libear/bus.h"
+
+
+/*
+ * Memory access profiler. It sits between the CPU and the MMU, and between the
+ * MMU and the bus, counting every access the CPU makes per virtual and per
+ * physical page, split by kernel and user mode. When the MMU is enabled, each
+ * access walks the page table, and the page table entry read is counted as a
+ * walk instead of a read.
+ * 
+ * At exit, a CSV summary is written with one row per page that was accessed,
+ * hottest first, followed by the total accesses to each bus device:
+ * 
+ *   type,mode,page,device,reads,writes,executes,walks
+ *   virt,user,0200,,12,0,3400,3412
+ *   phys,user,01:0200,RAM,12,0,3400,0
+ *   phys,user,00:1F00,RAM,0,0,0,3412
+ *   device,all,,RAM,3424,0,3400,3412
+ */
+
+// Kinds of memory access that are counted
+#define MEMPROF_READ    0
+#define MEMPROF_WRITE   1
+#define MEMPROF_EXECUTE 2
+#define MEMPROF_WALK    3
+#define MEMPROF_KINDS   4
+
+//! Number of pages in the physical address space
+#define MEMPROF_PHYS_PAGES (EAR_PHYSICAL_ADDRESS_SPACE_SIZE >> EAR_PAGE_SHIFT)
+
+typedef struct MemProfiler {
+	EAR* cpu;
+	Bus* bus;
+	char* path;
+	
+	// Real handlers that accesses are passed through to
+	EAR_MemoryHandler* mem_fn;
+	void* mem_cookie;
+	Bus_AccessHandler* bus_fn;
+	void* bus_cookie;
+	
+	// The CPU access in progress, used to attribute the bus accesses it causes
+	bool in_access;
+	bool walk_pending;
+	uint8_t cur_kernel;
+	uint8_t cur_kind;
+	
+	// Counts indexed by [kernel][kind][page]
+	uint64_t virt[2][MEMPROF_KINDS][EAR_PAGE_COUNT];
+	uint64_t (*phys)[MEMPROF_KINDS][MEMPROF_PHYS_PAGES];
+} MemProfiler;
+
+
+/*!
+ * @brief Create a memory access profiler and insert it between the CPU and the MMU
+ * and between the MMU and the bus. This should happen before the debugger interposes
+ * so that the debugger's own memory accesses aren't counted.
+ * 
+ * @param path Path of the CSV file to write when the profiler is closed
+ * @param cpu EAR processor whose memory accesses are counted
+ * @param mmu MMU used by the processor
+ * @param bus Physical memory bus, used to name the devices that were accessed
+ * 
+ * @return Newly created profiler, or NULL on error
+ */
+MemProfiler* MemProfiler_open(const char* path, EAR* cpu, MMU* mmu, Bus* bus);
+
+/*!
+ * @brief Counts a virtual memory access by the CPU, then performs it.
+ * 
+ * Accesses without an `out_r` pointer come from the debugger rather than the
+ * CPU, and aren't counted.
+ */
+bool MemProfiler_memoryHandler(
+	void* cookie, EAR_Protection prot, Bus_AccessMode mode,
+	EAR_FullAddr vmaddr, bool is_byte, void* data, EAR_HaltReason* out_r
+);
+
+/*! Counts a physical memory access caused by the CPU, then performs it. */
+bool MemProfiler_busHandler(
+	void* cookie, Bus_AccessMode mode,
+	EAR_PhysAddr paddr, bool is_byte, void* data,
+	EAR_HaltReason* out_r
+);
+
+/*!
+ * @brief Write the CSV summary and destroy the profiler. The profiler's handlers
+ * must not be called after this.
+ * 
+ * @return True if the summary was written successfully
+ */
+bool MemProfiler_close(MemProfiler** pmp);
+
+#endif /* EARDBG_MEMPROF_H */
@@ -8,9 +8,11 @@
 #include "pegasus.h"
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
-#include "common/dynamic_string.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "libear/types.h"
 
 
@@ -30,39 +32,91 @@ struct Pegasus_CommandHeader {
 static PegStatus Pegasus_parse(Pegasus* self);
 
 
-static bool Pegasus_readString(Pegasus* self, dynamic_string* str) {
-	if(!str) {
-		return false;
+static void Pegasus_releaseData(Pegasus* self) {
+	if(self->map_size != 0) {
+		munmap(self->peg_data, self->map_size);
+		self->peg_data = NULL;
+		self->map_size = 0;
+	}
+	else if(self->should_free) {
+		destroy(&self->peg_data);
+	}
+}
+
+
+static void Pegasus_releaseNames(Pegasus* self) {
+	foreach(&self->name_blocks, pblock) {
+		destroy(pblock);
 	}
+	array_clear(&self->name_blocks);
+	
+	self->name_next = NULL;
+	self->name_avail = 0;
+}
+
+
+// Free everything parsed from the PEGASUS file, and the lookup tables built from it
+static void Pegasus_releaseTables(Pegasus* self) {
+	array_clear(&self->symbols_sorted_by_name);
+	array_clear(&self->symbols_sorted_by_value);
+	destroy(&self->symbol_index_by_addr);
 	
-	// Mark string as empty
-	str->count = 0;
+	// Segment and symbol names all live in the name blocks
+	array_clear(&self->segments);
+	array_clear(&self->symbols);
+	Pegasus_releaseNames(self);
 	
-	// Read first byte of the lestring
-	char c = 0;
-	if(!Pegasus_read(self, &c, 1)) {
-		return false;
+	array_clear(&self->entrypoints);
+	array_clear(&self->relocs);
+}
+
+
+static char* Pegasus_allocName(Pegasus* self, size_t size) {
+	// Start a new block when the current one is full, leaving its unused tail behind
+	if(size > self->name_avail) {
+		size_t block_size = MAX(size, PEGASUS_NAME_BLOCK_SIZE);
+		char* block = malloc(block_size);
+		if(!block) {
+			return NULL;
+		}
+		
+		array_append(&self->name_blocks, block);
+		self->name_next = block;
+		self->name_avail = block_size;
 	}
 	
-	// Add first character to the string
-	string_appendChar(str, c & 0x7f);
+	char* name = self->name_next;
+	self->name_next += size;
+	self->name_avail -= size;
+	return name;
+}
+
+
+static char* Pegasus_readString(Pegasus* self) {
+	const unsigned char* str = Pegasus_getData(self);
+	size_t len = 0;
+	
+	// Find the end of the lestring, which is the first byte without its continuation bit set.
+	// A lone zero byte is the empty string.
+	do {
+		if(len >= self->peg_size - self->peg_pos) {
+			return NULL;
+		}
+	} while(str[len++] & 0x80);
 	
-	// Special case: when first byte is zero, it's the empty string
-	if(c == 0) {
-		return true;
+	char* name = Pegasus_allocName(self, len + 1);
+	if(!name) {
+		return NULL;
 	}
 	
-	// Keep going as long as the previous byte's continuation bit is set
-	while(c & 0x80) {
-		if(!Pegasus_read(self, &c, 1)) {
-			return false;
-		}
-		
-		// Append current byte's character value to the string
-		string_appendChar(str, c & 0x7f);
+	size_t i;
+	for(i = 0; i < len; i++) {
+		name[i] = str[i] & 0x7f;
 	}
+	name[len] = '\0';
 	
-	return true;
+	Pegasus_seek(self, len, SEEK_CUR);
+	return name;
 }
 
 
@@ -73,56 +127,150 @@ Pegasus* Pegasus_new(void) {
 
 
 /*!
- * @brief Parse a pegasus file from the given file path.
+ * @brief Map the contents of an open file into memory so that it can be attached
+ * directly to the physical memory bus. Regular files (including memfds) are mapped
+ * copy-on-write, while pipes and sockets are read until EOF into anonymous memory.
+ * Either way, the mapping is padded with zeroes to a whole number of EAR pages.
  * 
- * @param filename Path to the pegasus file to load
+ * @param fd Open file descriptor to read from, which is left open
+ * @param max_size Maximum number of bytes allowed in the file
+ * @param out_size Output variable set to the number of bytes in the file
+ * @param out_map_size Output variable set to the size of the mapping, for munmap()
+ * 
+ * @return The mapping, or MAP_FAILED with errno set (EFBIG if the file is larger
+ *         than `max_size`, or ENODATA if it's empty)
  */
-PegStatus Pegasus_parseFromFile(Pegasus* self, const char* filename) {
-	PegStatus s = PEG_SUCCESS;
-	int fd = -1;
-	dynamic_array(char) file_data = {0};
-	char read_buf[256];
-	ssize_t bytes_read = 0;
-	
-	// Normal filename
-	if(fd == -1) {
-		fd = open(filename, O_RDONLY);
-		if(fd < 0) {
-			s = PEG_IO_ERROR;
-			goto cleanup;
+void* Pegasus_mapFd(int fd, size_t max_size, size_t* out_size, size_t* out_map_size) {
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		return MAP_FAILED;
+	}
+	
+	if(S_ISREG(st.st_mode)) {
+		if(st.st_size == 0) {
+			errno = ENODATA;
+			return MAP_FAILED;
 		}
+		if((size_t)st.st_size > max_size) {
+			errno = EFBIG;
+			return MAP_FAILED;
+		}
+		
+		// Round up to a whole EAR page. The tail of the last host page past EOF reads as zeroes.
+		// A private mapping still shares the page cache, but allows Pegasus_write().
+		size_t map_size = EAR_CEIL_PAGE((size_t)st.st_size);
+		void* map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FILE, fd, 0);
+		if(map != MAP_FAILED) {
+			*out_size = (size_t)st.st_size;
+			*out_map_size = map_size;
+		}
+		return map;
 	}
 	
-	while(true) {
-		bytes_read = read(fd, read_buf, sizeof(read_buf));
-		if(bytes_read < 0) {
-			s = PEG_IO_ERROR;
-			goto cleanup;
+	// Read one byte past the limit to tell whether the file is too large
+	size_t host_page = (size_t)sysconf(_SC_PAGESIZE);
+	size_t cap = (max_size + 1 + host_page - 1) & ~(host_page - 1);
+	uint8_t* map = mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED) {
+		return MAP_FAILED;
+	}
+	
+	size_t size = 0;
+	while(size <= max_size) {
+		ssize_t n = read(fd, map + size, cap - size);
+		if(n < 0 && errno == EINTR) {
+			continue;
 		}
-		else if(bytes_read == 0) {
+		if(n < 0) {
+			int saved_errno = errno;
+			munmap(map, cap);
+			errno = saved_errno;
+			return MAP_FAILED;
+		}
+		if(n == 0) {
 			break;
 		}
-		
-		array_extend(&file_data, read_buf, bytes_read);
+		size += (size_t)n;
 	}
 	
-	array_shrink(&file_data);
+	if(size == 0 || size > max_size) {
+		munmap(map, cap);
+		errno = size == 0 ? ENODATA : EFBIG;
+		return MAP_FAILED;
+	}
 	
-	// Parse pegasus file
-	s = Pegasus_parseFromMemory(self, file_data.elems, file_data.count, true);
-	if(s != PEG_SUCCESS) {
-		array_clear(&file_data);
-		goto cleanup;
+	// Give back the host pages past the end of the padded data
+	size_t map_size = EAR_CEIL_PAGE(size);
+	size_t keep = (map_size + host_page - 1) & ~(host_page - 1);
+	if(keep < cap) {
+		munmap(map + keep, cap - keep);
 	}
 	
-	// When the above succeeds, the Pegasus object takes ownership of the
-	// memory allocated for file_data. Therefore, don't array_clear() it.
+	*out_size = size;
+	*out_map_size = map_size;
+	return map;
+}
+
+
+/*!
+ * @brief Parse a pegasus file from an open file descriptor, such as a memfd, a pipe,
+ * or a socket, without going through the filesystem. The data is mapped with
+ * `Pegasus_mapFd`, so `peg_data` can be attached directly to the physical memory bus.
+ * 
+ * @param fd Open file descriptor to read the pegasus file from, which is left open
+ */
+PegStatus Pegasus_parseFromFd(Pegasus* self, int fd) {
+	size_t size = 0;
+	size_t map_size = 0;
+	// Nothing larger could ever be attached to an EAR machine's bus
+	void* map = Pegasus_mapFd(fd, EAR_PHYSICAL_ADDRESS_SPACE_SIZE, &size, &map_size);
+	if(map == MAP_FAILED) {
+		return errno == ENODATA ? PEG_TRUNC_HEADER : PEG_IO_ERROR;
+	}
 	
-cleanup:
-	if(fd != -1) {
-		close(fd);
+	PegStatus s = Pegasus_parseFromMapping(self, map, size, map_size);
+	if(s != PEG_SUCCESS) {
+		munmap(map, map_size);
+	}
+	return s;
+}
+
+
+/*!
+ * @brief Parse a pegasus file from a mapping made by `Pegasus_mapFd`. When parsing
+ * succeeds, the Pegasus object takes ownership of the mapping and unmaps it when it's
+ * destroyed or parses another file. Otherwise, the caller still owns the mapping.
+ * 
+ * @param map Mapping that starts with the PEGASUS file data
+ * @param size Number of bytes in the PEGASUS file data
+ * @param map_size Size of the whole mapping, for munmap()
+ */
+PegStatus Pegasus_parseFromMapping(Pegasus* self, void* map, size_t size, size_t map_size) {
+	PegStatus s = Pegasus_parseFromMemory(self, map, size, false);
+	if(s != PEG_SUCCESS) {
+		return s;
+	}
+	
+	self->map_size = map_size;
+	return PEG_SUCCESS;
+}
+
+
+/*!
+ * @brief Parse a pegasus file from the given file path. The file is mapped into memory
+ * (copy-on-write) rather than read, and the mapping is padded to a whole number of EAR
+ * pages so that `peg_data` can be attached directly to the physical memory bus.
+ * 
+ * @param filename Path to the pegasus file to load
+ */
+PegStatus Pegasus_parseFromFile(Pegasus* self, const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		return PEG_IO_ERROR;
 	}
 	
+	PegStatus s = Pegasus_parseFromFd(self, fd);
+	close(fd);
 	return s;
 }
 
@@ -140,9 +288,8 @@ PegStatus Pegasus_parseFromMemory(Pegasus* self, void* data, size_t size, bool s
 		return PEG_INVALID_PARAMETER;
 	}
 	
-	if(self->should_free) {
-		destroy(&self->peg_data);
-	}
+	Pegasus_releaseData(self);
+	Pegasus_releaseTables(self);
 	
 	memset(self, 0, sizeof(*self));
 	self->peg_data = data;
@@ -243,7 +390,6 @@ bool Pegasus_write(Pegasus* self, const void* data, size_t nbytes) {
 
 static PegStatus Pegasus_parse(Pegasus* self) {
 	PegStatus s = PEG_SUCCESS;
-	dynamic_string nameBuffer = {0};
 	
 	// Read in header
 	if(!Pegasus_read(self, &self->header, sizeof(self->header))) {
@@ -290,11 +436,11 @@ static PegStatus Pegasus_parse(Pegasus* self) {
 					s = PEG_TRUNC_SEGMENT;
 					goto cleanup;
 				}
-				if(!Pegasus_readString(self, &nameBuffer)) {
+				seg.name = Pegasus_readString(self);
+				if(!seg.name) {
 					s = PEG_TRUNC_SEGMENT_NAME;
 					goto cleanup;
 				}
-				seg.name = string_dup(&nameBuffer);
 				array_append(&self->segments, seg);
 				break;
 			}
@@ -341,11 +487,11 @@ static PegStatus Pegasus_parse(Pegasus* self) {
 					}
 					
 					// Read symbol name
-					if(!Pegasus_readString(self, &nameBuffer)) {
+					sym.name = Pegasus_readString(self);
+					if(!sym.name) {
 						s = PEG_TRUNC_SYMBOL_NAME;
 						goto cleanup;
 					}
-					sym.name = string_dup(&nameBuffer);
 					sym.index = j;
 					array_append(&self->symbols, sym);
 				}
@@ -390,7 +536,6 @@ static PegStatus Pegasus_parse(Pegasus* self) {
 	}
 	
 cleanup:
-	string_clear(&nameBuffer);
 	return s;
 }
 
@@ -498,15 +643,10 @@ Pegasus_Symbol* Pegasus_findSymbolByName(Pegasus* self, const char* name) {
 }
 
 
-/*!
- * @brief Look up the nearest symbol before the given address.
- * 
- * @param addr Virtual address to look up
- * @return Symbol if found, or NULL otherwise
- */
-Pegasus_Symbol* Pegasus_findSymbolByAddress(Pegasus* self, uint16_t addr) {
+static void Pegasus_buildAddressIndex(Pegasus* self) {
 	if(self->symbols_sorted_by_value.count != self->symbols.count) {
 		array_clear(&self->symbols_sorted_by_value);
+		destroy(&self->symbol_index_by_addr);
 		
 		foreach(&self->symbols, pSym) {
 			array_append(&self->symbols_sorted_by_value, pSym);
@@ -518,36 +658,59 @@ Pegasus_Symbol* Pegasus_findSymbolByAddress(Pegasus* self, uint16_t addr) {
 		);
 	}
 	
-	if(!self->symbols_sorted_by_value.count) {
-		// No symbols to search
-		return NULL;
+	if(self->symbol_index_by_addr || !self->symbols_sorted_by_value.count) {
+		return;
 	}
 	
-	ssize_t lo = 0, hi = self->symbols_sorted_by_value.count - 1;
-	while(lo <= hi) {
-		ssize_t mid = (lo + hi + 1) / 2;
-		Pegasus_Symbol* sym = *array_at(&self->symbols_sorted_by_value, mid);
-		
-		if(addr > sym->value) {
-			// Symbol is before the target address
-			lo = mid + 1;
-		}
-		else if(addr < sym->value) {
-			// Symbol is after the target address
-			hi = mid - 1;
-		}
-		else {
-			return sym;
+	self->symbol_index_by_addr = calloc(EAR_VIRTUAL_ADDRESS_SPACE_SIZE, sizeof(*self->symbol_index_by_addr));
+	if(!self->symbol_index_by_addr) {
+		return;
+	}
+	
+	// Table entries are 16-bit, with 0 meaning no symbol. The symbol table's count is
+	// 16-bit too, so parsed images can't have more symbols than this anyway.
+	size_t count = MIN(self->symbols_sorted_by_value.count, (size_t)UINT16_MAX);
+	
+	// Walk the whole address space once alongside the sorted symbols. Each address
+	// maps to the last symbol whose value is at or before it.
+	uint32_t addr;
+	size_t next = 0;
+	uint16_t cur = 0;
+	for(addr = 0; addr < EAR_VIRTUAL_ADDRESS_SPACE_SIZE; addr++) {
+		while(next < count
+			&& (*array_at(&self->symbols_sorted_by_value, next))->value <= addr
+		) {
+			cur = (uint16_t)++next;
 		}
+		
+		self->symbol_index_by_addr[addr] = cur;
 	}
+}
+
+
+/*!
+ * @brief Look up the nearest symbol before the given address.
+ * 
+ * @note The first lookup builds a table covering the whole 64K address space, after
+ *       which every lookup is a single table access.
+ * @param addr Virtual address to look up
+ * @return Symbol if found, or NULL otherwise
+ */
+Pegasus_Symbol* Pegasus_findSymbolByAddress(Pegasus* self, uint16_t addr) {
+	Pegasus_buildAddressIndex(self);
 	
-	if(lo == 0) {
+	if(!self->symbol_index_by_addr) {
+		// No symbols to search
+		return NULL;
+	}
+	
+	uint16_t idx = self->symbol_index_by_addr[addr];
+	if(idx == 0) {
 		// No symbols before the target address
 		return NULL;
 	}
 	
-	// Return the closest symbol before the target address
-	return *array_at(&self->symbols_sorted_by_value, lo - 1);
+	return *array_at(&self->symbols_sorted_by_value, idx - 1);
 }
 
 
@@ -560,25 +723,8 @@ void Pegasus_destroy(Pegasus** pself) {
 	
 	*pself = NULL;
 	
-	array_clear(&self->symbols_sorted_by_name);
-	array_clear(&self->symbols_sorted_by_value);
-	
-	foreach(&self->segments, pseg) {
-		destroy(&pseg->name);
-	}
-	array_clear(&self->segments);
-	
-	foreach(&self->symbols, psym) {
-		destroy(&psym->name);
-	}
-	array_clear(&self->symbols);
-	
-	array_clear(&self->entrypoints);
-	array_clear(&self->relocs);
-	
-	if(self->should_free) {
-		destroy(&self->peg_data);
-	}
+	Pegasus_releaseTables(self);
+	Pegasus_releaseData(self);
 	
 	destroy(&self);
 }
@@ -32,12 +32,18 @@ struct Pegasus_Header {
 #define PEGASUS_MAGIC "\xe4PEGASUS"
 #define PEGASUS_ARCH_EAR3 "EAR3"
 
+//! Minimum size of each block used to allocate segment and symbol names
+#define PEGASUS_NAME_BLOCK_SIZE 4096
+
 struct Pegasus {
 	void* peg_data;
 	size_t peg_size;
 	size_t peg_pos;
 	bool should_free;
 	
+	// Nonzero when peg_data is a mapping created by Pegasus_mapFd()
+	size_t map_size;
+	
 	Pegasus_Header header;
 	
 	dynamic_array(Pegasus_Segment) segments;
@@ -50,9 +56,19 @@ struct Pegasus {
 	// not without a lot of extra bookkeeping).
 	dynamic_array(Pegasus_Entrypoint*) entrypoints;
 	
-	// For quick lookups
+	// For quick lookups. These are only built the first time a lookup needs them.
 	dynamic_array(Pegasus_Symbol*) symbols_sorted_by_name;
 	dynamic_array(Pegasus_Symbol*) symbols_sorted_by_value;
+	
+	// For each virtual address, one plus the index in symbols_sorted_by_value of
+	// the nearest symbol at or before that address (zero if there isn't one)
+	uint16_t* symbol_index_by_addr;
+	
+	// Segment and symbol names are carved out of these blocks instead of
+	// being allocated individually, and are all freed together
+	dynamic_array(char*) name_blocks;
+	char* name_next;
+	size_t name_avail;
 };
 
 struct Pegasus_Segment {
@@ -67,7 +83,7 @@ struct Pegasus_Segment {
 struct Pegasus_Entrypoint {
 	uint16_t a0, a1, a2, a3, a4, a5;
 	uint16_t s0, s1, s2;
-	uint16_t fp;
+	uint16_t fp, sp;
 	uint16_t ra, rd;
 	uint16_t pc, dpc;
 } __attribute__((packed));
@@ -88,7 +104,45 @@ struct Pegasus_Relocation {
 Pegasus* Pegasus_new(void);
 
 /*!
- * @brief Parse a pegasus file from the given file path.
+ * @brief Map the contents of an open file into memory so that it can be attached
+ * directly to the physical memory bus. Regular files (including memfds) are mapped
+ * copy-on-write, while pipes and sockets are read until EOF into anonymous memory.
+ * Either way, the mapping is padded with zeroes to a whole number of EAR pages.
+ * 
+ * @param fd Open file descriptor to read from, which is left open
+ * @param max_size Maximum number of bytes allowed in the file
+ * @param out_size Output variable set to the number of bytes in the file
+ * @param out_map_size Output variable set to the size of the mapping, for munmap()
+ * 
+ * @return The mapping, or MAP_FAILED with errno set (EFBIG if the file is larger
+ *         than `max_size`, or ENODATA if it's empty)
+ */
+void* Pegasus_mapFd(int fd, size_t max_size, size_t* out_size, size_t* out_map_size);
+
+/*!
+ * @brief Parse a pegasus file from an open file descriptor, such as a memfd, a pipe,
+ * or a socket, without going through the filesystem. The data is mapped with
+ * `Pegasus_mapFd`, so `peg_data` can be attached directly to the physical memory bus.
+ * 
+ * @param fd Open file descriptor to read the pegasus file from, which is left open
+ */
+PegStatus Pegasus_parseFromFd(Pegasus* self, int fd);
+
+/*!
+ * @brief Parse a pegasus file from a mapping made by `Pegasus_mapFd`. When parsing
+ * succeeds, the Pegasus object takes ownership of the mapping and unmaps it when it's
+ * destroyed or parses another file. Otherwise, the caller still owns the mapping.
+ * 
+ * @param map Mapping that starts with the PEGASUS file data
+ * @param size Number of bytes in the PEGASUS file data
+ * @param map_size Size of the whole mapping, for munmap()
+ */
+PegStatus Pegasus_parseFromMapping(Pegasus* self, void* map, size_t size, size_t map_size);
+
+/*!
+ * @brief Parse a pegasus file from the given file path. The file is mapped into memory
+ * (copy-on-write) rather than read, and the mapping is padded to a whole number of EAR
+ * pages so that `peg_data` can be attached directly to the physical memory bus.
  * 
  * @param filename Path to the pegasus file to load
  */
@@ -162,6 +216,8 @@ Pegasus_Symbol* Pegasus_findSymbolByName(Pegasus* self, const char* name);
 /*!
  * @brief Look up the nearest symbol before the given address.
  * 
+ * @note The first lookup builds a table covering the whole 64K address space, after
+ *       which every lookup is a single table access.
  * @param addr Virtual address to look up
  * @return Symbol if found, or NULL otherwise
  */
@@ -0,0 +1,372 @@
+//
+//  profile.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "profile.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <sys/time.h>
+#include "common/dynamic_string.h"
+#include "common/macros.h"
+
+
+//! Initial number of slots in the stack hash table
+#define PROFILE_TABLE_INITIAL_SIZE 1024
+
+// Set by the SIGPROF handler when it's time to take a sample
+static volatile sig_atomic_t g_profile_tick = 0;
+
+static void profile_signal_handler(int signum) {
+	(void)signum;
+	g_profile_tick = 1;
+}
+
+
+/*!
+ * @brief Create a profiler that writes folded stacks to a file when it's closed.
+ * 
+ * @param dbg Debugger used to read the stack and find symbols
+ * @param path Path of the file to write
+ * @param interval Number of instructions between samples
+ * 
+ * @return Newly created profiler, or NULL on error
+ */
+Profiler* Profiler_open(Debugger* dbg, const char* path, uint32_t interval) {
+	// Make sure the output file can be written before running anything
+	FILE* fp = fopen(path, "w");
+	if(!fp) {
+		return NULL;
+	}
+	fclose(fp);
+	
+	Profiler* prof = calloc(1, sizeof(*prof));
+	if(!prof) {
+		return NULL;
+	}
+	
+	prof->dbg = dbg;
+	prof->path = strdup(path);
+	prof->interval = MAX(interval, 1U);
+	prof->countdown = prof->interval;
+	prof->table_size = PROFILE_TABLE_INITIAL_SIZE;
+	prof->table = calloc(prof->table_size, sizeof(*prof->table));
+	if(!prof->path || !prof->table) {
+		free(prof->path);
+		free(prof->table);
+		free(prof);
+		return NULL;
+	}
+	
+	return prof;
+}
+
+
+/*!
+ * @brief Take samples when SIGPROF is delivered instead of counting instructions.
+ * 
+ * @param hz Number of samples per second of host CPU time
+ * 
+ * @return True if the profiling timer was started
+ */
+bool Profiler_startTimer(Profiler* prof, unsigned hz) {
+	if(hz == 0) {
+		return false;
+	}
+	
+	struct sigaction sa = {0};
+	sa.sa_handler = profile_signal_handler;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if(sigaction(SIGPROF, &sa, NULL) != 0) {
+		return false;
+	}
+	
+	long usec = MAX(1000000L / hz, 1L);
+	struct itimerval timer = {
+		.it_interval = {.tv_sec = usec / 1000000, .tv_usec = usec % 1000000},
+		.it_value = {.tv_sec = usec / 1000000, .tv_usec = usec % 1000000},
+	};
+	if(setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+		return false;
+	}
+	
+	prof->timer = true;
+	return true;
+}
+
+
+// Find the function containing an address, ignoring addresses outside the PEGASUS file's
+// segments (like the return address of the outermost frame) that would otherwise be
+// attributed to whichever symbol happens to come before them
+static Pegasus_Symbol* Profiler_findSymbol(Pegasus* peg, EAR_VirtAddr pc) {
+	if(!peg) {
+		return NULL;
+	}
+	
+	unsigned page = EAR_PAGE_NUMBER(pc);
+	foreach(&peg->segments, seg) {
+		unsigned page_count = seg->present_page_count + seg->absent_page_count;
+		if(page >= seg->virtual_page && page < seg->virtual_page + page_count) {
+			return Pegasus_findSymbolByAddress(peg, pc);
+		}
+	}
+	
+	return NULL;
+}
+
+
+static bool Profiler_addFrame(void* cookie, unsigned index, EAR_VirtAddr pc, EAR_UWord dpc) {
+	Profiler* prof = cookie;
+	(void)dpc;
+	
+	if(prof->sample_depth == PROFILE_MAX_DEPTH) {
+		return false;
+	}
+	
+	if(index == 0 && prof->sample_top != UINT32_MAX) {
+		pc = (EAR_VirtAddr)prof->sample_top;
+	}
+	
+	// Frames are counted by the function they're in rather than the exact address
+	uint8_t bank = (prof->sample_flags & PROFILE_FRAME_BANK) ? 1 : 0;
+	Pegasus_Symbol* sym = Profiler_findSymbol(prof->dbg->pegs[bank], pc);
+	uint32_t frame = prof->sample_flags;
+	if(sym) {
+		frame |= PROFILE_FRAME_SYMBOL | sym->value;
+	}
+	else {
+		frame |= pc;
+	}
+	
+	prof->sample[prof->sample_depth++] = frame;
+	return true;
+}
+
+
+// Add the frames of one thread state to the sample, outermost first
+static void Profiler_collect(Profiler* prof, EAR* cpu, bool alt) {
+	EAR_ThreadState* ctx = CTX_X(*cpu, alt);
+	uint32_t start = prof->sample_depth;
+	
+	prof->sample_flags = 0;
+	if(cpu->ctx.active ^ alt) {
+		prof->sample_flags |= PROFILE_FRAME_BANK;
+	}
+	if(Debugger_isKernelMode(ctx)) {
+		prof->sample_flags |= PROFILE_FRAME_KERNEL;
+	}
+	
+	// The PC register of the running thread already points past the current instruction
+	prof->sample_top = alt ? UINT32_MAX : ctx->cr[CR_INSN_ADDR];
+	
+	Debugger_unwind(prof->dbg, alt, /*quiet=*/true, &Profiler_addFrame, prof);
+	
+	// Frames are found innermost first
+	uint32_t lo = start, hi = prof->sample_depth;
+	while(hi - lo >= 2) {
+		uint32_t tmp = prof->sample[lo];
+		prof->sample[lo++] = prof->sample[--hi];
+		prof->sample[hi] = tmp;
+	}
+}
+
+
+static uint32_t Profiler_hash(const uint32_t* frames, uint32_t depth) {
+	// FNV-1a
+	uint32_t hash = 2166136261U;
+	for(uint32_t i = 0; i < depth; i++) {
+		hash = (hash ^ frames[i]) * 16777619U;
+	}
+	return hash;
+}
+
+
+static void Profiler_grow(Profiler* prof) {
+	size_t new_size = prof->table_size * 2;
+	uint32_t* new_table = calloc(new_size, sizeof(*new_table));
+	if(!new_table) {
+		abort();
+	}
+	
+	enumerate(&prof->stacks, i, stack) {
+		size_t slot = stack->hash & (new_size - 1);
+		while(new_table[slot] != 0) {
+			slot = (slot + 1) & (new_size - 1);
+		}
+		new_table[slot] = (uint32_t)i + 1;
+	}
+	
+	free(prof->table);
+	prof->table = new_table;
+	prof->table_size = new_size;
+}
+
+
+// Count the sample that was just collected
+static void Profiler_addSample(Profiler* prof) {
+	uint32_t depth = prof->sample_depth;
+	uint32_t hash = Profiler_hash(prof->sample, depth);
+	
+	if((prof->stacks.count + 1) * 2 > prof->table_size) {
+		Profiler_grow(prof);
+	}
+	
+	size_t mask = prof->table_size - 1;
+	size_t slot;
+	for(slot = hash & mask; prof->table[slot] != 0; slot = (slot + 1) & mask) {
+		ProfileStack* stack = &prof->stacks.elems[prof->table[slot] - 1];
+		if(stack->hash == hash
+			&& stack->depth == depth
+			&& memcmp(&prof->frames.elems[stack->first], prof->sample, depth * sizeof(*prof->sample)) == 0
+		) {
+			++stack->count;
+			++prof->sample_count;
+			return;
+		}
+	}
+	
+	ProfileStack stack = {
+		.count = 1,
+		.hash = hash,
+		.first = (uint32_t)prof->frames.count,
+		.depth = depth,
+	};
+	array_extend(&prof->frames, prof->sample, depth);
+	array_append(&prof->stacks, stack);
+	prof->table[slot] = (uint32_t)prof->stacks.count;
+	++prof->sample_count;
+}
+
+
+static void Profiler_sample(Profiler* prof, EAR* cpu) {
+	prof->sample_depth = 0;
+	
+	// An exception handler's stack continues from the user code it interrupted
+	if(Debugger_isKernelMode(CTX(*cpu)) && !Debugger_isKernelMode(CTX_X(*cpu, 1))) {
+		Profiler_collect(prof, cpu, true);
+	}
+	Profiler_collect(prof, cpu, false);
+	
+	Profiler_addSample(prof);
+}
+
+
+/*!
+ * @brief Sample the stack when it's time. Call this from the CPU's exec hook with the same arguments.
+ * 
+ * @param cpu EAR processor executing the instruction
+ * @param before True if called before executing the instruction, false if after
+ */
+void Profiler_execHook(Profiler* prof, EAR* cpu, bool before) {
+	if(!before) {
+		return;
+	}
+	
+	if(prof->timer) {
+		if(!g_profile_tick) {
+			return;
+		}
+		g_profile_tick = 0;
+	}
+	else if(--prof->countdown != 0) {
+		return;
+	}
+	else {
+		prof->countdown = prof->interval;
+	}
+	
+	Profiler_sample(prof, cpu);
+}
+
+
+static void Profiler_appendFrameName(Profiler* prof, uint32_t frame, dynamic_string* out) {
+	EAR_VirtAddr addr = (EAR_VirtAddr)(frame & 0xFFFF);
+	Pegasus* peg = prof->dbg->pegs[(frame & PROFILE_FRAME_BANK) ? 1 : 0];
+	Pegasus_Symbol* sym = NULL;
+	if((frame & PROFILE_FRAME_SYMBOL) && peg) {
+		sym = Pegasus_findSymbolByAddress(peg, addr);
+	}
+	
+	if(sym) {
+		string_append(out, sym->name);
+	}
+	else {
+		char buf[8];
+		snprintf(buf, sizeof(buf), "0x%04X", addr);
+		string_append(out, buf);
+	}
+	
+	// Flamegraph tools color frames with this suffix as kernel code
+	if(frame & PROFILE_FRAME_KERNEL) {
+		string_append(out, "_[k]");
+	}
+}
+
+
+static int compare_lines(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+
+/*!
+ * @brief Write the folded stacks to the output file and destroy the profiler.
+ * 
+ * @return True if the output file was written successfully
+ */
+bool Profiler_close(Profiler** pprof) {
+	Profiler* prof = *pprof;
+	if(!prof) {
+		return true;
+	}
+	*pprof = NULL;
+	
+	if(prof->timer) {
+		struct itimerval timer = {0};
+		setitimer(ITIMER_PROF, &timer, NULL);
+		signal(SIGPROF, SIG_IGN);
+	}
+	
+	// Build each folded stack line, then sort them so the output is stable
+	dynamic_array(char*) lines = {0};
+	foreach(&prof->stacks, stack) {
+		dynamic_string line = {0};
+		for(uint32_t i = 0; i < stack->depth; i++) {
+			if(i != 0) {
+				string_appendChar(&line, ';');
+			}
+			Profiler_appendFrameName(prof, prof->frames.elems[stack->first + i], &line);
+		}
+		
+		char count[24];
+		snprintf(count, sizeof(count), " %" PRIu64, stack->count);
+		string_append(&line, count);
+		array_append(&lines, string_cstr(&line));
+	}
+	if(lines.count != 0) {
+		qsort(lines.elems, lines.count, sizeof(*lines.elems), compare_lines);
+	}
+	
+	bool ok = false;
+	FILE* fp = fopen(prof->path, "w");
+	if(fp) {
+		foreach(&lines, line) {
+			fprintf(fp, "%s\n", *line);
+		}
+		ok = !ferror(fp);
+		ok = fclose(fp) == 0 && ok;
+	}
+	
+	array_destroy(&lines);
+	array_clear(&prof->frames);
+	array_clear(&prof->stacks);
+	free(prof->table);
+	free(prof->path);
+	free(prof);
+	return ok;
+}
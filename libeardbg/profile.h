@@ -0,0 +1,113 @@
+//
+//  profile.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_PROFILE_H
+#define EARDBG_PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/dynamic_array.h"
+#include "libear/ear.h"
+#include "debugger.h"
+
+
+/*
+ * Sampling profiler for guest code. Each sample walks the stack like the
+ * debugger's `bt` command, and identical stacks are counted together. The
+ * result is written in the "folded stacks" format used by flamegraph tools:
+ * 
+ *   outer;caller;callee <count>
+ * 
+ * Frames are named by the symbol containing them, using the Pegasus image of
+ * the register bank that was running them. Frames that ran in kernel mode end
+ * with "_[k]". A sample taken in kernel mode while handling an exception from
+ * user mode also includes the interrupted user stack as its outer frames.
+ */
+
+//! Default number of instructions between samples
+#define PROFILE_DEFAULT_INTERVAL 1000
+
+//! Deepest stack that is recorded for one sample
+#define PROFILE_MAX_DEPTH 128
+
+// Bits in a profile frame, along with the address in the low 16 bits
+#define PROFILE_FRAME_SYMBOL (1U << 16) //!< Address is the start of a symbol
+#define PROFILE_FRAME_KERNEL (1U << 17) //!< Frame ran in kernel mode
+#define PROFILE_FRAME_BANK   (1U << 18) //!< Frame ran on register bank 1
+
+//! One unique stack and the number of times it was sampled
+typedef struct ProfileStack {
+	uint64_t count;
+	uint32_t hash;
+	uint32_t first;  //!< Index of the outermost frame in Profiler.frames
+	uint32_t depth;
+} ProfileStack;
+
+typedef struct Profiler {
+	Debugger* dbg;
+	char* path;
+	
+	// Sampling is triggered by either an instruction count or SIGPROF
+	uint32_t interval;
+	uint32_t countdown;
+	bool timer;
+	
+	// Frames of every unique stack, outermost first
+	dynamic_array(uint32_t) frames;
+	dynamic_array(ProfileStack) stacks;
+	
+	// Open-addressed hash table of indices into `stacks`, plus one (0 is empty)
+	uint32_t* table;
+	size_t table_size;
+	
+	// Frames of the sample being taken
+	uint32_t sample[PROFILE_MAX_DEPTH];
+	uint32_t sample_depth;
+	uint32_t sample_flags;   //!< PROFILE_FRAME_* bits for the frames being collected
+	uint32_t sample_top;     //!< Replaces the address of frame 0, or UINT32_MAX
+	
+	uint64_t sample_count;
+} Profiler;
+
+
+/*!
+ * @brief Create a profiler that writes folded stacks to a file when it's closed.
+ * 
+ * @param dbg Debugger used to read the stack and find symbols
+ * @param path Path of the file to write
+ * @param interval Number of instructions between samples
+ * 
+ * @return Newly created profiler, or NULL on error
+ */
+Profiler* Profiler_open(Debugger* dbg, const char* path, uint32_t interval);
+
+/*!
+ * @brief Take samples when SIGPROF is delivered instead of counting instructions.
+ * 
+ * @param hz Number of samples per second of host CPU time
+ * 
+ * @return True if the profiling timer was started
+ */
+bool Profiler_startTimer(Profiler* prof, unsigned hz);
+
+/*!
+ * @brief Sample the stack when it's time. Call this from the CPU's exec hook with the same arguments.
+ * 
+ * @param cpu EAR processor executing the instruction
+ * @param before True if called before executing the instruction, false if after
+ */
+void Profiler_execHook(Profiler* prof, EAR* cpu, bool before);
+
+/*!
+ * @brief Write the folded stacks to the output file and destroy the profiler.
+ * 
+ * @return True if the output file was written successfully
+ */
+bool Profiler_close(Profiler** pprof);
+
+#endif /* EARDBG_PROFILE_H */
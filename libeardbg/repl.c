@@ -1,12 +1,18 @@
 #include "repl.h"
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "common/dynamic_array.h"
+#include "common/dynamic_string.h"
 #include "linenoise/linenoise.h"
 #include "libear/ear.h"
 #include "debugger.h"
+#include "stats.h"
 #include "ansi_colors.h"
 #include "utils.h"
 
@@ -173,12 +179,19 @@ typedef enum CMD_TYPE {
 	CMD_CONTROL_REGISTERS,
 	CMD_DISASSEMBLE,
 	CMD_EXCEPTION,
+	CMD_FINISH,
 	CMD_HELP,
 	CMD_HEXDUMP,
+	CMD_LAST_WRITE,
+	CMD_NEXT,
 	CMD_PMAP,
 	CMD_QUIT,
 	CMD_REGISTERS,
+	CMD_REVERSE_CONTINUE,
+	CMD_REVERSE_STEP,
+	CMD_STATS,
 	CMD_STEP,
+	CMD_UNTIL,
 	CMD_VMMAP,
 	
 	CMD_COUNT //!< Number of command types
@@ -204,14 +217,34 @@ static CommandArgsHints hnt_vaddr = {
 	"vaddr(XXXX)", false, NULL
 };
 
-// <addr(XXXX or XX:XXXX)>
-static CommandArgsHints hnt_either_addr = {
-	"addr(XXXX or XX:XXXX)", false, NULL
+// [<size=1>]
+static CommandArgsHints hnt_watch_size = {
+	"size=1", true, NULL
 };
 
-// <mode([RWX]+)> <addr(XXXX or XX:XXXX)>
+// <addr(XXXX or XX:XXXX)> [<size=1>]
+static CommandArgsHints hnt_either_addr_size = {
+	"addr(XXXX or XX:XXXX)", false, &hnt_watch_size
+};
+
+// <mode([RWX]+)> <addr(XXXX or XX:XXXX)> [<size=1>]
 static CommandArgsHints hnt_mode_addr = {
-	"mode([RWX]+)", false, &hnt_either_addr
+	"mode([RWX]+)", false, &hnt_either_addr_size
+};
+
+// [<expr>...]
+static CommandArgsHints hnt_log_args = {
+	"expr...", true, NULL
+};
+
+// "<format>" [<expr>...]
+static CommandArgsHints hnt_log_format = {
+	"\"format\"", false, &hnt_log_args
+};
+
+// <vaddr(XXXX)> "<format>" [<expr>...]
+static CommandArgsHints hnt_vaddr_format = {
+	"vaddr(XXXX)", false, &hnt_log_format
 };
 
 // <breakpoint id>
@@ -264,6 +297,11 @@ static CommandArgsHints hnt_exception_subcmd = {
 	"exception subcommand", false, NULL
 };
 
+// [json]
+static CommandArgsHints hnt_json = {
+	"json", true, NULL
+};
+
 // This must remain sorted (according to strncasecmp)
 static CommandMapEntry cmd_map[] = {
 	{"altbacktrace",    CMD_BACKTRACE | CMD_KERNEL, NULL},
@@ -294,20 +332,36 @@ static CommandMapEntry cmd_map[] = {
 	{"exc",             CMD_EXCEPTION | CMD_KERNEL, &hnt_exception_subcmd},
 	{"exception",       CMD_EXCEPTION | CMD_KERNEL, &hnt_exception_subcmd},
 	{"exit",            CMD_QUIT, NULL},
+	{"fin",             CMD_FINISH, NULL},
+	{"finish",          CMD_FINISH, NULL},
 	{"h",               CMD_HELP, &hnt_command_or_category},
 	{"hd",              CMD_HEXDUMP, &hnt_addr_size_mode},
 	{"help",            CMD_HELP, NULL},
 	{"hexdump",         CMD_HEXDUMP, &hnt_addr_size_mode},
 	{"hlt",             CMD_EXCEPTION | CMD_KERNEL, NULL},
+	{"last-write",      CMD_LAST_WRITE, &hnt_vaddr},
+	{"lastwrite",       CMD_LAST_WRITE, &hnt_vaddr},
+	{"log",             CMD_BREAKPOINT, &hnt_vaddr_format},
+	{"n",               CMD_NEXT, NULL},
+	{"next",            CMD_NEXT, NULL},
+	{"ni",              CMD_NEXT, NULL},
 	{"pmap",            CMD_PMAP | CMD_KERNEL, NULL},
 	{"q",               CMD_QUIT, NULL},
 	{"quit",            CMD_QUIT, NULL},
+	{"rc",              CMD_REVERSE_CONTINUE, NULL},
 	{"reg",             CMD_REGISTERS, NULL},
 	{"registers",       CMD_REGISTERS, NULL},
 	{"regs",            CMD_REGISTERS, NULL},
+	{"reverse-continue", CMD_REVERSE_CONTINUE, NULL},
+	{"reverse-step",    CMD_REVERSE_STEP, NULL},
+	{"rs",              CMD_REVERSE_STEP, NULL},
+	{"rsi",             CMD_REVERSE_STEP, NULL},
 	{"s",               CMD_STEP, NULL},
 	{"si",              CMD_STEP, NULL},
+	{"stats",           CMD_STATS, &hnt_json},
 	{"step",            CMD_STEP, NULL},
+	{"unt",             CMD_UNTIL, &hnt_vaddr},
+	{"until",           CMD_UNTIL, &hnt_vaddr},
 	{"vmmap",           CMD_VMMAP, NULL},
 	{"xxd",             CMD_HEXDUMP, &hnt_addr_size_mode},
 };
@@ -369,6 +423,44 @@ static char* cmd_getNextArgument(const char** line) {
 		return NULL;
 	}
 	
+	// Quoted arguments can contain spaces, and backslash escapes a character
+	if(**line == '"') {
+		dynamic_string arg = {0};
+		
+		++*line;
+		while(**line != '"' && **line != '\0') {
+			if(**line == '\\' && (*line)[1] != '\0') {
+				++*line;
+				switch(**line) {
+					case 'n':
+						string_appendChar(&arg, '\n');
+						break;
+					
+					case 't':
+						string_appendChar(&arg, '\t');
+						break;
+					
+					default:
+						string_appendChar(&arg, **line);
+						break;
+				}
+			}
+			else {
+				string_appendChar(&arg, **line);
+			}
+			++*line;
+		}
+		
+		// Skip the closing quote
+		if(**line == '"') {
+			++*line;
+		}
+		
+		char* ret = strdup(string_cstr(&arg));
+		string_clear(&arg);
+		return ret;
+	}
+	
 	// Found start of argument
 	const char* arg_begin = *line;
 	
@@ -407,11 +499,18 @@ static void Debugger_doContinue(Debugger* dbg, Command* cmd);
 static void Debugger_doControlRegisters(Debugger* dbg, Command* cmd);
 static void Debugger_doDisassemble(Debugger* dbg, Command* cmd);
 static void Debugger_doException(Debugger* dbg, Command* cmd);
+static void Debugger_doFinish(Debugger* dbg, Command* cmd);
 static void Debugger_doHelp(Command* cmd);
 static void Debugger_doHexdump(Debugger* dbg, Command* cmd);
+static void Debugger_doLastWrite(Debugger* dbg, Command* cmd);
+static void Debugger_doNext(Debugger* dbg, Command* cmd);
 static void Debugger_doPMap(Debugger* dbg, Command* cmd);
 static void Debugger_doRegisters(Debugger* dbg, Command* cmd);
+static void Debugger_doStats(Debugger* dbg, Command* cmd);
+static void Debugger_doReverseContinue(Debugger* dbg, Command* cmd);
+static void Debugger_doReverseStep(Debugger* dbg, Command* cmd);
 static void Debugger_doStep(Debugger* dbg, Command* cmd);
+static void Debugger_doUntil(Debugger* dbg, Command* cmd);
 static void Debugger_doVMMap(Debugger* dbg, Command* cmd);
 
 
@@ -615,13 +714,23 @@ static void dbg_free_hint(void* hint) {
 }
 
 
+// Halt reasons are marked as seen once they have been reported, so they're only reported once
+#define MARK_SEEN(hr) ((hr) < 0 ? ((hr) & ~0x1000) : ((hr) | 0x1000))
+#define CLEAR_SEEN(hr) ((hr) < 0 ? ((hr) | 0x1000) : ((hr) & ~0x1000))
+#define IS_SEEN(hr) (!!((hr) & 0x1000) != ((hr) < 0))
+
+
 EAR_HaltReason Debugger_run(Debugger* dbg) {
 	// Should we even run the debugger REPL?
 	if(dbg->debug_flags & DEBUG_DETACHED) {
 		Debugger_doContinue(dbg, NULL);
+		Debugger_flushLog(dbg);
 		return dbg->r;
 	}
 	
+	// Record history from here on so that execution can be reversed
+	Debugger_startHistory(dbg);
+	
 	// When not kernel debugging, skip to the first instruction in user mode
 	if(!(dbg->debug_flags & DEBUG_KERNEL)) {
 		Debugger_stepInstruction(dbg);
@@ -666,15 +775,12 @@ EAR_HaltReason Debugger_run(Debugger* dbg) {
 			continue;
 		}
 		
-#define MARK_SEEN(hr) ((hr) < 0 ? ((hr) & ~0x1000) : ((hr) | 0x1000))
-#define CLEAR_SEEN(hr) ((hr) < 0 ? ((hr) | 0x1000) : ((hr) & ~0x1000))
-#define IS_SEEN(hr) (!!((hr) & 0x1000) != ((hr) < 0))
-		
 		// Mark this halt reason as seen
 		dbg->r = MARK_SEEN(dbg->r);
 		
 		// Run the command
 		int quit = Debugger_perform(dbg, cmd);
+		Debugger_flushLog(dbg);
 		if(quit != 0) {
 			break;
 		}
@@ -712,10 +818,257 @@ EAR_HaltReason Debugger_run(Debugger* dbg) {
 		r = HALT_DEBUGGER;
 	}
 	return r;
+}
+
+
+// Machine-readable name of a halt reason for script output
+static const char* haltReasonName(EAR_HaltReason r) {
+	switch(r) {
+		case HALT_UNALIGNED:
+			return "unaligned";
+		case HALT_MMU_FAULT:
+			return "mmu_fault";
+		case HALT_BUS_FAULT:
+			return "bus_fault";
+		case HALT_BUS_PROTECTED:
+			return "bus_protected";
+		case HALT_BUS_ERROR:
+			return "bus_error";
+		case HALT_DENIED:
+			return "denied";
+		case HALT_DECODE:
+			return "decode";
+		case HALT_DOUBLE_FAULT:
+			return "double_fault";
+		case HALT_IO_ERROR:
+			return "io_error";
+		case HALT_NONE:
+			return "none";
+		case HALT_EXCEPTION:
+			return "exception";
+		case HALT_BREAKPOINT:
+			return "breakpoint";
+		case HALT_DEBUGGER:
+			return "debugger";
+		case HALT_RETURN:
+			return "return";
+		case HALT_COMPLETE:
+			return "complete";
+		case HALT_INSN_LIMIT:
+			return "insn_limit";
+		default:
+			return "unknown";
+	}
+}
+
+
+static void json_writeString(FILE* fp, const char* str, size_t len) {
+	fputc('"', fp);
+	for(size_t i = 0; i < len; i++) {
+		unsigned char c = str[i];
+		switch(c) {
+			case '"':
+				fputs("\\\"", fp);
+				break;
+			
+			case '\\':
+				fputs("\\\\", fp);
+				break;
+			
+			case '\n':
+				fputs("\\n", fp);
+				break;
+			
+			case '\t':
+				fputs("\\t", fp);
+				break;
+			
+			default:
+				// Control characters and bytes that aren't ASCII are escaped so the output is valid UTF-8
+				if(c < 0x20 || c >= 0x7F) {
+					fprintf(fp, "\\u%04x", c);
+				}
+				else {
+					fputc(c, fp);
+				}
+				break;
+		}
+	}
+	fputc('"', fp);
+}
+
+
+// Send everything written to stderr into a temporary file until Debugger_endCapture
+static void Debugger_beginCapture(DebugScript* script) {
+	fflush(stderr);
+	script->capture = tmpfile();
+	if(script->capture) {
+		dup2(fileno(script->capture), STDERR_FILENO);
+	}
+}
+
+
+// Restore stderr and return what was written to it (must be freed), setting out_len
+static char* Debugger_endCapture(DebugScript* script, size_t* out_len) {
+	*out_len = 0;
+	if(!script->capture) {
+		return strdup("");
+	}
+	
+	fflush(stderr);
+	dup2(fileno(script->out), STDERR_FILENO);
+	
+	long size = ftell(script->capture);
+	char* text = malloc(size > 0 ? size + 1 : 1);
+	if(text) {
+		rewind(script->capture);
+		*out_len = fread(text, 1, size > 0 ? size : 0, script->capture);
+		text[*out_len] = '\0';
+	}
+	
+	fclose(script->capture);
+	script->capture = NULL;
+	return text;
+}
+
+
+// Write the JSON result of the current command, with its output and the CPU's state
+static void Debugger_writeScriptResult(Debugger* dbg, bool ran, bool exited, int status) {
+	DebugScript* script = dbg->script;
+	size_t len;
+	char* output = Debugger_endCapture(script, &len);
+	
+	fprintf(script->out, "{\"line\":%u,\"command\":", script->line_number);
+	json_writeString(script->out, script->command, strlen(script->command));
+	fprintf(script->out, ",\"output\":");
+	json_writeString(script->out, output ? output : "", output ? len : 0);
+	free(output);
+	
+	if(exited) {
+		fprintf(script->out, ",\"exited\":%d}\n", status);
+		fflush(script->out);
+		return;
+	}
+	
+	// Only report a halt reason when the command ran the CPU, like the REPL
+	EAR_HaltReason r = CLEAR_SEEN(dbg->r);
+	if(ran && !IS_SEEN(dbg->r)) {
+		fprintf(script->out, ",\"halt\":\"%s\"", haltReasonName(r));
+	}
+	else {
+		fprintf(script->out, ",\"halt\":null");
+	}
 	
-#undef MARK_SEEN
-#undef CLEAR_SEEN
-#undef IS_SEEN
+	bool alt = !(dbg->debug_flags & DEBUG_KERNEL) && Debugger_isKernelMode(CTX(*dbg->cpu));
+	fprintf(script->out, ",\"pc\":%u}\n", CTX_X(*dbg->cpu, alt)->r[PC]);
+	fflush(script->out);
+}
+
+
+/*!
+ * @brief Runs debugger commands from a script, one per line, without a terminal.
+ * 
+ * For each command, one line of JSON is written to stderr with the command's
+ * output and the resulting state of the CPU. Blank lines and lines starting
+ * with '#' are skipped.
+ * 
+ * @param script Stream to read commands from
+ * 
+ * @return Halt reason, like `Debugger_run`
+ */
+EAR_HaltReason Debugger_runScript(Debugger* dbg, FILE* script) {
+	DebugScript state = {0};
+	
+	// JSON goes to the real stderr, while each command's output is captured
+	int out_fd = dup(STDERR_FILENO);
+	state.out = out_fd < 0 ? NULL : fdopen(out_fd, "w");
+	if(!state.out) {
+		perror("fdopen");
+		return HALT_IO_ERROR;
+	}
+	
+	// Record history from here on so that execution can be reversed
+	Debugger_startHistory(dbg);
+	
+	// When not kernel debugging, skip to the first instruction in user mode
+	if(!(dbg->debug_flags & DEBUG_KERNEL)) {
+		Debugger_stepInstruction(dbg);
+		if(dbg->r != HALT_NONE && dbg->r != HALT_EXCEPTION) {
+			fclose(state.out);
+			return dbg->r;
+		}
+	}
+	
+	dbg->script = &state;
+	
+	char* line = NULL;
+	size_t line_cap = 0;
+	ssize_t line_len;
+	while((line_len = getline(&line, &line_cap, script)) >= 0) {
+		++state.line_number;
+		
+		// Strip the line ending and leading whitespace
+		while(line_len > 0 && (line[line_len - 1] == '\n' || line[line_len - 1] == '\r')) {
+			line[--line_len] = '\0';
+		}
+		const char* text = line;
+		while(isspace(*text)) {
+			++text;
+		}
+		if(*text == '\0' || *text == '#') {
+			continue;
+		}
+		state.command = text;
+		
+		Debugger_beginCapture(&state);
+		dbg->r = MARK_SEEN(dbg->r);
+		
+		int quit = 0;
+		bool ran = false;
+		Command* cmd = cmd_parse(text);
+		if(cmd && (cmd->type & CMD_KERNEL) && !(dbg->debug_flags & DEBUG_KERNEL)) {
+			fprintf(stderr, "Command is only available in kernel debug mode.\n");
+		}
+		else if(cmd) {
+			cmd->type &= ~CMD_KERNEL;
+			quit = Debugger_perform(dbg, cmd);
+			Debugger_flushLog(dbg);
+			ran = true;
+		}
+		
+		if(cmd) {
+			array_destroy(&cmd->args);
+			free(cmd);
+		}
+		
+		Debugger_writeScriptResult(dbg, ran, false, 0);
+		if(quit != 0) {
+			break;
+		}
+	}
+	
+	free(line);
+	dbg->script = NULL;
+	fclose(state.out);
+	
+	EAR_HaltReason r = CLEAR_SEEN(dbg->r);
+	if(r == HALT_NONE) {
+		r = HALT_DEBUGGER;
+	}
+	return r;
+}
+
+
+/*!
+ * @brief Called when the program exits in the middle of a scripted command, so the
+ * command's results can still be written.
+ * 
+ * @param status Exit status of the program
+ */
+void Debugger_scriptNotifyExit(Debugger* dbg, int status) {
+	if(dbg->script->capture) {
+		Debugger_writeScriptResult(dbg, true, true, status);
+	}
 }
 
 
@@ -749,6 +1102,10 @@ static int Debugger_perform(Debugger* dbg, Command* cmd) {
 			Debugger_doException(dbg, cmd);
 			break;
 		
+		case CMD_FINISH:
+			Debugger_doFinish(dbg, cmd);
+			break;
+		
 		case CMD_HELP:
 			Debugger_doHelp(cmd);
 			break;
@@ -757,6 +1114,14 @@ static int Debugger_perform(Debugger* dbg, Command* cmd) {
 			Debugger_doHexdump(dbg, cmd);
 			break;
 		
+		case CMD_LAST_WRITE:
+			Debugger_doLastWrite(dbg, cmd);
+			break;
+		
+		case CMD_NEXT:
+			Debugger_doNext(dbg, cmd);
+			break;
+		
 		case CMD_QUIT:
 			return 1;
 		
@@ -764,10 +1129,26 @@ static int Debugger_perform(Debugger* dbg, Command* cmd) {
 			Debugger_doRegisters(dbg, cmd);
 			break;
 		
+		case CMD_REVERSE_CONTINUE:
+			Debugger_doReverseContinue(dbg, cmd);
+			break;
+		
+		case CMD_REVERSE_STEP:
+			Debugger_doReverseStep(dbg, cmd);
+			break;
+		
+		case CMD_STATS:
+			Debugger_doStats(dbg, cmd);
+			break;
+		
 		case CMD_STEP:
 			Debugger_doStep(dbg, cmd);
 			break;
 		
+		case CMD_UNTIL:
+			Debugger_doUntil(dbg, cmd);
+			break;
+		
 		case CMD_VMMAP:
 			Debugger_doVMMap(dbg, cmd);
 			break;
@@ -818,22 +1199,73 @@ static bool Debugger_parseMode(const char* s, BreakpointFlags* out_flags) {
 static void Debugger_helpBreakpoint(void) {
 	fprintf(stderr,
 		"Available breakpoint commands:\n"
-		"ba <access mode ([RWX]+)> <addr(XXXX or XX:XXXX)>\n"
-		"                -- Add a memory access breakpoint on an address with some combination of access modes\n"
-		"bp add <vaddr>  -- Add a breakpoint at code address <vaddr>\n"
-		"b <vaddr>       -- Short mode for `bp add <vaddr>`\n"
-		"bp list         -- List all breakpoints and their enabled status\n"
+		"ba <access mode ([RWX]+)> <addr(XXXX or XX:XXXX)> [<size=1>] [if <condition>]\n"
+		"                -- Add a memory access breakpoint on an address with some combination of access modes,\n"
+		"                   optionally watching `size` bytes starting at the address\n"
+		"bp add <vaddr> [<size=1>] [if <condition>]\n"
+		"                -- Add a breakpoint at code address <vaddr>\n"
+		"b <vaddr> [if <condition>]\n"
+		"                -- Short mode for `bp add <vaddr>`\n"
+		"log <vaddr> \"<format>\" [<expr>...]\n"
+		"                -- Print a message each time code address <vaddr> runs instead of stopping, like\n"
+		"                   `log 1234 \"A0=%%x [SP]=%%04X\"` or `log 1234 \"%%s\" A1`\n"
+		"bp cond <id> [<condition>]\n"
+		"                -- Only stop at breakpoint <id> when <condition> is nonzero, or always stop\n"
+		"                   if no condition is given\n"
+		"bp list         -- List all breakpoints, their enabled status, and their hit counts\n"
 		"bp disable <id> -- Disable the breakpoint with ID <id>\n"
 		"bp enable <id>  -- Enable the breakpoint with ID <id>\n"
 		"bp toggle <id>  -- Toggle the enabled state of breakpoint with ID <id>\n"
 		"bp remove <id>  -- Remove the breakpoint with ID <id>\n"
 		"bp clear        -- Clear all breakpoints\n"
+		"Conditions and logged expressions can use registers, `hits`, symbols, hex numbers,\n"
+		"[addr] to read a word, and byte[addr] to read a byte, with C operators. For example:\n"
+		"    b 1234 if A0 == 41 && [SP+2] != 0\n"
 	);
 }
 
 
-#define CHECK_ARG_COUNT(argc) do { \
-	if(cmd->args.count != (argc)) { \
+// Print a breakpoint's logpoint message, condition, and hit count, and end the line
+static void Debugger_showBreakpointDetails(const Breakpoint* bp) {
+	if(bp->log) {
+		fprintf(stderr, ", logs \"%s\"", bp->log->source);
+	}
+	
+	if(bp->cond) {
+		fprintf(stderr, ", if %s", bp->cond->source);
+	}
+	
+	if(bp->hits != 0) {
+		fprintf(stderr, ", hit %" PRIu64 " time%s", bp->hits, bp->hits == 1 ? "" : "s");
+	}
+	
+	fprintf(stderr, "\n");
+}
+
+
+// Join the arguments starting at `start` with spaces, or return NULL if there are none
+static char* Debugger_joinArgs(Command* cmd, size_t start, size_t end) {
+	if(start >= end) {
+		return NULL;
+	}
+	
+	dynamic_string str = {0};
+	size_t i;
+	for(i = start; i < end; i++) {
+		if(i != start) {
+			string_appendChar(&str, ' ');
+		}
+		string_append(&str, cmd->args.elems[i]);
+	}
+	
+	char* ret = strdup(string_cstr(&str));
+	string_clear(&str);
+	return ret;
+}
+
+
+#define CHECK_ARG_COUNT(n) do { \
+	if(argc != (n)) { \
 		fprintf(stderr, "Wrong argument count for %s %s\n", cmd->args.elems[0], cmd->args.elems[1]); \
 		Debugger_helpBreakpoint(); \
 		return; \
@@ -855,6 +1287,21 @@ static void Debugger_doBreakpoint(Debugger* dbg, Command* cmd) {
 		return;
 	}
 	
+	// Everything after "if" is a condition, as in "b 1234 if A0 == 41"
+	size_t argc = cmd->args.count;
+	size_t i;
+	for(i = 1; i < cmd->args.count; i++) {
+		if(strcasecmp(cmd->args.elems[i], "if") == 0) {
+			argc = i;
+			break;
+		}
+	}
+	if(argc != cmd->args.count && argc + 1 == cmd->args.count) {
+		fprintf(stderr, "Missing condition after `if`\n");
+		Debugger_helpBreakpoint();
+		return;
+	}
+	
 	// Handle "ba" command separately from the others
 	BreakpointFlags mode = BP_EXECUTE;
 	const char* first = cmd->args.elems[pos++];
@@ -873,6 +1320,9 @@ static void Debugger_doBreakpoint(Debugger* dbg, Command* cmd) {
 	else if(strcasecmp(first, "be") == 0) {
 		subcmd = "enable";
 	}
+	else if(strcasecmp(first, "log") == 0) {
+		subcmd = "log";
+	}
 	else {
 		subcmd = cmd->args.elems[pos++];
 	}
@@ -889,20 +1339,29 @@ static void Debugger_doBreakpoint(Debugger* dbg, Command* cmd) {
 			
 			if(bp->flags & BP_PHYSICAL) {
 				fprintf(
-					stderr,
-					"Breakpoint #%u at physical address %02X:%04X (%s%s) is %sabled\n",
-					(unsigned)i + 1,
-					EAR_FULL_REGION(bp->addr), EAR_FULL_NOTREGION(bp->addr),
+					stderr, "Breakpoint #%u at physical address %02X:%04X",
+					(unsigned)i + 1, EAR_FULL_REGION(bp->addr), EAR_FULL_NOTREGION(bp->addr)
+				);
+				if(bp->size != 1) {
+					fprintf(stderr, " size 0x%X", bp->size);
+				}
+				
+				fprintf(
+					stderr, " (%s%s) is %sabled",
 					(bp->flags & BP_READ) ? "R" : "",
 					(bp->flags & BP_WRITE) ? "W" : "",
 					(bp->flags & BP_ENABLED) ? "en" : "dis"
 				);
+				Debugger_showBreakpointDetails(bp);
 			}
 			else {
 				fprintf(
 					stderr, "Breakpoint #%u at address %04X",
 					(unsigned)i + 1, bp->addr
 				);
+				if(bp->size != 1) {
+					fprintf(stderr, " size 0x%X", bp->size);
+				}
 				
 				if(peg) {
 					Pegasus_Symbol* sym = Pegasus_findSymbolByAddress(peg, bp->addr);
@@ -913,12 +1372,13 @@ static void Debugger_doBreakpoint(Debugger* dbg, Command* cmd) {
 				}
 				
 				fprintf(
-					stderr, " (%s%s%s) is %sabled\n",
+					stderr, " (%s%s%s) is %sabled",
 					(bp->flags & BP_READ) ? "R" : "",
 					(bp->flags & BP_WRITE) ? "W" : "",
 					(bp->flags & BP_EXECUTE) ? "X" : "",
 					(bp->flags & BP_ENABLED) ? "en" : "dis"
 				);
+				Debugger_showBreakpointDetails(bp);
 			}
 		}
 	}
@@ -982,6 +1442,66 @@ static void Debugger_doBreakpoint(Debugger* dbg, Command* cmd) {
 		enabled = Debugger_toggleBreakpoint(dbg, bpid);
 		fprintf(stderr, "Toggled breakpoint #%u %s\n", bpid + 1, enabled ? "on" : "off");
 	}
+	else if(strcasecmp(subcmd, "cond") == 0 || strcasecmp(subcmd, "condition") == 0) {
+		if(argc < pos + 1 || (argc != cmd->args.count && argc != pos + 1)) {
+			fprintf(stderr, "Wrong argument count for %s %s\n", cmd->args.elems[0], cmd->args.elems[1]);
+			Debugger_helpBreakpoint();
+			return;
+		}
+		
+		// Parse breakpoint ID
+		bpid = (BreakpointID)strtoul(cmd->args.elems[pos++], &end, 0);
+		if(*end != '\0' || !Debugger_breakpointExists(dbg, bpid - 1)) {
+			fprintf(stderr, "Invalid breakpoint ID given to `breakpoint cond`\n");
+			Debugger_helpBreakpoint();
+			return;
+		}
+		--bpid;
+		
+		// The condition may be written with or without "if" in front of it
+		char* cond_str = Debugger_joinArgs(cmd, argc == cmd->args.count ? pos : argc + 1, cmd->args.count);
+		if(!cond_str) {
+			Debugger_setBreakpointCondition(dbg, bpid, NULL);
+			fprintf(stderr, "Breakpoint #%u is now unconditional\n", bpid + 1);
+			return;
+		}
+		
+		DebugExpr* cond = DebugExpr_compile(cond_str, dbg->pegs[dbg->cpu->ctx.active]);
+		free(cond_str);
+		if(!cond) {
+			return;
+		}
+		
+		Debugger_setBreakpointCondition(dbg, bpid, cond);
+		fprintf(stderr, "Breakpoint #%u now stops if %s\n", bpid + 1, cond->source);
+	}
+	else if(strcasecmp(subcmd, "log") == 0) {
+		if(argc != cmd->args.count || argc < pos + 2) {
+			fprintf(stderr, "Wrong argument count for %s\n", cmd->args.elems[0]);
+			Debugger_helpBreakpoint();
+			return;
+		}
+		
+		bool do_phys = false;
+		str = cmd->args.elems[pos++];
+		if(!Debugger_parseAddress(dbg, str, &addr, &do_phys) || do_phys) {
+			fprintf(stderr, "Invalid code address given to `log`\n");
+			Debugger_helpBreakpoint();
+			return;
+		}
+		
+		const char* format = cmd->args.elems[pos++];
+		DebugLogFormat* log = DebugLogFormat_compile(
+			format, &cmd->args.elems[pos], cmd->args.count - pos,
+			dbg->pegs[dbg->cpu->ctx.active]
+		);
+		if(!log) {
+			return;
+		}
+		
+		bpid = Debugger_addLogpoint(dbg, (EAR_VirtAddr)addr, log);
+		fprintf(stderr, "Created logpoint #%u at address %04X\n", bpid + 1, addr);
+	}
 	else if(strcasecmp(subcmd, "clear") == 0) {
 		CHECK_ARG_COUNT(pos);
 		
@@ -990,8 +1510,14 @@ static void Debugger_doBreakpoint(Debugger* dbg, Command* cmd) {
 	}
 	else {
 		// Allow a short form like "b <vaddr>"
+		const char* size_str = NULL;
 		if(!strcasecmp(subcmd, "add")) {
-			CHECK_ARG_COUNT(pos + 1);
+			if(argc == pos + 2) {
+				size_str = cmd->args.elems[pos + 1];
+			}
+			else {
+				CHECK_ARG_COUNT(pos + 1);
+			}
 			str = cmd->args.elems[pos++];
 		}
 		else {
@@ -1006,30 +1532,65 @@ static void Debugger_doBreakpoint(Debugger* dbg, Command* cmd) {
 			return;
 		}
 		
+		// Optional number of bytes to watch
+		EAR_FullAddr size = 1;
+		if(size_str) {
+			unsigned long limit = do_phys ? EAR_PHYSICAL_ADDRESS_SPACE_SIZE : EAR_VIRTUAL_ADDRESS_SPACE_SIZE;
+			unsigned long size_ul = strtoul(size_str, &end, 0);
+			if(*end != '\0' || size_ul == 0 || size_ul > limit - addr) {
+				fprintf(stderr, "Invalid size given to `breakpoint add`\n");
+				Debugger_helpBreakpoint();
+				return;
+			}
+			size = (EAR_FullAddr)size_ul;
+		}
+		
+		// Optional condition, compiled before the breakpoint is created in case it's invalid
+		DebugExpr* cond = NULL;
+		char* cond_str = Debugger_joinArgs(cmd, argc + 1, cmd->args.count);
+		if(cond_str) {
+			cond = DebugExpr_compile(cond_str, dbg->pegs[dbg->cpu->ctx.active]);
+			free(cond_str);
+			if(!cond) {
+				return;
+			}
+		}
+		
 		if(do_phys) {
 			if(mode & BP_EXECUTE) {
 				fprintf(stderr, "Physical breakpoints can only use read/write mode, not execute\n");
 				Debugger_helpBreakpoint();
+				DebugExpr_destroy(cond);
 				return;
 			}
 			
-			bpid = Debugger_addBreakpoint(dbg, addr, mode);
+			bpid = Debugger_addBreakpointRange(dbg, addr, size, mode);
+			Debugger_setBreakpointCondition(dbg, bpid, cond);
 			fprintf(
 				stderr,
-				"Created breakpoint #%u at physical address %02X:%04X (%s%s)\n",
-				bpid + 1,
-				EAR_FULL_REGION(addr), EAR_FULL_NOTREGION(addr),
+				"Created breakpoint #%u at physical address %02X:%04X",
+				bpid + 1, EAR_FULL_REGION(addr), EAR_FULL_NOTREGION(addr)
+			);
+			if(size != 1) {
+				fprintf(stderr, " size 0x%X", size);
+			}
+			
+			fprintf(
+				stderr, " (%s%s)\n",
 				(mode & BP_READ) ? "R" : "",
 				(mode & BP_WRITE) ? "W" : ""
 			);
 		}
 		else {
-			bpid = Debugger_addBreakpoint(dbg, addr, mode);
+			bpid = Debugger_addBreakpointRange(dbg, addr, size, mode);
+			Debugger_setBreakpointCondition(dbg, bpid, cond);
+			fprintf(stderr, "Created breakpoint #%u at address %04X", bpid + 1, addr);
+			if(size != 1) {
+				fprintf(stderr, " size 0x%X", size);
+			}
+			
 			fprintf(
-				stderr,
-				"Created breakpoint #%u at address %04X (%s%s%s)\n",
-				bpid + 1,
-				addr,
+				stderr, " (%s%s%s)\n",
 				(mode & BP_READ) ? "R" : "",
 				(mode & BP_WRITE) ? "W" : "",
 				(mode & BP_EXECUTE) ? "X" : ""
@@ -1045,6 +1606,15 @@ static void Debugger_helpRunning(void) {
 		"Available running commands:\n"
 		"continue/c      -- Run until a breakpoint is encountered or the program halts\n"
 		"step/s          -- Runs a single instruction and returns to the debugger\n"
+		"next/n          -- Like `step`, but runs function calls until they return\n"
+		"finish/fin      -- Runs until the current function returns\n"
+		"until <vaddr(XXXX)>\n"
+		"                -- Runs until reaching the code address `vaddr`\n"
+		"reverse-continue/rc\n"
+		"                -- Runs backwards until a breakpoint is encountered or the recorded history begins\n"
+		"reverse-step/rs -- Goes back to before the previous instruction\n"
+		"lastwrite <vaddr(XXXX)>\n"
+		"                -- Goes back to before the last instruction that wrote to `vaddr`\n"
 	);
 }
 
@@ -1058,6 +1628,7 @@ static void Debugger_doContinue(Debugger* dbg, Command* cmd) {
 	
 	bool enabledInterruptHandler = enable_interrupt_handler();
 	
+	Debugger_updateInterposers(dbg);
 	dbg->debug_flags |= DEBUG_RESUMING;
 	dbg->r = EAR_continue(dbg->cpu);
 	
@@ -1078,6 +1649,88 @@ static void Debugger_doStep(Debugger* dbg, Command* cmd) {
 }
 
 
+static void Debugger_doNext(Debugger* dbg, Command* cmd) {
+	if(cmd->args.count != 1) {
+		fprintf(stderr, "Wrong argument count for next\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	Debugger_stepOver(dbg);
+}
+
+
+static void Debugger_doFinish(Debugger* dbg, Command* cmd) {
+	if(cmd->args.count != 1) {
+		fprintf(stderr, "Wrong argument count for finish\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	Debugger_finish(dbg);
+}
+
+
+static void Debugger_doUntil(Debugger* dbg, Command* cmd) {
+	if(cmd->args.count != 2) {
+		fprintf(stderr, "Wrong argument count for until\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	EAR_FullAddr addr;
+	bool do_phys = false;
+	if(!Debugger_parseAddress(dbg, cmd->args.elems[1], &addr, &do_phys) || do_phys) {
+		fprintf(stderr, "Invalid virtual address given to `until`\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	Debugger_runUntil(dbg, (EAR_VirtAddr)addr);
+}
+
+
+static void Debugger_doReverseStep(Debugger* dbg, Command* cmd) {
+	if(cmd->args.count != 1) {
+		fprintf(stderr, "Wrong argument count for reverse-step\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	Debugger_reverseStep(dbg);
+}
+
+
+static void Debugger_doReverseContinue(Debugger* dbg, Command* cmd) {
+	if(cmd->args.count != 1) {
+		fprintf(stderr, "Wrong argument count for reverse-continue\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	Debugger_reverseContinue(dbg);
+}
+
+
+static void Debugger_doLastWrite(Debugger* dbg, Command* cmd) {
+	if(cmd->args.count != 2) {
+		fprintf(stderr, "Wrong argument count for lastwrite\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	EAR_FullAddr addr;
+	bool do_phys = false;
+	if(!Debugger_parseAddress(dbg, cmd->args.elems[1], &addr, &do_phys) || do_phys) {
+		fprintf(stderr, "Invalid virtual address given to `lastwrite`\n");
+		Debugger_helpRunning();
+		return;
+	}
+	
+	Debugger_reverseToLastWrite(dbg, (EAR_VirtAddr)addr);
+}
+
+
 static void Debugger_helpInspecting(void) {
 	fprintf(
 		stderr,
@@ -1091,6 +1744,7 @@ static void Debugger_helpInspecting(void) {
 		"backtrace/bt    -- Shows the current call stack (backtrace)\n"
 		"registers/regs  -- Shows register values\n"
 		"cregs           -- Shows control register values\n"
+		"stats [json]    -- Shows runtime statistics (instructions, exceptions, MMU, bus, ports)\n"
 		"altctx          -- Like `context` but for the alternate thread state\n"
 		"altbt           -- Like `backtrace` but for the alternate thread state\n"
 		"altregs         -- Like `regs` but for the alternate thread state\n"
@@ -1501,12 +2155,33 @@ static void Debugger_doPMap(Debugger* dbg, Command* cmd) {
 		return;
 	}
 	
-	if(!dbg->bus_dump_fn) {
+	if(!dbg->bus_dump_fn || !dbg->bus) {
 		fprintf(stderr, "Debugger doesn't know how to dump the physical memory layout\n");
 		return;
 	}
 	
-	dbg->bus_dump_fn(dbg->bus_cookie, stderr);
+	// Not bus_cookie, which may be an interposed handler's cookie rather than the bus
+	dbg->bus_dump_fn(dbg->bus, stderr);
+}
+
+
+static void Debugger_doStats(Debugger* dbg, Command* cmd) {
+	bool json = false;
+	if(cmd->args.count == 2 && !strcasecmp(cmd->args.elems[1], "json")) {
+		json = true;
+	}
+	else if(cmd->args.count != 1) {
+		fprintf(stderr, "Wrong argument count for `%s`\n", cmd->args.elems[0]);
+		Debugger_helpInspecting();
+		return;
+	}
+	
+	if(!dbg->mmu) {
+		fprintf(stderr, "Debugger isn't connected to the MMU\n");
+		return;
+	}
+	
+	Stats_print(stderr, dbg->cpu, dbg->mmu, dbg->bus, json);
 }
 
 
@@ -1544,6 +2219,12 @@ static void Debugger_doHelp(Command* cmd) {
 			
 			case CMD_CONTINUE:
 			case CMD_STEP:
+			case CMD_NEXT:
+			case CMD_FINISH:
+			case CMD_UNTIL:
+			case CMD_REVERSE_CONTINUE:
+			case CMD_REVERSE_STEP:
+			case CMD_LAST_WRITE:
 				Debugger_helpRunning();
 				return;
 			
@@ -1555,6 +2236,7 @@ static void Debugger_doHelp(Command* cmd) {
 			case CMD_CONTROL_REGISTERS:
 			case CMD_VMMAP:
 			case CMD_PMAP:
+			case CMD_STATS:
 				Debugger_helpInspecting();
 				return;
 			
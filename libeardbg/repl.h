@@ -1,11 +1,41 @@
 #ifndef EARDBG_REPL_H
 #define EARDBG_REPL_H
 
+#include <stdio.h>
 #include "libear/ear.h"
 
 typedef struct Debugger Debugger;
 
+//! State of a non-interactive debugger session run by `Debugger_runScript`
+typedef struct DebugScript {
+	FILE* out;          //!< Where JSON results are written (the real stderr)
+	FILE* capture;      //!< Collects the current command's output, or NULL
+	unsigned line_number;
+	const char* command;
+} DebugScript;
+
 /*! Interactively runs the debugger. */
 EAR_HaltReason Debugger_run(Debugger* dbg);
 
+/*!
+ * @brief Runs debugger commands from a script, one per line, without a terminal.
+ * 
+ * For each command, one line of JSON is written to stderr with the command's
+ * output and the resulting state of the CPU. Blank lines and lines starting
+ * with '#' are skipped.
+ * 
+ * @param script Stream to read commands from
+ * 
+ * @return Halt reason, like `Debugger_run`
+ */
+EAR_HaltReason Debugger_runScript(Debugger* dbg, FILE* script);
+
+/*!
+ * @brief Called when the program exits in the middle of a scripted command, so the
+ * command's results can still be written.
+ * 
+ * @param status Exit status of the program
+ */
+void Debugger_scriptNotifyExit(Debugger* dbg, int status);
+
 #endif /* EARDBG_REPL_H */
@@ -0,0 +1,350 @@
+//
+//  replay.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "replay.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+typedef struct ReplayEvent {
+	uint64_t insn_count;
+	ReplayEventKind kind;
+	uint8_t port_number;
+	uint8_t value;
+} ReplayEvent;
+
+
+/*!
+ * @brief Create a log file and start recording port I/O into it.
+ * 
+ * @param path Path of the log file to create
+ * 
+ * @return Newly created log, or NULL on error (with errno set)
+ */
+ReplayLog* ReplayLog_create(const char* path) {
+	ReplayLog* log = calloc(1, sizeof(*log));
+	if(!log) {
+		return NULL;
+	}
+	
+	log->fp = fopen(path, "wbe");
+	if(!log->fp) {
+		free(log);
+		return NULL;
+	}
+	
+	ReplayFileHeader header;
+	memcpy(header.magic, REPLAY_MAGIC, sizeof(header.magic));
+	header.version = REPLAY_VERSION;
+	if(fwrite(&header, sizeof(header), 1, log->fp) != 1 || fflush(log->fp) != 0) {
+		int saved_errno = errno;
+		fclose(log->fp);
+		free(log);
+		errno = saved_errno;
+		return NULL;
+	}
+	
+	return log;
+}
+
+
+/*!
+ * @brief Open a previously recorded log file to replay its port I/O.
+ * 
+ * @param path Path of the log file to replay
+ * 
+ * @return Opened log, or NULL on error (with errno set, or EINVAL for a bad header)
+ */
+ReplayLog* ReplayLog_open(const char* path) {
+	ReplayLog* log = NULL;
+	void* map = MAP_FAILED;
+	size_t size = 0;
+	int saved_errno = 0;
+	
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		return NULL;
+	}
+	
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		goto fail;
+	}
+	size = st.st_size;
+	
+	ReplayFileHeader header;
+	if(size < sizeof(header)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	
+	map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(map == MAP_FAILED) {
+		goto fail;
+	}
+	
+	memcpy(&header, map, sizeof(header));
+	if(memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0 || header.version != REPLAY_VERSION) {
+		errno = EINVAL;
+		goto fail;
+	}
+	
+	log = calloc(1, sizeof(*log));
+	if(!log) {
+		goto fail;
+	}
+	
+	close(fd);
+	log->data = map;
+	log->size = size;
+	log->pos = sizeof(header);
+	return log;
+	
+fail:
+	saved_errno = errno;
+	if(map != MAP_FAILED) {
+		munmap(map, size);
+	}
+	close(fd);
+	errno = saved_errno;
+	return NULL;
+}
+
+
+/*! Returns true if the log is being replayed rather than recorded */
+bool ReplayLog_isReplaying(ReplayLog* log) {
+	return log->data != NULL;
+}
+
+
+static void ReplayLog_writeEvent(
+	ReplayLog* log, uint64_t insn_count, ReplayEventKind kind,
+	uint8_t port_number, uint8_t value
+) { //ReplayLog_writeEvent
+	uint8_t buf[12];
+	size_t len = 0;
+	
+	// Instruction count delta as unsigned LEB128
+	uint64_t delta = insn_count - log->last_insn_count;
+	do {
+		buf[len] = delta & 0x7F;
+		delta >>= 7;
+		if(delta != 0) {
+			buf[len] |= 0x80;
+		}
+		++len;
+	} while(delta != 0);
+	
+	buf[len++] = kind << 4 | (port_number & 0xF);
+	buf[len++] = value;
+	
+	// Events are left in stdio's buffer. The log is flushed when the program halts,
+	// exits, or is killed by a fatal signal (see `ReplayLog_flush`).
+	fwrite(buf, 1, len, log->fp);
+	
+	log->last_insn_count = insn_count;
+}
+
+
+/*!
+ * @brief Record the result of an `RDB` instruction.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being read
+ * @param byte Byte that was read
+ * @param reason HALT_NONE if the read succeeded, otherwise the failing halt reason
+ */
+void ReplayLog_recordRead(
+	ReplayLog* log, uint64_t insn_count, uint8_t port_number,
+	EAR_Byte byte, EAR_HaltReason reason
+) {
+	if(reason == HALT_NONE) {
+		ReplayLog_writeEvent(log, insn_count, REPLAY_READ, port_number, byte);
+	}
+	else {
+		ReplayLog_writeEvent(log, insn_count, REPLAY_READ_FAIL, port_number, (uint8_t)-reason);
+	}
+}
+
+
+/*!
+ * @brief Record a successful `WRB` instruction.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being written
+ * @param byte Byte that was written
+ */
+void ReplayLog_recordWrite(ReplayLog* log, uint64_t insn_count, uint8_t port_number, EAR_Byte byte) {
+	ReplayLog_writeEvent(log, insn_count, REPLAY_WRITE, port_number, byte);
+}
+
+
+// Decode the next event without consuming it, returning the position after it (or 0 at the end)
+static size_t ReplayLog_peek(ReplayLog* log, ReplayEvent* out_event) {
+	size_t pos = log->pos;
+	uint64_t delta = 0;
+	unsigned shift = 0;
+	
+	while(true) {
+		if(pos >= log->size || shift >= 64) {
+			return 0;
+		}
+		
+		uint8_t b = log->data[pos++];
+		delta |= (uint64_t)(b & 0x7F) << shift;
+		shift += 7;
+		if(!(b & 0x80)) {
+			break;
+		}
+	}
+	
+	if(pos + 2 > log->size) {
+		return 0;
+	}
+	
+	out_event->insn_count = log->last_insn_count + delta;
+	out_event->kind = log->data[pos] >> 4;
+	out_event->port_number = log->data[pos] & 0xF;
+	out_event->value = log->data[pos + 1];
+	return pos + 2;
+}
+
+
+// Consume the next event if it matches what the program is doing now
+static bool ReplayLog_expect(
+	ReplayLog* log, uint64_t insn_count, bool is_read,
+	uint8_t port_number, ReplayEvent* out_event
+) { //ReplayLog_expect
+	size_t next = ReplayLog_peek(log, out_event);
+	if(next == 0) {
+		fprintf(
+			stderr, "Replay diverged at instruction %llu: %s port %u after the end of the log\n",
+			(unsigned long long)insn_count, is_read ? "read from" : "write to", port_number
+		);
+		return false;
+	}
+	
+	if(out_event->insn_count != insn_count
+		|| (out_event->kind == REPLAY_WRITE) == is_read
+		|| out_event->port_number != port_number
+	) {
+		fprintf(
+			stderr, "Replay diverged at instruction %llu: %s port %u, but the log has a %s port %u at instruction %llu\n",
+			(unsigned long long)insn_count, is_read ? "read from" : "write to", port_number,
+			out_event->kind == REPLAY_WRITE ? "write to" : "read from", out_event->port_number,
+			(unsigned long long)out_event->insn_count
+		);
+		return false;
+	}
+	
+	log->pos = next;
+	log->last_insn_count = insn_count;
+	return true;
+}
+
+
+/*!
+ * @brief Replay the result of an `RDB` instruction.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being read
+ * @param out_byte Output pointer where the recorded byte will be written
+ * 
+ * @return The recorded halt reason, or HALT_BUS_ERROR if the execution diverged from the log
+ */
+EAR_HaltReason ReplayLog_replayRead(
+	ReplayLog* log, uint64_t insn_count, uint8_t port_number, EAR_Byte* out_byte
+) {
+	ReplayEvent event;
+	if(!ReplayLog_expect(log, insn_count, /*is_read=*/true, port_number, &event)) {
+		return HALT_BUS_ERROR;
+	}
+	
+	if(event.kind == REPLAY_READ_FAIL) {
+		return -(EAR_HaltReason)event.value;
+	}
+	
+	*out_byte = event.value;
+	return HALT_NONE;
+}
+
+
+/*!
+ * @brief Check a `WRB` instruction against the log.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being written
+ * @param byte Byte being written
+ * 
+ * @return HALT_NONE if the write matches the log, or HALT_BUS_ERROR if the execution diverged
+ */
+EAR_HaltReason ReplayLog_replayWrite(
+	ReplayLog* log, uint64_t insn_count, uint8_t port_number, EAR_Byte byte
+) {
+	ReplayEvent event;
+	if(!ReplayLog_expect(log, insn_count, /*is_read=*/false, port_number, &event)) {
+		return HALT_BUS_ERROR;
+	}
+	
+	if(event.value != byte) {
+		fprintf(
+			stderr, "Replay diverged at instruction %llu: wrote 0x%02X to port %u, but the log has 0x%02X\n",
+			(unsigned long long)insn_count, byte, port_number, event.value
+		);
+		return HALT_BUS_ERROR;
+	}
+	
+	return HALT_NONE;
+}
+
+
+/*!
+ * @brief Write any buffered events of a log that is being recorded to its file.
+ * 
+ * @return True if everything recorded so far was written successfully
+ */
+bool ReplayLog_flush(ReplayLog* log) {
+	if(!log || !log->fp) {
+		return true;
+	}
+	
+	return fflush(log->fp) == 0 && !ferror(log->fp);
+}
+
+
+/*!
+ * @brief Close a log that is being recorded or replayed.
+ * 
+ * @return True if everything recorded was written successfully
+ */
+bool ReplayLog_close(ReplayLog** plog) {
+	ReplayLog* log = *plog;
+	if(!log) {
+		return true;
+	}
+	*plog = NULL;
+	
+	bool success = true;
+	if(log->fp) {
+		success = !ferror(log->fp);
+		if(fclose(log->fp) != 0) {
+			success = false;
+		}
+	}
+	
+	if(log->data) {
+		munmap((void*)log->data, log->size);
+	}
+	
+	free(log);
+	return success;
+}
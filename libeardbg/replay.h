@@ -0,0 +1,146 @@
+//
+//  replay.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_REPLAY_H
+#define EARDBG_REPLAY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "libear/ear.h"
+
+
+/*
+ * Port I/O log file layout:
+ * 
+ *   ReplayFileHeader
+ *   Event, Event, ...
+ * 
+ * Each event is the number of instructions executed since the previous event
+ * (as an unsigned LEB128 number), then a byte with the event kind in the high
+ * nibble and the port number in the low nibble, then one value byte. For
+ * REPLAY_READ and REPLAY_WRITE the value byte is the data, and for
+ * REPLAY_READ_FAIL it is the negated halt reason.
+ * 
+ * The timer only counts executed instructions, so nothing else needs to be
+ * recorded to make a run deterministic.
+ */
+
+#define REPLAY_MAGIC "EARPORTS"
+#define REPLAY_VERSION 1
+
+typedef struct ReplayFileHeader ReplayFileHeader;
+struct ReplayFileHeader {
+	char magic[8];
+	uint32_t version;
+} __attribute__((packed));
+
+typedef uint8_t ReplayEventKind;
+#define REPLAY_READ      ((ReplayEventKind)0) //!< `RDB` read a byte
+#define REPLAY_READ_FAIL ((ReplayEventKind)1) //!< `RDB` failed, such as at the end of input
+#define REPLAY_WRITE     ((ReplayEventKind)2) //!< `WRB` wrote a byte
+
+typedef struct ReplayLog ReplayLog;
+struct ReplayLog {
+	// Recording: events are appended to this file
+	FILE* fp;
+	
+	// Replaying: the whole log mapped into memory
+	const uint8_t* data;
+	size_t size;
+	size_t pos;
+	
+	// Instruction count of the previous event
+	uint64_t last_insn_count;
+};
+
+
+/*!
+ * @brief Create a log file and start recording port I/O into it.
+ * 
+ * @param path Path of the log file to create
+ * 
+ * @return Newly created log, or NULL on error (with errno set)
+ */
+ReplayLog* ReplayLog_create(const char* path);
+
+/*!
+ * @brief Open a previously recorded log file to replay its port I/O.
+ * 
+ * @param path Path of the log file to replay
+ * 
+ * @return Opened log, or NULL on error (with errno set, or EINVAL for a bad header)
+ */
+ReplayLog* ReplayLog_open(const char* path);
+
+/*! Returns true if the log is being replayed rather than recorded */
+bool ReplayLog_isReplaying(ReplayLog* log);
+
+/*!
+ * @brief Record the result of an `RDB` instruction.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being read
+ * @param byte Byte that was read
+ * @param reason HALT_NONE if the read succeeded, otherwise the failing halt reason
+ */
+void ReplayLog_recordRead(
+	ReplayLog* log, uint64_t insn_count, uint8_t port_number,
+	EAR_Byte byte, EAR_HaltReason reason
+);
+
+/*!
+ * @brief Record a successful `WRB` instruction.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being written
+ * @param byte Byte that was written
+ */
+void ReplayLog_recordWrite(ReplayLog* log, uint64_t insn_count, uint8_t port_number, EAR_Byte byte);
+
+/*!
+ * @brief Replay the result of an `RDB` instruction.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being read
+ * @param out_byte Output pointer where the recorded byte will be written
+ * 
+ * @return The recorded halt reason, or HALT_BUS_ERROR if the execution diverged from the log
+ */
+EAR_HaltReason ReplayLog_replayRead(
+	ReplayLog* log, uint64_t insn_count, uint8_t port_number, EAR_Byte* out_byte
+);
+
+/*!
+ * @brief Check a `WRB` instruction against the log.
+ * 
+ * @param insn_count Number of instructions executed before this one
+ * @param port_number Port number being written
+ * @param byte Byte being written
+ * 
+ * @return HALT_NONE if the write matches the log, or HALT_BUS_ERROR if the execution diverged
+ */
+EAR_HaltReason ReplayLog_replayWrite(
+	ReplayLog* log, uint64_t insn_count, uint8_t port_number, EAR_Byte byte
+);
+
+/*!
+ * @brief Write any buffered events of a log that is being recorded to its file.
+ * 
+ * @return True if everything recorded so far was written successfully
+ */
+bool ReplayLog_flush(ReplayLog* log);
+
+/*!
+ * @brief Close a log that is being recorded or replayed.
+ * 
+ * @return True if everything recorded was written successfully
+ */
+bool ReplayLog_close(ReplayLog** plog);
+
+#endif /* EARDBG_REPLAY_H */
@@ -0,0 +1,191 @@
+//
+//  stats.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "stats.h"
+#include <inttypes.h>
+#include "common/dynamic_array.h"
+
+
+#if EAR_STATS
+
+static const char* exc_code_names[EAR_EXC_CODE_COUNT] = {
+	"UNALIGNED", "MMU", "BUS", "DECODE", "ARITHMETIC", "DENIED_CREG", "DENIED_INSN", "TIMER"
+};
+
+
+static void Stats_printDevicesText(FILE* fp, Bus_DeviceArray* devices, int indent) {
+	foreach(devices, dev) {
+		if(dev->reads != 0 || dev->writes != 0) {
+			fprintf(
+				fp, "  %*s%-*s %14" PRIu64 " %14" PRIu64 "\n",
+				indent, "", 16 - indent, dev->name ? dev->name : "(unnamed)",
+				dev->reads, dev->writes
+			);
+		}
+		Stats_printDevicesText(fp, &dev->children, indent + 2);
+	}
+}
+
+
+static void Stats_printText(FILE* fp, EAR* cpu, MMU* mmu, Bus* bus) {
+	EAR_Stats* stats = &cpu->stats;
+	
+	fprintf(fp, "Instructions:\n  %-16s %14s %14s\n", "opcode", "executed", "skipped");
+	uint64_t totals[2] = {0};
+	for(unsigned op = 0; op < EAR_OPCODE_COUNT; op++) {
+		if(stats->insns[op][true] != 0 || stats->insns[op][false] != 0) {
+			fprintf(
+				fp, "  %-16s %14" PRIu64 " %14" PRIu64 "\n",
+				EAR_getMnemonic(op), stats->insns[op][true], stats->insns[op][false]
+			);
+			totals[true] += stats->insns[op][true];
+			totals[false] += stats->insns[op][false];
+		}
+	}
+	fprintf(fp, "  %-16s %14" PRIu64 " %14" PRIu64 "\n", "total", totals[true], totals[false]);
+	
+	fprintf(fp, "Exceptions:\n");
+	for(unsigned code = 0; code < EAR_EXC_CODE_COUNT; code++) {
+		if(stats->exceptions[code] != 0) {
+			fprintf(fp, "  %-16s %14" PRIu64 "\n", exc_code_names[code], stats->exceptions[code]);
+		}
+	}
+	fprintf(fp, "  %-16s %14" PRIu64 "\n", "bank swaps", stats->bank_swaps);
+	
+	fprintf(
+		fp,
+		"MMU:\n"
+		"  %-16s %14" PRIu64 "\n"
+		"  %-16s %14" PRIu64 "\n"
+		"  %-16s %14" PRIu64 "\n",
+		"translations", mmu->translations,
+		"table walks", mmu->walks,
+		"faults", mmu->faults
+	);
+	
+	if(bus) {
+		fprintf(fp, "Bus:\n  %-16s %14s %14s\n", "device", "reads", "writes");
+		Stats_printDevicesText(fp, &bus->devices, 0);
+	}
+	
+	fprintf(fp, "Ports:\n  %-16s %14s %14s\n", "port", "bytes read", "bytes written");
+	for(unsigned port = 0; port < EAR_PORT_COUNT; port++) {
+		if(stats->port_reads[port] != 0 || stats->port_writes[port] != 0) {
+			fprintf(
+				fp, "  %-16u %14" PRIu64 " %14" PRIu64 "\n",
+				port, stats->port_reads[port], stats->port_writes[port]
+			);
+		}
+	}
+#if EAR_STATS_TIMING
+	fprintf(fp, "  %-16s %14.3f ms\n", "time blocked", stats->port_ns / 1e6);
+#endif
+}
+
+
+static void Stats_printDevicesJSON(FILE* fp, Bus_DeviceArray* devices, bool* first) {
+	foreach(devices, dev) {
+		if(dev->reads != 0 || dev->writes != 0) {
+			fprintf(
+				fp, "%s{\"name\":\"%s\",\"reads\":%" PRIu64 ",\"writes\":%" PRIu64 "}",
+				*first ? "" : ",", dev->name ? dev->name : "", dev->reads, dev->writes
+			);
+			*first = false;
+		}
+		Stats_printDevicesJSON(fp, &dev->children, first);
+	}
+}
+
+
+static void Stats_printJSON(FILE* fp, EAR* cpu, MMU* mmu, Bus* bus) {
+	EAR_Stats* stats = &cpu->stats;
+	const char* sep = "";
+	
+	fprintf(fp, "{\"instructions\":{");
+	for(unsigned op = 0; op < EAR_OPCODE_COUNT; op++) {
+		if(stats->insns[op][true] != 0 || stats->insns[op][false] != 0) {
+			fprintf(
+				fp, "%s\"%s\":{\"executed\":%" PRIu64 ",\"skipped\":%" PRIu64 "}",
+				sep, EAR_getMnemonic(op), stats->insns[op][true], stats->insns[op][false]
+			);
+			sep = ",";
+		}
+	}
+	
+	fprintf(fp, "},\"exceptions\":{");
+	sep = "";
+	for(unsigned code = 0; code < EAR_EXC_CODE_COUNT; code++) {
+		if(stats->exceptions[code] != 0) {
+			fprintf(fp, "%s\"%s\":%" PRIu64, sep, exc_code_names[code], stats->exceptions[code]);
+			sep = ",";
+		}
+	}
+	
+	fprintf(
+		fp,
+		"},\"bank_swaps\":%" PRIu64
+		",\"mmu\":{\"translations\":%" PRIu64 ",\"walks\":%" PRIu64 ",\"faults\":%" PRIu64 "}",
+		stats->bank_swaps, mmu->translations, mmu->walks, mmu->faults
+	);
+	
+	if(bus) {
+		fprintf(fp, ",\"devices\":[");
+		bool first = true;
+		Stats_printDevicesJSON(fp, &bus->devices, &first);
+		fprintf(fp, "]");
+	}
+	
+	fprintf(fp, ",\"ports\":{");
+	sep = "";
+	for(unsigned port = 0; port < EAR_PORT_COUNT; port++) {
+		if(stats->port_reads[port] != 0 || stats->port_writes[port] != 0) {
+			fprintf(
+				fp, "%s\"%u\":{\"read\":%" PRIu64 ",\"written\":%" PRIu64 "}",
+				sep, port, stats->port_reads[port], stats->port_writes[port]
+			);
+			sep = ",";
+		}
+	}
+#if EAR_STATS_TIMING
+	fprintf(fp, "},\"port_ns\":%" PRIu64 "}\n", stats->port_ns);
+#else
+	fprintf(fp, "}}\n");
+#endif
+}
+
+#endif /* EAR_STATS */
+
+
+/*!
+ * @brief Print the runtime statistics counters, leaving out counters that are zero.
+ * 
+ * @param fp File to print the statistics to
+ * @param cpu EAR processor
+ * @param mmu MMU used by the processor
+ * @param bus Physical memory bus, or NULL to leave out the per-device counts
+ * @param json True to print a single JSON object instead of text
+ */
+void Stats_print(FILE* fp, EAR* cpu, MMU* mmu, Bus* bus, bool json) {
+#if EAR_STATS
+	if(json) {
+		Stats_printJSON(fp, cpu, mmu, bus);
+	}
+	else {
+		Stats_printText(fp, cpu, mmu, bus);
+	}
+#else /* EAR_STATS */
+	(void)cpu;
+	(void)mmu;
+	(void)bus;
+	if(json) {
+		fprintf(fp, "{}\n");
+	}
+	else {
+		fprintf(fp, "Runtime statistics were not compiled in (EAR_STATS=0)\n");
+	}
+#endif /* EAR_STATS */
+}
@@ -0,0 +1,45 @@
+//
+//  stats.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_STATS_H
+#define EARDBG_STATS_H
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "libear/ear.h"
+#include "libear/mmu.h"
+#include "libear/bus.h"
+
+
+/*
+ * Runtime statistics report. The counters themselves live in the CPU, MMU, and
+ * bus devices and are only updated when libear is built with EAR_STATS, as in
+ * libear-stats.so and libeardbg-stats.so. They count:
+ * 
+ * - Instructions executed by opcode, split by whether their condition passed
+ * - Exceptions raised by EXC_CODE, and thread state bank swaps
+ * - Address translations, page table walks, and translation faults
+ * - Reads and writes sent to each bus device
+ * - Bytes moved through each port, and host time spent blocked in port I/O when
+ *   libear is also built with EAR_STATS_TIMING
+ * 
+ * Accesses made by the debugger to inspect memory are included in the bus counts,
+ * but not in the MMU counts.
+ */
+
+/*!
+ * @brief Print the runtime statistics counters, leaving out counters that are zero.
+ * 
+ * @param fp File to print the statistics to
+ * @param cpu EAR processor
+ * @param mmu MMU used by the processor
+ * @param bus Physical memory bus, or NULL to leave out the per-device counts
+ * @param json True to print a single JSON object instead of text
+ */
+void Stats_print(FILE* fp, EAR* cpu, MMU* mmu, Bus* bus, bool json);
+
+#endif /* EARDBG_STATS_H */
@@ -0,0 +1,391 @@
+//
+//  trace.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include "common/macros.h"
+
+
+/*!
+ * @brief Create a binary trace file.
+ * 
+ * @param path Path of the trace file to create
+ * @param ring_size When nonzero, only keep roughly the last `ring_size` bytes of
+ *        the trace in memory and write them out when the trace is closed
+ * 
+ * @return Newly created trace writer, or NULL on error (with errno set)
+ */
+TraceWriter* TraceWriter_open(const char* path, size_t ring_size) {
+	TraceWriter* tw = calloc(1, sizeof(*tw));
+	if(!tw) {
+		return NULL;
+	}
+	
+	tw->fd = -1;
+	tw->modes = TRACE_USER | TRACE_KERNEL;
+	tw->addr_lo = 0;
+	tw->addr_hi = EAR_UWORD_MAX;
+	
+	// A ring needs at least two blocks so that wrapping around doesn't
+	// throw away everything that was just traced
+	tw->block_count = 1;
+	if(ring_size != 0) {
+		tw->ring = true;
+		tw->block_count = MAX((ring_size + TRACE_BLOCK_SIZE - 1) / TRACE_BLOCK_SIZE, (size_t)2);
+	}
+	
+	tw->blocks = malloc(tw->block_count * TRACE_BLOCK_SIZE);
+	tw->block_used = calloc(tw->block_count, sizeof(*tw->block_used));
+	if(!tw->blocks || !tw->block_used) {
+		goto fail;
+	}
+	
+	tw->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(tw->fd < 0) {
+		goto fail;
+	}
+	
+	TraceFileHeader header;
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	if(write(tw->fd, &header, sizeof(header)) != sizeof(header)) {
+		goto fail;
+	}
+	
+	return tw;
+	
+fail:
+	if(tw->fd >= 0) {
+		int saved_errno = errno;
+		close(tw->fd);
+		errno = saved_errno;
+	}
+	free(tw->blocks);
+	free(tw->block_used);
+	free(tw);
+	return NULL;
+}
+
+
+/*!
+ * @brief Only trace instructions executed in the selected modes.
+ * 
+ * @param modes Bitmask of TRACE_USER and/or TRACE_KERNEL
+ */
+void TraceWriter_setModes(TraceWriter* tw, TraceModes modes) {
+	tw->modes = modes;
+}
+
+
+/*!
+ * @brief Only trace instructions whose address lies within the given range.
+ * 
+ * @param lo Lowest instruction address to trace
+ * @param hi Highest instruction address to trace (inclusive)
+ */
+void TraceWriter_setRange(TraceWriter* tw, EAR_UWord lo, EAR_UWord hi) {
+	tw->addr_lo = lo;
+	tw->addr_hi = hi;
+}
+
+
+/*!
+ * @brief Only trace instructions within the named symbol, which is assumed to extend
+ * up to the next symbol in the image.
+ * 
+ * @param peg Image containing the symbol
+ * @param name Name of the symbol
+ * 
+ * @return True if the symbol was found
+ */
+bool TraceWriter_setSymbol(TraceWriter* tw, Pegasus* peg, const char* name) {
+	Pegasus_Symbol* sym = Pegasus_findSymbolByName(peg, name);
+	if(!sym) {
+		return false;
+	}
+	
+	// Find where the next symbol starts
+	EAR_UWord hi = EAR_UWORD_MAX;
+	foreach(&peg->symbols, other) {
+		if(other->value > sym->value && other->value - 1 < hi) {
+			hi = other->value - 1;
+		}
+	}
+	
+	TraceWriter_setRange(tw, sym->value, hi);
+	return true;
+}
+
+
+static void TraceWriter_writeBlock(TraceWriter* tw, size_t index) {
+	const uint8_t* data = tw->blocks + index * TRACE_BLOCK_SIZE;
+	size_t size = tw->block_used[index];
+	
+	while(size != 0 && !tw->failed) {
+		ssize_t written = write(tw->fd, data, size);
+		if(written < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			tw->failed = true;
+			break;
+		}
+		
+		data += written;
+		size -= written;
+	}
+	
+	tw->block_used[index] = 0;
+}
+
+
+// Make sure there's room for a whole record at the end of the current block
+static inline uint8_t* TraceWriter_reserve(TraceWriter* tw) {
+	if(tw->block_used[tw->cur_block] + TRACE_RECORD_MAX > TRACE_BLOCK_SIZE) {
+		if(tw->ring) {
+			// Start overwriting the oldest block
+			if(++tw->cur_block == tw->block_count) {
+				tw->cur_block = 0;
+				tw->wrapped = true;
+			}
+			tw->block_used[tw->cur_block] = 0;
+		}
+		else {
+			TraceWriter_writeBlock(tw, tw->cur_block);
+		}
+	}
+	
+	return tw->blocks + tw->cur_block * TRACE_BLOCK_SIZE + tw->block_used[tw->cur_block];
+}
+
+
+static inline void pack_instruction(uint8_t out[7], const EAR_Instruction* insn) {
+	out[0] = insn->op | insn->toggle_flags << 5 | insn->cross_rx << 6 | insn->cross_ry << 7;
+	out[1] = insn->cond | insn->cross_rd << 4;
+	out[2] = insn->rd | insn->rdx << 4;
+	out[3] = insn->rx | insn->ry << 4;
+	out[4] = insn->imm & 0xFF;
+	out[5] = insn->imm >> 8;
+	out[6] = insn->port_number;
+}
+
+
+static inline void unpack_instruction(EAR_Instruction* insn, const uint8_t in[7]) {
+	memset(insn, 0, sizeof(*insn));
+	insn->op = in[0] & 0x1F;
+	insn->toggle_flags = (in[0] >> 5) & 1;
+	insn->cross_rx = (in[0] >> 6) & 1;
+	insn->cross_ry = (in[0] >> 7) & 1;
+	insn->cond = in[1] & 0xF;
+	insn->cross_rd = (in[1] >> 4) & 1;
+	insn->rd = in[2] & 0xF;
+	insn->rdx = in[2] >> 4;
+	insn->rx = in[3] & 0xF;
+	insn->ry = in[3] >> 4;
+	insn->imm = in[4] | (EAR_UWord)in[5] << 8;
+	insn->port_number = in[6];
+}
+
+
+// Finish the record of an instruction whose post-exec hook was never called
+static void TraceWriter_commitPending(TraceWriter* tw) {
+	if(!tw->pending) {
+		return;
+	}
+	tw->pending = false;
+	
+	size_t* used = &tw->block_used[tw->cur_block];
+	TraceRecord* rec = (TraceRecord*)(tw->blocks + tw->cur_block * TRACE_BLOCK_SIZE + *used);
+	rec->changed = 0;
+	*used += sizeof(*rec);
+	++tw->record_count;
+}
+
+
+/*!
+ * @brief Record an instruction. Call this from the CPU's exec hook with the same arguments.
+ * 
+ * @param cpu EAR processor executing the instruction
+ * @param insn Instruction being executed
+ * @param pc Address of the next instruction to be executed (after this one)
+ * @param before True if called before executing the instruction, false if after
+ * @param cond True if the instruction's condition evaluated to true
+ */
+void TraceWriter_execHook(
+	TraceWriter* tw, EAR* cpu, EAR_Instruction* insn,
+	EAR_FullAddr pc, bool before, bool cond
+) {
+	EAR_ThreadState* ctx = CTX(*cpu);
+	
+	if(before) {
+		// An instruction that never finished executing is recorded as changing nothing
+		TraceWriter_commitPending(tw);
+		
+		bool kernel = !(ctx->cr[CR_FLAGS] & FLAG_DENY_XREGS);
+		if(!(tw->modes & (kernel ? TRACE_KERNEL : TRACE_USER))) {
+			return;
+		}
+		
+		EAR_VirtAddr insn_addr = ctx->cr[CR_INSN_ADDR];
+		if(insn_addr < tw->addr_lo || insn_addr > tw->addr_hi) {
+			return;
+		}
+		
+		TraceRecord* rec = (TraceRecord*)TraceWriter_reserve(tw);
+		rec->insn_addr = insn_addr;
+		rec->dpc = ctx->r[DPC];
+		rec->pc = (uint16_t)pc;
+		rec->info = cpu->ctx.active ? TRACE_INFO_BANK : 0;
+		if(cond) {
+			rec->info |= TRACE_INFO_COND;
+		}
+		if(kernel) {
+			rec->info |= TRACE_INFO_KERNEL;
+		}
+		pack_instruction(rec->insn, insn);
+		
+		// Remember register values to find which ones the instruction changes
+		memcpy(tw->regs_before, ctx->r, sizeof(tw->regs_before));
+		tw->pending_bank = cpu->ctx.active;
+		tw->pending = true;
+		return;
+	}
+	
+	if(!tw->pending) {
+		return;
+	}
+	tw->pending = false;
+	
+	// Compare against the same bank even if the instruction caused a bank switch
+	EAR_UWord* regs = cpu->ctx.banks[tw->pending_bank].r;
+	size_t* used = &tw->block_used[tw->cur_block];
+	TraceRecord* rec = (TraceRecord*)(tw->blocks + tw->cur_block * TRACE_BLOCK_SIZE + *used);
+	
+	uint16_t changed = 0;
+	unsigned count = 0;
+	EAR_Register i;
+	for(i = 0; i < 16; i++) {
+		if(regs[i] != tw->regs_before[i]) {
+			changed |= 1 << i;
+			rec->values[count++] = regs[i];
+		}
+	}
+	
+	rec->changed = changed;
+	*used += sizeof(*rec) + count * sizeof(rec->values[0]);
+	++tw->record_count;
+}
+
+
+/*!
+ * @brief Write out any buffered records and close the trace file.
+ * 
+ * @return True if the whole trace was written successfully
+ */
+bool TraceWriter_close(TraceWriter** ptw) {
+	TraceWriter* tw = *ptw;
+	if(!tw) {
+		return true;
+	}
+	*ptw = NULL;
+	
+	// Keep the last instruction even if it never finished, such as when it exited the program
+	TraceWriter_commitPending(tw);
+	
+	// Write out the ring's blocks from oldest to newest
+	size_t oldest = (tw->ring && tw->wrapped) ? tw->cur_block + 1 : 0;
+	size_t i;
+	for(i = 0; i < tw->block_count; i++) {
+		size_t index = (oldest + i) % tw->block_count;
+		TraceWriter_writeBlock(tw, index);
+		if(index == tw->cur_block) {
+			break;
+		}
+	}
+	
+	bool success = !tw->failed;
+	if(close(tw->fd) != 0) {
+		success = false;
+	}
+	
+	free(tw->blocks);
+	free(tw->block_used);
+	free(tw);
+	return success;
+}
+
+
+/*!
+ * @brief Start reading trace records from a complete trace file in memory.
+ * 
+ * @param data Pointer to the beginning of the trace file data
+ * @param size Number of bytes in the trace file data
+ * 
+ * @return True if the data starts with a valid trace file header
+ */
+bool TraceReader_init(TraceReader* tr, const void* data, size_t size) {
+	TraceFileHeader header;
+	
+	tr->data = data;
+	tr->size = size;
+	tr->pos = sizeof(header);
+	
+	if(size < sizeof(header)) {
+		return false;
+	}
+	
+	memcpy(&header, data, sizeof(header));
+	return memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) == 0
+		&& header.version == TRACE_VERSION;
+}
+
+
+/*!
+ * @brief Decode the next record from a trace file.
+ * 
+ * @param out_entry Output pointer where the decoded record will be written
+ * 
+ * @return True if a record was decoded, or false at the end of the trace
+ */
+bool TraceReader_next(TraceReader* tr, TraceEntry* out_entry) {
+	TraceRecord rec;
+	
+	if(tr->pos + sizeof(rec) > tr->size) {
+		return false;
+	}
+	
+	memcpy(&rec, tr->data + tr->pos, sizeof(rec));
+	unsigned count = __builtin_popcount(rec.changed);
+	if(tr->pos + sizeof(rec) + count * sizeof(uint16_t) > tr->size) {
+		return false;
+	}
+	
+	out_entry->insn_addr = rec.insn_addr;
+	out_entry->dpc = rec.dpc;
+	out_entry->pc = rec.pc;
+	out_entry->bank = (rec.info & TRACE_INFO_BANK) ? 1 : 0;
+	out_entry->cond = !!(rec.info & TRACE_INFO_COND);
+	out_entry->kernel = !!(rec.info & TRACE_INFO_KERNEL);
+	unpack_instruction(&out_entry->insn, rec.insn);
+	out_entry->changed = rec.changed;
+	
+	const uint8_t* values = tr->data + tr->pos + sizeof(rec);
+	EAR_Register i;
+	for(i = 0; i < 16; i++) {
+		if(rec.changed & (1 << i)) {
+			memcpy(&out_entry->values[i], values, sizeof(uint16_t));
+			values += sizeof(uint16_t);
+		}
+	}
+	
+	tr->pos = values - tr->data;
+	return true;
+}
@@ -0,0 +1,193 @@
+//
+//  trace.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef EARDBG_TRACE_H
+#define EARDBG_TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "libear/ear.h"
+#include "pegasus.h"
+
+
+/*
+ * Binary execution trace file layout:
+ * 
+ *   TraceFileHeader
+ *   TraceRecord, TraceRecord, ...
+ * 
+ * Each TraceRecord is a fixed 16-byte part followed by one word for each
+ * bit set in `changed`, in register number order. All fields are
+ * little-endian.
+ */
+
+#define TRACE_MAGIC "EARTRACE"
+#define TRACE_VERSION 1
+
+typedef struct TraceFileHeader TraceFileHeader;
+struct TraceFileHeader {
+	char magic[8];
+	uint32_t version;
+} __attribute__((packed));
+
+// Bits in TraceRecord.info
+#define TRACE_INFO_BANK    ((uint8_t)(1 << 0)) //!< Register bank that executed the instruction
+#define TRACE_INFO_COND    ((uint8_t)(1 << 1)) //!< Instruction's condition evaluated to true
+#define TRACE_INFO_KERNEL  ((uint8_t)(1 << 2)) //!< Instruction executed in kernel mode
+
+typedef struct TraceRecord TraceRecord;
+struct TraceRecord {
+	uint16_t insn_addr;  //!< Address of the instruction (INSN_ADDR)
+	uint16_t dpc;        //!< Value of DPC while the instruction was fetched
+	uint16_t pc;         //!< Address of the following instruction
+	uint8_t info;        //!< TRACE_INFO_* bits
+	uint8_t insn[7];     //!< Packed decoded instruction
+	uint16_t changed;    //!< Bitmask of registers changed by the instruction
+	uint16_t values[];   //!< New values of each changed register
+} __attribute__((packed));
+
+//! Largest possible size of an encoded trace record
+#define TRACE_RECORD_MAX (sizeof(TraceRecord) + 16 * sizeof(uint16_t))
+
+//! Traced instructions are buffered in blocks of this size
+#define TRACE_BLOCK_SIZE 0x10000
+
+// Which modes to trace
+typedef uint8_t TraceModes;
+#define TRACE_USER   ((TraceModes)(1 << 0))
+#define TRACE_KERNEL ((TraceModes)(1 << 1))
+
+typedef struct TraceWriter TraceWriter;
+struct TraceWriter {
+	int fd;
+
+	// Buffer blocks. Normally there is only one, which is written out to the
+	// file each time it fills up. In ring mode, the oldest block is reused
+	// instead and nothing is written until the trace is closed.
+	uint8_t* blocks;
+	size_t* block_used;
+	size_t block_count;
+	size_t cur_block;
+	bool ring;
+	bool wrapped;
+
+	// Filters
+	TraceModes modes;
+	EAR_UWord addr_lo;
+	EAR_UWord addr_hi;
+
+	// Instruction that has been seen by the pre-exec hook but not the post-exec hook.
+	// Its record is written at the end of the current block but not yet committed.
+	bool pending;
+	uint8_t pending_bank;
+	EAR_UWord regs_before[16];
+
+	uint64_t record_count;
+	bool failed;
+};
+
+//! A decoded trace record
+typedef struct TraceEntry TraceEntry;
+struct TraceEntry {
+	EAR_VirtAddr insn_addr;   //!< Address of the instruction
+	EAR_UWord dpc;            //!< Value of DPC while the instruction was fetched
+	EAR_FullAddr pc;          //!< Address of the following instruction
+	uint8_t bank;             //!< Register bank that executed the instruction
+	bool cond;                //!< True if the condition evaluated to true
+	bool kernel;              //!< True if the instruction executed in kernel mode
+	EAR_Instruction insn;     //!< Decoded instruction
+	uint16_t changed;         //!< Bitmask of registers changed by the instruction
+	EAR_UWord values[16];     //!< New register values, valid for bits set in `changed`
+};
+
+typedef struct TraceReader TraceReader;
+struct TraceReader {
+	const uint8_t* data;
+	size_t size;
+	size_t pos;
+};
+
+
+/*!
+ * @brief Create a binary trace file.
+ * 
+ * @param path Path of the trace file to create
+ * @param ring_size When nonzero, only keep roughly the last `ring_size` bytes of
+ *        the trace in memory and write them out when the trace is closed
+ * 
+ * @return Newly created trace writer, or NULL on error (with errno set)
+ */
+TraceWriter* TraceWriter_open(const char* path, size_t ring_size);
+
+/*!
+ * @brief Only trace instructions executed in the selected modes.
+ * 
+ * @param modes Bitmask of TRACE_USER and/or TRACE_KERNEL
+ */
+void TraceWriter_setModes(TraceWriter* tw, TraceModes modes);
+
+/*!
+ * @brief Only trace instructions whose address lies within the given range.
+ * 
+ * @param lo Lowest instruction address to trace
+ * @param hi Highest instruction address to trace (inclusive)
+ */
+void TraceWriter_setRange(TraceWriter* tw, EAR_UWord lo, EAR_UWord hi);
+
+/*!
+ * @brief Only trace instructions within the named symbol, which is assumed to extend
+ * up to the next symbol in the image.
+ * 
+ * @param peg Image containing the symbol
+ * @param name Name of the symbol
+ * 
+ * @return True if the symbol was found
+ */
+bool TraceWriter_setSymbol(TraceWriter* tw, Pegasus* peg, const char* name);
+
+/*!
+ * @brief Record an instruction. Call this from the CPU's exec hook with the same arguments.
+ * 
+ * @param cpu EAR processor executing the instruction
+ * @param insn Instruction being executed
+ * @param pc Address of the next instruction to be executed (after this one)
+ * @param before True if called before executing the instruction, false if after
+ * @param cond True if the instruction's condition evaluated to true
+ */
+void TraceWriter_execHook(
+	TraceWriter* tw, EAR* cpu, EAR_Instruction* insn,
+	EAR_FullAddr pc, bool before, bool cond
+);
+
+/*!
+ * @brief Write out any buffered records and close the trace file.
+ * 
+ * @return True if the whole trace was written successfully
+ */
+bool TraceWriter_close(TraceWriter** ptw);
+
+/*!
+ * @brief Start reading trace records from a complete trace file in memory.
+ * 
+ * @param data Pointer to the beginning of the trace file data
+ * @param size Number of bytes in the trace file data
+ * 
+ * @return True if the data starts with a valid trace file header
+ */
+bool TraceReader_init(TraceReader* tr, const void* data, size_t size);
+
+/*!
+ * @brief Decode the next record from a trace file.
+ * 
+ * @param out_entry Output pointer where the decoded record will be written
+ * 
+ * @return True if a record was decoded, or false at the end of the trace
+ */
+bool TraceReader_next(TraceReader* tr, TraceEntry* out_entry);
+
+#endif /* EARDBG_TRACE_H */
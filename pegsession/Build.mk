@@ -2,6 +2,15 @@
 # active PEGASUS I/O session as long as they know the session ID.
 DOCKER_IMAGE := pegsession
 
+# The session broker is a single epoll-based process that handles every
+# connection, so hundreds of concurrent sessions don't need a process each.
+TARGET := pegsession
+PRODUCT := $(PEG_BIN)/$(TARGET)
+
+LIBS := \
+	$(PEG_BIN)/libear.so \
+	$(PEG_BIN)/libeardbg.so
+
 # This project allows connecting to a PEGASUS session from any challenge.
 # Upon receiving a connection, this service will ask for the PEGASUS
 # session ID, which is a 64-bit securely random hex string. It will use
@@ -12,14 +21,18 @@ DOCKER_PORTS := $(PEGSESSION_PORT)
 # This Docker image does not use the base image for PwnableHarness
 DOCKER_IMAGE_CUSTOM := 1
 
-# The Dockerfile needs to copy the entrypoint.sh and peg_connect.sh scripts
-# from the project directory, so tell it where that is.
+# The Dockerfile needs to copy the entrypoint.sh script from the project
+# directory and the broker and its libraries from the bin directory, so
+# tell it where those are.
 DOCKER_BUILD_ARGS := \
 	--build-arg "DIR=$(DIR)" \
+	--build-arg "PEG_BIN=$(PEG_BIN)" \
 	--build-arg "PORT=$(PEGSESSION_PORT)" \
 	--build-arg "MOUNT_POINT=$(PEG_SESSIONS_MOUNT_POINT)"
 
 # Automatically rebuild the Docker image whenever any of these files change.
 DOCKER_BUILD_DEPS := \
 	$(DIR)/entrypoint.sh \
-	$(DIR)/peg_connect.sh
+	$(PRODUCT) \
+	$(PEG_BIN)/libear.so \
+	$(PEG_BIN)/libeardbg.so
@@ -0,0 +1,660 @@
+//
+//  pegsession.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+// Needed for splice()
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include "common/macros.h"
+#include "common/dynamic_array.h"
+#include "libeardbg/listen.h"
+
+/*
+ * Broker that connects players to the I/O of their PEGASUS session. For each TCP
+ * connection it asks for the session ID, checks that it's exactly 16 lowercase hex
+ * characters, connects to the UNIX domain socket "<sessions dir>/peg.<id>" that
+ * runpeg is listening on, and then moves data between the two sockets in both
+ * directions until both sides are finished.
+ * 
+ * Everything runs on one thread with epoll, and data is moved with splice() through
+ * a pipe per direction so it's never copied into this process. If splice() isn't
+ * supported for a pair of sockets, that direction falls back to recv() and send().
+ */
+
+//! Number of hex characters in a PEGASUS session ID
+#define PEG_SESSION_ID_LEN 16
+
+//! Seconds a client has to enter the session ID
+#define PEG_SESSION_ID_TIMEOUT 60
+
+//! Max bytes moved per splice() or recv() call
+#define PEG_RELAY_CHUNK (64 * 1024)
+
+//! Maximum number of events handled per epoll_wait() call
+#define PEG_EPOLL_EVENTS 64
+
+
+//! One direction of a brokered session
+typedef struct PegRelay {
+	int from;
+	int to;
+	int pipe_fds[2];       //!< Pipe holding data read but not yet written, or -1 when copying
+	uint8_t* buf;          //!< Buffer used instead of the pipe when splice() isn't supported
+	size_t buf_offset;
+	size_t pending;        //!< Bytes read from `from` that haven't been written to `to` yet
+	bool want_read;        //!< Waiting for `from` to be readable
+	bool want_write;       //!< Waiting for `to` to be writable
+	bool eof;              //!< Reached the end of `from`
+	bool done;             //!< Finished, and `to` has been shut down for writing
+} PegRelay;
+
+typedef struct PegSession PegSession;
+
+//! Registered with epoll for each socket of a session, to tell which one an event is for
+typedef struct PegSocket {
+	PegSession* session;
+	int index;             //!< 0 for the client's socket, 1 for the session's
+} PegSocket;
+
+//! A client connection, either entering its session ID or connected to the session
+struct PegSession {
+	unsigned id;
+	int fds[2];            //!< Client socket, then session socket (-1 until connected)
+	PegSocket sockets[2];
+	bool hup[2];           //!< Whether each socket was removed from epoll after a hangup
+	PegRelay relays[2];    //!< Relay reading from each socket
+	time_t deadline;
+	char line[PEG_SESSION_ID_LEN + 2];
+	size_t line_len;
+	bool id_valid;         //!< Whether the client entered a valid session ID and is waiting to connect
+	char extra[256];       //!< Data the client sent after its session ID
+	size_t extra_len;
+	bool closed;
+};
+
+typedef struct PegBroker {
+	const char* sessions_dir;
+	int listen_fd;
+	int epoll_fd;
+	unsigned next_id;
+	bool accept_paused;
+	dynamic_array(PegSession*) waiting;
+	dynamic_array(PegSession*) closing;
+} PegBroker;
+
+
+// Best-effort message to a client, which is dropped if the client isn't reading
+static void PegBroker_reply(int fd, const char* msg) {
+	(void)!send(fd, msg, strlen(msg), MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+
+static void PegRelay_init(PegRelay* relay, int from, int to) {
+	relay->from = from;
+	relay->to = to;
+	relay->pipe_fds[0] = relay->pipe_fds[1] = -1;
+	relay->want_read = true;
+	
+	// Without a pipe, this direction just copies through a buffer
+	if(pipe2(relay->pipe_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+		relay->pipe_fds[0] = relay->pipe_fds[1] = -1;
+	}
+}
+
+
+static void PegRelay_destroy(PegRelay* relay) {
+	if(relay->pipe_fds[0] != -1) {
+		close(relay->pipe_fds[0]);
+		close(relay->pipe_fds[1]);
+		relay->pipe_fds[0] = relay->pipe_fds[1] = -1;
+	}
+	destroy(&relay->buf);
+}
+
+
+// Switch a relay from splice() to copying, keeping any data already in its pipe
+static bool PegRelay_stopSplicing(PegRelay* relay) {
+	if(!relay->buf) {
+		relay->buf = malloc(PEG_RELAY_CHUNK);
+		if(!relay->buf) {
+			return false;
+		}
+	}
+	
+	// The pipe never holds more than one chunk, as it's drained before refilling
+	relay->buf_offset = 0;
+	size_t have = 0;
+	while(have < relay->pending) {
+		ssize_t n = read(relay->pipe_fds[0], relay->buf + have, relay->pending - have);
+		if(n <= 0) {
+			return false;
+		}
+		have += n;
+	}
+	
+	if(relay->pipe_fds[0] != -1) {
+		close(relay->pipe_fds[0]);
+		close(relay->pipe_fds[1]);
+		relay->pipe_fds[0] = relay->pipe_fds[1] = -1;
+	}
+	return true;
+}
+
+
+// Move as much data as possible through a relay, returning false on a fatal error
+static bool PegRelay_pump(PegRelay* relay) {
+	relay->want_read = relay->want_write = false;
+	
+	while(!relay->done) {
+		// Drain pending data before reading any more
+		if(relay->pending != 0) {
+			ssize_t n;
+			if(relay->pipe_fds[0] != -1) {
+				n = splice(relay->pipe_fds[0], NULL, relay->to, NULL, relay->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+				if(n < 0 && errno == EINVAL) {
+					if(!PegRelay_stopSplicing(relay)) {
+						return false;
+					}
+					continue;
+				}
+			}
+			else {
+				n = send(relay->to, relay->buf + relay->buf_offset, relay->pending, MSG_NOSIGNAL);
+				if(n > 0) {
+					relay->buf_offset += n;
+				}
+			}
+			
+			if(n < 0) {
+				if(errno == EAGAIN || errno == EWOULDBLOCK) {
+					relay->want_write = true;
+					return true;
+				}
+				if(errno == EINTR) {
+					continue;
+				}
+				
+				// Nobody is left to receive this direction, so drop the rest of it
+				if(errno == EPIPE || errno == ECONNRESET) {
+					relay->pending = 0;
+					relay->done = true;
+					break;
+				}
+				return false;
+			}
+			relay->pending -= n;
+			continue;
+		}
+		
+		// Pass on the end of the stream once everything before it has been written
+		if(relay->eof) {
+			shutdown(relay->to, SHUT_WR);
+			relay->done = true;
+			break;
+		}
+		
+		ssize_t n;
+		if(relay->pipe_fds[1] != -1) {
+			n = splice(relay->from, NULL, relay->pipe_fds[1], NULL, PEG_RELAY_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+			if(n < 0 && errno == EINVAL) {
+				if(!PegRelay_stopSplicing(relay)) {
+					return false;
+				}
+				continue;
+			}
+		}
+		else {
+			if(!relay->buf) {
+				relay->buf = malloc(PEG_RELAY_CHUNK);
+				if(!relay->buf) {
+					return false;
+				}
+			}
+			relay->buf_offset = 0;
+			n = recv(relay->from, relay->buf, PEG_RELAY_CHUNK, 0);
+		}
+		
+		if(n < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK) {
+				relay->want_read = true;
+				return true;
+			}
+			if(errno == EINTR) {
+				continue;
+			}
+			
+			// A reset connection ends this direction like a normal close
+			if(errno != ECONNRESET) {
+				return false;
+			}
+			n = 0;
+		}
+		
+		if(n == 0) {
+			relay->eof = true;
+		}
+		relay->pending = n;
+	}
+	
+	return true;
+}
+
+
+static void PegSession_destroy(PegSession** psession) {
+	PegSession* session = *psession;
+	if(!session) {
+		return;
+	}
+	*psession = NULL;
+	
+	for(int i = 0; i < 2; i++) {
+		if(session->fds[i] != -1) {
+			close(session->fds[i]);
+		}
+	}
+	PegRelay_destroy(&session->relays[0]);
+	PegRelay_destroy(&session->relays[1]);
+	free(session);
+}
+
+
+// Close a session and, if it was holding up accepting connections, resume accepting.
+// It's freed after the current batch of events, which may still refer to it.
+static void PegBroker_close(PegBroker* broker, PegSession* session) {
+	// Closing the file descriptors removes them from the epoll set
+	for(int i = 0; i < 2; i++) {
+		if(session->fds[i] != -1) {
+			close(session->fds[i]);
+			session->fds[i] = -1;
+		}
+	}
+	session->closed = true;
+	array_append(&broker->closing, session);
+	
+	if(broker->accept_paused) {
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+		if(epoll_ctl(broker->epoll_fd, EPOLL_CTL_MOD, broker->listen_fd, &ev) == 0) {
+			broker->accept_paused = false;
+		}
+	}
+}
+
+
+// Stop waiting for a client's session ID, optionally closing the connection
+static void PegBroker_forget(PegBroker* broker, PegSession* session, bool close_conn) {
+	enumerate(&broker->waiting, i, pcur) {
+		if(*pcur == session) {
+			array_removeIndex(&broker->waiting, i);
+			break;
+		}
+	}
+	
+	if(close_conn) {
+		PegBroker_close(broker, session);
+	}
+}
+
+
+static void PegBroker_accept(PegBroker* broker) {
+	while(true) {
+		struct sockaddr_storage addr;
+		socklen_t addr_len = sizeof(addr);
+		int fd = accept(broker->listen_fd, (struct sockaddr*)&addr, &addr_len);
+		if(fd < 0) {
+			if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				// Out of resources, so leave connections in the backlog until a session closes
+				perror("accept");
+				struct epoll_event ev = {.events = 0, .data.ptr = NULL};
+				if(epoll_ctl(broker->epoll_fd, EPOLL_CTL_MOD, broker->listen_fd, &ev) == 0) {
+					broker->accept_paused = true;
+				}
+			}
+			else if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				perror("accept");
+			}
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		
+		PegSession* session = calloc(1, sizeof(*session));
+		if(!session) {
+			close(fd);
+			continue;
+		}
+		session->id = broker->next_id++;
+		session->fds[0] = fd;
+		session->fds[1] = -1;
+		for(int i = 0; i < 2; i++) {
+			session->sockets[i].session = session;
+			session->sockets[i].index = i;
+			session->relays[i].pipe_fds[0] = session->relays[i].pipe_fds[1] = -1;
+		}
+		session->deadline = time(NULL) + PEG_SESSION_ID_TIMEOUT;
+		
+		char host[NI_MAXHOST] = "?";
+		char port[NI_MAXSERV] = "?";
+		getnameinfo((struct sockaddr*)&addr, addr_len, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV);
+		
+		char date[32] = "";
+		time_t now = time(NULL);
+		struct tm tm;
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime_r(&now, &tm));
+		fprintf(stderr, "%u: Received connection from %s:%s at %s\n", session->id, host, port, date);
+		
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = &session->sockets[0]};
+		if(epoll_ctl(broker->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			perror("epoll_ctl");
+			PegSession_destroy(&session);
+			continue;
+		}
+		array_append(&broker->waiting, session);
+		
+		PegBroker_reply(fd, "Enter PEGASUS session ID:\n");
+	}
+}
+
+
+// Update which events epoll reports for the sockets of a connected session, based on
+// what its relays are waiting for
+static bool PegBroker_watch(PegBroker* broker, PegSession* session, bool connecting) {
+	for(int i = 0; i < 2; i++) {
+		if(session->hup[i]) {
+			continue;
+		}
+		
+		// Relay i reads from socket i, and the other relay writes to it
+		struct epoll_event ev = {.events = 0, .data.ptr = &session->sockets[i]};
+		if(session->relays[i].want_read) {
+			ev.events |= EPOLLIN;
+		}
+		if(session->relays[!i].want_write) {
+			ev.events |= EPOLLOUT;
+		}
+		
+		// The session socket is new when the client has just been connected to it
+		int op = connecting && i == 1 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+		if(epoll_ctl(broker->epoll_fd, op, session->fds[i], &ev) != 0) {
+			perror("epoll_ctl");
+			return false;
+		}
+	}
+	return true;
+}
+
+
+// Connect a client to the session it asked for, once it has entered a valid session ID.
+// Anything the client sent after its session ID is passed on to the session first.
+static void PegBroker_connect(PegBroker* broker, PegSession* session) {
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/peg.%s", broker->sessions_dir, session->line);
+	
+	session->fds[1] = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(session->fds[1] < 0) {
+		perror("socket");
+		PegBroker_forget(broker, session, true);
+		return;
+	}
+	
+	// Connecting to a UNIX domain socket never completes asynchronously. It fails with
+	// EAGAIN when runpeg's backlog is full, so leave the client waiting and try again later.
+	if(connect(session->fds[1], (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		if(errno == EAGAIN) {
+			close(session->fds[1]);
+			session->fds[1] = -1;
+			struct epoll_event ev = {.events = 0, .data.ptr = &session->sockets[0]};
+			epoll_ctl(broker->epoll_fd, EPOLL_CTL_MOD, session->fds[0], &ev);
+			return;
+		}
+		
+		fprintf(stderr, "%u: Unable to connect to %s: %s\n", session->id, addr.sun_path, strerror(errno));
+		PegBroker_reply(session->fds[0], "Unable to connect to PEGASUS session.\n");
+		PegBroker_forget(broker, session, true);
+		return;
+	}
+	PegBroker_forget(broker, session, false);
+	
+	PegRelay* upload = &session->relays[0];
+	PegRelay_init(upload, session->fds[0], session->fds[1]);
+	PegRelay_init(&session->relays[1], session->fds[1], session->fds[0]);
+	
+	if(session->extra_len != 0) {
+		// The pipe is empty and much larger than this, so this never writes partially
+		ssize_t n = -1;
+		if(upload->pipe_fds[1] != -1) {
+			n = write(upload->pipe_fds[1], session->extra, session->extra_len);
+		}
+		if(n != (ssize_t)session->extra_len) {
+			if(!PegRelay_stopSplicing(upload)) {
+				PegBroker_close(broker, session);
+				return;
+			}
+			memcpy(upload->buf, session->extra, session->extra_len);
+		}
+		upload->pending = session->extra_len;
+	}
+	
+	if(!PegRelay_pump(&session->relays[0]) || !PegRelay_pump(&session->relays[1])) {
+		PegBroker_close(broker, session);
+		return;
+	}
+	
+	if(!PegBroker_watch(broker, session, true)) {
+		PegBroker_close(broker, session);
+	}
+}
+
+
+// Read the session ID a client is typing, connecting it when the line is complete
+static void PegBroker_readID(PegBroker* broker, PegSession* session) {
+	char buf[256];
+	ssize_t n = recv(session->fds[0], buf, sizeof(buf), 0);
+	if(n < 0) {
+		if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			PegBroker_forget(broker, session, true);
+		}
+		return;
+	}
+	
+	// The ID may also be ended by closing the connection
+	size_t count = n;
+	char* newline = memchr(buf, '\n', count);
+	size_t take = newline ? (size_t)(newline - buf) : count;
+	size_t copy = MIN(take, sizeof(session->line) - 1 - session->line_len);
+	memcpy(session->line + session->line_len, buf, copy);
+	session->line_len += copy;
+	session->line[session->line_len] = '\0';
+	
+	bool too_long = copy < take;
+	if(!newline && !too_long && count != 0) {
+		return;
+	}
+	
+	// Accept the ID from clients that end lines with CRLF
+	if(session->line_len != 0 && session->line[session->line_len - 1] == '\r') {
+		session->line[--session->line_len] = '\0';
+	}
+	
+	bool valid = !too_long && session->line_len == PEG_SESSION_ID_LEN;
+	for(size_t i = 0; valid && i < session->line_len; i++) {
+		char c = session->line[i];
+		valid = (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f');
+	}
+	
+	if(!valid) {
+		// Strip unprintable characters before logging what the client sent
+		size_t clean_len = 0;
+		for(size_t i = 0; i < session->line_len; i++) {
+			char c = session->line[i];
+			if(c >= ' ' && c <= '~') {
+				session->line[clean_len++] = c;
+			}
+		}
+		session->line[clean_len] = '\0';
+		fprintf(stderr, "%u: INVALID: %s\n", session->id, session->line);
+		PegBroker_reply(session->fds[0], "Invalid PEGASUS session ID. Must be exactly 16 hexadecimal characters (lowercase).\n");
+		PegBroker_forget(broker, session, true);
+		return;
+	}
+	
+	fprintf(stderr, "%u: VALID: %s\n", session->id, session->line);
+	session->id_valid = true;
+	
+	// Without a newline, the client already closed its side, which the relay will pass on
+	if(newline) {
+		session->extra_len = count - take - 1;
+		memcpy(session->extra, newline + 1, session->extra_len);
+	}
+	PegBroker_connect(broker, session);
+}
+
+
+// Handle an event on either socket of a connected session
+static void PegBroker_relay(PegBroker* broker, PegSocket* sock, uint32_t events) {
+	PegSession* session = sock->session;
+	if(events & EPOLLERR) {
+		PegBroker_close(broker, session);
+		return;
+	}
+	
+	if(!PegRelay_pump(&session->relays[0]) || !PegRelay_pump(&session->relays[1])) {
+		PegBroker_close(broker, session);
+		return;
+	}
+	
+	if(events & EPOLLHUP) {
+		// Nothing more can be written to a socket that hung up, and epoll would keep
+		// reporting the hangup, so stop watching it. Reading from it won't block anymore,
+		// so the relay reading from it is driven by events on the other socket.
+		PegRelay* relay_to = &session->relays[!sock->index];
+		relay_to->pending = 0;
+		relay_to->done = true;
+		relay_to->want_read = relay_to->want_write = false;
+		session->hup[sock->index] = true;
+		epoll_ctl(broker->epoll_fd, EPOLL_CTL_DEL, session->fds[sock->index], NULL);
+	}
+	
+	if(session->relays[0].done && session->relays[1].done) {
+		PegBroker_close(broker, session);
+		return;
+	}
+	
+	if(!PegBroker_watch(broker, session, false)) {
+		PegBroker_close(broker, session);
+	}
+}
+
+
+// Drop clients that are taking too long to enter their session ID or to be connected,
+// and retry connecting clients whose session was busy
+static void PegBroker_expire(PegBroker* broker) {
+	time_t now = time(NULL);
+	for(size_t i = broker->waiting.count; i-- > 0;) {
+		PegSession* session = broker->waiting.elems[i];
+		if(now >= session->deadline) {
+			fprintf(stderr, "%u: TIMEOUT\n", session->id);
+			PegBroker_forget(broker, session, true);
+		}
+		else if(session->id_valid) {
+			PegBroker_connect(broker, session);
+		}
+	}
+}
+
+
+int main(int argc, char** argv) {
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s LISTEN_ADDRESS SESSIONS_DIR\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	PegBroker broker = {0};
+	broker.sessions_dir = argv[2];
+	broker.epoll_fd = -1;
+	
+	// Clients hanging up mid-write shouldn't kill the broker
+	broker.listen_fd = listen_on_address(argv[1], SOMAXCONN);
+	if(broker.listen_fd < 0) {
+		return EXIT_FAILURE;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	fcntl(broker.listen_fd, F_SETFL, fcntl(broker.listen_fd, F_GETFL) | O_NONBLOCK);
+	
+	broker.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(broker.epoll_fd < 0) {
+		perror("epoll_create1");
+		close_listener(broker.listen_fd, argv[1]);
+		return EXIT_FAILURE;
+	}
+	
+	// The listening socket is the only one registered with a NULL pointer
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	if(epoll_ctl(broker.epoll_fd, EPOLL_CTL_ADD, broker.listen_fd, &ev) != 0) {
+		perror("epoll_ctl");
+		close(broker.epoll_fd);
+		close_listener(broker.listen_fd, argv[1]);
+		return EXIT_FAILURE;
+	}
+	
+	fprintf(stderr, "Brokering PEGASUS sessions in %s on %s\n", broker.sessions_dir, argv[1]);
+	
+	while(true) {
+		struct epoll_event events[PEG_EPOLL_EVENTS];
+		int count = epoll_wait(broker.epoll_fd, events, ARRAY_COUNT(events), 1000);
+		if(count < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+		
+		for(int i = 0; i < count; i++) {
+			PegSocket* sock = events[i].data.ptr;
+			if(sock == NULL) {
+				PegBroker_accept(&broker);
+			}
+			else if(sock->session->closed) {
+				continue;
+			}
+			else if(sock->session->id_valid && sock->session->fds[1] == -1) {
+				// Only an error is reported while waiting to connect
+				PegBroker_forget(&broker, sock->session, true);
+			}
+			else if(sock->session->fds[1] == -1) {
+				PegBroker_readID(&broker, sock->session);
+			}
+			else {
+				PegBroker_relay(&broker, sock, events[i].events);
+			}
+		}
+		
+		PegBroker_expire(&broker);
+		foreach(&broker.closing, psession) {
+			PegSession_destroy(psession);
+		}
+		broker.closing.count = 0;
+	}
+	
+	close(broker.epoll_fd);
+	close_listener(broker.listen_fd, argv[1]);
+	return EXIT_FAILURE;
+}
@@ -3,9 +3,13 @@ PRODUCT := $(PEG_BIN)/$(TARGET)
 
 RUNPEG_DIR := $(DIR)
 
+# runpeg supports --stats, so it uses the builds of libear and libeardbg that have
+# the runtime statistics counters compiled in
+CFLAGS := $(DEFAULT_CFLAGS) -DEAR_STATS=1
+
 LIBS := \
-	$(PEG_BIN)/libear.so \
-	$(PEG_BIN)/libeardbg.so \
+	$(PEG_BIN)/libear-stats.so \
+	$(PEG_BIN)/libeardbg-stats.so \
 	$(PEG_BIN)/libkjc_argparse.a
 
 SRCS := runpeg.c bootrom.c
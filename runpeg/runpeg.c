@@ -8,26 +8,34 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <dlfcn.h>
 #include <errno.h>
+#include <signal.h>
+#include <ctype.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
-#include <netdb.h>
-#include <sys/un.h>
-#include <netinet/in.h>
-#include <signal.h>
 #include "common/dynamic_string.h"
 #include "libear/ear.h"
 #include "libear/bus.h"
 #include "libear/mmu.h"
 #include "libear/plugin.h"
 #include "libeardbg/debugger.h"
+#include "libeardbg/loader.h"
+#include "libeardbg/trace.h"
+#include "libeardbg/profile.h"
+#include "libeardbg/memprof.h"
+#include "libeardbg/stats.h"
+#include "libeardbg/bench.h"
+#include "libeardbg/replay.h"
+#include "libeardbg/listen.h"
+#include "libeardbg/gdbstub.h"
 #include "kjc_argparse/kjc_argparse.h"
 #include "bootrom.h"
 
@@ -63,6 +71,15 @@ typedef struct RunPegCookie {
 	
 	// True if kernel-mode instructions should be traced
 	bool kernel;
+	
+	// Writes a binary trace of executed instructions when non-NULL
+	TraceWriter* trace_writer;
+	
+	// Samples the guest call stack when non-NULL
+	Profiler* profiler;
+	
+	// Port I/O is recorded to or replayed from this log when non-NULL
+	ReplayLog* replay_log;
 } RunPegCookie;
 
 
@@ -97,15 +114,28 @@ static EAR_HaltReason runpeg_trace(void* cookie, EAR_Instruction* insn, EAR_Full
 		Debugger_showInstruction(runpeg->dbg, insn, pc, stderr);
 	}
 	
-	return runpeg->dbg_trace ? runpeg->dbg_trace(runpeg->dbg, insn, pc, before, cond) : HALT_NONE;
+	EAR_HaltReason ret = runpeg->dbg_trace ? runpeg->dbg_trace(runpeg->dbg, insn, pc, before, cond) : HALT_NONE;
+	
+	// Instructions that the debugger stops at before they execute aren't recorded
+	if(runpeg->trace_writer && (!before || ret == HALT_NONE)) {
+		TraceWriter_execHook(runpeg->trace_writer, ear, insn, pc, before, cond);
+	}
+	
+	if(runpeg->profiler && ret == HALT_NONE) {
+		Profiler_execHook(runpeg->profiler, ear, before);
+	}
+	
+	// The debugger is about to take over, so write out the recorded port I/O
+	if(ret != HALT_NONE) {
+		ReplayLog_flush(runpeg->replay_log);
+	}
+	
+	return ret;
 }
 
 
-// Called during execution of the `RDB` instruction
-static EAR_HaltReason runpeg_portRead(void* cookie, uint8_t port_number, EAR_Byte* out_byte) {
-	RunPegCookie* runpeg = cookie;
-	EAR_Byte byte;
-	
+// Read a byte from the file descriptor attached to a port
+static EAR_HaltReason runpeg_readByte(RunPegCookie* runpeg, uint8_t port_number, EAR_Byte* out_byte) {
 	int fd = -1;
 	if(port_number == 0) {
 		fd = runpeg->in_fd;
@@ -119,7 +149,7 @@ static EAR_HaltReason runpeg_portRead(void* cookie, uint8_t port_number, EAR_Byt
 	}
 	
 	// Read byte from stdin
-	ssize_t bytes_read = read(fd, &byte, 1);
+	ssize_t bytes_read = read(fd, out_byte, 1);
 	if(bytes_read != 1) {
 		if(g_interrupted) {
 			return HALT_DEBUGGER;
@@ -131,6 +161,36 @@ static EAR_HaltReason runpeg_portRead(void* cookie, uint8_t port_number, EAR_Byt
 		return HALT_IO_ERROR;
 	}
 	
+	return HALT_NONE;
+}
+
+
+// Called during execution of the `RDB` instruction
+static EAR_HaltReason runpeg_portRead(void* cookie, uint8_t port_number, EAR_Byte* out_byte) {
+	RunPegCookie* runpeg = cookie;
+	EAR_Byte byte = 0;
+	
+	// When replaying, every byte comes from the log instead
+	if(runpeg->replay_log && ReplayLog_isReplaying(runpeg->replay_log)) {
+		EAR_HaltReason r = ReplayLog_replayRead(runpeg->replay_log, runpeg->ear->ins_count, port_number, &byte);
+		if(r != HALT_NONE) {
+			return r;
+		}
+	}
+	else {
+		EAR_HaltReason r = runpeg_readByte(runpeg, port_number, &byte);
+		
+		// Reads that were interrupted by the debugger will be retried later
+		if(runpeg->replay_log && r != HALT_DEBUGGER) {
+			ReplayLog_recordRead(runpeg->replay_log, runpeg->ear->ins_count, port_number, byte, r);
+		}
+		
+		if(r != HALT_NONE) {
+			ReplayLog_flush(runpeg->replay_log);
+			return r;
+		}
+	}
+	
 	if(runpeg->verbose) {
 		char ch[5] = {0};
 		const char* ch_str = NULL;
@@ -214,6 +274,21 @@ static EAR_HaltReason runpeg_portWrite(void* cookie, uint8_t port_number, EAR_By
 		fprintf(stderr, "WRB (%hhu), '%s'\n", port_number, ch_str);
 	}
 	
+	// Replays check that the program writes exactly what it wrote when it was recorded.
+	// Writes to ports that don't exist always fail the same way, so they aren't logged.
+	bool logged_port = port_number <= 1 || port_number == 0xD || port_number == 0xE;
+	if(runpeg->replay_log && logged_port) {
+		if(ReplayLog_isReplaying(runpeg->replay_log)) {
+			EAR_HaltReason r = ReplayLog_replayWrite(runpeg->replay_log, runpeg->ear->ins_count, port_number, byte);
+			if(r != HALT_NONE) {
+				return r;
+			}
+		}
+		else {
+			ReplayLog_recordWrite(runpeg->replay_log, runpeg->ear->ins_count, port_number, byte);
+		}
+	}
+	
 	int fd = -1;
 	switch(port_number) {
 		case 0: //stdout
@@ -228,10 +303,15 @@ static EAR_HaltReason runpeg_portWrite(void* cookie, uint8_t port_number, EAR_By
 			if(!runpeg->show_debug_uart) {
 				return HALT_NONE;
 			}
-			fd = runpeg->out_fd;
+			
+			// With --io-concurrency, the bootrom runs before any client has connected
+			fd = runpeg->out_fd >= 0 ? runpeg->out_fd : STDERR_FILENO;
 			break;
 		
 		case 0xE: //exit
+			if(runpeg->dbg) {
+				Debugger_notifyExit(runpeg->dbg, byte);
+			}
 			exit(byte);
 		
 		default:
@@ -251,198 +331,113 @@ static EAR_HaltReason runpeg_portWrite(void* cookie, uint8_t port_number, EAR_By
 }
 
 
-// When listening for a connection to a UNIX domain socket, be careful to ensure that
-// the socket is always deleted even when this program is killed by alarm().
-const char* g_unix_bind = NULL;
-static void unlink_unix_socket(int signum) {
-	if(g_unix_bind != NULL) {
-		unlink(g_unix_bind);
-		_exit(signum);
+// The program can exit from within a `WRB` instruction, so the binary trace
+// file is closed from an atexit handler to make sure it is always written.
+static TraceWriter* g_trace_writer = NULL;
+
+static void close_trace_file(void) {
+	if(!TraceWriter_close(&g_trace_writer)) {
+		perror("Failed to write trace file");
 	}
 }
 
 
-static int listen_for_connection(const char* listen_address, bool io_quiet) {
-	int err = -1;
-	int conn = -1;
-	int sock = -1;
-	socklen_t socklen = 0;
-	struct sockaddr* psa = NULL;
-	bool did_unix_bind = false;
-	unsigned i;
-	static const int signals_to_catch[] = {
-		SIGALRM,
-		SIGINT,
-		SIGSEGV,
-		SIGABRT,
-		SIGPIPE,
-		SIGTERM,
-		SIGHUP,
-	};
-	
-	// There are two forms of socket listen addresses handled here.
-	//
-	// 1. <hostname>:<port>
-	// 2. <path to UNIX domain socket>
-	const char* port_str = strchr(listen_address, ':');
-	if(port_str != NULL) {
-		// This is form 1, meaning we will listen for incoming TCP connections on the given host and port.
-		char* hostname;
-		if(port_str == listen_address) {
-			hostname = NULL;
-		}
-		else {
-			hostname = strndup(listen_address, port_str - listen_address);
-		}
-		port_str++;
-		
-		struct addrinfo hints = {0};
-		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_flags = AI_PASSIVE;
-		
-		// Do a domain name lookup on the provided hostname
-		struct addrinfo* ais = NULL;
-		int gai_err = getaddrinfo(hostname, port_str, &hints, &ais);
-		destroy(&hostname);
-		if(gai_err != 0) {
-			fprintf(stderr, "Error: Couldn't resolve hostname \"%s\": %s\n", listen_address, gai_strerror(gai_err));
-			goto out;
-		}
-		
-		// Try listening to each returned address
-		struct addrinfo* ai;
-		int first_errno = 0;
-		for(ai = ais; ai != NULL; ai = ai->ai_next) {
-			errno = 0;
-			sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-			if(sock == -1) {
-				if(first_errno == 0) {
-					first_errno = errno;
-				}
-				continue;
-			}
-			
-			errno = 0;
-			int err = bind(sock, ai->ai_addr, ai->ai_addrlen);
-			if(err == 0) {
-				socklen = ai->ai_addrlen;
-				break;
-			}
-			
-			if(first_errno == 0) {
-				first_errno = errno;
-			}
-			
-			close(sock);
-			sock = -1;
-		}
-		
-		// Done with name lookup
-		freeaddrinfo(ais);
-		
-		if(ai == NULL) {
-			fprintf(stderr, "Error: Unable to bind to an address for %s:%s", listen_address, port_str);
-			if(first_errno != 0) {
-				fprintf(stderr, ": %s\n", strerror(first_errno));
-			}
-			else {
-				fprintf(stderr, "\n");
-			}
-			goto out;
-		}
-	}
-	else {
-		// This is form 2, meaning we will listen for incoming UNIX domain socket connections at the given path.
-		errno = 0;
-		sock = socket(AF_UNIX, SOCK_STREAM, 0);
-		if(sock < 0) {
-			fprintf(stderr, "Error: Couldn't create UNIX socket: %s\n", strerror(errno));
-			goto out;
-		}
-		
-		struct sockaddr_un sau = {0};
-		sau.sun_family = AF_UNIX;
-		
-		// Make sure there's no truncation.
-		if(strlen(listen_address) >= sizeof(sau.sun_path)) {
-			fprintf(stderr, "Error: Listen address is too long (%s)\n", listen_address);
-			goto out;
-		}
-		strncpy(sau.sun_path, listen_address, sizeof(sau.sun_path) - 1);
-		
-		// Enable signal handler to delete the UNIX domain socket in case of a fatal signal.
-		g_unix_bind = listen_address;
-		for(i = 0; i < ARRAY_COUNT(signals_to_catch); i++) {
-			signal(signals_to_catch[i], &unlink_unix_socket);
-		}
-		
-		// Binding to a UNIX socket will create the filesystem entry.
-		errno = 0;
-		err = bind(sock, (struct sockaddr*)&sau, sizeof(sau));
-		if(err != 0) {
-			fprintf(stderr, "Error: Couldn't bind to UNIX socket at %s: %s\n", listen_address, strerror(errno));
-			goto out;
-		}
-		
-		did_unix_bind = true;
-		
-		// Set permissions of UNIX socket (tried doing fchmod() before bind(), didn't work)
-		errno = 0;
-		err = chmod(listen_address, 0777);
-		if(err < 0) {
-			fprintf(stderr, "Error: Failed to change UNIX socket permissions: %s\n", strerror(errno));
-			goto out;
-		}
-		
-		socklen = sizeof(sau);
+// Likewise for the profiler's output
+static Profiler* g_profiler = NULL;
+
+static void close_profile_file(void) {
+	if(!Profiler_close(&g_profiler)) {
+		perror("Failed to write profile");
 	}
-	
-	if(!io_quiet) {
-		fprintf(stderr, "Listening for incoming connection on %s...\n", listen_address);
+}
+
+
+// And for the memory access profiler's output
+static MemProfiler* g_memprof = NULL;
+
+static void close_memprof_file(void) {
+	if(!MemProfiler_close(&g_memprof)) {
+		perror("Failed to write memory profile");
 	}
-	
-	// We now have some bound socket (either TCP or UNIX domain) and need
-	// to listen to it for a single incoming connection.
-	errno = 0;
-	if(listen(sock, 1) != 0) {
-		fprintf(stderr, "Error: Unable to listen on I/O socket: %s\n", strerror(errno));
-		goto out;
+}
+
+
+// And the benchmark results are printed when the program exits
+static Bench* g_bench = NULL;
+
+static void finish_bench(void) {
+	Bench_finish(&g_bench, stderr);
+}
+
+
+// And so are the runtime statistics
+static struct {
+	EAR* cpu;
+	MMU* mmu;
+	Bus* bus;
+	bool text;
+	const char* json_path;
+} g_stats;
+
+static void print_stats(void) {
+	if(!g_stats.cpu) {
+		return;
 	}
 	
-	psa = malloc(socklen);
-	if(!psa) {
-		goto out;
+	if(g_stats.text) {
+		Stats_print(stderr, g_stats.cpu, g_stats.mmu, g_stats.bus, false);
 	}
 	
-	// Accept the incoming connection, giving us the connection socket
-	errno = 0;
-	conn = accept(sock, psa, &socklen);
-	if(conn < 0) {
-		fprintf(stderr, "Error: Failed to accept incoming connection: %s\n", strerror(errno));
-		goto out;
+	if(g_stats.json_path) {
+		FILE* fp = fopen(g_stats.json_path, "w");
+		if(!fp) {
+			perror(g_stats.json_path);
+		}
+		else {
+			Stats_print(fp, g_stats.cpu, g_stats.mmu, g_stats.bus, true);
+			if(fclose(fp) != 0) {
+				perror("Failed to write statistics");
+			}
+		}
 	}
 	
-out:
-	destroy(&psa);
-	
-	// We've received the only connection we care about, and can now close the listening socket.
-	if(sock != -1) {
-		close(sock);
+	g_stats.cpu = NULL;
+}
+
+
+// And the port I/O log, whose events are buffered until the program halts or exits.
+// It's also flushed when the process is killed so that the recording isn't truncated.
+static ReplayLog* g_replay_log = NULL;
+static const int replay_signals[] = {
+	SIGALRM,
+	SIGINT,
+	SIGSEGV,
+	SIGBUS,
+	SIGABRT,
+	SIGPIPE,
+	SIGTERM,
+	SIGHUP,
+};
+static struct sigaction old_replay_handlers[ARRAY_COUNT(replay_signals)];
+
+static void close_replay_log(void) {
+	if(!ReplayLog_close(&g_replay_log)) {
+		perror("Failed to write replay log");
 	}
-	
-	// When we listened on a UNIX socket, we can also now delete the socket from the filesystem safely.
-	if(did_unix_bind) {
-		unlink(listen_address);
-		
-		// Uninstall the signal handlers now that the UNIX socket has been deleted.
-		g_unix_bind = NULL;
-		for(i = 0; i < ARRAY_COUNT(signals_to_catch); i++) {
-			signal(signals_to_catch[i], SIG_DFL);
+}
+
+static void flush_replay_log(int signum) {
+	ReplayLog_flush(g_replay_log);
+	
+	// Restore the previous handler (which may be the default action) and let it run
+	size_t i;
+	for(i = 0; i < ARRAY_COUNT(replay_signals); i++) {
+		if(replay_signals[i] == signum) {
+			sigaction(signum, &old_replay_handlers[i], NULL);
+			break;
 		}
 	}
-	
-	return conn;
+	raise(signum);
 }
 
 
@@ -464,6 +459,19 @@ struct PluginInfo {
 	bool initialized;
 };
 
+// Open an input file, using an already-open file descriptor for /dev/fd/N paths so
+// that pipes, sockets, and memfds can be passed in without touching the filesystem
+static int open_input(const char* path) {
+	int fdnum;
+	char extra;
+	if(sscanf(path, "/dev/fd/%d%c", &fdnum, &extra) == 1 || sscanf(path, "/proc/self/fd/%d%c", &fdnum, &extra) == 1) {
+		return dup(fdnum);
+	}
+	
+	return open(path, O_RDONLY);
+}
+
+
 int main(int argc, char** argv) {
 	static EAR ear;
 	static MMU mmu;
@@ -473,6 +481,7 @@ int main(int argc, char** argv) {
 	int fd = -1;
 	const char* bootromFile = NULL;
 	void* rom_map = MAP_FAILED;
+	size_t rom_map_size = 0;
 	off_t rom_size = 0;
 	void* ram_map = MAP_FAILED;
 	DebugFlags debugFlags = 0;
@@ -486,6 +495,8 @@ int main(int argc, char** argv) {
 	}) inputFileMaps = {0};
 	Pegasus* bootpeg = NULL;
 	Pegasus* userpeg = NULL;
+	EAR_Byte userpegRegion = 0;
+	bool fastLoad = false;
 	dynamic_array(PluginInfo) plugins = {0};
 	dynamic_array(PegVar) pluginArgs = {0};
 	cookie.in_fd = STDIN_FILENO;
@@ -493,6 +504,28 @@ int main(int argc, char** argv) {
 	cookie.flag_fd = -1;
 	const char* listen_address = NULL;
 	bool io_quiet = false;
+	unsigned ioConcurrency = 0;
+	int ioListener = -1;
+	int timeoutSeconds = 0;
+	const char* flagPortFile = NULL;
+	const char* gdbAddress = NULL;
+	const char* debugScript = NULL;
+	const char* traceFile = NULL;
+	size_t traceRingSize = 0;
+	TraceModes traceModes = TRACE_USER;
+	bool traceRangeSet = false;
+	EAR_UWord traceLo = 0, traceHi = 0;
+	const char* traceSymbol = NULL;
+	const char* profileFile = NULL;
+	int profileInterval = 0;
+	int profileHz = 0;
+	const char* memprofFile = NULL;
+	bool flagBench = false;
+	bool flagStats = false;
+	uint64_t maxInstructions = 0;
+	const char* statsJsonFile = NULL;
+	const char* recordFile = NULL;
+	const char* replayFile = NULL;
 	EAR_HaltReason r = HALT_NONE;
 	
 	ARGPARSE(argc, argv) {
@@ -502,9 +535,21 @@ int main(int argc, char** argv) {
 		}
 		
 		ARG_INT('t', "timeout", "Max number of seconds to run before exiting", seconds) {
+			timeoutSeconds = seconds;
 			alarm(seconds);
 		}
 		
+		ARG_STRING(0, "max-instructions", "Stop after running N instructions (including the bootrom), printing the final state", n) {
+			// Only allow digits, as strtoull() also skips whitespace and accepts "-5" by negating it
+			char* end = NULL;
+			errno = 0;
+			maxInstructions = strtoull(n, &end, 10);
+			if(!isdigit((unsigned char)*n) || *end != '\0' || errno == ERANGE || maxInstructions == 0) {
+				fprintf(stderr, "Error: Invalid --max-instructions count '%s'\n", n);
+				goto usage;
+			}
+		}
+		
 		ARG_STRING(0, "bootrom", "Path to the bootrom image to use (flat binary or PEGASUS file)", filepath) {
 			bootromFile = filepath;
 		}
@@ -529,6 +574,10 @@ int main(int argc, char** argv) {
 			array_append(&pluginArgs, pv);
 		}
 		
+		ARG(0, "fast-load", "Load the first input file on the host instead of with the bootrom's loader") {
+			fastLoad = true;
+		}
+		
 		ARG_STRING(0, "function", "Resolve the named symbol and call it as a function", funcname) {
 			array_append(&functions, funcname);
 		}
@@ -551,6 +600,16 @@ int main(int argc, char** argv) {
 			cookie.show_debug_uart = true;
 		}
 		
+		ARG_STRING(0, "gdb", "Wait for a GDB remote protocol client on a host:port or UNIX domain socket path", address) {
+			flagDebug = true;
+			gdbAddress = address;
+		}
+		
+		ARG_STRING(0, "debug-script", "Run debugger commands from a file (- for stdin) and print the results as JSON lines", path) {
+			flagDebug = true;
+			debugScript = path;
+		}
+		
 		ARG(0, "trace", "Print every instruction as it runs (only usermode)") {
 			cookie.trace = true;
 		}
@@ -560,6 +619,94 @@ int main(int argc, char** argv) {
 			cookie.kernel = true;
 		}
 		
+		ARG_STRING(0, "trace-file", "Write a binary trace of every instruction to the file (decode it with eartrace)", path) {
+			traceFile = path;
+		}
+		
+		ARG_INT(0, "trace-ring", "Only keep the last N KiB of the binary trace in memory, written out at exit", kib) {
+			if(kib <= 0) {
+				fprintf(stderr, "Error: The --trace-ring size must be positive\n");
+				goto usage;
+			}
+			traceRingSize = (size_t)kib * 1024;
+		}
+		
+		ARG_STRING(0, "trace-mode", "Which instructions to write to the binary trace: user (default), kernel, or all", mode) {
+			if(strcmp(mode, "user") == 0) {
+				traceModes = TRACE_USER;
+			}
+			else if(strcmp(mode, "kernel") == 0) {
+				traceModes = TRACE_KERNEL;
+			}
+			else if(strcmp(mode, "all") == 0) {
+				traceModes = TRACE_USER | TRACE_KERNEL;
+			}
+			else {
+				fprintf(stderr, "Error: Unknown --trace-mode '%s'\n", mode);
+				goto usage;
+			}
+		}
+		
+		ARG_STRING(0, "trace-range", "Only write instructions at addresses LO-HI (hex, inclusive) to the binary trace", range) {
+			unsigned lo, hi;
+			char extra;
+			if(sscanf(range, "%x-%x%c", &lo, &hi, &extra) != 2 || lo > hi || hi > EAR_UWORD_MAX) {
+				fprintf(stderr, "Error: Invalid --trace-range '%s'\n", range);
+				goto usage;
+			}
+			traceRangeSet = true;
+			traceLo = lo;
+			traceHi = hi;
+		}
+		
+		ARG_STRING(0, "profile", "Sample the guest call stack and write folded stacks for flamegraphs to the file", path) {
+			profileFile = path;
+		}
+		
+		ARG_INT(0, "profile-interval", "Take a profile sample every N instructions (default 1000)", n) {
+			if(n <= 0) {
+				fprintf(stderr, "Error: The --profile-interval must be positive\n");
+				goto usage;
+			}
+			profileInterval = n;
+		}
+		
+		ARG_INT(0, "profile-hz", "Take profile samples on SIGPROF, N times per second of CPU time", hz) {
+			if(hz <= 0) {
+				fprintf(stderr, "Error: The --profile-hz rate must be positive\n");
+				goto usage;
+			}
+			profileHz = hz;
+		}
+		
+		ARG(0, "bench", "Measure emulator speed, printing guest MIPS and memory accesses for the boot and user phases at exit") {
+			flagBench = true;
+		}
+		
+		ARG(0, "stats", "Print runtime statistics (instructions by opcode, exceptions, MMU, bus, and port I/O) at exit") {
+			flagStats = true;
+		}
+		
+		ARG_STRING(0, "stats-json", "Write the runtime statistics to the file as JSON at exit", path) {
+			statsJsonFile = path;
+		}
+		
+		ARG_STRING(0, "memprof", "Count guest memory accesses per page and bus device and write a CSV summary to the file", path) {
+			memprofFile = path;
+		}
+		
+		ARG_STRING(0, "trace-symbol", "Only write instructions within the named function to the binary trace", name) {
+			traceSymbol = name;
+		}
+		
+		ARG_STRING(0, "record", "Record all port I/O to the file so that the run can be replayed later", path) {
+			recordFile = path;
+		}
+		
+		ARG_STRING(0, "replay", "Replay port I/O from a file made by --record instead of using real input", path) {
+			replayFile = path;
+		}
+		
 		ARG('u', "uart", "Show output written to port 0xD (kernel debug UART)") {
 			cookie.show_debug_uart = true;
 		}
@@ -577,6 +724,7 @@ int main(int argc, char** argv) {
 		}
 		
 		ARG_STRING(0, "flag-port-file", "Use the given file as the data to read from port 0xF", flag_file) {
+			flagPortFile = flag_file;
 			cookie.flag_fd = open(flag_file, O_RDONLY);
 			if(cookie.flag_fd < 0) {
 				perror(flag_file);
@@ -604,13 +752,21 @@ int main(int argc, char** argv) {
 			io_quiet = true;
 		}
 		
+		ARG_INT(0, "io-concurrency", "Keep accepting --io-listen connections, running up to N at once in forked copies of the booted machine", n) {
+			if(n <= 0) {
+				fprintf(stderr, "Error: The --io-concurrency limit must be positive\n");
+				goto usage;
+			}
+			ioConcurrency = n;
+		}
+		
 		ARG_POSITIONAL("input1.peg {inputN.peg...}", arg) {
 			array_append(&inputFiles, arg);
 		}
 		
 		ARG_END {
-			if(io_quiet && listen_address == NULL) {
-				fprintf(stderr, "The --io-quiet argument is meaningless without --io-listen.\n");
+			if(io_quiet && listen_address == NULL && gdbAddress == NULL) {
+				fprintf(stderr, "The --io-quiet argument is meaningless without --io-listen or --gdb.\n");
 				goto usage;
 			}
 			
@@ -625,9 +781,79 @@ int main(int argc, char** argv) {
 				}
 			}
 			
+			if(ioConcurrency != 0) {
+				if(listen_address == NULL) {
+					fprintf(stderr, "Error: The --io-concurrency argument requires --io-listen!\n");
+					goto usage;
+				}
+				
+				// Each connection runs in its own process, which can't share the terminal
+				// with a debugger or write to the same output files. Every child would also
+				// interleave its instruction trace and print its own stats at exit.
+				if(flagDebug || debugScript != NULL || gdbAddress != NULL) {
+					fprintf(stderr, "Error: Cannot use the debugger with --io-concurrency!\n");
+					goto usage;
+				}
+				if(traceFile != NULL || profileFile != NULL || memprofFile != NULL || statsJsonFile != NULL || recordFile != NULL || flagBench) {
+					fprintf(stderr, "Error: Cannot write --trace-file, --profile, --memprof, --stats-json, --record, or --bench output with --io-concurrency!\n");
+					goto usage;
+				}
+				if(cookie.trace || flagStats) {
+					fprintf(stderr, "Error: Cannot use --trace, --kernel-trace, or --stats with --io-concurrency!\n");
+					goto usage;
+				}
+			}
+			
+			// The boot up to `@Pegasus_load` runs before the debugger takes control, and
+			// the bootrom's loader is skipped entirely, so kernel debugging would miss them
+			if(fastLoad && cookie.kernel) {
+				fprintf(stderr, "Error: Cannot use --fast-load with --kernel-debug or --kernel-trace!\n");
+				goto usage;
+			}
+			
+			if(gdbAddress != NULL && debugScript != NULL) {
+				fprintf(stderr, "Error: Cannot specify both --gdb and --debug-script!\n");
+				goto usage;
+			}
+			
+			if(traceFile == NULL && (traceRingSize != 0 || traceRangeSet || traceSymbol != NULL)) {
+				fprintf(stderr, "Error: The --trace-* options require --trace-file!\n");
+				goto usage;
+			}
+			
+			if(profileFile == NULL && (profileInterval != 0 || profileHz != 0)) {
+				fprintf(stderr, "Error: The --profile-* options require --profile!\n");
+				goto usage;
+			}
+			
+			if(profileInterval != 0 && profileHz != 0) {
+				fprintf(stderr, "Error: Cannot specify both --profile-interval and --profile-hz!\n");
+				goto usage;
+			}
+			
+			if(recordFile != NULL && replayFile != NULL) {
+				fprintf(stderr, "Error: Cannot specify both --record and --replay!\n");
+				goto usage;
+			}
+			
+			if(replayFile != NULL && listen_address != NULL) {
+				fprintf(stderr, "Error: Cannot specify both --replay and --io-listen!\n");
+				goto usage;
+			}
+			
+			if(flagBench && (flagDebug || debugScript != NULL)) {
+				fprintf(stderr, "Error: Cannot use --bench while debugging!\n");
+				goto usage;
+			}
+			
+			if(traceRangeSet && traceSymbol != NULL) {
+				fprintf(stderr, "Error: Cannot specify both --trace-range and --trace-symbol!\n");
+				goto usage;
+			}
+			
 			// All good!
 			break;
-			
+		
 		usage:
 			ARGPARSE_HELP();
 			exit(EXIT_FAILURE);
@@ -635,7 +861,21 @@ int main(int argc, char** argv) {
 	}
 	
 	// When --io-listen is passed, listen on the specified socket and use it for I/O operations on port 0.
-	if(listen_address != NULL) {
+	// With --io-concurrency, connections are only accepted once the machine has booted (see below).
+	if(listen_address != NULL && ioConcurrency != 0) {
+		ioListener = listen_on_address(listen_address, SOMAXCONN);
+		if(ioListener < 0) {
+			exit(EXIT_FAILURE);
+		}
+		
+		// The timeout applies to each connection rather than to the listener
+		alarm(0);
+		
+		// No client is connected while booting, so the bootrom can't use port 0 yet
+		cookie.in_fd = -1;
+		cookie.out_fd = -1;
+	}
+	else if(listen_address != NULL) {
 		int conn = listen_for_connection(listen_address, io_quiet);
 		if(conn < 0) {
 			exit(EXIT_FAILURE);
@@ -680,8 +920,34 @@ int main(int argc, char** argv) {
 	MMU_setBusHandler(&mmu, Bus_accessHandler, &bus);
 	EAR_setMemoryHandler(&ear, MMU_memoryHandler, &mmu);
 	
+	// Set CPU port r/w function
+	EAR_setPorts(&ear, &runpeg_portRead, &runpeg_portWrite, &cookie);
+	
+	// The memory profiler goes below the debugger so the debugger's own accesses aren't counted
+	if(memprofFile != NULL) {
+		g_memprof = MemProfiler_open(memprofFile, &ear, &mmu, &bus);
+		if(!g_memprof) {
+			perror(memprofFile);
+			goto cleanup;
+		}
+		atexit(close_memprof_file);
+	}
+	
+	if(flagBench) {
+		g_bench = Bench_create(&ear);
+		if(!g_bench) {
+			perror("Bench_create");
+			goto cleanup;
+		}
+		atexit(finish_bench);
+	}
+	
 	cookie.ear = &ear;
 	
+	if(maxInstructions != 0) {
+		EAR_setInstructionLimit(&ear, maxInstructions);
+	}
+	
 	// Print a trace of each instruction as it executes
 	EAR_setExecHook(&ear, runpeg_trace, &cookie);
 	
@@ -699,48 +965,38 @@ int main(int argc, char** argv) {
 	// Allow debugger to hook instruction execution
 	cookie.dbg_trace = Debugger_execHook;
 	
-	// Insert debugger as man-in-the-middle between the CPU and the MMU
-	Debugger_setMemoryHandler(cookie.dbg, ear.mem_fn, ear.mem_cookie);
-	EAR_setMemoryHandler(&ear, Debugger_memoryHandler, cookie.dbg);
-	
-	// Insert debugger as man-in-the-middle between the MMU and the bus
-	Debugger_setBusHandler(cookie.dbg, mmu.bus_fn, mmu.bus_cookie);
-	MMU_setBusHandler(&mmu, Debugger_busHandler, cookie.dbg);
-	
-	// For `pmap` command
+	// For `pmap` and `stats` commands
 	Debugger_setBusDumper(cookie.dbg, Bus_dump);
+	Debugger_setBus(cookie.dbg, &bus);
 	
-	// Set CPU port r/w function
-	EAR_setPorts(&ear, &runpeg_portRead, &runpeg_portWrite, &cookie);
+	// Allow the debugger to insert itself as man-in-the-middle between the CPU and the MMU,
+	// between the MMU and the bus, and between the CPU and its ports whenever it's attached
+	Debugger_interpose(cookie.dbg, &mmu);
 	
 	void* bootromData = NULL;
 	if(bootromFile) {
 		// Open code file
-		fd = open(bootromFile, O_RDONLY);
+		fd = open_input(bootromFile);
 		if(fd < 0) {
 			perror(bootromFile);
 			goto cleanup;
 		}
 		
-		rom_size = lseek(fd, 0, SEEK_END);
-		if(rom_size < 0) {
-			perror("lseek");
-			goto cleanup;
-		}
-		
-		if(rom_size > EAR_VIRTUAL_ADDRESS_SPACE_SIZE) {
-			fprintf(stderr, "Bootrom file %s is too large (0x%llX bytes)\n", bootromFile, (long long)rom_size);
-			goto cleanup;
-		}
-		
 		// Map contents of code file into memory
-		rom_map = mmap(NULL, rom_size, PROT_READ, MAP_SHARED | MAP_FILE, fd, 0);
+		size_t filesize = 0;
+		rom_map = Pegasus_mapFd(fd, EAR_VIRTUAL_ADDRESS_SPACE_SIZE, &filesize, &rom_map_size);
 		close(fd);
 		fd = -1;
 		if(rom_map == MAP_FAILED) {
-			perror("mmap");
+			if(errno == EFBIG) {
+				fprintf(stderr, "Bootrom file %s is too large (over 0x%X bytes)\n", bootromFile, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+			}
+			else {
+				perror(bootromFile);
+			}
 			goto cleanup;
 		}
+		rom_size = (off_t)filesize;
 		
 		bootromData = rom_map;
 	}
@@ -797,10 +1053,10 @@ int main(int argc, char** argv) {
 		);
 	}
 	
-	// Allocate memory for RAM
+	// Allocate memory for RAM, which each forked connection needs its own copy of
 	ram_map = mmap(
 		NULL, EAR_VIRTUAL_ADDRESS_SPACE_SIZE,
-		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+		PROT_READ | PROT_WRITE, (ioConcurrency != 0 ? MAP_PRIVATE : MAP_SHARED) | MAP_ANONYMOUS,
 		-1, 0
 	);
 	if(ram_map == MAP_FAILED) {
@@ -816,6 +1072,9 @@ int main(int argc, char** argv) {
 		ram_map
 	);
 	
+	// RAM is the only writable memory, so it's all that needs to be saved for reverse execution
+	Debugger_addHistoryMemory(cookie.dbg, ram_map, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+	
 	// Load and map input files in their own regions
 	foreach(&inputFiles, pFile) {
 		if(next_region == 0xFF) {
@@ -823,51 +1082,47 @@ int main(int argc, char** argv) {
 			goto cleanup;
 		}
 		
-		fd = open(*pFile, O_RDONLY);
+		// Map the whole file, which is then shared between the parser, the debugger, and the bus
+		fd = open_input(*pFile);
 		if(fd < 0) {
 			perror(*pFile);
 			goto cleanup;
 		}
 		
-		off_t filesize = lseek(fd, 0, SEEK_END);
-		if(filesize > EAR_VIRTUAL_ADDRESS_SPACE_SIZE) {
-			fprintf(stderr, "File %s is too large (0x%llX bytes)\n", *pFile, (long long)filesize);
-			goto cleanup;
-		}
-		
-		filesize = EAR_CEIL_PAGE(filesize);
-		
-		void* map = mmap(
-			NULL, filesize, PROT_READ, MAP_SHARED | MAP_FILE, fd, 0
-		);
-		if(map == MAP_FAILED) {
-			perror(*pFile);
-			goto cleanup;
-		}
-		
+		size_t filesize = 0;
+		size_t mapsize = 0;
+		void* map = Pegasus_mapFd(fd, EAR_VIRTUAL_ADDRESS_SPACE_SIZE, &filesize, &mapsize);
 		close(fd);
 		fd = -1;
-		
-		element_type(&inputFileMaps) mapitem = {
-			.map = map,
-			.size = filesize,
-		};
-		array_append(&inputFileMaps, mapitem);
-		Bus_addMemory(&bus, *pFile, BUS_MODE_READ, next_region++ << EAR_REGION_SHIFT, filesize, map);
-		
-		if(cookie.verbose) {
-			fprintf(stderr, "Mapped %s to region %02X\n", *pFile, next_region - 1);
+		if(map == MAP_FAILED) {
+			if(errno == EFBIG) {
+				fprintf(stderr, "File %s is too large (over 0x%X bytes)\n", *pFile, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+			}
+			else {
+				perror(*pFile);
+			}
+			goto cleanup;
 		}
 		
+		// Parse the first PEGASUS file directly from the mapping
+		bool parsed = false;
 		if(!userpeg) {
 			userpeg = Pegasus_new();
 			if(!userpeg) {
 				perror("alloc");
+				munmap(map, mapsize);
 				goto cleanup;
 			}
 			
-			PegStatus s = Pegasus_parseFromMemory(userpeg, map, filesize, false);
+			PegStatus s = Pegasus_parseFromMapping(userpeg, map, filesize, mapsize);
 			if(s == PEG_SUCCESS) {
+				// The Pegasus object now owns the mapping
+				parsed = true;
+				
+				// The bootrom only ever loads the first input file
+				if(pFile == inputFiles.elems) {
+					userpegRegion = next_region;
+				}
 				Debugger_addPegasusImage(cookie.dbg, userpeg, true);
 			}
 			else {
@@ -878,6 +1133,21 @@ int main(int argc, char** argv) {
 				Pegasus_destroy(&userpeg);
 			}
 		}
+		
+		// Files that aren't parsed as PEGASUS files are just mapped
+		if(!parsed) {
+			element_type(&inputFileMaps) mapitem = {
+				.map = map,
+				.size = mapsize,
+			};
+			array_append(&inputFileMaps, mapitem);
+		}
+		
+		Bus_addMemory(&bus, *pFile, BUS_MODE_READ, next_region++ << EAR_REGION_SHIFT, mapsize, map);
+		
+		if(cookie.verbose) {
+			fprintf(stderr, "Mapped %s to region %02X\n", *pFile, next_region - 1);
+		}
 	}
 	
 	// Initialize checker plugin(s)
@@ -901,11 +1171,175 @@ int main(int argc, char** argv) {
 		}
 	}
 	
-	// Run the bootloader
-	r = Debugger_run(cookie.dbg);
+	// Start recording or replaying port I/O
+	if(recordFile != NULL) {
+		g_replay_log = ReplayLog_create(recordFile);
+		if(!g_replay_log) {
+			perror(recordFile);
+			goto cleanup;
+		}
+		atexit(close_replay_log);
+		
+		struct sigaction sa = {0};
+		sa.sa_handler = &flush_replay_log;
+		sigemptyset(&sa.sa_mask);
+		size_t i;
+		for(i = 0; i < ARRAY_COUNT(replay_signals); i++) {
+			sigaction(replay_signals[i], &sa, &old_replay_handlers[i]);
+		}
+	}
+	else if(replayFile != NULL) {
+		g_replay_log = ReplayLog_open(replayFile);
+		if(!g_replay_log) {
+			perror(replayFile);
+			goto cleanup;
+		}
+		atexit(close_replay_log);
+	}
+	cookie.replay_log = g_replay_log;
+	
+	// Start writing the binary trace
+	if(traceFile != NULL) {
+		g_trace_writer = TraceWriter_open(traceFile, traceRingSize);
+		if(!g_trace_writer) {
+			perror(traceFile);
+			goto cleanup;
+		}
+		atexit(close_trace_file);
+		
+		TraceWriter_setModes(g_trace_writer, traceModes);
+		if(traceRangeSet) {
+			TraceWriter_setRange(g_trace_writer, traceLo, traceHi);
+		}
+		else if(traceSymbol != NULL) {
+			if(!(userpeg && TraceWriter_setSymbol(g_trace_writer, userpeg, traceSymbol))
+				&& !(bootpeg && TraceWriter_setSymbol(g_trace_writer, bootpeg, traceSymbol))
+			) {
+				fprintf(stderr, "Error: Couldn't find symbol '%s' for --trace-symbol\n", traceSymbol);
+				goto cleanup;
+			}
+		}
+		
+		cookie.trace_writer = g_trace_writer;
+	}
+	
+	// Start sampling the guest call stack
+	if(profileFile != NULL) {
+		g_profiler = Profiler_open(cookie.dbg, profileFile, profileInterval ? profileInterval : PROFILE_DEFAULT_INTERVAL);
+		if(!g_profiler) {
+			perror(profileFile);
+			goto cleanup;
+		}
+		atexit(close_profile_file);
+		
+		if(profileHz != 0 && !Profiler_startTimer(g_profiler, profileHz)) {
+			perror("Failed to start the profiling timer");
+			goto cleanup;
+		}
+		
+		cookie.profiler = g_profiler;
+	}
+	
+	// Everything from here on is the guest running
+	if(g_bench) {
+		Bench_start(g_bench);
+	}
+	
+	if(flagStats || statsJsonFile != NULL) {
+		g_stats.cpu = &ear;
+		g_stats.mmu = &mmu;
+		g_stats.bus = &bus;
+		g_stats.text = flagStats;
+		g_stats.json_path = statsJsonFile;
+		atexit(print_stats);
+	}
+	
+	// With --io-concurrency, run the bootrom up to where it would load the user program
+	// just once. Then each connection is handled by a forked copy of this process, so
+	// connecting doesn't have to wait for the machine to boot.
+	if(ioListener != -1) {
+		bool at_loader = false;
+		if(bootpeg != NULL) {
+			r = PegasusLoader_bootToLoader(&ear, bootpeg, &at_loader);
+			if(r != HALT_NONE) {
+				fprintf(stderr, "Halted: %s\n", EAR_haltReasonToString(r));
+				goto cleanup;
+			}
+		}
+		
+		// Only returns in the child processes (or on error)
+		int conn = fork_for_each_connection(ioListener, listen_address, ioConcurrency, io_quiet);
+		ioListener = -1;
+		if(conn < 0) {
+			goto cleanup;
+		}
+		cookie.in_fd = conn;
+		cookie.out_fd = conn;
+		alarm(timeoutSeconds);
+		
+		// Reopen the flag file, as the open one's read position is shared with the other children
+		if(cookie.flag_fd >= 0) {
+			close(cookie.flag_fd);
+			cookie.flag_fd = open(flagPortFile, O_RDONLY);
+			if(cookie.flag_fd < 0) {
+				perror(flagPortFile);
+				goto cleanup;
+			}
+		}
+		
+		if(fastLoad && at_loader && userpegRegion != 0) {
+			r = PegasusLoader_loadFromCall(&ear, userpeg, userpegRegion, mmu.bus_fn, mmu.bus_cookie);
+			if(r != HALT_NONE) {
+				fprintf(stderr, "Halted: %s\n", EAR_haltReasonToString(r));
+				goto cleanup;
+			}
+		}
+	}
+	else if(fastLoad && bootpeg != NULL && userpegRegion != 0) {
+		// Run the bootrom up to where it would load the user program, then map
+		// the user program's segments and set its entrypoint from the host
+		r = PegasusLoader_fastBoot(&ear, bootpeg, userpeg, userpegRegion, mmu.bus_fn, mmu.bus_cookie);
+		if(r != HALT_NONE) {
+			fprintf(stderr, "Halted: %s\n", EAR_haltReasonToString(r));
+			goto cleanup;
+		}
+	}
+	
+	// Run the bootloader, under the control of a GDB client or script if one was given
+	if(gdbAddress != NULL) {
+		int gdbConn = listen_for_connection(gdbAddress, io_quiet);
+		if(gdbConn < 0) {
+			goto cleanup;
+		}
+		
+		r = Debugger_serveGdb(cookie.dbg, gdbConn);
+		close(gdbConn);
+	}
+	else if(debugScript != NULL) {
+		FILE* script = strcmp(debugScript, "-") == 0 ? stdin : fopen(debugScript, "r");
+		if(!script) {
+			perror(debugScript);
+			goto cleanup;
+		}
+		
+		r = Debugger_runScript(cookie.dbg, script);
+		if(script != stdin) {
+			fclose(script);
+		}
+	}
+	else {
+		r = Debugger_run(cookie.dbg);
+	}
 	
 	if(r != HALT_NONE) {
 		fprintf(stderr, "Halted: %s\n", EAR_haltReasonToString(r));
+		if(r == HALT_INSN_LIMIT) {
+			// Show where the program was cut off (the debugger already did this)
+			if(!flagDebug) {
+				Debugger_showContext(cookie.dbg, false, stderr);
+			}
+			goto cleanup;
+		}
 		if(EAR_FAILED(r)) {
 			goto cleanup;
 		}
@@ -915,6 +1349,17 @@ int main(int argc, char** argv) {
 	ret = EXIT_SUCCESS;
 	
 cleanup:
+	cookie.trace_writer = NULL;
+	close_trace_file();
+	cookie.profiler = NULL;
+	close_profile_file();
+	close_memprof_file();
+	finish_bench();
+	print_stats();
+	
+	cookie.replay_log = NULL;
+	close_replay_log();
+	
 	foreach(&plugins, plugin) {
 		if(plugin->initialized) {
 			plugin->obj->fn_destroy(plugin->obj);
@@ -938,14 +1383,16 @@ cleanup:
 	Pegasus_destroy(&bootpeg);
 	
 	if(rom_map != MAP_FAILED) {
-		munmap(rom_map, rom_size);
+		munmap(rom_map, rom_map_size);
 	}
 	
 	if(fd >= 0) {
 		close(fd);
 	}
 	
-	if(listen_address != NULL) {
+	close_listener(ioListener, ioListener != -1 ? listen_address : NULL);
+	
+	if(listen_address != NULL && cookie.in_fd >= 0) {
 		close(cookie.in_fd);
 		if(cookie.out_fd != cookie.in_fd) {
 			close(cookie.out_fd);
@@ -0,0 +1,28 @@
+TARGET := libpegasus_server.so
+PRODUCT := $(PEG_BIN)/$(TARGET)
+
+SERVER_DIR := $(DIR)
+
+LIBS := \
+	$(PEG_BIN)/libear.so \
+	$(PEG_BIN)/libeardbg.so
+
+SRCS := pegasus_server.c pegasus_vm.c result_cache.c bootrom.c
+
+$(SERVER_DIR)/bootrom.c: $(BOOTROM)
+	$(_v)xxd -i -C -n BOOTROM $< $@
+
+CFLAGS := -Wall -Wextra -I$(PEG_DIR)
+
+ifeq "$(CC)" "gcc"
+CFLAGS := $(CFLAGS) -Wno-format-truncation
+endif
+
+LDLIBS := -lpthread
+
+BITS := 64
+ASLR := 1
+RELRO := 1
+NX := 1
+CANARY := 1
+DEBUG := 1
@@ -0,0 +1,782 @@
+//
+//  pegasus_server.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 11/5/2020.
+//
+
+#include "pegasus_server.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include "common/macros.h"
+#include "common/dynamic_array.h"
+#include "libear/ear.h"
+#include "libeardbg/listen.h"
+#include "runpeg/bootrom.h"
+#include "pegasus_vm.h"
+#include "result_cache.h"
+
+/*!
+ * Maximum allowed size of a PEG file. The submission region of the VM's physical
+ * memory is the size of the EAR address space (64 KiB).
+ */
+#define PEG_SIZE_MAX EAR_VIRTUAL_ADDRESS_SPACE_SIZE
+
+//! Maximum number of events handled per epoll_wait() call
+#define PEG_EPOLL_EVENTS 64
+
+//! Result cache size when it's turned on by setting PEG_SERVER_CACHE_DIR
+#define PEG_DEFAULT_CACHE_BYTES (64 * 1024 * 1024)
+
+
+//! A connection that is uploading its PEGASUS file or waiting for a worker
+typedef struct PegConn {
+	int fd;
+	time_t deadline;
+	uint8_t size_buf[4];
+	uint32_t peg_size;
+	size_t received;
+	char* peg_data;
+} PegConn;
+
+typedef struct PegasusServer PegasusServer;
+
+typedef struct PegWorker {
+	PegasusServer* srv;
+	PegasusVM* vm;
+	unsigned index;
+	pthread_t thread;
+	bool started;
+	
+	// Buffers reused for every submission when the result cache is enabled
+	ResultCache_Transcript cached;
+	ResultCache_Transcript recorded;
+	ResultCache_Transcript input;
+} PegWorker;
+
+struct PegasusServer {
+	PegasusServer_Config config;
+	PegPlugin_Init_func* plugin_init;
+	char* flag;
+	size_t flag_size;
+	ResultCache* cache;
+	
+	// Accept loop
+	int listen_fd;
+	int epoll_fd;
+	dynamic_array(PegConn*) uploading;
+	
+	// Complete uploads waiting for a worker, as a ring buffer
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	PegConn** queue;
+	unsigned queue_head;
+	unsigned queue_count;
+	bool stopping;
+	
+	dynamic_array(PegWorker) workers;
+};
+
+
+// Best-effort message to a client, which is dropped if the client isn't reading
+static void PegasusServer_reply(int fd, const char* fmt, ...) {
+	char msg[200];
+	va_list ap;
+	va_start(ap, fmt);
+	int len = vsnprintf(msg, sizeof(msg), fmt, ap);
+	va_end(ap);
+	
+	if(len > 0) {
+		(void)!send(fd, msg, MIN((size_t)len, sizeof(msg) - 1), MSG_NOSIGNAL | MSG_DONTWAIT);
+	}
+}
+
+
+static void PegConn_destroy(PegConn** pconn) {
+	PegConn* conn = *pconn;
+	if(!conn) {
+		return;
+	}
+	*pconn = NULL;
+	
+	if(conn->fd != -1) {
+		close(conn->fd);
+	}
+	free(conn->peg_data);
+	free(conn);
+}
+
+
+static unsigned PegasusServer_pendingCount(PegasusServer* srv) {
+	pthread_mutex_lock(&srv->lock);
+	unsigned count = srv->queue_count;
+	pthread_mutex_unlock(&srv->lock);
+	return (unsigned)srv->uploading.count + count;
+}
+
+
+// Hand a complete upload to the workers, or return false if the queue is full
+static bool PegasusServer_enqueue(PegasusServer* srv, PegConn* conn) {
+	bool ok = false;
+	pthread_mutex_lock(&srv->lock);
+	if(srv->queue_count < srv->config.max_pending) {
+		unsigned tail = (srv->queue_head + srv->queue_count) % srv->config.max_pending;
+		srv->queue[tail] = conn;
+		++srv->queue_count;
+		pthread_cond_signal(&srv->ready);
+		ok = true;
+	}
+	pthread_mutex_unlock(&srv->lock);
+	return ok;
+}
+
+
+// Wait for a complete upload, or return NULL once the server is stopping
+static PegConn* PegasusServer_dequeue(PegasusServer* srv) {
+	pthread_mutex_lock(&srv->lock);
+	while(srv->queue_count == 0 && !srv->stopping) {
+		pthread_cond_wait(&srv->ready, &srv->lock);
+	}
+	if(srv->stopping) {
+		pthread_mutex_unlock(&srv->lock);
+		return NULL;
+	}
+	
+	PegConn* conn = srv->queue[srv->queue_head];
+	srv->queue_head = (srv->queue_head + 1) % srv->config.max_pending;
+	--srv->queue_count;
+	pthread_mutex_unlock(&srv->lock);
+	return conn;
+}
+
+
+// Stop watching an uploading connection, optionally closing it
+static void PegasusServer_forget(PegasusServer* srv, PegConn* conn, bool close_conn) {
+	epoll_ctl(srv->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+	
+	enumerate(&srv->uploading, i, pcur) {
+		if(*pcur == conn) {
+			array_removeIndex(&srv->uploading, i);
+			break;
+		}
+	}
+	
+	if(close_conn) {
+		PegConn_destroy(&conn);
+	}
+}
+
+
+static void PegasusServer_accept(PegasusServer* srv) {
+	while(true) {
+		int fd = accept(srv->listen_fd, NULL, NULL);
+		if(fd < 0) {
+			if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				perror("accept");
+			}
+			return;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		
+		if(PegasusServer_pendingCount(srv) >= srv->config.max_pending) {
+			PegasusServer_reply(fd, "PEG/1.1 503 Service Unavailable\n");
+			close(fd);
+			continue;
+		}
+		
+		PegConn* conn = calloc(1, sizeof(*conn));
+		if(!conn) {
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		conn->deadline = time(NULL) + srv->config.io_timeout;
+		
+		struct epoll_event ev = {.events = EPOLLIN, .data.ptr = conn};
+		if(epoll_ctl(srv->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+			perror("epoll_ctl");
+			PegConn_destroy(&conn);
+			continue;
+		}
+		array_append(&srv->uploading, conn);
+		
+		PegasusServer_reply(fd, "PEG SIZE?\n");
+	}
+}
+
+
+// Receive more of a PEGASUS file upload, handing it to a worker when it's complete
+static void PegasusServer_receive(PegasusServer* srv, PegConn* conn) {
+	while(true) {
+		void* dst;
+		size_t want;
+		if(conn->received < sizeof(conn->size_buf)) {
+			dst = conn->size_buf + conn->received;
+			want = sizeof(conn->size_buf) - conn->received;
+		}
+		else {
+			size_t offset = conn->received - sizeof(conn->size_buf);
+			dst = conn->peg_data + offset;
+			want = conn->peg_size - offset;
+		}
+		
+		ssize_t n = recv(conn->fd, dst, want, 0);
+		if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+			return;
+		}
+		if(n <= 0) {
+			PegasusServer_forget(srv, conn, true);
+			return;
+		}
+		
+		bool had_size = conn->received >= sizeof(conn->size_buf);
+		conn->received += n;
+		
+		if(!had_size && conn->received == sizeof(conn->size_buf)) {
+			uint32_t size_be;
+			memcpy(&size_be, conn->size_buf, sizeof(size_be));
+			conn->peg_size = ntohl(size_be);
+			if(conn->peg_size == 0) {
+				PegasusServer_reply(conn->fd, "PEG SIZE must not be zero!\n");
+				PegasusServer_forget(srv, conn, true);
+				return;
+			}
+			if(conn->peg_size > PEG_SIZE_MAX) {
+				PegasusServer_reply(conn->fd, "PEG SIZE exceeds max! (%u > %u)\n", conn->peg_size, PEG_SIZE_MAX);
+				PegasusServer_forget(srv, conn, true);
+				return;
+			}
+			
+			conn->peg_data = malloc(conn->peg_size);
+			if(!conn->peg_data) {
+				PegasusServer_reply(conn->fd, "Out of memory\n");
+				PegasusServer_forget(srv, conn, true);
+				return;
+			}
+			
+			PegasusServer_reply(conn->fd, "PEG DATA?\n");
+		}
+		
+		if(conn->received == sizeof(conn->size_buf) + conn->peg_size) {
+			PegasusServer_forget(srv, conn, false);
+			if(!PegasusServer_enqueue(srv, conn)) {
+				PegasusServer_reply(conn->fd, "PEG/1.1 503 Service Unavailable\n");
+				PegConn_destroy(&conn);
+			}
+			return;
+		}
+	}
+}
+
+
+// Drop clients that are taking too long to upload
+static void PegasusServer_expire(PegasusServer* srv) {
+	time_t now = time(NULL);
+	for(size_t i = srv->uploading.count; i-- > 0;) {
+		PegConn* conn = srv->uploading.elems[i];
+		if(now >= conn->deadline) {
+			PegasusServer_reply(conn->fd, "PEG/1.1 408 Request Timeout\n");
+			PegasusServer_forget(srv, conn, true);
+		}
+	}
+}
+
+
+// Send the output of a cached run, returning false if the client hung up
+static bool PegasusServer_sendCached(int fd, const uint8_t* events, size_t count) {
+	uint8_t buf[256];
+	size_t len = 0;
+	size_t i;
+	for(i = 0; i < count; i++) {
+		buf[len++] = events[i * 2 + 1];
+		if(len == sizeof(buf) || i + 1 == count) {
+			if(send(fd, buf, len, MSG_NOSIGNAL) != (ssize_t)len) {
+				return false;
+			}
+			len = 0;
+		}
+	}
+	return true;
+}
+
+
+// Walk the transcript of a previous run of this PEGASUS file against the client's
+// input. Returns true if the client's input matched all the way to the end, in which
+// case the client has received the same output as a real run would have sent.
+// Otherwise, the VM is set up to take over from the point where the input diverged.
+static bool PegasusServer_replayCached(PegWorker* worker, PegConn* conn) {
+	const uint8_t* events = worker->cached.elems;
+	size_t event_count = worker->cached.count / 2;
+	size_t output_sent = 0;
+	bool input_eof = false;
+	size_t i = 0;
+	
+	worker->input.count = 0;
+	while(i < event_count) {
+		// Stop answering a slow client once the submission is out of time
+		if(PegasusVM_checkDeadline(worker->vm)) {
+			return true;
+		}
+		
+		// Send each run of output in one go
+		size_t writes = 0;
+		while(i + writes < event_count && events[(i + writes) * 2] == RESULT_CACHE_WRITE) {
+			++writes;
+		}
+		if(writes > 0) {
+			if(!PegasusServer_sendCached(conn->fd, events + i * 2, writes)) {
+				return true;
+			}
+			output_sent += writes;
+			i += writes;
+			continue;
+		}
+		
+		uint8_t byte;
+		ssize_t bytes_read;
+		do {
+			bytes_read = recv(conn->fd, &byte, 1, 0);
+		} while(bytes_read < 0 && errno == EINTR);
+		
+		ResultCacheEvent kind = events[i * 2];
+		if(bytes_read == 1) {
+			array_append(&worker->input, byte);
+			if(kind != RESULT_CACHE_READ || byte != events[i * 2 + 1]) {
+				break;
+			}
+		}
+		else if(kind != RESULT_CACHE_READ_FAIL) {
+			input_eof = true;
+			break;
+		}
+		
+		++i;
+	}
+	
+	if(i == event_count) {
+		return true;
+	}
+	
+	PegasusVM_setReplayedIO(worker->vm, worker->input.elems, worker->input.count, input_eof, output_sent);
+	return false;
+}
+
+
+static void PegasusServer_runSubmission(PegWorker* worker, PegConn* conn) {
+	PegasusServer* srv = worker->srv;
+	PegasusVM* vm = worker->vm;
+	ResultCache_Result result;
+	bool replayed = false;
+	
+	// The program's port I/O blocks, but not forever
+	int flags = fcntl(conn->fd, F_GETFL);
+	fcntl(conn->fd, F_SETFL, flags & ~O_NONBLOCK);
+	struct timeval tv = {.tv_sec = srv->config.io_timeout};
+	setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	
+	// Restore the VM to its warm snapshot, just before the user program is loaded
+	PegasusVM_reset(vm, conn->fd, srv->flag, srv->flag_size);
+	
+	// Each read or write waits at most io_timeout, so also limit the submission's total
+	// time, including answering from the cache
+	if(srv->config.run_timeout != 0) {
+		PegasusVM_setDeadline(vm, time(NULL) + srv->config.run_timeout);
+	}
+	
+	// Answer from a previous run of the same file for as long as the input matches
+	if(srv->cache != NULL && ResultCache_lookup(srv->cache, conn->peg_data, conn->peg_size, &worker->cached, &result)) {
+		replayed = PegasusServer_replayCached(worker, conn);
+	}
+	
+	if(!replayed) {
+		PegStatus s = PegasusVM_load(vm, conn->peg_data, conn->peg_size);
+		if(s != PEG_SUCCESS) {
+			PegasusServer_reply(conn->fd, "%s\n", PegStatus_toString(s));
+			goto out;
+		}
+		
+		// Record everything from here on, including any I/O done by fn_onLoaded
+		if(srv->cache != NULL) {
+			worker->recorded.count = 0;
+			vm->transcript = &worker->recorded;
+		}
+		
+		// Invoke onLoaded callback if defined
+		if(vm->plugin != NULL && vm->plugin->fn_onLoaded != NULL && !vm->plugin->fn_onLoaded(vm->plugin)) {
+			goto out;
+		}
+		
+		result.halt_reason = PegasusVM_run(vm, srv->config.insn_budget);
+		result.exited = vm->exited;
+		result.exit_status = vm->exit_status;
+		result.ins_count = vm->cpu.ins_count;
+		
+		// A run that lost its client or ran out of time might have gone differently otherwise
+		if(srv->cache != NULL && !vm->write_failed && !vm->timed_out) {
+			ResultCache_store(srv->cache, conn->peg_data, conn->peg_size, &worker->recorded, &result);
+		}
+	}
+	
+	if(vm->timed_out) {
+		PegasusServer_reply(conn->fd, "PEG/1.1 408 Request Timeout\n");
+		fprintf(stderr, "worker %u: %u bytes, timed out%s\n", worker->index, conn->peg_size, replayed ? " (cached)" : "");
+		goto out;
+	}
+	
+	if(!result.exited) {
+		PegasusServer_reply(conn->fd, "EAR core halted: %s\n", EAR_haltReasonToString(result.halt_reason));
+	}
+	
+	fprintf(
+		stderr, "worker %u: %u bytes, %" PRIu64 " instructions, %s %d%s\n",
+		worker->index, conn->peg_size, result.ins_count,
+		result.exited ? "exit" : "halt", result.exited ? result.exit_status : (int)result.halt_reason,
+		replayed ? " (cached)" : ""
+	);
+	
+out:
+	PegasusVM_unload(vm);
+}
+
+
+static void* PegasusServer_workerMain(void* arg) {
+	PegWorker* worker = arg;
+	
+	PegConn* conn;
+	while((conn = PegasusServer_dequeue(worker->srv)) != NULL) {
+		PegasusServer_runSubmission(worker, conn);
+		PegConn_destroy(&conn);
+	}
+	
+	return NULL;
+}
+
+
+static bool PegasusServer_readFlag(PegasusServer* srv, const char* path) {
+	FILE* fp = fopen(path, "r");
+	if(!fp) {
+		perror(path);
+		return false;
+	}
+	
+	struct stat st;
+	if(fstat(fileno(fp), &st) != 0 || st.st_size < 0) {
+		perror(path);
+		fclose(fp);
+		return false;
+	}
+	
+	srv->flag_size = (size_t)st.st_size;
+	srv->flag = malloc(srv->flag_size + 1);
+	if(!srv->flag || fread(srv->flag, 1, srv->flag_size, fp) != srv->flag_size) {
+		perror(path);
+		fclose(fp);
+		return false;
+	}
+	
+	fclose(fp);
+	return true;
+}
+
+
+// Hash the contents of every executable file mapped into this process, which covers
+// the plugin, the emulator, and this library however they were linked
+static uint64_t PegasusServer_hashMappedFiles(uint64_t hash) {
+	FILE* maps = fopen("/proc/self/maps", "re");
+	if(!maps) {
+		return hash;
+	}
+	
+	dynamic_array(char*) paths = {0};
+	char line[PATH_MAX + 128];
+	while(fgets(line, sizeof(line), maps) != NULL) {
+		char perms[5];
+		int path_start = 0;
+		if(sscanf(line, "%*s %4s %*s %*s %*s %n", perms, &path_start) != 1 || perms[2] != 'x') {
+			continue;
+		}
+		
+		char* path = line + path_start;
+		path[strcspn(path, "\n")] = '\0';
+		if(path[0] != '/') {
+			continue;
+		}
+		
+		bool seen = false;
+		foreach(&paths, pcur) {
+			if(strcmp(*pcur, path) == 0) {
+				seen = true;
+				break;
+			}
+		}
+		if(!seen) {
+			array_append(&paths, strdup(path));
+		}
+	}
+	fclose(maps);
+	
+	foreach(&paths, pcur) {
+		hash = ResultCache_hash(hash, *pcur, strlen(*pcur));
+		
+		FILE* fp = fopen(*pcur, "rbe");
+		if(!fp) {
+			continue;
+		}
+		
+		char buf[0x4000];
+		size_t n;
+		while((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+			hash = ResultCache_hash(hash, buf, n);
+		}
+		fclose(fp);
+	}
+	
+	array_destroy(&paths);
+	return hash;
+}
+
+
+// Hash everything besides the submission and its input that affects how it runs
+static uint64_t PegasusServer_configHash(PegasusServer* srv) {
+	uint64_t hash = RESULT_CACHE_HASH_INIT;
+	hash = ResultCache_hash(hash, BOOTROM, BOOTROM_LEN);
+	hash = ResultCache_hash(hash, &srv->config.insn_budget, sizeof(srv->config.insn_budget));
+	hash = ResultCache_hash(hash, srv->flag, srv->flag_size);
+	
+	int i;
+	for(i = 0; i < srv->config.var_count; i++) {
+		const PegVar* var = &srv->config.vars[i];
+		hash = ResultCache_hash(hash, var->name, strlen(var->name) + 1);
+		hash = ResultCache_hash(hash, var->value, strlen(var->value) + 1);
+	}
+	
+	return PegasusServer_hashMappedFiles(hash);
+}
+
+
+/*!
+ * @brief Fill in the default server configuration. The listen address, worker count,
+ * and result cache directory can be overridden with the PEG_SERVER_LISTEN,
+ * PEG_SERVER_WORKERS, and PEG_SERVER_CACHE_DIR environment variables. The result
+ * cache is off unless PEG_SERVER_CACHE_DIR is set.
+ */
+void PegasusServer_defaultConfig(PegasusServer_Config* config) {
+	memset(config, 0, sizeof(*config));
+	config->listen_address = ":10000";
+	config->worker_count = (unsigned)MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	config->max_pending = 256;
+	config->insn_budget = 10000000;
+	config->io_timeout = 5;
+	config->run_timeout = 60;
+	
+	const char* env = getenv("PEG_SERVER_LISTEN");
+	if(env != NULL && *env != '\0') {
+		config->listen_address = env;
+	}
+	
+	env = getenv("PEG_SERVER_WORKERS");
+	if(env != NULL && atoi(env) > 0) {
+		config->worker_count = (unsigned)atoi(env);
+	}
+	
+	// The result cache is opt-in
+	env = getenv("PEG_SERVER_CACHE_DIR");
+	if(env != NULL && *env != '\0') {
+		config->cache_dir = env;
+		config->cache_bytes = PEG_DEFAULT_CACHE_BYTES;
+	}
+}
+
+
+/*!
+ * @brief Run the PEGASUS server until it fails. If that happens after the workers have
+ * started, it waits for them to finish their current submissions before returning.
+ * 
+ * @param config Server configuration
+ * @param plugin_init Function pointer to the plugin initialization function, or NULL
+ * 
+ * @return False after printing an error message
+ */
+bool PegasusServer_serve(const PegasusServer_Config* config, PegPlugin_Init_func* plugin_init) {
+	PegasusServer srv = {0};
+	srv.config = *config;
+	srv.plugin_init = plugin_init;
+	srv.listen_fd = -1;
+	srv.epoll_fd = -1;
+	
+	if(srv.config.worker_count == 0 || srv.config.max_pending == 0) {
+		fprintf(stderr, "Error: The server needs at least one worker and one pending connection\n");
+		return false;
+	}
+	
+	if(srv.config.flag_path != NULL && !PegasusServer_readFlag(&srv, srv.config.flag_path)) {
+		goto cleanup;
+	}
+	
+	// Plugins can check submissions in fn_onLoaded or read randomness, which a replayed
+	// transcript wouldn't reproduce, so only runs without a plugin are cached
+	if(srv.config.cache_bytes > 0 && srv.plugin_init != NULL) {
+		fprintf(stderr, "Warning: The result cache is disabled because a plugin is loaded\n");
+	}
+	else if(srv.config.cache_bytes > 0) {
+		uint64_t config_hash = PegasusServer_configHash(&srv);
+		srv.cache = ResultCache_create(srv.config.cache_bytes, srv.config.cache_dir, config_hash);
+		if(!srv.cache) {
+			goto cleanup;
+		}
+	}
+	
+	srv.queue = calloc(srv.config.max_pending, sizeof(*srv.queue));
+	if(!srv.queue) {
+		perror("calloc");
+		goto cleanup;
+	}
+	pthread_mutex_init(&srv.lock, NULL);
+	pthread_cond_init(&srv.ready, NULL);
+	
+	// Each worker gets its own warm VM, booted once and reused for every submission
+	for(unsigned i = 0; i < srv.config.worker_count; i++) {
+		PegWorker worker = {.srv = &srv, .index = i};
+		worker.vm = PegasusVM_create(BOOTROM, BOOTROM_LEN);
+		if(!worker.vm) {
+			fprintf(stderr, "Error: Failed to create a VM\n");
+			goto cleanup;
+		}
+		array_append(&srv.workers, worker);
+		
+		if(!PegasusVM_warmUp(worker.vm, srv.plugin_init, srv.config.var_count, srv.config.vars)) {
+			fprintf(stderr, "Error: Failed to warm up a VM\n");
+			goto cleanup;
+		}
+	}
+	
+	// Clients hanging up mid-write shouldn't kill the server
+	srv.listen_fd = listen_on_address(srv.config.listen_address, SOMAXCONN);
+	if(srv.listen_fd < 0) {
+		goto cleanup;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	fcntl(srv.listen_fd, F_SETFL, fcntl(srv.listen_fd, F_GETFL) | O_NONBLOCK);
+	
+	srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(srv.epoll_fd < 0) {
+		perror("epoll_create1");
+		goto cleanup;
+	}
+	
+	// The listening socket is the only one registered with a NULL pointer
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+	if(epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &ev) != 0) {
+		perror("epoll_ctl");
+		goto cleanup;
+	}
+	
+	foreach(&srv.workers, worker) {
+		int err = pthread_create(&worker->thread, NULL, &PegasusServer_workerMain, worker);
+		if(err != 0) {
+			fprintf(stderr, "Error: Failed to start worker thread: %s\n", strerror(err));
+			goto stop;
+		}
+		worker->started = true;
+	}
+	
+	fprintf(
+		stderr, "Serving PEGASUS submissions on %s with %u workers\n",
+		srv.config.listen_address, srv.config.worker_count
+	);
+	
+	while(true) {
+		struct epoll_event events[PEG_EPOLL_EVENTS];
+		int count = epoll_wait(srv.epoll_fd, events, ARRAY_COUNT(events), 1000);
+		if(count < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+		
+		for(int i = 0; i < count; i++) {
+			if(events[i].data.ptr == NULL) {
+				PegasusServer_accept(&srv);
+			}
+			else {
+				PegasusServer_receive(&srv, events[i].data.ptr);
+			}
+		}
+		
+		PegasusServer_expire(&srv);
+	}
+	
+stop:
+	// Let the workers finish the submissions they're running, then wait for them to exit
+	pthread_mutex_lock(&srv.lock);
+	srv.stopping = true;
+	pthread_cond_broadcast(&srv.ready);
+	pthread_mutex_unlock(&srv.lock);
+	foreach(&srv.workers, worker) {
+		if(worker->started) {
+			pthread_join(worker->thread, NULL);
+		}
+	}
+	
+	// Drop the clients that are still uploading or waiting for a worker
+	foreach(&srv.uploading, pconn) {
+		PegConn_destroy(pconn);
+	}
+	array_clear(&srv.uploading);
+	while(srv.queue_count > 0) {
+		PegConn_destroy(&srv.queue[srv.queue_head]);
+		srv.queue_head = (srv.queue_head + 1) % srv.config.max_pending;
+		--srv.queue_count;
+	}
+	pthread_cond_destroy(&srv.ready);
+	pthread_mutex_destroy(&srv.lock);
+	
+cleanup:
+	if(srv.epoll_fd != -1) {
+		close(srv.epoll_fd);
+	}
+	close_listener(srv.listen_fd, srv.listen_fd != -1 ? srv.config.listen_address : NULL);
+	foreach(&srv.workers, worker) {
+		PegasusVM_destroy(&worker->vm);
+	}
+	array_clear(&srv.workers);
+	free(srv.queue);
+	ResultCache_destroy(&srv.cache);
+	free(srv.flag);
+	return false;
+}
+
+
+/*!
+ * @brief Run the PEGASUS server using the provided plugin and the default configuration.
+ * 
+ * @param plugin_init Function pointer to the plugin initialization function
+ * 
+ * @return False after printing an error message
+ */
+bool PegasusServer_serveWithPlugin(PegPlugin_Init_func* plugin_init) {
+	PegasusServer_Config config;
+	PegasusServer_defaultConfig(&config);
+	return PegasusServer_serve(&config, plugin_init);
+}
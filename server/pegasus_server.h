@@ -0,0 +1,120 @@
+//
+//  pegasus_server.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 11/5/2020.
+//
+
+#ifndef PEG_PEGASUS_SERVER_H
+#define PEG_PEGASUS_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <dlfcn.h>
+#include "libear/plugin.h"
+
+/*
+ * Long-lived server that receives PEGASUS files from clients and runs each one in
+ * a fresh EAR machine. For each connection:
+ * 
+ *   S: PEG SIZE?\n
+ *   C: <PEGASUS file size as a 32-bit big-endian integer>
+ *   S: PEG DATA?\n
+ *   C: <PEGASUS file contents>
+ * 
+ * Then the program runs with ports 0 and 1 connected to the client until it exits,
+ * faults, uses up its instruction budget, or runs out of time, and the connection
+ * is closed.
+ * 
+ * One thread accepts connections and receives the uploads with epoll, so slow
+ * clients don't hold up the VMs. Each complete upload is handed to one of a fixed
+ * number of worker threads, and each worker owns a warm VM: at startup its plugin is
+ * initialized and the bootrom is run up to the point where the user program would be
+ * loaded. Every submission starts from a copy of that state, so it only costs loading
+ * the PEGASUS file and running the user program.
+ * 
+ * The challenge plugin's init function is therefore called once per worker, on the
+ * server's main thread, and its fn_onLoaded callback is called on the worker thread
+ * before each submission runs. Plugins must keep all of their state in the PegPlugin
+ * object rather than in globals, and reset any per-submission state in fn_onLoaded.
+ * 
+ * Without a plugin, runs are deterministic, so when the result cache is turned on, a
+ * resubmitted file is answered from it for as long as the client's input matches the
+ * previous run (see result_cache.h). Plugins can do anything in their callbacks,
+ * including reading randomness, so the cache is never used with a plugin.
+ */
+
+typedef struct PegasusServer_Config {
+	const char* listen_address;  //!< "<hostname>:<port>" or a UNIX domain socket path
+	unsigned worker_count;       //!< Number of worker threads, each with its own VM
+	unsigned max_pending;        //!< Max connections uploading or waiting for a worker
+	uint64_t insn_budget;        //!< Max instructions per submission, after the VM's warm boot
+	unsigned io_timeout;         //!< Seconds to wait on a client before dropping it
+	unsigned run_timeout;        //!< Seconds a submission can keep doing client I/O, or 0 for no limit
+	const char* flag_path;       //!< File read by the program on port 0xF, or NULL
+	size_t cache_bytes;          //!< Memory for cached results of previous runs, or 0 to disable (the default)
+	const char* cache_dir;       //!< Directory that cached results are also saved to, or NULL
+	int var_count;               //!< Number of plugin variables in `vars`
+	PegVar* vars;                //!< Variables passed to the plugin's init function
+} PegasusServer_Config;
+
+
+/*!
+ * @brief Fill in the default server configuration. The listen address, worker count,
+ * and result cache directory can be overridden with the PEG_SERVER_LISTEN,
+ * PEG_SERVER_WORKERS, and PEG_SERVER_CACHE_DIR environment variables. The result
+ * cache is off unless PEG_SERVER_CACHE_DIR is set.
+ */
+void PegasusServer_defaultConfig(PegasusServer_Config* config);
+
+/*!
+ * @brief Run the PEGASUS server until it fails. If that happens after the workers have
+ * started, it waits for them to finish their current submissions before returning.
+ * 
+ * @param config Server configuration
+ * @param plugin_init Function pointer to the plugin initialization function, or NULL
+ * 
+ * @return False after printing an error message
+ */
+bool PegasusServer_serve(const PegasusServer_Config* config, PegPlugin_Init_func* plugin_init);
+
+/*!
+ * @brief Run the PEGASUS server using the provided plugin and the default configuration.
+ * 
+ * @param plugin_init Function pointer to the plugin initialization function
+ * 
+ * @return False after printing an error message
+ */
+bool PegasusServer_serveWithPlugin(PegPlugin_Init_func* plugin_init);
+
+
+/*!
+ * @brief Dynamically load libpegasus_server.so and call the PegasusServer_serveWithPlugin() function.
+ * 
+ * @param plugin_init Function pointer to the plugin initialization function
+ * 
+ * @return True on success, or false on failure
+ */
+static inline bool PegasusServer_dlopenAndServeWithPlugin(PegPlugin_Init_func* plugin_init) {
+	void* srv_handle = dlopen("./libpegasus_server.so", RTLD_LAZY);
+	if(srv_handle == NULL) {
+		fprintf(stderr, "Unable to dlopen libpegasus_server.so: %s\n", dlerror());
+		return false;
+	}
+	
+	const char* sym = "PegasusServer_serveWithPlugin";
+	bool (*fn_serve)(PegPlugin_Init_func* plugin_init) = (bool (*)(PegPlugin_Init_func*))dlsym(srv_handle, sym);
+	if(fn_serve == NULL) {
+		fprintf(stderr, "Missing required symbol \"%s\" in libpegasus_server.so!\n", sym);
+		dlclose(srv_handle);
+		return false;
+	}
+	
+	bool ret = fn_serve(plugin_init);
+	dlclose(srv_handle);
+	return ret;
+}
+
+#endif /* PEG_PEGASUS_SERVER_H */
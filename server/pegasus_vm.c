@@ -0,0 +1,483 @@
+//
+//  pegasus_vm.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "pegasus_vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "common/macros.h"
+#include "libeardbg/loader.h"
+
+
+static void PegasusVM_record(PegasusVM* vm, ResultCacheEvent kind, uint8_t value) {
+	// Oversized transcripts won't be cached, so stop growing them
+	if(vm->transcript != NULL && vm->transcript->count <= RESULT_CACHE_MAX_TRANSCRIPT) {
+		array_append(vm->transcript, kind);
+		array_append(vm->transcript, value);
+	}
+}
+
+
+/*!
+ * @brief Check whether the current submission's deadline has passed, and if so, set
+ * `timed_out`.
+ * 
+ * @return True if the submission is out of time
+ */
+bool PegasusVM_checkDeadline(PegasusVM* vm) {
+	if(vm->deadline != 0 && time(NULL) >= vm->deadline) {
+		vm->timed_out = true;
+	}
+	return vm->timed_out;
+}
+
+
+static EAR_HaltReason PegasusVM_portRead(void* cookie, uint8_t port_number, EAR_Byte* out_byte) {
+	PegasusVM* vm = cookie;
+	
+	switch(port_number) {
+		case 0: { //stdin
+			// Input the client sent while a cached run was being replayed
+			if(vm->input_pos < vm->input_prefix_size) {
+				*out_byte = vm->input_prefix[vm->input_pos++];
+				PegasusVM_record(vm, RESULT_CACHE_READ, *out_byte);
+				return HALT_NONE;
+			}
+			
+			// A client that keeps sending slowly could otherwise hold the worker forever
+			if(PegasusVM_checkDeadline(vm)) {
+				return HALT_IO_ERROR;
+			}
+			
+			ssize_t bytes_read = 0;
+			if(!vm->input_eof) {
+				do {
+					bytes_read = recv(vm->fd, out_byte, 1, 0);
+				} while(bytes_read < 0 && errno == EINTR);
+			}
+			
+			// The client disconnected or didn't send anything before the timeout
+			if(bytes_read != 1) {
+				PegasusVM_record(vm, RESULT_CACHE_READ_FAIL, 0);
+				return HALT_IO_ERROR;
+			}
+			
+			PegasusVM_record(vm, RESULT_CACHE_READ, *out_byte);
+			return HALT_NONE;
+		}
+		
+		case 0xF: //flag
+			if(vm->flag_pos >= vm->flag_size) {
+				return HALT_IO_ERROR;
+			}
+			*out_byte = vm->flag[vm->flag_pos++];
+			return HALT_NONE;
+		
+		default:
+			return HALT_BUS_FAULT;
+	}
+}
+
+
+static EAR_HaltReason PegasusVM_portWrite(void* cookie, uint8_t port_number, EAR_Byte byte) {
+	PegasusVM* vm = cookie;
+	
+	switch(port_number) {
+		case 0: //stdout
+		case 1: //stderr
+			break;
+		
+		case 0xD: //debug (UART)
+			return HALT_NONE;
+		
+		case 0xE: //exit
+			// Stop the CPU like the program returned from its topmost frame
+			vm->exited = true;
+			vm->exit_status = byte;
+			return HALT_RETURN;
+		
+		default:
+			return HALT_BUS_FAULT;
+	}
+	
+	PegasusVM_record(vm, RESULT_CACHE_WRITE, byte);
+	
+	// The client already received this byte from the result cache
+	if(vm->output_skip > 0) {
+		--vm->output_skip;
+		return HALT_NONE;
+	}
+	
+	// Likewise for a client that keeps reading slowly
+	if(PegasusVM_checkDeadline(vm)) {
+		return HALT_IO_ERROR;
+	}
+	
+	ssize_t bytes_written;
+	do {
+		bytes_written = send(vm->fd, &byte, 1, MSG_NOSIGNAL);
+	} while(bytes_written < 0 && errno == EINTR);
+	
+	if(bytes_written != 1) {
+		vm->write_failed = true;
+		return HALT_IO_ERROR;
+	}
+	return HALT_NONE;
+}
+
+
+/*!
+ * @brief Create a VM with the bootrom, RAM, and submission regions attached.
+ * 
+ * @param bootrom Bootrom image (PEGASUS file with a @ROM segment, or a flat binary)
+ * @param bootrom_size Size of the bootrom image in bytes
+ * 
+ * @return Newly created VM, or NULL on error
+ */
+PegasusVM* PegasusVM_create(void* bootrom, size_t bootrom_size) {
+	PegasusVM* vm = calloc(1, sizeof(*vm));
+	if(!vm) {
+		return NULL;
+	}
+	
+	vm->fd = -1;
+	Bus_init(&vm->bus);
+	
+	vm->ram = calloc(1, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+	vm->boot_ram = malloc(EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+	vm->peg_buf = calloc(1, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+	vm->bootpeg = Pegasus_new();
+	if(!vm->ram || !vm->boot_ram || !vm->peg_buf || !vm->bootpeg) {
+		PegasusVM_destroy(&vm);
+		return NULL;
+	}
+	
+	// Attach the bootrom's @ROM and @ROMDATA segments, or the whole image if it's a flat binary
+	void* rom = bootrom;
+	size_t rom_size = bootrom_size;
+	if(Pegasus_parseFromMemory(vm->bootpeg, bootrom, bootrom_size, false) == PEG_SUCCESS) {
+		if(!Pegasus_getSegmentData(vm->bootpeg, "@ROM", &rom, &rom_size)) {
+			fprintf(stderr, "Error: No @ROM segment in bootrom PEGASUS file\n");
+			PegasusVM_destroy(&vm);
+			return NULL;
+		}
+		
+		void* romdata;
+		size_t romdata_size;
+		if(Pegasus_getSegmentData(vm->bootpeg, "@ROMDATA", &romdata, &romdata_size)) {
+			if(romdata != (char*)rom + rom_size) {
+				fprintf(stderr, "Error: @ROMDATA segment in bootrom PEGASUS file is not at the end of the @ROM segment\n");
+				PegasusVM_destroy(&vm);
+				return NULL;
+			}
+			rom_size += romdata_size;
+		}
+	}
+	else {
+		Pegasus_destroy(&vm->bootpeg);
+	}
+	
+	if(rom_size > EAR_VIRTUAL_ADDRESS_SPACE_SIZE) {
+		fprintf(stderr, "Error: Bootrom is too large (0x%zX bytes)\n", rom_size);
+		PegasusVM_destroy(&vm);
+		return NULL;
+	}
+	
+	Bus_addMemory(&vm->bus, "ROM", BUS_MODE_READ, 0x000000, (uint32_t)rom_size, rom);
+	Bus_addMemory(
+		&vm->bus, "RAM", BUS_MODE_RDWR,
+		1 << EAR_REGION_SHIFT, EAR_VIRTUAL_ADDRESS_SPACE_SIZE,
+		vm->ram
+	);
+	Bus_addMemory(
+		&vm->bus, "PEG", BUS_MODE_READ,
+		PEGASUS_VM_PEG_REGION << EAR_REGION_SHIFT, EAR_VIRTUAL_ADDRESS_SPACE_SIZE,
+		vm->peg_buf
+	);
+	
+	PegasusVM_reset(vm, -1, NULL, 0);
+	return vm;
+}
+
+
+/*! Destroy a VM created by `PegasusVM_create`. */
+void PegasusVM_destroy(PegasusVM** pvm) {
+	PegasusVM* vm = *pvm;
+	if(!vm) {
+		return;
+	}
+	*pvm = NULL;
+	
+	PegasusVM_unload(vm);
+	if(vm->plugin != NULL && vm->plugin->fn_destroy != NULL) {
+		vm->plugin->fn_destroy(vm->plugin);
+	}
+	Pegasus_destroy(&vm->bootpeg);
+	Bus_destroy(&vm->bus);
+	free(vm->peg_buf);
+	free(vm->boot_ram);
+	free(vm->ram);
+	free(vm);
+}
+
+
+static void PegasusVM_saveSnapshot(PegasusVM* vm) {
+	memcpy(vm->boot_ram, vm->ram, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+	vm->boot_cpu = vm->cpu;
+	vm->boot_mmu = vm->mmu;
+	vm->warm = true;
+}
+
+
+/*!
+ * @brief Initialize a plugin in the VM and boot it up to the point where the user
+ * program would be loaded, then save that state for `PegasusVM_reset` to restore.
+ * 
+ * @param plugin_init Plugin initialization function, or NULL
+ * @param var_count Number of variables in `vars`
+ * @param vars Variables passed to the plugin's init function
+ * 
+ * @return True on success, or false if the plugin failed to initialize or the
+ *         bootrom halted before reaching `@Pegasus_load`
+ */
+bool PegasusVM_warmUp(PegasusVM* vm, PegPlugin_Init_func* plugin_init, int var_count, PegVar* vars) {
+	vm->warm = false;
+	vm->at_loader = false;
+	PegasusVM_reset(vm, -1, NULL, 0);
+	
+	// Plugins hook into the CPU before it boots, just like in runpeg
+	if(plugin_init != NULL && vm->plugin == NULL) {
+		vm->plugin = plugin_init(&vm->cpu, var_count, vars);
+		if(vm->plugin == NULL) {
+			return false;
+		}
+	}
+	
+	// Without a `@Pegasus_load` to stop at, every submission boots from power-on
+	PegasusVM_saveSnapshot(vm);
+	if(!vm->bootpeg) {
+		return true;
+	}
+	
+	bool at_loader;
+	EAR_HaltReason r = PegasusLoader_bootToLoader(&vm->cpu, vm->bootpeg, &at_loader);
+	if(r != HALT_NONE) {
+		fprintf(stderr, "Error: Bootrom halted while warming up VM: %s\n", EAR_haltReasonToString(r));
+		return false;
+	}
+	
+	if(at_loader) {
+		PegasusVM_saveSnapshot(vm);
+		vm->at_loader = true;
+	}
+	
+	PegasusVM_reset(vm, -1, NULL, 0);
+	return true;
+}
+
+
+/*!
+ * @brief Reset the VM for a new submission, either to the warm snapshot or to
+ * power-on state.
+ * 
+ * @param fd Connected client socket used for port I/O
+ * @param flag Data that the program reads from port 0xF
+ * @param flag_size Number of bytes in `flag`
+ */
+void PegasusVM_reset(PegasusVM* vm, int fd, const char* flag, size_t flag_size) {
+	PegasusVM_unload(vm);
+	
+	if(vm->warm) {
+		// The snapshot's port and memory handlers still point at this VM and its plugin
+		memcpy(vm->ram, vm->boot_ram, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+		vm->cpu = vm->boot_cpu;
+		vm->mmu = vm->boot_mmu;
+	}
+	else {
+		// Only RAM is writable, so it's the only memory that needs to be cleared
+		memset(vm->ram, 0, EAR_VIRTUAL_ADDRESS_SPACE_SIZE);
+		
+		EAR_init(&vm->cpu);
+		MMU_init(&vm->mmu);
+		MMU_setContext(&vm->mmu, &vm->cpu.ctx);
+		MMU_setBusHandler(&vm->mmu, Bus_accessHandler, &vm->bus);
+		EAR_setMemoryHandler(&vm->cpu, MMU_memoryHandler, &vm->mmu);
+		EAR_setPorts(&vm->cpu, &PegasusVM_portRead, &PegasusVM_portWrite, vm);
+	}
+	
+	vm->fd = fd;
+	vm->input_prefix = NULL;
+	vm->input_prefix_size = 0;
+	vm->input_pos = 0;
+	vm->input_eof = false;
+	vm->output_skip = 0;
+	vm->transcript = NULL;
+	vm->write_failed = false;
+	vm->deadline = 0;
+	vm->timed_out = false;
+	vm->flag = flag;
+	vm->flag_size = flag_size;
+	vm->flag_pos = 0;
+	vm->exited = false;
+	vm->exit_status = 0;
+}
+
+
+/*!
+ * @brief Account for client I/O that already happened while replaying a cached run,
+ * so the run picks up where the replay diverged.
+ * 
+ * @param input Bytes already read from the client, which the program reads first
+ * @param input_size Number of bytes in `input`
+ * @param input_eof True if reading from the client already failed after `input`
+ * @param output_sent Number of output bytes the client already received, which
+ *        won't be sent again
+ */
+void PegasusVM_setReplayedIO(PegasusVM* vm, const uint8_t* input, size_t input_size, bool input_eof, size_t output_sent) {
+	vm->input_prefix = input;
+	vm->input_prefix_size = input_size;
+	vm->input_pos = 0;
+	vm->input_eof = input_eof;
+	vm->output_skip = output_sent;
+}
+
+
+/*!
+ * @brief Limit how long the current submission can keep talking to its client. Once
+ * the deadline passes, reading from port 0 and writing to ports 0 and 1 fail.
+ * 
+ * @param deadline Time from `time()` when client I/O starts failing, or 0 for no limit
+ */
+void PegasusVM_setDeadline(PegasusVM* vm, time_t deadline) {
+	vm->deadline = deadline;
+	vm->timed_out = false;
+}
+
+
+// Parse the submission that was just placed at the start of the submission region
+static PegStatus PegasusVM_parseSubmission(PegasusVM* vm, size_t size) {
+	// Zero whatever is left over from a larger previous submission
+	if(size < vm->peg_size) {
+		memset((char*)vm->peg_buf + size, 0, vm->peg_size - size);
+	}
+	vm->peg_size = size;
+	
+	vm->peg = Pegasus_new();
+	if(!vm->peg) {
+		return PEG_INVALID_PARAMETER;
+	}
+	
+	PegStatus s = Pegasus_parseFromMemory(vm->peg, vm->peg_buf, size, false);
+	if(s != PEG_SUCCESS) {
+		Pegasus_destroy(&vm->peg);
+	}
+	return s;
+}
+
+
+/*!
+ * @brief Copy a submitted PEGASUS file into the VM's submission region and parse it.
+ * 
+ * @param data Contents of the PEGASUS file
+ * @param size Number of bytes in `data`, at most EAR_VIRTUAL_ADDRESS_SPACE_SIZE
+ * 
+ * @return PEG_SUCCESS, or the reason the file couldn't be parsed
+ */
+PegStatus PegasusVM_load(PegasusVM* vm, const void* data, size_t size) {
+	PegasusVM_unload(vm);
+	
+	if(size > EAR_VIRTUAL_ADDRESS_SPACE_SIZE) {
+		return PEG_INVALID_PARAMETER;
+	}
+	
+	memcpy(vm->peg_buf, data, size);
+	return PegasusVM_parseSubmission(vm, size);
+}
+
+
+/*!
+ * @brief Read a submitted PEGASUS file from an open file descriptor (such as a memfd,
+ * pipe, or socket) straight into the VM's submission region and parse it.
+ * 
+ * @param fd File descriptor to read until EOF, which is left open
+ * 
+ * @return PEG_SUCCESS, PEG_IO_ERROR if reading failed or the file is larger than
+ *         EAR_VIRTUAL_ADDRESS_SPACE_SIZE, or the reason the file couldn't be parsed
+ */
+PegStatus PegasusVM_loadFromFd(PegasusVM* vm, int fd) {
+	PegasusVM_unload(vm);
+	
+	size_t size = 0;
+	while(true) {
+		// Once the region is full, only EOF is acceptable
+		uint8_t extra;
+		uint8_t* dst = size < EAR_VIRTUAL_ADDRESS_SPACE_SIZE ? (uint8_t*)vm->peg_buf + size : &extra;
+		size_t want = size < EAR_VIRTUAL_ADDRESS_SPACE_SIZE ? EAR_VIRTUAL_ADDRESS_SPACE_SIZE - size : 1;
+		
+		ssize_t n = read(fd, dst, want);
+		if(n < 0 && errno == EINTR) {
+			continue;
+		}
+		if(n == 0) {
+			break;
+		}
+		if(n < 0 || dst == &extra) {
+			// Don't leave part of this file behind in the submission region
+			memset(vm->peg_buf, 0, MAX(vm->peg_size, size));
+			vm->peg_size = 0;
+			return PEG_IO_ERROR;
+		}
+		size += (size_t)n;
+	}
+	
+	return PegasusVM_parseSubmission(vm, size);
+}
+
+
+/*!
+ * @brief Boot the VM and run the loaded submission until it exits, halts, or runs
+ * out of instructions.
+ * 
+ * @param insn_budget Maximum number of instructions to run from where the VM was reset
+ * 
+ * @return HALT_RETURN when the program exited through port 0xE (see `exit_status`),
+ *         otherwise the reason the CPU halted
+ */
+EAR_HaltReason PegasusVM_run(PegasusVM* vm, uint64_t insn_budget) {
+	EAR_setInstructionLimit(&vm->cpu, vm->cpu.ins_count + insn_budget);
+	
+	// Map the submission from the host instead of running the bootrom's loader
+	if(vm->at_loader && vm->peg) {
+		EAR_HaltReason r = PegasusLoader_loadFromCall(
+			&vm->cpu, vm->peg, PEGASUS_VM_PEG_REGION,
+			vm->mmu.bus_fn, vm->mmu.bus_cookie
+		);
+		if(r != HALT_NONE) {
+			return r;
+		}
+	}
+	else if(vm->bootpeg && vm->peg) {
+		EAR_HaltReason r = PegasusLoader_fastBoot(
+			&vm->cpu, vm->bootpeg, vm->peg, PEGASUS_VM_PEG_REGION,
+			vm->mmu.bus_fn, vm->mmu.bus_cookie
+		);
+		if(r != HALT_NONE) {
+			return r;
+		}
+	}
+	
+	return EAR_continue(&vm->cpu);
+}
+
+
+/*! Release the parsed submission after it has finished running. */
+void PegasusVM_unload(PegasusVM* vm) {
+	Pegasus_destroy(&vm->peg);
+}
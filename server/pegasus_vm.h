@@ -0,0 +1,197 @@
+//
+//  pegasus_vm.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef PEG_PEGASUS_VM_H
+#define PEG_PEGASUS_VM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "libear/ear.h"
+#include "libear/mmu.h"
+#include "libear/bus.h"
+#include "libear/plugin.h"
+#include "libeardbg/pegasus.h"
+#include "result_cache.h"
+
+
+/*
+ * A complete EAR machine that is set up once and then reused for one submission
+ * after another. The physical memory layout matches runpeg's:
+ * 
+ *   00:0000  Bootrom (read-only, shared by every VM)
+ *   01:0000  RAM
+ *   02:0000  The submitted PEGASUS file (read-only)
+ * 
+ * Resetting the VM for the next submission clears RAM and the CPU state, but the
+ * bus and all memory stay attached, so no allocations happen per submission.
+ * 
+ * A VM can also be warmed up: its plugins are initialized and the bootrom is run up
+ * to the call to `@Pegasus_load`, and that machine state is saved as a snapshot.
+ * Every reset after that restores the snapshot, so each submission only pays for
+ * loading the PEGASUS file and running the user program.
+ */
+
+//! Physical memory region where the submitted PEGASUS file is attached
+#define PEGASUS_VM_PEG_REGION 2
+
+typedef struct PegasusVM {
+	EAR cpu;
+	MMU mmu;
+	Bus bus;
+	
+	// Bootrom parsed from the baked-in image, used to boot straight to `@Pegasus_load`
+	Pegasus* bootpeg;
+	
+	// Backing memory for the RAM and submission regions
+	EAR_UWord* ram;
+	EAR_UWord* peg_buf;
+	size_t peg_size;
+	
+	// The current submission, parsed from peg_buf
+	Pegasus* peg;
+	
+	// Connected client used for port 0 and 1 I/O
+	int fd;
+	
+	// Client I/O that already happened before the VM started running, see `PegasusVM_setReplayedIO`
+	const uint8_t* input_prefix;
+	size_t input_prefix_size;
+	size_t input_pos;
+	bool input_eof;
+	size_t output_skip;
+	
+	// When set, every byte read from or written to the client is appended here
+	ResultCache_Transcript* transcript;
+	bool write_failed;
+	
+	// Client I/O fails once time() reaches the deadline, unless it's 0
+	time_t deadline;
+	bool timed_out;
+	
+	// Data read from port 0xF, shared by every VM
+	const char* flag;
+	size_t flag_size;
+	size_t flag_pos;
+	
+	// Set when the program writes its exit status to port 0xE
+	bool exited;
+	uint8_t exit_status;
+	
+	// Plugin initialized by `PegasusVM_warmUp`, which stays hooked into the CPU
+	PegPlugin* plugin;
+	
+	// Machine state restored by `PegasusVM_reset` once the VM is warm
+	bool warm;
+	bool at_loader;  //!< Snapshot is stopped at the first instruction of `@Pegasus_load`
+	EAR boot_cpu;
+	MMU boot_mmu;
+	EAR_UWord* boot_ram;
+} PegasusVM;
+
+
+/*!
+ * @brief Create a VM with the bootrom, RAM, and submission regions attached.
+ * 
+ * @param bootrom Bootrom image (PEGASUS file with a @ROM segment, or a flat binary)
+ * @param bootrom_size Size of the bootrom image in bytes
+ * 
+ * @return Newly created VM, or NULL on error
+ */
+PegasusVM* PegasusVM_create(void* bootrom, size_t bootrom_size);
+
+/*! Destroy a VM created by `PegasusVM_create`. */
+void PegasusVM_destroy(PegasusVM** pvm);
+
+/*!
+ * @brief Initialize a plugin in the VM and boot it up to the point where the user
+ * program would be loaded, then save that state for `PegasusVM_reset` to restore.
+ * 
+ * @param plugin_init Plugin initialization function, or NULL
+ * @param var_count Number of variables in `vars`
+ * @param vars Variables passed to the plugin's init function
+ * 
+ * @return True on success, or false if the plugin failed to initialize or the
+ *         bootrom halted before reaching `@Pegasus_load`
+ */
+bool PegasusVM_warmUp(PegasusVM* vm, PegPlugin_Init_func* plugin_init, int var_count, PegVar* vars);
+
+/*!
+ * @brief Reset the VM for a new submission, either to the warm snapshot or to
+ * power-on state.
+ * 
+ * @param fd Connected client socket used for port I/O
+ * @param flag Data that the program reads from port 0xF
+ * @param flag_size Number of bytes in `flag`
+ */
+void PegasusVM_reset(PegasusVM* vm, int fd, const char* flag, size_t flag_size);
+
+/*!
+ * @brief Account for client I/O that already happened while replaying a cached run,
+ * so the run picks up where the replay diverged.
+ * 
+ * @param input Bytes already read from the client, which the program reads first
+ * @param input_size Number of bytes in `input`
+ * @param input_eof True if reading from the client already failed after `input`
+ * @param output_sent Number of output bytes the client already received, which
+ *        won't be sent again
+ */
+void PegasusVM_setReplayedIO(PegasusVM* vm, const uint8_t* input, size_t input_size, bool input_eof, size_t output_sent);
+
+/*!
+ * @brief Limit how long the current submission can keep talking to its client. Once
+ * the deadline passes, reading from port 0 and writing to ports 0 and 1 fail.
+ * 
+ * @param deadline Time from `time()` when client I/O starts failing, or 0 for no limit
+ */
+void PegasusVM_setDeadline(PegasusVM* vm, time_t deadline);
+
+/*!
+ * @brief Check whether the current submission's deadline has passed, and if so, set
+ * `timed_out`.
+ * 
+ * @return True if the submission is out of time
+ */
+bool PegasusVM_checkDeadline(PegasusVM* vm);
+
+/*!
+ * @brief Copy a submitted PEGASUS file into the VM's submission region and parse it.
+ * 
+ * @param data Contents of the PEGASUS file
+ * @param size Number of bytes in `data`, at most EAR_VIRTUAL_ADDRESS_SPACE_SIZE
+ * 
+ * @return PEG_SUCCESS, or the reason the file couldn't be parsed
+ */
+PegStatus PegasusVM_load(PegasusVM* vm, const void* data, size_t size);
+
+/*!
+ * @brief Read a submitted PEGASUS file from an open file descriptor (such as a memfd,
+ * pipe, or socket) straight into the VM's submission region and parse it.
+ * 
+ * @param fd File descriptor to read until EOF, which is left open
+ * 
+ * @return PEG_SUCCESS, PEG_IO_ERROR if reading failed or the file is larger than
+ *         EAR_VIRTUAL_ADDRESS_SPACE_SIZE, or the reason the file couldn't be parsed
+ */
+PegStatus PegasusVM_loadFromFd(PegasusVM* vm, int fd);
+
+/*!
+ * @brief Boot the VM and run the loaded submission until it exits, halts, or runs
+ * out of instructions.
+ * 
+ * @param insn_budget Maximum number of instructions to run from where the VM was reset
+ * 
+ * @return HALT_RETURN when the program exited through port 0xE (see `exit_status`),
+ *         otherwise the reason the CPU halted
+ */
+EAR_HaltReason PegasusVM_run(PegasusVM* vm, uint64_t insn_budget);
+
+/*! Release the parsed submission after it has finished running. */
+void PegasusVM_unload(PegasusVM* vm);
+
+#endif /* PEG_PEGASUS_VM_H */
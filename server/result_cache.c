@@ -0,0 +1,400 @@
+//
+//  result_cache.c
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#include "result_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define RESULT_CACHE_MAGIC "PEGCACHE"
+#define RESULT_CACHE_VERSION 1
+
+typedef struct ResultCacheFileHeader ResultCacheFileHeader;
+struct ResultCacheFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t peg_size;
+	uint32_t transcript_size;
+	int32_t halt_reason;
+	uint8_t exited;
+	uint8_t exit_status;
+	uint64_t ins_count;
+} __attribute__((packed));
+
+typedef struct ResultCacheEntry {
+	uint64_t hash;
+	uint64_t last_used;
+	uint8_t* peg;
+	size_t peg_size;
+	ResultCache_Transcript transcript;
+	ResultCache_Result result;
+} ResultCacheEntry;
+
+struct ResultCache {
+	pthread_mutex_t lock;
+	size_t max_bytes;
+	size_t used_bytes;
+	uint64_t clock;
+	char* dir;
+	dynamic_array(ResultCacheEntry*) entries;
+};
+
+
+/*!
+ * @brief Hash more data into a 64-bit FNV-1a hash. Hashes only pick which entry to
+ * compare against, so collisions are harmless.
+ * 
+ * @param hash Hash so far, starting from RESULT_CACHE_HASH_INIT
+ * @param data Data to hash
+ * @param size Number of bytes in `data`
+ * 
+ * @return Updated hash
+ */
+uint64_t ResultCache_hash(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	size_t i;
+	for(i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+	}
+	return hash;
+}
+
+
+static size_t ResultCacheEntry_size(const ResultCacheEntry* entry) {
+	return sizeof(*entry) + entry->peg_size + entry->transcript.count;
+}
+
+
+static void ResultCacheEntry_destroy(ResultCacheEntry** pentry) {
+	ResultCacheEntry* entry = *pentry;
+	if(!entry) {
+		return;
+	}
+	*pentry = NULL;
+	
+	array_clear(&entry->transcript);
+	free(entry->peg);
+	free(entry);
+}
+
+
+static ResultCacheEntry* ResultCacheEntry_create(
+	uint64_t hash, const void* peg, size_t peg_size,
+	const uint8_t* transcript, size_t transcript_size,
+	const ResultCache_Result* result
+) { //ResultCacheEntry_create
+	ResultCacheEntry* entry = calloc(1, sizeof(*entry));
+	if(!entry) {
+		return NULL;
+	}
+	
+	entry->peg = malloc(peg_size);
+	if(!entry->peg) {
+		free(entry);
+		return NULL;
+	}
+	
+	entry->hash = hash;
+	memcpy(entry->peg, peg, peg_size);
+	entry->peg_size = peg_size;
+	array_extend(&entry->transcript, transcript, transcript_size);
+	entry->result = *result;
+	return entry;
+}
+
+
+/*!
+ * @brief Create a result cache.
+ * 
+ * @param max_bytes Max memory used by cached PEGASUS files and transcripts
+ * @param dir Directory for the on-disk store, or NULL to only cache in memory
+ * @param config_hash Hash of everything besides the PEGASUS file and input that
+ *        affects how a submission runs
+ * 
+ * @return Newly created cache, or NULL on error
+ */
+ResultCache* ResultCache_create(size_t max_bytes, const char* dir, uint64_t config_hash) {
+	ResultCache* cache = calloc(1, sizeof(*cache));
+	if(!cache) {
+		return NULL;
+	}
+	
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->max_bytes = max_bytes;
+	
+	if(dir != NULL) {
+		char path[PATH_MAX];
+		snprintf(path, sizeof(path), "%s/%016" PRIx64, dir, config_hash);
+		
+		if((mkdir(dir, 0755) != 0 && errno != EEXIST) || (mkdir(path, 0755) != 0 && errno != EEXIST)) {
+			perror(path);
+			ResultCache_destroy(&cache);
+			return NULL;
+		}
+		
+		cache->dir = strdup(path);
+		if(!cache->dir) {
+			ResultCache_destroy(&cache);
+			return NULL;
+		}
+	}
+	
+	return cache;
+}
+
+
+/*! Destroy a result cache created by `ResultCache_create` */
+void ResultCache_destroy(ResultCache** pcache) {
+	ResultCache* cache = *pcache;
+	if(!cache) {
+		return;
+	}
+	*pcache = NULL;
+	
+	foreach(&cache->entries, pentry) {
+		ResultCacheEntry_destroy(pentry);
+	}
+	array_clear(&cache->entries);
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->dir);
+	free(cache);
+}
+
+
+static void ResultCache_entryPath(ResultCache* cache, uint64_t hash, char* path, size_t path_size) {
+	snprintf(path, path_size, "%s/%016" PRIx64, cache->dir, hash);
+}
+
+
+// Read an entry from the on-disk store, or return NULL if it isn't there
+static ResultCacheEntry* ResultCache_readEntry(
+	ResultCache* cache, uint64_t hash, const void* peg, size_t peg_size
+) { //ResultCache_readEntry
+	ResultCacheEntry* entry = NULL;
+	uint8_t* buf = NULL;
+	
+	char path[PATH_MAX];
+	ResultCache_entryPath(cache, hash, path, sizeof(path));
+	FILE* fp = fopen(path, "rbe");
+	if(!fp) {
+		return NULL;
+	}
+	
+	ResultCacheFileHeader header;
+	if(fread(&header, sizeof(header), 1, fp) != 1
+		|| memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic)) != 0
+		|| header.version != RESULT_CACHE_VERSION
+		|| header.peg_size != peg_size
+		|| header.transcript_size > RESULT_CACHE_MAX_TRANSCRIPT
+	) {
+		goto out;
+	}
+	
+	buf = malloc(peg_size + header.transcript_size);
+	if(!buf || fread(buf, 1, peg_size + header.transcript_size, fp) != peg_size + header.transcript_size) {
+		goto out;
+	}
+	
+	// Another file with the same hash may have replaced this one
+	if(memcmp(buf, peg, peg_size) != 0) {
+		goto out;
+	}
+	
+	ResultCache_Result result = {
+		.halt_reason = header.halt_reason,
+		.exited = header.exited != 0,
+		.exit_status = header.exit_status,
+		.ins_count = header.ins_count,
+	};
+	entry = ResultCacheEntry_create(hash, peg, peg_size, buf + peg_size, header.transcript_size, &result);
+	
+out:
+	free(buf);
+	fclose(fp);
+	return entry;
+}
+
+
+// Write an entry to the on-disk store, replacing it atomically so readers never see half of it
+static void ResultCache_writeEntry(ResultCache* cache, const ResultCacheEntry* entry) {
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 32];
+	ResultCache_entryPath(cache, entry->hash, path, sizeof(path));
+	snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+	
+	FILE* fp = fopen(tmp_path, "wbe");
+	if(!fp) {
+		return;
+	}
+	
+	ResultCacheFileHeader header = {
+		.version = RESULT_CACHE_VERSION,
+		.peg_size = (uint32_t)entry->peg_size,
+		.transcript_size = (uint32_t)entry->transcript.count,
+		.halt_reason = entry->result.halt_reason,
+		.exited = entry->result.exited,
+		.exit_status = entry->result.exit_status,
+		.ins_count = entry->result.ins_count,
+	};
+	memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic));
+	
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+		&& fwrite(entry->peg, 1, entry->peg_size, fp) == entry->peg_size
+		&& fwrite(entry->transcript.elems, 1, entry->transcript.count, fp) == entry->transcript.count;
+	if(fclose(fp) != 0) {
+		ok = false;
+	}
+	
+	if(!ok || rename(tmp_path, path) != 0) {
+		unlink(tmp_path);
+	}
+}
+
+
+// Find a cached entry in memory, and return its index or -1
+static ssize_t ResultCache_find(ResultCache* cache, uint64_t hash, const void* peg, size_t peg_size) {
+	enumerate(&cache->entries, i, pentry) {
+		ResultCacheEntry* entry = *pentry;
+		if(entry->hash == hash && entry->peg_size == peg_size && memcmp(entry->peg, peg, peg_size) == 0) {
+			return (ssize_t)i;
+		}
+	}
+	return -1;
+}
+
+
+static void ResultCache_removeIndex(ResultCache* cache, size_t index) {
+	ResultCacheEntry* entry = cache->entries.elems[index];
+	cache->used_bytes -= ResultCacheEntry_size(entry);
+	ResultCacheEntry_destroy(&entry);
+	array_removeIndex(&cache->entries, index);
+}
+
+
+// Add an entry to memory, evicting the least recently used entries to make room
+static void ResultCache_insert(ResultCache* cache, ResultCacheEntry* entry) {
+	size_t size = ResultCacheEntry_size(entry);
+	if(size > cache->max_bytes) {
+		ResultCacheEntry_destroy(&entry);
+		return;
+	}
+	
+	while(cache->used_bytes + size > cache->max_bytes) {
+		size_t oldest = 0;
+		enumerate(&cache->entries, i, pcur) {
+			if((*pcur)->last_used < cache->entries.elems[oldest]->last_used) {
+				oldest = i;
+			}
+		}
+		ResultCache_removeIndex(cache, oldest);
+	}
+	
+	entry->last_used = ++cache->clock;
+	cache->used_bytes += size;
+	array_append(&cache->entries, entry);
+}
+
+
+/*!
+ * @brief Look up the previous run of a PEGASUS file.
+ * 
+ * @param peg Contents of the PEGASUS file
+ * @param peg_size Number of bytes in `peg`
+ * @param out_transcript Output array that the run's transcript is copied into
+ * @param out_result Output variable set to how the run ended
+ * 
+ * @return True if the file has been run before
+ */
+bool ResultCache_lookup(
+	ResultCache* cache, const void* peg, size_t peg_size,
+	ResultCache_Transcript* out_transcript, ResultCache_Result* out_result
+) { //ResultCache_lookup
+	uint64_t hash = ResultCache_hash(RESULT_CACHE_HASH_INIT, peg, peg_size);
+	
+	pthread_mutex_lock(&cache->lock);
+	ssize_t index = ResultCache_find(cache, hash, peg, peg_size);
+	if(index >= 0) {
+		ResultCacheEntry* entry = cache->entries.elems[index];
+		entry->last_used = ++cache->clock;
+		out_transcript->count = 0;
+		array_extend(out_transcript, entry->transcript.elems, entry->transcript.count);
+		*out_result = entry->result;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	
+	if(index >= 0) {
+		return true;
+	}
+	if(cache->dir == NULL) {
+		return false;
+	}
+	
+	// Fall back to the on-disk store, without holding the lock during file I/O
+	ResultCacheEntry* loaded = ResultCache_readEntry(cache, hash, peg, peg_size);
+	if(!loaded) {
+		return false;
+	}
+	
+	out_transcript->count = 0;
+	array_extend(out_transcript, loaded->transcript.elems, loaded->transcript.count);
+	*out_result = loaded->result;
+	
+	pthread_mutex_lock(&cache->lock);
+	if(ResultCache_find(cache, hash, peg, peg_size) < 0) {
+		ResultCache_insert(cache, loaded);
+	}
+	else {
+		ResultCacheEntry_destroy(&loaded);
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return true;
+}
+
+
+/*!
+ * @brief Remember the latest run of a PEGASUS file, replacing any previous one.
+ * 
+ * @param peg Contents of the PEGASUS file
+ * @param peg_size Number of bytes in `peg`
+ * @param transcript Transcript of the run
+ * @param result How the run ended
+ */
+void ResultCache_store(
+	ResultCache* cache, const void* peg, size_t peg_size,
+	const ResultCache_Transcript* transcript, const ResultCache_Result* result
+) { //ResultCache_store
+	if(transcript->count > RESULT_CACHE_MAX_TRANSCRIPT) {
+		return;
+	}
+	
+	uint64_t hash = ResultCache_hash(RESULT_CACHE_HASH_INIT, peg, peg_size);
+	ResultCacheEntry* entry = ResultCacheEntry_create(
+		hash, peg, peg_size,
+		transcript->elems, transcript->count, result
+	);
+	if(!entry) {
+		return;
+	}
+	
+	if(cache->dir != NULL) {
+		ResultCache_writeEntry(cache, entry);
+	}
+	
+	pthread_mutex_lock(&cache->lock);
+	ssize_t index = ResultCache_find(cache, hash, peg, peg_size);
+	if(index >= 0) {
+		ResultCache_removeIndex(cache, (size_t)index);
+	}
+	ResultCache_insert(cache, entry);
+	pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,115 @@
+//
+//  result_cache.h
+//  PegasusEar
+//
+//  Created by Kevin Colley on 10/18/26.
+//
+
+#ifndef PEG_RESULT_CACHE_H
+#define PEG_RESULT_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "common/dynamic_array.h"
+
+
+/*
+ * Cache of finished runs, keyed by the exact bytes of the submitted PEGASUS file.
+ * 
+ * Execution without a plugin is deterministic, so a run is completely described by
+ * the input bytes it read and the output bytes it wrote, in order. Each entry holds that transcript
+ * of a previous run plus how it ended. A resubmission of the same file can then be
+ * answered by walking the transcript: output is sent straight from the cache, and
+ * each byte the client sends must match the byte the previous run read. If the
+ * client sends something different, the submission is run for real from there.
+ * 
+ * Entries are kept in memory up to a byte limit, least recently used first out,
+ * and are also written to an on-disk store that survives restarts. The on-disk
+ * store is split by a hash of everything else that affects a run (the bootrom,
+ * plugin, plugin variables, flag, and instruction budget), so changing any of them
+ * starts with an empty cache.
+ * 
+ * Transcript layout: a sequence of 2-byte events, each a ResultCacheEvent kind
+ * followed by the byte read or written (0 for RESULT_CACHE_READ_FAIL).
+ */
+
+typedef uint8_t ResultCacheEvent;
+#define RESULT_CACHE_READ      ((ResultCacheEvent)0) //!< Read a byte from the client
+#define RESULT_CACHE_READ_FAIL ((ResultCacheEvent)1) //!< Reading from the client failed
+#define RESULT_CACHE_WRITE     ((ResultCacheEvent)2) //!< Wrote a byte to the client
+
+//! Transcripts larger than this aren't cached
+#define RESULT_CACHE_MAX_TRANSCRIPT (1024 * 1024)
+
+//! Initial value for ResultCache_hash()
+#define RESULT_CACHE_HASH_INIT 0xCBF29CE484222325ULL
+
+typedef dynamic_array(uint8_t) ResultCache_Transcript;
+
+typedef struct ResultCache_Result {
+	int32_t halt_reason;  //!< EAR_HaltReason the run stopped with
+	bool exited;          //!< True if the program exited through port 0xE
+	uint8_t exit_status;  //!< Value written to port 0xE
+	uint64_t ins_count;   //!< Instructions executed, including the bootrom
+} ResultCache_Result;
+
+typedef struct ResultCache ResultCache;
+
+
+/*!
+ * @brief Hash more data into a 64-bit FNV-1a hash. Hashes only pick which entry to
+ * compare against, so collisions are harmless.
+ * 
+ * @param hash Hash so far, starting from RESULT_CACHE_HASH_INIT
+ * @param data Data to hash
+ * @param size Number of bytes in `data`
+ * 
+ * @return Updated hash
+ */
+uint64_t ResultCache_hash(uint64_t hash, const void* data, size_t size);
+
+/*!
+ * @brief Create a result cache.
+ * 
+ * @param max_bytes Max memory used by cached PEGASUS files and transcripts
+ * @param dir Directory for the on-disk store, or NULL to only cache in memory
+ * @param config_hash Hash of everything besides the PEGASUS file and input that
+ *        affects how a submission runs
+ * 
+ * @return Newly created cache, or NULL on error
+ */
+ResultCache* ResultCache_create(size_t max_bytes, const char* dir, uint64_t config_hash);
+
+/*! Destroy a result cache created by `ResultCache_create` */
+void ResultCache_destroy(ResultCache** pcache);
+
+/*!
+ * @brief Look up the previous run of a PEGASUS file.
+ * 
+ * @param peg Contents of the PEGASUS file
+ * @param peg_size Number of bytes in `peg`
+ * @param out_transcript Output array that the run's transcript is copied into
+ * @param out_result Output variable set to how the run ended
+ * 
+ * @return True if the file has been run before
+ */
+bool ResultCache_lookup(
+	ResultCache* cache, const void* peg, size_t peg_size,
+	ResultCache_Transcript* out_transcript, ResultCache_Result* out_result
+);
+
+/*!
+ * @brief Remember the latest run of a PEGASUS file, replacing any previous one.
+ * 
+ * @param peg Contents of the PEGASUS file
+ * @param peg_size Number of bytes in `peg`
+ * @param transcript Transcript of the run
+ * @param result How the run ended
+ */
+void ResultCache_store(
+	ResultCache* cache, const void* peg, size_t peg_size,
+	const ResultCache_Transcript* transcript, const ResultCache_Result* result
+);
+
+#endif /* PEG_RESULT_CACHE_H */
@@ -4,12 +4,13 @@ TEST_BUILD := $(BUILD_DIR)
 TEST_EAR_SRCS := $(wildcard $(TEST_DIR)/*.ear)
 TEST_PEG_FILES := $(patsubst $(TEST_DIR)/%.ear,$(TEST_BUILD)/%.peg,$(TEST_EAR_SRCS))
 TEST_CHECK_TARGETS := $(patsubst $(TEST_DIR)/%.ear,check-ear[%],$(TEST_EAR_SRCS))
+TEST_FAST_CHECK_TARGETS := $(patsubst $(TEST_DIR)/%.ear,check-ear-fast[%],$(TEST_EAR_SRCS))
 PRODUCTS := $(TEST_PEG_FILES)
 
 
-.PHONY: check check-python check-ear
+.PHONY: check check-python check-ear check-ear-fast check-replay check-max-instructions check-io-concurrency check-profile
 
-check: check-python check-ear
+check: check-python check-ear check-ear-fast check-replay check-max-instructions check-io-concurrency check-profile
 
 check-python:
 	$(_v)pytest --quiet $(PEG_DIR)
@@ -18,3 +19,39 @@ check-ear: $(TEST_CHECK_TARGETS)
 
 check-ear[%]: $(TEST_BUILD)/%.peg $(TEST_DIR)/test_flag.txt | $(PEG_BIN)/runpeg
 	$(_v)$(PEG_BIN)/runpeg --timeout=5 --flag-port-file=$(TEST_DIR)/test_flag.txt $< >/dev/null 2>&1 && echo "PASS $*" || echo "FAIL $* : $$?"
+
+# Same tests, but with the first input file loaded on the host instead of by the bootrom
+check-ear-fast: $(TEST_FAST_CHECK_TARGETS)
+
+check-ear-fast[%]: $(TEST_BUILD)/%.peg $(TEST_DIR)/test_flag.txt | $(PEG_BIN)/runpeg
+	$(_v)$(PEG_BIN)/runpeg --timeout=5 --fast-load --flag-port-file=$(TEST_DIR)/test_flag.txt $< >/dev/null 2>&1 && echo "PASS fast $*" || echo "FAIL fast $* : $$?"
+
+# Record a run that reads the flag, then replay it without the flag file
+check-replay: $(TEST_BUILD)/flag_test.peg $(TEST_DIR)/test_flag.txt | $(PEG_BIN)/runpeg
+	$(_v)$(PEG_BIN)/runpeg --timeout=5 --flag-port-file=$(TEST_DIR)/test_flag.txt --record=$(TEST_BUILD)/flag_test.replay $< >/dev/null 2>&1 \
+		&& $(PEG_BIN)/runpeg --timeout=5 --replay=$(TEST_BUILD)/flag_test.replay $< >/dev/null 2>&1 \
+		&& echo "PASS replay" || echo "FAIL replay : $$?"
+
+# A run cut short by --max-instructions must fail and say why
+check-max-instructions: $(TEST_BUILD)/uadd32.peg | $(PEG_BIN)/runpeg
+	$(_v)out=$$($(PEG_BIN)/runpeg --timeout=5 --max-instructions=1000 $< 2>&1 >/dev/null); status=$$?; \
+		[ $$status -ne 0 ] && echo "$$out" | grep -q "Reached the instruction limit" \
+		&& echo "PASS max-instructions" || echo "FAIL max-instructions : $$status"
+
+# Every sample taken inside a known call chain must be rooted at main, not at a symbol
+# that happens to come before the return address of the outermost frame
+check-profile: $(TEST_BUILD)/call_stack.peg | $(PEG_BIN)/runpeg
+	$(_v)out=$(TEST_BUILD)/call_stack.folded; \
+		$(PEG_BIN)/runpeg --timeout=5 --profile=$$out --profile-interval=1 $< >/dev/null 2>&1 \
+		&& grep -q '^0xFF00;@main;@test;@outer;@inner ' $$out \
+		&& ! grep '@inner ' $$out | grep -qv '^0xFF00;@main;@test;' \
+		&& echo "PASS profile" || echo "FAIL profile"
+
+# Boot once and serve two connections at the same time, with the bootrom's debug UART
+# shown. Its output goes to stderr until a client connects, then to the client.
+check-io-concurrency: $(TEST_BUILD)/uadd32.peg $(TEST_DIR)/io_client.py | $(PEG_BIN)/runpeg
+	$(_v)sock=$(TEST_BUILD)/io_concurrency.sock; rm -f $$sock; \
+		$(PEG_BIN)/runpeg -u --io-concurrency=2 --io-listen=$$sock $< >/dev/null 2>&1 & pid=$$!; \
+		python3 $(TEST_DIR)/io_client.py $$sock 2 "Starting user program"; status=$$?; \
+		kill $$pid 2>/dev/null; rm -f $$sock; \
+		[ $$status -eq 0 ] && echo "PASS io-concurrency" || echo "FAIL io-concurrency : $$status"
@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""
+Connect to `runpeg --io-listen` on a UNIX domain socket several times at once and
+check that every connection receives the expected output before being closed.
+
+Usage: io_client.py SOCKET_PATH CONNECTIONS EXPECTED_TEXT
+"""
+import os
+import socket
+import sys
+import threading
+import time
+
+
+def read_all(sock_path, results, index):
+	try:
+		with socket.socket(socket.AF_UNIX) as s:
+			s.settimeout(5)
+			s.connect(sock_path)
+			output = b""
+			while True:
+				data = s.recv(4096)
+				if not data:
+					break
+				output += data
+			results[index] = output
+	except OSError as e:
+		print(f"Connection {index}: {e}", file=sys.stderr)
+
+
+def main(argv):
+	sock_path, count, expected = argv[1], int(argv[2]), argv[3].encode()
+
+	# runpeg only creates the socket once it has booted
+	deadline = time.monotonic() + 5
+	while not os.path.exists(sock_path):
+		if time.monotonic() >= deadline:
+			print(f"{sock_path} was never created", file=sys.stderr)
+			return 1
+		time.sleep(0.05)
+
+	results = [None] * count
+	threads = [threading.Thread(target=read_all, args=(sock_path, results, i)) for i in range(count)]
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+
+	ok = True
+	for i, output in enumerate(results):
+		if output is None or expected not in output:
+			print(f"Connection {i} got {output!r}", file=sys.stderr)
+			ok = False
+	return 0 if ok else 1
+
+
+if __name__ == "__main__":
+	sys.exit(main(sys.argv))